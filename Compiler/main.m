@@ -81,23 +81,15 @@ static LKAST *parseScript(NSString *script, NSString *extension)
 
 static NSArray *Transforms = nil;
 
-static void  applyTransforms(LKAST* anAST)
-{
-	FOREACH(Transforms, transform, id<LKASTVisitor>)
-	{
-		[anAST visitWithVisitor:transform];
-	}
-}
-
 static BOOL jitScript(NSString *script, NSString *extension, BOOL interpret)
 {
 	NS_DURING
 		LKAST *ast = parseScript(script, extension);
-		if (![ast check])
+		if (![[LKPassManager passManagerWithTransforms:
+				LKTransformsWithoutInlining(Transforms)] runOnAST: ast])
 		{
 			NS_VALUERETURN(NO, BOOL);
 		}
-		applyTransforms(ast);
 		if (NO == interpret)
 		{
 			id codeGenerator = defaultJIT();
@@ -126,11 +118,11 @@ static BOOL staticCompileScript(NSString *script, NSString *outFile,
 {
 	NS_DURING
 		LKAST *ast = parseScript(script, extension);
-		if (![ast check])
+		if (![[LKPassManager passManagerWithTransforms:
+				LKTransformsWithoutInlining(Transforms)] runOnAST: ast])
 		{
 			NS_VALUERETURN(NO, BOOL);
 		}
-		applyTransforms(ast);
 		[ast compileWithGenerator: defaultStaticCompilterWithFile(outFile)];
 	NS_HANDLER
 		NSLog(@"%@", localException);
@@ -298,13 +290,14 @@ int main(int argc, char **argv)
 		}
 	}
 
+	Transforms = [LKCompiler defaultTransforms];
 	NSString *transformName = [opts objectForKey:@"v"];
 	if (nil != transformName)
 	{
 		Class transform = NSClassFromString(transformName);
 		if ([transform conformsToProtocol:@protocol(LKASTVisitor)])
 		{
-			Transforms = A([[transform new] autorelease]);
+			Transforms = [Transforms arrayByAddingObject: [[transform new] autorelease]];
 		}
 		else
 		{
@@ -12,7 +12,7 @@
 	}
 	NSString * name = [decl name];
 
-	[[[method symbols] symbols] removeObject: name];
+	[[method symbols] removeSymbolNamed: name];
 	[cls addInstanceVariable: name];
 	return nil;
 }
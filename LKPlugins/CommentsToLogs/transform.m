@@ -3,6 +3,11 @@
 @interface LKCommentToLogTransform : LKASTVisitor
 @end
 @implementation LKCommentToLogTransform 
+// Comments are replaced independently of the rest of the tree.
++ (BOOL) canFuse
+{
+	return YES;
+}
 - (LKAST*) visitComment:(LKComment*)aNode
 {
 	LKMessageSend* msg = [LKMessageSend messageWithSelectorName: @"log"];
@@ -10,7 +15,6 @@
 	string = [@"Comment: " stringByAppendingString:string];
 	[msg setTarget: [LKStringLiteral literalFromString:string]];
 	[msg setParent: [aNode parent]];
-	[msg check];
 	return msg;
 }
 @end
@@ -8,6 +8,12 @@
 @interface LKLowerIfRespondsTransform : LKASTVisitor
 @end
 @implementation LKLowerIfRespondsTransform 
+// Only sends whose receiver is an ifResponds send of a variable are lowered,
+// and the new nodes do not need lowering again.
++ (BOOL) canFuse
+{
+	return YES;
+}
 - (LKAST*)visitMessageSend: (LKMessageSend*)aNode
 {
 	LKAST *receiver = [aNode target];
@@ -44,7 +50,6 @@
 		                                   else: [NSArray array]];
 
 	[ifStatement setParent: [aNode parent]];
-	[ifStatement check];
 	return ifStatement;
 }
 @end
@@ -29,6 +29,13 @@ NSArray *statementsFromBlock(LKAST*aBlock)
 @interface LKLowerIfTrueTransform : LKASTVisitor
 @end
 @implementation LKLowerIfTrueTransform 
+// The statements moved out of the blocks are visited after the if statement
+// that replaces the send, so the transforms fused with this one still see
+// them.
++ (BOOL) canFuse
+{
+	return YES;
+}
 - (LKAST*) visitMessageSend:(LKMessageSend*)aNode
 {
 	LKBlockExpr *thenBlock = nil;
@@ -88,7 +95,6 @@ NSArray *statementsFromBlock(LKAST*aBlock)
 										   else: elseClause];
 
 	[ifStatement setParent: [aNode parent]];
-	[ifStatement check];
 	return ifStatement;
 }
 @end
@@ -5,6 +5,37 @@
 
 @class LKModule;
 @class LKInterpreterContext;
+
+/**
+ * The kinds of AST node that visitors distinguish, used to dispatch to the
+ * visitor's method for each kind.  A node's kind is the first of these
+ * classes that it is an instance of, in this order.
+ */
+typedef enum
+{
+	/** The kind has not been computed yet. */
+	LKASTKindUnknown = 0,
+	LKASTKindArrayExpr,
+	LKASTKindAssignExpr,
+	LKASTKindBlockExpr,
+	LKASTKindCategoryDef,
+	LKASTKindComment,
+	LKASTKindCompare,
+	LKASTKindDeclRef,
+	LKASTKindIfStatement,
+	LKASTKindLiteral,
+	LKASTKindLoop,
+	LKASTKindMessageSend,
+	LKASTKindMessageCascade,
+	LKASTKindMethod,
+	LKASTKindModule,
+	LKASTKindReturn,
+	LKASTKindSubclass,
+	LKASTKindVariableDecl,
+	/** A node that is none of the above. */
+	LKASTKindOther,
+	LKASTKindCount
+} LKASTKind;
 /**
  * Root class for AST nodes.  Every node in the abstract syntax tree inherits
  * from this.  It stores the parent, allowing navigation up the tree, and a
@@ -19,6 +50,13 @@
 	/** Symbol table for this context.  If no new symbols are defined, this is a
 	* pointer to the parent's symbol table. */
 	LKSymbolTable * symbols;
+	/** The module containing this node, if known.  Set from the parent's
+	* value by -setParent:, so that -module does not have to walk the tree. */
+	__unsafe_unretained LKModule *owningModule;
+	/** The kind of this node.  Computed on first use. */
+	LKASTKind kind;
+	/** The type of this node's value, set by -inferTypes. */
+	LKInferredType *inferredType;
 }
 /**
  * Returns the AST nodes available at runtime for subclasses and categories.
@@ -28,6 +66,19 @@
  * Returns the module containing the current AST.
  */
 - (LKModule*) module;
+/**
+ * Returns the kind of this node.
+ */
+- (LKASTKind) nodeKind;
+/**
+ * Returns the type of the value of this node, or nil if types have not been
+ * inferred for it.  Methods have the type of the value that they return.
+ */
+- (LKInferredType*) inferredType;
+/**
+ * Sets the type of the value of this node.
+ */
+- (void) setInferredType: (LKInferredType*)aType;
 /**
  * Initialise a new AST node with the specified symbol table.
  */
@@ -120,4 +171,40 @@
 - (id)interpretInContext: (LKInterpreterContext*)context;
 @end
 
+@interface LKAST (TypeInference)
+/**
+ * Infers the types of the values of expressions, variables and method returns
+ * in every method in this tree.  The tree must have been checked.
+ *
+ * Inference follows the flow of control through each method and block, so a
+ * reference to a variable has the type of the values that may be stored in it
+ * at that point.  Types come from literals, arithmetic and comparisons, types
+ * pragmas, and the methods of classes that exist when inference runs.
+ * Variables that blocks assign to may change at any time, so nothing is
+ * inferred for them.
+ */
+- (void) inferTypes;
+@end
+
+@interface LKAST (EscapeAnalysis)
+/**
+ * Marks the blocks in this tree that do not escape, the blocks that refer to
+ * themselves, and the variables that only non-escaping blocks reference and
+ * do not assign to.  The tree must have been checked, and its types
+ * inferred.
+ *
+ * A block does not escape only when LanguageKit's own code implements the
+ * message that it is passed to, and it does not refer to the block object.
+ * That is the case for block literals that are the receiver of value,
+ * value:, value:value:, value:value:value: or whileTrue:, or the argument of
+ * whileTrue: sent to a block literal, and for the arguments of ifTrue:,
+ * ifFalse:, ifTrue:ifFalse:, ifFalse:ifTrue:, and:, or:, timesRepeat:, to:do:
+ * and to:by:do: sent to a value inferred to be an integer or a BOOL.  Blocks
+ * passed to any other receiver, including collections and the ifNil: family,
+ * escape, because the receiver's class may implement the message by keeping
+ * them.
+ */
+- (void) analyseEscapes;
+@end
+
 #define SAFECAST(type, obj) ([obj isKindOfClass:[type class]] ? (type*)obj : ([NSException raise:@"InvalidCast" format:@"Can not cast %@ to %s", obj, #type], (type*)nil))
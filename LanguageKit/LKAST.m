@@ -1,11 +1,14 @@
-#import "LKAST.h"
-#import "LKDeclRef.h"
-#import "LKModule.h"
+#import "LanguageKit.h"
 #import <objc/runtime.h>
 
 static Class DeclRefClass;
 static Class ModuleClass;
 
+/**
+ * The class for each node kind, in the order in which they are tested.
+ */
+static Class KindClasses[LKASTKindOther];
+
 static NSMutableDictionary *ASTSubclassAndCategoryNodes = nil;
 
 @implementation LKAST
@@ -23,16 +26,63 @@ static NSMutableDictionary *ASTSubclassAndCategoryNodes = nil;
 {
 	DeclRefClass = [LKDeclRef class];
 	ModuleClass = [LKModule class];
+	KindClasses[LKASTKindArrayExpr] = [LKArrayExpr class];
+	KindClasses[LKASTKindAssignExpr] = [LKAssignExpr class];
+	KindClasses[LKASTKindBlockExpr] = [LKBlockExpr class];
+	KindClasses[LKASTKindCategoryDef] = [LKCategoryDef class];
+	KindClasses[LKASTKindComment] = [LKComment class];
+	KindClasses[LKASTKindCompare] = [LKCompare class];
+	KindClasses[LKASTKindDeclRef] = [LKDeclRef class];
+	KindClasses[LKASTKindIfStatement] = [LKIfStatement class];
+	KindClasses[LKASTKindLiteral] = [LKLiteral class];
+	KindClasses[LKASTKindLoop] = [LKLoop class];
+	KindClasses[LKASTKindMessageSend] = [LKMessageSend class];
+	KindClasses[LKASTKindMessageCascade] = [LKMessageCascade class];
+	KindClasses[LKASTKindMethod] = [LKMethod class];
+	KindClasses[LKASTKindModule] = [LKModule class];
+	KindClasses[LKASTKindReturn] = [LKReturn class];
+	KindClasses[LKASTKindSubclass] = [LKSubclass class];
+	KindClasses[LKASTKindVariableDecl] = [LKVariableDecl class];
+}
+
+- (LKInferredType*) inferredType
+{
+	return inferredType;
+}
+
+- (void) setInferredType: (LKInferredType*)aType
+{
+	inferredType = aType;
+}
+
+- (LKASTKind) nodeKind
+{
+	if (LKASTKindUnknown == kind)
+	{
+		LKASTKind k = LKASTKindArrayExpr;
+		while ((k < LKASTKindOther) && ![self isKindOfClass: KindClasses[k]])
+		{
+			k++;
+		}
+		kind = k;
+	}
+	return kind;
 }
 
 - (LKModule*) module
 {
-	__unsafe_unretained LKAST *module = self;
-	while (nil != module && ModuleClass != object_getClass(module))
+	// Nodes created outside of a check, for example by transforms, may not
+	// have had a parent with a known module, so fall back to walking the tree.
+	if (nil == owningModule)
 	{
-		module = module->parent;
+		__unsafe_unretained LKAST *module = self;
+		while (nil != module && ModuleClass != object_getClass(module))
+		{
+			module = module->parent;
+		}
+		owningModule = (LKModule*)module;
 	}
-	return (LKModule*)module;
+	return owningModule;
 }
 
 
@@ -61,6 +111,9 @@ static NSMutableDictionary *ASTSubclassAndCategoryNodes = nil;
 {
 	[self inheritSymbolTable: [aNode symbols]];
 	parent = aNode;
+	// Checking sets parents from the module downwards, so the parent's module
+	// is normally already known.
+	owningModule = (nil == aNode) ? nil : aNode->owningModule;
 }
 - (void) setBracketed:(BOOL)aFlag
 {
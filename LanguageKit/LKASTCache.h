@@ -0,0 +1,62 @@
+#import <Foundation/Foundation.h>
+
+@class LKAST;
+
+/**
+ * A cache of parsed abstract syntax trees, so that scripts do not have to be
+ * parsed again each time that they are loaded.
+ *
+ * Trees are stored in a compact binary form, in a file next to the source
+ * (or in the user's caches directory if the source's directory is not
+ * writable).  Loading a tree maps the file into memory and creates the nodes
+ * directly, without invoking the parser.  Each file records a hash of the
+ * source, the parser, and the builds of LanguageKit and of the parser's
+ * binary, identified by their paths, sizes and modification times.  It is
+ * ignored if any of these differ.
+ *
+ * Only -[LKCompiler loadScriptNamed:fromBundle:] uses this cache.  Code that
+ * is compiled from a string, or loaded as a bundle, is parsed each time.
+ *
+ * The cache stores trees as they are after parsing, including the symbol
+ * tables for arguments and locals.  Trees must still be checked after they
+ * are loaded, because the results of semantic analysis depend on the classes
+ * and headers loaded into the process, not just on the source.
+ *
+ * Nodes are serialised by walking their instance variables, so new AST
+ * classes are supported without extra code.  Objects are encoded along with
+ * the names and types of their classes' instance variables, and a file is
+ * rejected if these no longer match the running code.
+ */
+@interface LKASTCache : NSObject
+/**
+ * Returns the cached tree for the source code, which was read from the
+ * specified path, or nil if there is no valid cached tree.
+ */
++ (LKAST*) cachedASTForSource: (NSString*)aSource
+                       atPath: (NSString*)aPath
+                  parserClass: (Class)aParser;
+/**
+ * Stores the tree produced by parsing the source code from the specified
+ * path.  The tree must not yet have been checked.  Returns YES on success.
+ */
++ (BOOL) cacheAST: (LKAST*)anAST
+        forSource: (NSString*)aSource
+           atPath: (NSString*)aPath
+      parserClass: (Class)aParser;
+/**
+ * Returns a copy of a tree that shares no nodes with it, made by serialising
+ * it in memory.  The symbol tables of the classes in a module are shared,
+ * because they are global.  The tree may have been checked, but the copy must
+ * be checked again before it is used.  Returns nil if the tree contains
+ * objects that can not be stored.
+ */
++ (LKAST*) deepCopyOfAST: (LKAST*)anAST;
+@end
+
+/**
+ * Returns a string that identifies the build of the binary containing the
+ * specified address, from its path, size and modification time, or nil if it
+ * can not be found.  Version numbers are not enough, because they do not change
+ * between development builds, and the GNUmakefile does not set CFBundleVersion.
+ */
+NSString *LKBinaryIdentity(const void *anAddress);
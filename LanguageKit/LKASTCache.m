@@ -0,0 +1,854 @@
+#import "LKASTCache.h"
+#import "LKAST.h"
+#import "LKCategory.h"
+#import "LKModule.h"
+#import "LKSubclass.h"
+#import "LKSymbolTable.h"
+#import "LKToken.h"
+#import <objc/runtime.h>
+#include <dlfcn.h>
+#include <string.h>
+#include <sys/stat.h>
+
+/**
+ * Format version.  Increment when the layout changes.
+ */
+static const uint32_t LKASTCacheVersion = 1;
+static const char LKASTCacheMagic[8] = { 'L', 'K', 'A', 'S', 'T', 'B', 'I', 'N' };
+
+/**
+ * The file starts with this header, followed by a table of count 32-bit
+ * offsets of records from the start of the file, followed by the records.
+ * References between records are indexes into the table.  Index 0 is nil and
+ * has no record, and index 1 is the root of the tree.
+ */
+struct LKASTCacheHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t count;
+	/** Hash of the source code. */
+	uint64_t sourceHash;
+	/** Hash of the parser's name and the LanguageKit version. */
+	uint64_t environmentHash;
+};
+
+/**
+ * Each record starts with one of these.
+ */
+typedef enum
+{
+	/** A UTF-8 string: length, then bytes. */
+	LKASTRecordString = 1,
+	/** An LKToken, stored as a string. */
+	LKASTRecordToken,
+	/** A 64-bit integer. */
+	LKASTRecordInteger,
+	/** A double. */
+	LKASTRecordFloat,
+	/** Count, then references to the elements. */
+	LKASTRecordArray,
+	/** Count, then references to each key and value. */
+	LKASTRecordDictionary,
+	/** NSNull. */
+	LKASTRecordNull,
+	/** A class, stored as its name. */
+	LKASTRecordClass,
+	/**
+	 * The global symbol table for a class, stored as the class name.  These
+	 * are shared between trees, so must not be copied.
+	 */
+	LKASTRecordClassTable,
+	/**
+	 * The instance variables stored for a class: the class name and count,
+	 * then the name and type encoding of each.
+	 */
+	LKASTRecordLayout,
+	/**
+	 * An instance: a reference to its class's layout, then the value of each
+	 * instance variable, as a reference for objects or as bytes.
+	 */
+	LKASTRecordObject
+} LKASTRecordKind;
+
+/**
+ * Returns the 64-bit FNV-1a hash of the bytes.
+ */
+static uint64_t Hash(const void *bytes, size_t length)
+{
+	const unsigned char *b = bytes;
+	uint64_t hash = 14695981039346656037ULL;
+	for (size_t i=0 ; i<length ; i++)
+	{
+		hash ^= b[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+static uint64_t HashString(NSString *aString)
+{
+	NSData *data = [aString dataUsingEncoding: NSUTF8StringEncoding];
+	return Hash([data bytes], [data length]);
+}
+
+NSString *LKBinaryIdentity(const void *anAddress)
+{
+	Dl_info info;
+	struct stat st;
+	if ((0 == dladdr(anAddress, &info)) || (NULL == info.dli_fname) ||
+	    (0 != stat(info.dli_fname, &st)))
+	{
+		return nil;
+	}
+	return [NSString stringWithFormat: @"%s %lld %lld", info.dli_fname,
+		(long long)st.st_size, (long long)st.st_mtime];
+}
+
+/**
+ * Returns a hash of the parser and the LanguageKit build, or 0 if the builds
+ * can not be identified, in which case trees must not be cached.
+ */
+static uint64_t EnvironmentHash(Class aParser)
+{
+	NSString *languageKit = LKBinaryIdentity((const void*)EnvironmentHash);
+	NSString *parser = LKBinaryIdentity((const void*)
+		class_getMethodImplementation(aParser, @selector(parseString:)));
+	if ((nil == languageKit) || (nil == parser))
+	{
+		return 0;
+	}
+	NSString *version = [[NSBundle bundleForClass: [LKAST class]]
+		objectForInfoDictionaryKey: @"CFBundleVersion"];
+	return HashString([NSString stringWithFormat: @"%@ %@ %@ %@",
+		NSStringFromClass(aParser), version, languageKit, parser]);
+}
+
+/**
+ * Returns the paths where the tree for a source file may be stored: next to
+ * the source, and in the caches directory.
+ */
+static NSArray *CachePaths(NSString *aPath)
+{
+	NSMutableArray *paths = [NSMutableArray arrayWithObject:
+		[aPath stringByAppendingPathExtension: @"lkast"]];
+	NSArray *dirs = NSSearchPathForDirectoriesInDomains(NSCachesDirectory,
+			NSUserDomainMask, YES);
+	if ([dirs count] > 0)
+	{
+		NSString *name = [NSString stringWithFormat: @"%016llx.lkast",
+			(unsigned long long)HashString([aPath stringByStandardizingPath])];
+		[paths addObject: [[[[dirs objectAtIndex: 0]
+			stringByAppendingPathComponent: @"LanguageKit"]
+			stringByAppendingPathComponent: @"ASTs"]
+			stringByAppendingPathComponent: name]];
+	}
+	return paths;
+}
+
+/**
+ * Returns YES if instance variables of this type are stored.  Pointers can
+ * not be stored, so they are left as NULL.  They are only used for caches,
+ * which are empty in a tree that has not been checked.
+ */
+static BOOL IsStoredType(const char *type)
+{
+	switch (*type)
+	{
+		case '@':
+			// Blocks can not be stored.
+			return '?' != type[1];
+		case 'c': case 'C': case 's': case 'S': case 'i': case 'I':
+		case 'l': case 'L': case 'q': case 'Q': case 'f': case 'd':
+		case 'B':
+			return YES;
+		case '{':
+			return NULL == strpbrk(type, "@^*:#?");
+		default:
+			return NO;
+	}
+}
+
+/**
+ * The instance variables stored for a class, including those declared by its
+ * superclasses.
+ */
+@interface LKASTLayout : NSObject
+{
+	@public
+	Class cls;
+	unsigned int count;
+	Ivar *ivars;
+}
++ (LKASTLayout*) layoutForClass: (Class)aClass;
+@end
+@implementation LKASTLayout
++ (LKASTLayout*) layoutForClass: (Class)aClass
+{
+	static NSMapTable *Layouts;
+	@synchronized(self)
+	{
+		if (nil == Layouts)
+		{
+			Layouts = [NSMapTable mapTableWithKeyOptions: NSPointerFunctionsOpaqueMemory |
+			                                              NSPointerFunctionsOpaquePersonality
+			                                valueOptions: NSPointerFunctionsStrongMemory];
+		}
+		LKASTLayout *layout = (__bridge LKASTLayout*)NSMapGet(Layouts, (__bridge void*)aClass);
+		if (nil != layout)
+		{
+			return layout;
+		}
+		layout = [LKASTLayout new];
+		layout->cls = aClass;
+		NSMutableArray *hierarchy = [NSMutableArray array];
+		for (Class c = aClass ; (Nil != c) && ([NSObject class] != c) ;
+		     c = class_getSuperclass(c))
+		{
+			[hierarchy insertObject: c atIndex: 0];
+		}
+		for (Class c in hierarchy)
+		{
+			unsigned int ivarCount;
+			Ivar *list = class_copyIvarList(c, &ivarCount);
+			layout->ivars = realloc(layout->ivars,
+				(layout->count + ivarCount) * sizeof(Ivar));
+			for (unsigned int i=0 ; i<ivarCount ; i++)
+			{
+				if (IsStoredType(ivar_getTypeEncoding(list[i])))
+				{
+					layout->ivars[layout->count++] = list[i];
+				}
+			}
+			free(list);
+		}
+		NSMapInsert(Layouts, (__bridge void*)aClass, (__bridge void*)layout);
+		return layout;
+	}
+}
+- (void) dealloc
+{
+	free(ivars);
+}
+@end
+
+/**
+ * Returns YES for objects that are stored by walking their instance
+ * variables.
+ */
+static BOOL IsReflective(id anObject)
+{
+	return [anObject isKindOfClass: [LKAST class]] ||
+		[anObject isKindOfClass: [LKSymbolTable class]] ||
+		[anObject isKindOfClass: [LKSymbol class]];
+}
+
+/**
+ * Serialises a tree.  Objects are numbered as they are found, and written in
+ * that order.
+ */
+@interface LKASTWriter : NSObject
+{
+	/** Objects to write, in index order.  Entry 0 is nil. */
+	NSMutableArray *objects;
+	/** Map from objects to their indexes. */
+	NSMapTable *indexes;
+	/** Map from classes to the indexes of their layouts. */
+	NSMapTable *layoutIndexes;
+	/** Map from the global symbol tables in the tree to class names. */
+	NSMapTable *classTables;
+	/** The records. */
+	NSMutableData *data;
+}
+- (NSData*) dataForAST: (LKAST*)anAST
+            sourceHash: (uint64_t)sourceHash
+       environmentHash: (uint64_t)environmentHash;
+@end
+@implementation LKASTWriter
+- (id) init
+{
+	self = [super init];
+	if (nil == self)
+	{
+		return nil;
+	}
+	objects = [NSMutableArray arrayWithObject: [NSNull null]];
+	indexes = [NSMapTable mapTableWithKeyOptions: NSPointerFunctionsOpaqueMemory |
+	                                              NSPointerFunctionsOpaquePersonality
+	                                valueOptions: NSPointerFunctionsOpaqueMemory |
+	                                              NSPointerFunctionsIntegerPersonality];
+	layoutIndexes = [NSMapTable mapTableWithKeyOptions: NSPointerFunctionsOpaqueMemory |
+	                                                    NSPointerFunctionsOpaquePersonality
+	                                      valueOptions: NSPointerFunctionsOpaqueMemory |
+	                                                    NSPointerFunctionsIntegerPersonality];
+	classTables = [NSMapTable mapTableWithKeyOptions: NSPointerFunctionsOpaqueMemory |
+	                                                  NSPointerFunctionsOpaquePersonality
+	                                    valueOptions: NSPointerFunctionsStrongMemory];
+	data = [NSMutableData data];
+	return self;
+}
+- (void) writeBytes: (const void*)bytes length: (size_t)length
+{
+	[data appendBytes: bytes length: length];
+}
+- (void) writeU32: (uint32_t)aValue
+{
+	[data appendBytes: &aValue length: sizeof(aValue)];
+}
+- (void) writeString: (NSString*)aString
+{
+	NSData *utf8 = [aString dataUsingEncoding: NSUTF8StringEncoding];
+	[self writeU32: (uint32_t)[utf8 length]];
+	[data appendData: utf8];
+}
+- (void) writeKind: (LKASTRecordKind)aKind
+{
+	uint8_t kind = aKind;
+	[data appendBytes: &kind length: 1];
+}
+- (uint32_t) indexForObject: (id)anObject
+{
+	if (nil == anObject)
+	{
+		return 0;
+	}
+	void *key = (__bridge void*)anObject;
+	uintptr_t index = (uintptr_t)NSMapGet(indexes, key);
+	if (0 != index)
+	{
+		return (uint32_t)index;
+	}
+	// Layouts must come before the objects that use them, so that the
+	// reader can allocate objects in a single pass.
+	if (!class_isMetaClass(object_getClass(anObject)) &&
+	    (NULL == NSMapGet(classTables, key)) && IsReflective(anObject))
+	{
+		Class cls = object_getClass(anObject);
+		if (NULL == NSMapGet(layoutIndexes, (__bridge void*)cls))
+		{
+			NSMapInsert(layoutIndexes, (__bridge void*)cls,
+				(void*)(uintptr_t)[objects count]);
+			[objects addObject: [LKASTLayout layoutForClass: cls]];
+		}
+	}
+	index = [objects count];
+	NSMapInsert(indexes, key, (void*)index);
+	[objects addObject: anObject];
+	return (uint32_t)index;
+}
+/**
+ * Writes the record for an object.  Returns NO if the object can not be
+ * stored.
+ */
+- (BOOL) writeObject: (id)anObject
+{
+	if ([anObject isKindOfClass: [LKASTLayout class]])
+	{
+		LKASTLayout *layout = anObject;
+		[self writeKind: LKASTRecordLayout];
+		[self writeString: NSStringFromClass(layout->cls)];
+		[self writeU32: layout->count];
+		for (unsigned int i=0 ; i<layout->count ; i++)
+		{
+			[self writeString: [NSString stringWithUTF8String: ivar_getName(layout->ivars[i])]];
+			[self writeString: [NSString stringWithUTF8String: ivar_getTypeEncoding(layout->ivars[i])]];
+		}
+		return YES;
+	}
+	if (class_isMetaClass(object_getClass(anObject)))
+	{
+		[self writeKind: LKASTRecordClass];
+		[self writeString: NSStringFromClass(anObject)];
+		return YES;
+	}
+	NSString *tableClass = (__bridge NSString*)NSMapGet(classTables, (__bridge void*)anObject);
+	if (nil != tableClass)
+	{
+		[self writeKind: LKASTRecordClassTable];
+		[self writeString: tableClass];
+		return YES;
+	}
+	if ([anObject isKindOfClass: [LKToken class]])
+	{
+		[self writeKind: LKASTRecordToken];
+		[self writeString: anObject];
+		return YES;
+	}
+	if ([anObject isKindOfClass: [NSString class]])
+	{
+		[self writeKind: LKASTRecordString];
+		[self writeString: anObject];
+		return YES;
+	}
+	if ([anObject isKindOfClass: [NSNumber class]])
+	{
+		const char *type = [anObject objCType];
+		if (('f' == *type) || ('d' == *type))
+		{
+			double d = [anObject doubleValue];
+			[self writeKind: LKASTRecordFloat];
+			[self writeBytes: &d length: sizeof(d)];
+		}
+		else
+		{
+			long long l = [anObject longLongValue];
+			[self writeKind: LKASTRecordInteger];
+			[self writeBytes: &l length: sizeof(l)];
+		}
+		return YES;
+	}
+	if ([anObject isKindOfClass: [NSArray class]])
+	{
+		[self writeKind: LKASTRecordArray];
+		[self writeU32: (uint32_t)[anObject count]];
+		for (id element in anObject)
+		{
+			[self writeU32: [self indexForObject: element]];
+		}
+		return YES;
+	}
+	if ([anObject isKindOfClass: [NSDictionary class]])
+	{
+		[self writeKind: LKASTRecordDictionary];
+		[self writeU32: (uint32_t)[anObject count]];
+		for (id key in anObject)
+		{
+			[self writeU32: [self indexForObject: key]];
+			[self writeU32: [self indexForObject: [anObject objectForKey: key]]];
+		}
+		return YES;
+	}
+	if ([anObject isKindOfClass: [NSNull class]])
+	{
+		[self writeKind: LKASTRecordNull];
+		return YES;
+	}
+	if (!IsReflective(anObject))
+	{
+		return NO;
+	}
+	Class cls = object_getClass(anObject);
+	LKASTLayout *layout = [LKASTLayout layoutForClass: cls];
+	[self writeKind: LKASTRecordObject];
+	[self writeU32: (uint32_t)(uintptr_t)NSMapGet(layoutIndexes, (__bridge void*)cls)];
+	const char *base = (__bridge void*)anObject;
+	for (unsigned int i=0 ; i<layout->count ; i++)
+	{
+		Ivar ivar = layout->ivars[i];
+		const char *type = ivar_getTypeEncoding(ivar);
+		if ('@' == *type)
+		{
+			[self writeU32: [self indexForObject: object_getIvar(anObject, ivar)]];
+		}
+		else
+		{
+			NSUInteger size;
+			NSGetSizeAndAlignment(type, &size, NULL);
+			[self writeBytes: base + ivar_getOffset(ivar) length: size];
+		}
+	}
+	return YES;
+}
+- (NSData*) dataForAST: (LKAST*)anAST
+            sourceHash: (uint64_t)sourceHash
+       environmentHash: (uint64_t)environmentHash
+{
+	if ([anAST isKindOfClass: [LKModule class]])
+	{
+		NSMutableArray *classNames = [NSMutableArray array];
+		for (LKSubclass *cls in [(LKModule*)anAST allClasses])
+		{
+			[classNames addObject: [cls classname]];
+		}
+		for (LKCategoryDef *category in [(LKModule*)anAST allCategories])
+		{
+			[classNames addObject: [category classname]];
+		}
+		for (NSString *name in classNames)
+		{
+			LKSymbolTable *table = [LKSymbolTable lookupTableForClass: name];
+			if (nil != table)
+			{
+				NSMapInsert(classTables, (__bridge void*)table, (__bridge void*)name);
+			}
+		}
+	}
+	NSMutableData *offsets = [NSMutableData dataWithLength: sizeof(uint32_t)];
+	[self indexForObject: anAST];
+	// Writing a record may find more objects, which are appended.
+	for (NSUInteger i=1 ; i<[objects count] ; i++)
+	{
+		uint32_t offset = (uint32_t)[data length];
+		[offsets appendBytes: &offset length: sizeof(offset)];
+		if (![self writeObject: [objects objectAtIndex: i]])
+		{
+			return nil;
+		}
+	}
+	struct LKASTCacheHeader header;
+	memcpy(header.magic, LKASTCacheMagic, 8);
+	header.version = LKASTCacheVersion;
+	header.count = (uint32_t)[objects count];
+	header.sourceHash = sourceHash;
+	header.environmentHash = environmentHash;
+	// Make the offsets relative to the start of the file.
+	uint32_t start = (uint32_t)(sizeof(header) + [offsets length]);
+	uint32_t *table = [offsets mutableBytes];
+	for (uint32_t i=1 ; i<header.count ; i++)
+	{
+		table[i] += start;
+	}
+	NSMutableData *file = [NSMutableData dataWithBytes: &header length: sizeof(header)];
+	[file appendData: offsets];
+	[file appendData: data];
+	return file;
+}
+@end
+
+/**
+ * A bounds-checked cursor over a record.  Reads past the end set ok to NO and
+ * return zeroes.
+ */
+struct LKASTReader
+{
+	const uint8_t *p;
+	const uint8_t *end;
+	BOOL ok;
+};
+
+static const void *ReadBytes(struct LKASTReader *r, size_t length)
+{
+	if (!r->ok || ((size_t)(r->end - r->p) < length))
+	{
+		r->ok = NO;
+		return NULL;
+	}
+	const void *bytes = r->p;
+	r->p += length;
+	return bytes;
+}
+static uint32_t ReadU32(struct LKASTReader *r)
+{
+	uint32_t value = 0;
+	const void *bytes = ReadBytes(r, sizeof(value));
+	if (NULL != bytes)
+	{
+		memcpy(&value, bytes, sizeof(value));
+	}
+	return value;
+}
+static NSString *ReadString(struct LKASTReader *r)
+{
+	uint32_t length = ReadU32(r);
+	const void *bytes = ReadBytes(r, length);
+	if (NULL == bytes)
+	{
+		return nil;
+	}
+	return [[NSString alloc] initWithBytes: bytes
+	                                length: length
+	                              encoding: NSUTF8StringEncoding];
+}
+/**
+ * Reads a reference to an object that has already been created.
+ */
+static id ReadReference(struct LKASTReader *r, NSArray *objects)
+{
+	uint32_t index = ReadU32(r);
+	if ((0 == index) || !r->ok)
+	{
+		return nil;
+	}
+	id object = (index < [objects count]) ? [objects objectAtIndex: index] : nil;
+	if ((nil == object) || [object isKindOfClass: [LKASTLayout class]])
+	{
+		r->ok = NO;
+		return nil;
+	}
+	return object;
+}
+/**
+ * Reads a layout and returns the current layout for the same class, or nil if
+ * the class's instance variables have changed.
+ */
+static LKASTLayout *ReadLayout(struct LKASTReader *r)
+{
+	Class cls = NSClassFromString(ReadString(r));
+	if ((Nil == cls) ||
+	    !([cls isSubclassOfClass: [LKAST class]] ||
+	      [cls isSubclassOfClass: [LKSymbolTable class]] ||
+	      [cls isSubclassOfClass: [LKSymbol class]]))
+	{
+		return nil;
+	}
+	LKASTLayout *layout = [LKASTLayout layoutForClass: cls];
+	if (ReadU32(r) != layout->count)
+	{
+		return nil;
+	}
+	for (unsigned int i=0 ; i<layout->count ; i++)
+	{
+		NSString *name = ReadString(r);
+		NSString *type = ReadString(r);
+		if (!r->ok ||
+		    ![name isEqualToString: [NSString stringWithUTF8String: ivar_getName(layout->ivars[i])]] ||
+		    ![type isEqualToString: [NSString stringWithUTF8String: ivar_getTypeEncoding(layout->ivars[i])]])
+		{
+			return nil;
+		}
+	}
+	return layout;
+}
+
+/**
+ * Recreates a tree from a cache file.  Returns nil if the file is invalid.
+ */
+static LKAST *ReadAST(NSData *file, uint64_t sourceHash, uint64_t environmentHash)
+{
+	const uint8_t *base = [file bytes];
+	size_t size = [file length];
+	struct LKASTCacheHeader header;
+	if (size < sizeof(header))
+	{
+		return nil;
+	}
+	memcpy(&header, base, sizeof(header));
+	if ((0 != memcmp(header.magic, LKASTCacheMagic, 8)) ||
+	    (header.version != LKASTCacheVersion) ||
+	    (header.sourceHash != sourceHash) ||
+	    (header.environmentHash != environmentHash) ||
+	    (header.count < 2) ||
+	    ((size - sizeof(header)) / sizeof(uint32_t) < header.count))
+	{
+		return nil;
+	}
+	const uint8_t *offsets = base + sizeof(header);
+	NSMutableArray *objects = [NSMutableArray arrayWithCapacity: header.count];
+	[objects addObject: [NSNull null]];
+
+	// Create every object first, so that references can be resolved in any
+	// order.  Containers and instances are filled in afterwards.
+	for (uint32_t i=1 ; i<header.count ; i++)
+	{
+		uint32_t offset;
+		memcpy(&offset, offsets + i * sizeof(uint32_t), sizeof(offset));
+		struct LKASTReader r = { base + offset, base + size, offset < size };
+		const uint8_t *kind = ReadBytes(&r, 1);
+		id object = nil;
+		switch (NULL == kind ? 0 : *kind)
+		{
+			case LKASTRecordString:
+				object = ReadString(&r);
+				break;
+			case LKASTRecordToken:
+			{
+				NSString *str = ReadString(&r);
+				if (nil != str)
+				{
+					object = [LKToken tokenWithRange: NSMakeRange(0, [str length])
+					                        inSource: str];
+				}
+				break;
+			}
+			case LKASTRecordInteger:
+			{
+				long long l;
+				const void *bytes = ReadBytes(&r, sizeof(l));
+				if (NULL != bytes)
+				{
+					memcpy(&l, bytes, sizeof(l));
+					object = [NSNumber numberWithLongLong: l];
+				}
+				break;
+			}
+			case LKASTRecordFloat:
+			{
+				double d;
+				const void *bytes = ReadBytes(&r, sizeof(d));
+				if (NULL != bytes)
+				{
+					memcpy(&d, bytes, sizeof(d));
+					object = [NSNumber numberWithDouble: d];
+				}
+				break;
+			}
+			case LKASTRecordArray:
+				object = [NSMutableArray arrayWithCapacity: ReadU32(&r)];
+				break;
+			case LKASTRecordDictionary:
+				object = [NSMutableDictionary dictionaryWithCapacity: ReadU32(&r)];
+				break;
+			case LKASTRecordNull:
+				object = [NSNull null];
+				break;
+			case LKASTRecordClass:
+				object = NSClassFromString(ReadString(&r));
+				break;
+			case LKASTRecordClassTable:
+			{
+				NSString *name = ReadString(&r);
+				if (nil != name)
+				{
+					object = [LKSymbolTable symbolTableForClass: name];
+				}
+				break;
+			}
+			case LKASTRecordLayout:
+				object = ReadLayout(&r);
+				break;
+			case LKASTRecordObject:
+			{
+				uint32_t layoutIndex = ReadU32(&r);
+				id layout = (layoutIndex < i) ? [objects objectAtIndex: layoutIndex] : nil;
+				if ([layout isKindOfClass: [LKASTLayout class]])
+				{
+					object = [((LKASTLayout*)layout)->cls alloc];
+				}
+				break;
+			}
+		}
+		if (!r.ok || (nil == object))
+		{
+			return nil;
+		}
+		[objects addObject: object];
+	}
+	for (uint32_t i=1 ; i<header.count ; i++)
+	{
+		uint32_t offset;
+		memcpy(&offset, offsets + i * sizeof(uint32_t), sizeof(offset));
+		struct LKASTReader r = { base + offset, base + size, YES };
+		const uint8_t *kind = ReadBytes(&r, 1);
+		id object = [objects objectAtIndex: i];
+		switch (*kind)
+		{
+			case LKASTRecordArray:
+			{
+				uint32_t count = ReadU32(&r);
+				for (uint32_t j=0 ; (j<count) && r.ok ; j++)
+				{
+					id element = ReadReference(&r, objects);
+					if (nil != element)
+					{
+						[object addObject: element];
+					}
+				}
+				break;
+			}
+			case LKASTRecordDictionary:
+			{
+				uint32_t count = ReadU32(&r);
+				for (uint32_t j=0 ; (j<count) && r.ok ; j++)
+				{
+					id key = ReadReference(&r, objects);
+					id value = ReadReference(&r, objects);
+					if ((nil != key) && (nil != value))
+					{
+						[object setObject: value forKey: key];
+					}
+				}
+				break;
+			}
+			case LKASTRecordObject:
+			{
+				LKASTLayout *layout = [objects objectAtIndex: ReadU32(&r)];
+				char *obj = (__bridge void*)object;
+				for (unsigned int j=0 ; (j<layout->count) && r.ok ; j++)
+				{
+					Ivar ivar = layout->ivars[j];
+					const char *type = ivar_getTypeEncoding(ivar);
+					if ('@' == *type)
+					{
+						object_setIvar(object, ivar, ReadReference(&r, objects));
+					}
+					else
+					{
+						NSUInteger ivarSize;
+						NSGetSizeAndAlignment(type, &ivarSize, NULL);
+						const void *bytes = ReadBytes(&r, ivarSize);
+						if (NULL != bytes)
+						{
+							memcpy(obj + ivar_getOffset(ivar), bytes, ivarSize);
+						}
+					}
+				}
+				break;
+			}
+			default:
+				break;
+		}
+		if (!r.ok)
+		{
+			return nil;
+		}
+	}
+	id root = [objects objectAtIndex: 1];
+	return [root isKindOfClass: [LKAST class]] ? root : nil;
+}
+
+@implementation LKASTCache
++ (LKAST*) cachedASTForSource: (NSString*)aSource
+                       atPath: (NSString*)aPath
+                  parserClass: (Class)aParser
+{
+	uint64_t sourceHash = HashString(aSource);
+	uint64_t environmentHash = EnvironmentHash(aParser);
+	if (0 == environmentHash)
+	{
+		return nil;
+	}
+	for (NSString *path in CachePaths(aPath))
+	{
+		NSData *file = [NSData dataWithContentsOfFile: path
+		                                      options: NSDataReadingMappedAlways
+		                                        error: NULL];
+		if (nil != file)
+		{
+			LKAST *ast = ReadAST(file, sourceHash, environmentHash);
+			if (nil != ast)
+			{
+				return ast;
+			}
+		}
+	}
+	return nil;
+}
++ (BOOL) cacheAST: (LKAST*)anAST
+        forSource: (NSString*)aSource
+           atPath: (NSString*)aPath
+      parserClass: (Class)aParser
+{
+	uint64_t environmentHash = EnvironmentHash(aParser);
+	if (0 == environmentHash)
+	{
+		return NO;
+	}
+	NSData *file = [[LKASTWriter new] dataForAST: anAST
+	                                  sourceHash: HashString(aSource)
+	                             environmentHash: environmentHash];
+	if (nil == file)
+	{
+		return NO;
+	}
+	NSFileManager *fm = [NSFileManager defaultManager];
+	for (NSString *path in CachePaths(aPath))
+	{
+		[fm createDirectoryAtPath: [path stringByDeletingLastPathComponent]
+		  withIntermediateDirectories: YES
+		                   attributes: nil
+		                        error: NULL];
+		if ([file writeToFile: path atomically: YES])
+		{
+			return YES;
+		}
+	}
+	return NO;
+}
++ (LKAST*) deepCopyOfAST: (LKAST*)anAST
+{
+	NSData *data = [[LKASTWriter new] dataForAST: anAST
+	                                  sourceHash: 0
+	                             environmentHash: 0];
+	return (nil == data) ? nil : ReadAST(data, 0, 0);
+}
+@end
@@ -9,4 +9,26 @@
  * Where Comment can be the suffix of any AST node subclass
  */
 @interface LKASTVisitor : NSObject<LKASTVisitor>
+{
+	/** The methods that this visitor's class uses for each kind of node. */
+	const struct LKVisitorDispatch *dispatch;
+}
+/**
+ * Returns YES if LKPassManager may run this visitor in the same traversal as
+ * the adjacent transforms that also return YES.  In a fused traversal, each
+ * node is passed to every visitor before its children are visited, so a
+ * visitor sees a node before later visitors have rewritten its children, and
+ * does not see the nodes that earlier visitors create.  Only visitors whose
+ * results do not depend on either may return YES.  Returns NO by default.
+ */
++ (BOOL) canFuse;
+/**
+ * Records that the visitor has changed a node in place, for example by
+ * editing one of its statement lists, rather than returning a replacement for
+ * it.  Visitors must call this for every node that they change in place, so
+ * that LKPassManager checks it again.  Changes are recorded for the pass
+ * manager running on the current thread, so one visitor may be used by
+ * several pass managers at once.
+ */
+- (void) didChangeNode: (LKAST*)aNode;
 @end
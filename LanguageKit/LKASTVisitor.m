@@ -1,85 +1,114 @@
 #import "LanguageKit.h"
 #import "LKASTVisitor.h"
 
-#pragma clang diagnostic ignored "-Warc-performSelector-leaks"
-#define DEFCLASS(x) \
-@class x;\
-Class x ## Class;
-DEFCLASS(LKArrayExpr);
-DEFCLASS(LKAssignExpr);
-DEFCLASS(LKBlockExpr);
-DEFCLASS(LKCategoryDef);
-DEFCLASS(LKComment);
-DEFCLASS(LKCompare);
-DEFCLASS(LKDeclRef);
-DEFCLASS(LKIfStatement);
-DEFCLASS(LKLiteral);
-DEFCLASS(LKLoop);
-DEFCLASS(LKMessageSend);
-DEFCLASS(LKMessageCascade);
-DEFCLASS(LKMethod);
-DEFCLASS(LKModule);
-DEFCLASS(LKReturn);
-DEFCLASS(LKSubclass);
-DEFCLASS(LKVariableDecl);
+#import <objc/runtime.h>
+#import <objc/message.h>
 
-@implementation LKASTVisitor
-#define SETCLASS(x) do {x ## Class = [x class];} while(0)
-+ (void) initialize
+/**
+ * The methods that a visitor class implements for each kind of node.  A NULL
+ * selector means that the visitor does not handle that kind.  Only selectors
+ * are cached, not implementations, so a visitor method that is replaced at run
+ * time, for example by a category, is still called correctly.
+ */
+struct LKVisitorDispatch
+{
+	SEL selectors[LKASTKindCount];
+};
+
+/**
+ * Map from visitor classes to their dispatch tables.  Tables are never freed,
+ * because classes are never unloaded.
+ */
+static NSMapTable *DispatchTables;
+
+static const char *VisitSelectors[LKASTKindOther] =
+{
+	NULL,
+	"visitArrayExpr:",
+	"visitAssignExpr:",
+	"visitBlockExpr:",
+	"visitCategoryDef:",
+	"visitComment:",
+	"visitCompare:",
+	"visitDeclRef:",
+	"visitIfStatement:",
+	"visitLiteral:",
+	"visitLoop:",
+	"visitMessageSend:",
+	"visitMessageCascade:",
+	"visitMethod:",
+	"visitModule:",
+	"visitReturn:",
+	"visitSubclass:",
+	"visitVariableDecl:"
+};
+
+/**
+ * Returns the dispatch table for a visitor class, building it the first time
+ * that the class visits a node.
+ */
+static const struct LKVisitorDispatch *dispatchTableForClass(Class cls)
 {
-	if (self == [LKASTVisitor class])
+	@synchronized([LKASTVisitor class])
 	{
-		SETCLASS(LKArrayExpr);
-		SETCLASS(LKAssignExpr);
-		SETCLASS(LKBlockExpr);
-		SETCLASS(LKCategoryDef);
-		SETCLASS(LKComment);
-		SETCLASS(LKCompare);
-		SETCLASS(LKDeclRef);
-		SETCLASS(LKIfStatement);
-		SETCLASS(LKLiteral);
-		SETCLASS(LKLoop);
-		SETCLASS(LKMessageSend);
-		SETCLASS(LKMessageCascade);
-		SETCLASS(LKMethod);
-		SETCLASS(LKModule);
-		SETCLASS(LKReturn);
-		SETCLASS(LKSubclass);
-		SETCLASS(LKVariableDecl);
+		if (nil == DispatchTables)
+		{
+			DispatchTables = [[NSMapTable alloc] initWithKeyPointerFunctions: [NSPointerFunctions pointerFunctionsWithOptions: NSPointerFunctionsOpaquePersonality | NSPointerFunctionsOpaqueMemory]
+			                                           valuePointerFunctions: [NSPointerFunctions pointerFunctionsWithOptions: NSPointerFunctionsOpaquePersonality | NSPointerFunctionsOpaqueMemory]
+			                                                        capacity: 32];
+		}
+		struct LKVisitorDispatch *table = NSMapGet(DispatchTables, (__bridge void*)cls);
+		if (NULL != table)
+		{
+			return table;
+		}
+		table = calloc(1, sizeof(struct LKVisitorDispatch));
+		for (int i=LKASTKindArrayExpr ; i<LKASTKindOther ; i++)
+		{
+			SEL sel = sel_registerName(VisitSelectors[i]);
+			if (class_respondsToSelector(cls, sel))
+			{
+				table->selectors[i] = sel;
+			}
+		}
+		NSMapInsert(DispatchTables, (__bridge void*)cls, table);
+		return table;
 	}
 }
 
-#define TRYCLASS(x)\
-	if ([aNode isKindOfClass: LK ## x ## Class]) \
-	{\
-		SEL sel = @selector(visit ## x:);\
-		if ([self respondsToSelector:sel])\
-		{\
-			return [self performSelector:sel withObject:aNode];\
-		}\
-		return aNode;\
-	}
-
+@implementation LKASTVisitor
++ (BOOL) canFuse
+{
+	return NO;
+}
+- (void) didChangeNode: (LKAST*)aNode
+{
+	[[[[NSThread currentThread] threadDictionary]
+		objectForKey: @"LKChangedNodes"] addObject: aNode];
+}
 - (LKAST*) visitASTNode:(LKAST*)aNode
 {
-		TRYCLASS(ArrayExpr);
-		TRYCLASS(AssignExpr);
-		TRYCLASS(BlockExpr);
-		TRYCLASS(CategoryDef);
-		TRYCLASS(Comment);
-		TRYCLASS(Compare);
-		TRYCLASS(DeclRef);
-		TRYCLASS(IfStatement);
-		TRYCLASS(Literal);
-		TRYCLASS(Loop);
-		TRYCLASS(MessageSend);
-		TRYCLASS(MessageCascade);
-		TRYCLASS(Method);
-		TRYCLASS(Module);
-		TRYCLASS(Return);
-		TRYCLASS(Subclass);
-		TRYCLASS(VariableDecl);
+	// Find out which kinds of node the class handles once, rather than
+	// testing the node's class and whether the visitor responds to a
+	// selector each time a node is visited.  The message is then sent as
+	// usual, so the runtime's method cache finds the current implementation.
+	// Methods added to a visitor class after it has visited a node are not
+	// used.
+	if (NULL == dispatch)
+	{
+		dispatch = dispatchTableForClass(object_getClass(self));
+	}
+	LKASTKind kind = [aNode nodeKind];
+	if (LKASTKindOther == kind)
+	{
 		NSLog(@"Unrecognised AST node type: %@", [aNode class]);
 		return aNode;
+	}
+	SEL sel = dispatch->selectors[kind];
+	if (NULL == sel)
+	{
+		return aNode;
+	}
+	return ((LKAST*(*)(id, SEL, LKAST*))objc_msgSend)(self, sel, aNode);
 }
 @end
@@ -25,6 +25,17 @@
  * List of local variables
  */
 @property (nonatomic, retain) NSMutableArray<LKVariableDecl *> *locals;
+/**
+ * Whether this block is only called while the scope that creates it is
+ * active, set by -[LKAST analyseEscapes].  A non-escaping block does not need
+ * to be copied to the heap.
+ */
+@property (nonatomic, getter=isNonEscaping) BOOL nonEscaping;
+/**
+ * Whether this block's statements refer to the block object, set by
+ * -[LKAST analyseEscapes].
+ */
+@property (nonatomic, getter=isSelfReferencing) BOOL selfReferencing;
 /**
  * Set the statements in this node.
  */
@@ -3,7 +3,7 @@
 #import "Runtime/LKObject.h"
 
 @implementation LKBlockExpr
-@synthesize arguments, locals;
+@synthesize arguments, locals, nonEscaping, selfReferencing;
 + (id) blockWithArguments:(NSMutableArray<LKVariableDecl *>*)arguments locals:(NSMutableArray<LKVariableDecl *>*)locals statements:(NSMutableArray*)statementList
 {
 	return [[self alloc] initWithArguments: arguments
@@ -82,10 +82,21 @@
 	{
         [sig appendFormat: @"%lu%s", sizeof(id)*i, @encode(NSObject *)];
 	}
-	[aGenerator beginBlockWithArgs: args
-	                        locals: [symbols locals]
-	                     externals: [symbols byRefVariables]
-	                     signature: sig];
+	if (nonEscaping &&
+	    [aGenerator respondsToSelector: @selector(beginNonEscapingBlockWithArgs:locals:externals:signature:)])
+	{
+		[aGenerator beginNonEscapingBlockWithArgs: args
+		                                   locals: [symbols locals]
+		                                externals: [symbols byRefVariables]
+		                                signature: sig];
+	}
+	else
+	{
+		[aGenerator beginBlockWithArgs: args
+		                        locals: [symbols locals]
+		                     externals: [symbols byRefVariables]
+		                     signature: sig];
+	}
 	void * lastValue = NULL;
 	BOOL addBranch = YES;
 	for (LKAST *statement in statements)
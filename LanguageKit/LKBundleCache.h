@@ -0,0 +1,73 @@
+#import <Foundation/Foundation.h>
+
+/**
+ * A cache of libraries compiled from LanguageKit bundles.
+ *
+ * Each library is identified by a key computed from the contents of
+ * everything that the compiled code depends on: the bundle's LKInfo.plist,
+ * its sources, the frameworks that it loads, and the builds of LanguageKit and
+ * of the static code generator, identified by their paths, sizes and
+ * modification times.  A library is only used if its key matches, so editing
+ * a file or rebuilding LanguageKit always invalidates it, and touching a
+ * source file without changing it does not.
+ *
+ * Libraries are stored in the user's caches directory, named after their
+ * keys.  A bundle may also ship a prebuilt languagekit-cache.so, which is
+ * used if the Key entry in the languagekit-cache.plist next to it matches.
+ * +[LKCompiler compileLanguageKitBundle:output:] writes this file next to the
+ * library that it builds.  Libraries in ~/Library/LKCaches, where older
+ * versions of LanguageKit stored them, are still loaded if their key file
+ * matches or, without one, if they are newer than all of the inputs.
+ *
+ * Libraries are copied to a temporary file and renamed into place, so a
+ * process loading a library never sees a partially-written file.  A manifest
+ * records the bundle that each library was compiled from.  Installing a
+ * library removes older libraries compiled from the same bundle and then, if
+ * the cache is larger than its maximum size, removes the least recently used
+ * libraries.
+ */
+@interface LKBundleCache : NSObject
+/**
+ * Computes the key for a bundle from the files that its compiled code depends
+ * on, and remembers it for the bundle.  Directories are treated as bundles,
+ * and their executables are hashed.  Returns nil, and forgets any previous
+ * key, if the build of LanguageKit can not be identified, so that no cached
+ * library is used.
+ */
++ (NSString*) keyForBundle: (NSBundle*)aBundle inputs: (NSArray*)paths;
+/**
+ * Returns the key last computed for the bundle, or nil if there is none.
+ */
++ (NSString*) keyForBundle: (NSBundle*)aBundle;
+/**
+ * Loads the cached library for the bundle, if one exists for its current key.
+ * Returns YES on success.
+ */
++ (BOOL) loadLibraryForBundle: (NSBundle*)aBundle;
+/**
+ * Records the bundle's current key next to the library at the specified path,
+ * in a file with the same name and a plist extension, so that the library can
+ * be shipped in the bundle as languagekit-cache.so.  Returns YES on success.
+ */
++ (BOOL) writeKeyForLibrary: (NSString*)aPath forBundle: (NSBundle*)aBundle;
+/**
+ * Installs the library at the specified path as the cached library for the
+ * bundle's current key, and then removes stale libraries.  Returns YES on
+ * success.
+ */
++ (BOOL) installLibrary: (NSString*)aPath forBundle: (NSBundle*)aBundle;
+/**
+ * Removes libraries for keys that are no longer current, and then removes
+ * the least recently used libraries until the cache is smaller than the
+ * maximum size.
+ */
++ (void) collectGarbage;
+/**
+ * Sets the maximum size of the cache, in bytes.  Defaults to 64MB.
+ */
++ (void) setMaximumSize: (unsigned long long)aSize;
+/**
+ * Returns the maximum size of the cache, in bytes.
+ */
++ (unsigned long long) maximumSize;
+@end
@@ -0,0 +1,412 @@
+#import "LKBundleCache.h"
+#import "LKAST.h"
+#import "LKASTCache.h"
+#import "LKCodeGen.h"
+#import <objc/runtime.h>
+#include <dlfcn.h>
+#include <stdio.h>
+#include <unistd.h>
+
+/**
+ * Version of the key format.  Increment when the inputs to keys change.
+ */
+static const uint32_t LKBundleCacheVersion = 2;
+
+static unsigned long long MaximumSize = 64 * 1024 * 1024;
+
+/**
+ * Map from bundle paths to their current keys.
+ */
+static NSMutableDictionary *Keys;
+/**
+ * Map from bundle paths to the inputs that their current keys were computed
+ * from.
+ */
+static NSMutableDictionary *Inputs;
+
+static uint64_t HashBytes(uint64_t hash, const void *bytes, size_t length)
+{
+	const unsigned char *b = bytes;
+	for (size_t i=0 ; i<length ; i++)
+	{
+		hash ^= b[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+/**
+ * Adds the contents of a file to a 64-bit FNV-1a hash.  Bundles are hashed by
+ * their executables.  A missing file is hashed as a marker, so that it still
+ * changes the key when it appears.
+ */
+static uint64_t HashFile(uint64_t hash, NSString *aPath)
+{
+	BOOL isDir = NO;
+	if ([[NSFileManager defaultManager] fileExistsAtPath: aPath isDirectory: &isDir] &&
+	    isDir)
+	{
+		aPath = [[NSBundle bundleWithPath: aPath] executablePath];
+	}
+	NSData *data = (nil == aPath) ? nil :
+		[NSData dataWithContentsOfFile: aPath
+		                       options: NSDataReadingMappedIfSafe
+		                         error: NULL];
+	if (nil == data)
+	{
+		return HashBytes(hash, "missing", 8);
+	}
+	uint64_t length = [data length];
+	hash = HashBytes(hash, &length, sizeof(length));
+	return HashBytes(hash, [data bytes], [data length]);
+}
+
+/**
+ * Returns the directory that cached libraries are stored in.
+ */
+static NSString *CacheDirectory(void)
+{
+	NSArray *dirs = NSSearchPathForDirectoriesInDomains(NSCachesDirectory,
+			NSUserDomainMask, YES);
+	if ([dirs count] == 0)
+	{
+		return nil;
+	}
+	return [[[dirs objectAtIndex: 0]
+		stringByAppendingPathComponent: @"LanguageKit"]
+		stringByAppendingPathComponent: @"Bundles"];
+}
+
+static NSString *ManifestPath(NSString *dir)
+{
+	return [dir stringByAppendingPathComponent: @"manifest.plist"];
+}
+
+/**
+ * Returns the path of the file that records the key of a library that is not
+ * in the cache directory: the library's path with a plist extension.
+ */
+static NSString *KeyFilePath(NSString *soFile)
+{
+	return [[soFile stringByDeletingPathExtension] stringByAppendingPathExtension: @"plist"];
+}
+
+/**
+ * Returns the library that older versions of LanguageKit cached for a bundle,
+ * in ~/Library/LKCaches.
+ */
+static NSString *LegacyLibraryPath(NSBundle *aBundle)
+{
+	NSArray *dirs = NSSearchPathForDirectoriesInDomains(NSLibraryDirectory,
+			NSUserDomainMask, YES);
+	if ([dirs count] == 0)
+	{
+		return nil;
+	}
+	return [[[[dirs objectAtIndex: 0]
+		stringByAppendingPathComponent: @"LKCaches"]
+		stringByAppendingPathComponent: [aBundle bundlePath]]
+		stringByAppendingPathComponent: @"languagekit-cache.so"];
+}
+
+/**
+ * Returns YES if a library outside the cache directory was built from the
+ * current version of the bundle.  Libraries with a key file must match the
+ * key.  Libraries without one are only trusted if they are newer than all of
+ * the inputs, as older versions of LanguageKit did.
+ */
+static BOOL IsCurrentLibrary(NSString *soFile, NSString *key, NSArray *inputs,
+                             BOOL allowDates)
+{
+	NSFileManager *fm = [NSFileManager defaultManager];
+	if ((nil == soFile) || ![fm fileExistsAtPath: soFile])
+	{
+		return NO;
+	}
+	NSDictionary *keyFile = [NSDictionary dictionaryWithContentsOfFile: KeyFilePath(soFile)];
+	if (nil != keyFile)
+	{
+		return [key isEqualToString: [keyFile objectForKey: @"Key"]];
+	}
+	if (!allowDates)
+	{
+		return NO;
+	}
+	NSDate *soDate = [[fm attributesOfItemAtPath: soFile error: NULL] fileModificationDate];
+	for (NSString *input in inputs)
+	{
+		NSDate *date = [[fm attributesOfItemAtPath: input error: NULL] fileModificationDate];
+		if ((nil == soDate) || ([date compare: soDate] == NSOrderedDescending))
+		{
+			return NO;
+		}
+	}
+	return YES;
+}
+
+/**
+ * Loads a library.  Returns YES on success.
+ */
+static BOOL LoadLibrary(NSString *soFile)
+{
+	void *so = dlopen([soFile fileSystemRepresentation], RTLD_GLOBAL);
+	if (so == NULL)
+	{
+		NSLog(@"Failed to load cache.  dlopen() error: %s", dlerror());
+	}
+	return NULL != so;
+}
+
+/**
+ * Acquires the lock that serialises changes to the cache between processes.
+ * Returns nil if it can not be acquired.
+ */
+static NSDistributedLock *LockCache(NSString *dir)
+{
+	NSDistributedLock *lock = [NSDistributedLock lockWithPath:
+		[dir stringByAppendingPathComponent: @"lock"]];
+	for (int i=0 ; i<20 ; i++)
+	{
+		if ([lock tryLock])
+		{
+			return lock;
+		}
+		// A process that died while holding the lock leaves it behind.
+		if ([[lock lockDate] timeIntervalSinceNow] < -60)
+		{
+			[lock breakLock];
+			continue;
+		}
+		usleep(100000);
+	}
+	return nil;
+}
+
+@implementation LKBundleCache
++ (NSString*) keyForBundle: (NSBundle*)aBundle inputs: (NSArray*)paths
+{
+	// The compiled code depends on the builds of LanguageKit and of the code
+	// generator, not just on their versions.
+	NSString *languageKit = LKBinaryIdentity((const void*)HashFile);
+	Class codeGenerator = [LKCodeGenLoader defaultStaticCompilerClass];
+	NSString *codeGen = (Nil == codeGenerator) ? @"none" : LKBinaryIdentity((const void*)
+		class_getMethodImplementation(codeGenerator, @selector(initWithFile:)));
+	NSString *key = nil;
+	if ((nil != languageKit) && (nil != codeGen))
+	{
+		uint64_t hash = 14695981039346656037ULL;
+		hash = HashBytes(hash, &LKBundleCacheVersion, sizeof(LKBundleCacheVersion));
+		NSString *version = [[NSBundle bundleForClass: [LKAST class]]
+			objectForInfoDictionaryKey: @"CFBundleVersion"];
+		NSData *versionData = [[NSString stringWithFormat: @"%@ %@ %@",
+			version, languageKit, codeGen] dataUsingEncoding: NSUTF8StringEncoding];
+		hash = HashBytes(hash, [versionData bytes], [versionData length]);
+		for (NSString *path in paths)
+		{
+			hash = HashFile(hash, path);
+		}
+		key = [NSString stringWithFormat: @"%016llx", (unsigned long long)hash];
+	}
+	@synchronized(self)
+	{
+		if (nil == Keys)
+		{
+			Keys = [NSMutableDictionary new];
+			Inputs = [NSMutableDictionary new];
+		}
+		if (nil == key)
+		{
+			[Keys removeObjectForKey: [aBundle bundlePath]];
+			[Inputs removeObjectForKey: [aBundle bundlePath]];
+		}
+		else
+		{
+			[Keys setObject: key forKey: [aBundle bundlePath]];
+			[Inputs setObject: [paths copy] forKey: [aBundle bundlePath]];
+		}
+	}
+	return key;
+}
++ (NSString*) keyForBundle: (NSBundle*)aBundle
+{
+	@synchronized(self)
+	{
+		return [Keys objectForKey: [aBundle bundlePath]];
+	}
+}
++ (BOOL) loadLibraryForBundle: (NSBundle*)aBundle
+{
+	NSString *key = [self keyForBundle: aBundle];
+	if (nil == key)
+	{
+		return NO;
+	}
+	NSArray *inputs;
+	@synchronized(self)
+	{
+		inputs = [Inputs objectForKey: [aBundle bundlePath]];
+	}
+	NSFileManager *fm = [NSFileManager defaultManager];
+	NSString *soFile = [aBundle pathForResource: @"languagekit-cache"
+	                                     ofType: @"so"];
+	// A library shipped in the bundle needs a key file, because its date is
+	// set when the bundle is installed, not when it was compiled.
+	if (IsCurrentLibrary(soFile, key, inputs, NO))
+	{
+		return LoadLibrary(soFile);
+	}
+	soFile = [[CacheDirectory() stringByAppendingPathComponent: key]
+		stringByAppendingPathExtension: @"so"];
+	if ((nil == soFile) || ![fm fileExistsAtPath: soFile])
+	{
+		soFile = LegacyLibraryPath(aBundle);
+		if (IsCurrentLibrary(soFile, key, inputs, YES))
+		{
+			return LoadLibrary(soFile);
+		}
+		return NO;
+	}
+	// The modification date records when the library was last used, so that
+	// garbage collection removes the least recently used libraries first.
+	[fm setAttributes: [NSDictionary dictionaryWithObject: [NSDate date]
+	                                               forKey: NSFileModificationDate]
+	     ofItemAtPath: soFile
+	            error: NULL];
+	return LoadLibrary(soFile);
+}
++ (BOOL) writeKeyForLibrary: (NSString*)aPath forBundle: (NSBundle*)aBundle
+{
+	NSString *key = [self keyForBundle: aBundle];
+	if (nil == key)
+	{
+		return NO;
+	}
+	return [[NSDictionary dictionaryWithObject: key forKey: @"Key"]
+		writeToFile: KeyFilePath(aPath) atomically: YES];
+}
++ (BOOL) installLibrary: (NSString*)aPath forBundle: (NSBundle*)aBundle
+{
+	NSString *key = [self keyForBundle: aBundle];
+	NSString *dir = CacheDirectory();
+	if ((nil == key) || (nil == dir))
+	{
+		return NO;
+	}
+	NSFileManager *fm = [NSFileManager defaultManager];
+	[fm createDirectoryAtPath: dir
+	  withIntermediateDirectories: YES
+	                   attributes: nil
+	                        error: NULL];
+	// Copy to a temporary file in the same directory, so that the rename is
+	// atomic.
+	NSString *tmp = [dir stringByAppendingPathComponent:
+		[NSString stringWithFormat: @"%@.%d.tmp", key, (int)getpid()]];
+	[fm removeItemAtPath: tmp error: NULL];
+	if (![fm copyItemAtPath: aPath toPath: tmp error: NULL])
+	{
+		return NO;
+	}
+	NSString *soFile = [[dir stringByAppendingPathComponent: key]
+		stringByAppendingPathExtension: @"so"];
+	NSDistributedLock *lock = LockCache(dir);
+	if (0 != rename([tmp fileSystemRepresentation], [soFile fileSystemRepresentation]))
+	{
+		[fm removeItemAtPath: tmp error: NULL];
+		[lock unlock];
+		return NO;
+	}
+	// If the lock can not be acquired, then the library is still usable, but
+	// it is not recorded in the manifest, so the next garbage collection
+	// removes it.
+	if (nil != lock)
+	{
+		NSString *manifestPath = ManifestPath(dir);
+		NSMutableDictionary *manifest =
+			[NSMutableDictionary dictionaryWithContentsOfFile: manifestPath];
+		if (nil == manifest)
+		{
+			manifest = [NSMutableDictionary dictionary];
+		}
+		[manifest setObject: key forKey: [aBundle bundlePath]];
+		[manifest writeToFile: manifestPath atomically: YES];
+		[self collectGarbageInDirectory: dir];
+		[lock unlock];
+	}
+	return YES;
+}
+/**
+ * Collects garbage.  The caller must hold the cache lock.
+ */
++ (void) collectGarbageInDirectory: (NSString*)dir
+{
+	NSFileManager *fm = [NSFileManager defaultManager];
+	NSDictionary *manifest = [NSDictionary dictionaryWithContentsOfFile: ManifestPath(dir)];
+	NSSet *current = [NSSet setWithArray: [manifest allValues]];
+	NSMutableArray *libraries = [NSMutableArray array];
+	unsigned long long total = 0;
+	for (NSString *file in [fm contentsOfDirectoryAtPath: dir error: NULL])
+	{
+		NSString *path = [dir stringByAppendingPathComponent: file];
+		NSDictionary *attributes = [fm attributesOfItemAtPath: path error: NULL];
+		NSDate *date = [attributes fileModificationDate];
+		if ([@"tmp" isEqualToString: [file pathExtension]])
+		{
+			// Left behind by a process that died while installing.
+			if ([date timeIntervalSinceNow] < -3600)
+			{
+				[fm removeItemAtPath: path error: NULL];
+			}
+			continue;
+		}
+		if (![@"so" isEqualToString: [file pathExtension]])
+		{
+			continue;
+		}
+		// The manifest records the current key for each bundle, so any other
+		// library was compiled from an older version of a bundle.
+		if (![current containsObject: [file stringByDeletingPathExtension]])
+		{
+			[fm removeItemAtPath: path error: NULL];
+			continue;
+		}
+		total += [attributes fileSize];
+		[libraries addObject: [NSArray arrayWithObjects: path, date,
+			[NSNumber numberWithUnsignedLongLong: [attributes fileSize]], nil]];
+	}
+	if (total <= MaximumSize)
+	{
+		return;
+	}
+	[libraries sortUsingComparator: ^(NSArray *a, NSArray *b)
+		{
+			return [[a objectAtIndex: 1] compare: [b objectAtIndex: 1]];
+		}];
+	for (NSArray *library in libraries)
+	{
+		if (total <= MaximumSize)
+		{
+			break;
+		}
+		[fm removeItemAtPath: [library objectAtIndex: 0] error: NULL];
+		total -= [[library objectAtIndex: 2] unsignedLongLongValue];
+	}
+}
++ (void) collectGarbage
+{
+	NSString *dir = CacheDirectory();
+	NSDistributedLock *lock = (nil == dir) ? nil : LockCache(dir);
+	if (nil != lock)
+	{
+		[self collectGarbageInDirectory: dir];
+		[lock unlock];
+	}
+}
++ (void) setMaximumSize: (unsigned long long)aSize
+{
+	MaximumSize = aSize;
+}
++ (unsigned long long) maximumSize
+{
+	return MaximumSize;
+}
+@end
@@ -210,6 +210,18 @@
  * that has been associated with the specified label.
  */
 - (void) goToLabelledBasicBlock:(NSString*)aLabel;
+@optional
+/**
+ * Begin generating a block expression that is only called while the current
+ * scope is active, in place of -beginBlockWithArgs:locals:externals:signature:.
+ * The block may be allocated on the stack and is never copied.  Externals whose
+ * symbols are non-escaping may be captured by address, and the variables that
+ * they refer to kept on the stack rather than in byref storage.
+ */
+- (void) beginNonEscapingBlockWithArgs: (NSArray*)args
+                                locals: (NSArray*)locals
+                             externals: (NSArray*)externals
+                             signature: (NSString*)signature;
 @end
 /**
  * Protocol for static code generators.
@@ -234,6 +246,11 @@
  * file specified in the argument.
  */
 + (id<LKStaticCodeGenerator>) defaultStaticCompilerWithFile:(NSString*)outFile;
+/**
+ * Returns the class of the default code generator for static compilation, or
+ * Nil if it could not be loaded.
+ */
++ (Class) defaultStaticCompilerClass;
 @end
 /**
  * Returns the default code generator for JIT compilation.
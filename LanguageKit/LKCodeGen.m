@@ -23,6 +23,10 @@ static Class defaultStaticClass;
 {
 	return [[defaultStaticClass alloc] initWithFile:outFile];
 }
++ (Class) defaultStaticCompilerClass
+{
+	return defaultStaticClass;
+}
 @end
 id <LKCodeGenerator> defaultJIT(void)
 {
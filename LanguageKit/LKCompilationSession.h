@@ -0,0 +1,86 @@
+#import <Foundation/Foundation.h>
+
+@class LKCompiler;
+
+/**
+ * An incremental compiler for live editing.
+ *
+ * A session remembers the source of every method that it has compiled, along
+ * with the names of the variables, classes and selectors that each method
+ * refers to.  When a method or class definition changes, only that code and
+ * the methods that depend on something it changed are compiled again, rather
+ * than whole files.
+ *
+ * A method is recompiled when:
+ *
+ * - a class that it refers to is defined;
+ * - an instance or class variable that it refers to is added to its class or
+ *   a superclass; or
+ * - a selector that it sends is implemented for the first time; or
+ * - a method that was inlined into it is changed.
+ *
+ * Methods that failed to compile are kept, so that they are retried when the
+ * definitions that they were missing appear.  This means that methods can be
+ * loaded before the class definitions that they need.
+ *
+ * Sessions are not thread-safe.
+ */
+@interface LKCompilationSession : NSObject
+{
+	/** The compiler used to parse and check code. */
+	LKCompiler *compiler;
+	/** Recorded methods, keyed by "Class>>selector" or "Class class>>selector". */
+	NSMutableDictionary *methods;
+	/** The keys of the methods that depend on each dependency. */
+	NSMutableDictionary *dependents;
+	/** Selectors implemented by compiled methods in this session. */
+	NSCountedSet *selectors;
+	/** Class definitions compiled by this session, keyed by class name. */
+	NSMutableDictionary *classes;
+	/** The methods recompiled by the last change. */
+	NSMutableArray *recompiledMethods;
+}
+/**
+ * Whether the session runs code in the interpreter instead of compiling it
+ * with the JIT.  Defaults to YES if no JIT is available.
+ */
+@property (nonatomic) BOOL interpret;
+/**
+ * Returns a new session that uses the specified compiler to parse and check
+ * code.
+ */
++ (LKCompilationSession*) sessionWithCompiler: (LKCompiler*)aCompiler;
+/**
+ * Initialises a session that uses the specified compiler to parse and check
+ * code.
+ */
+- (id) initWithCompiler: (LKCompiler*)aCompiler;
+/**
+ * Compiles a method on the named class, replacing any earlier version of the
+ * method, and then recompiles the methods that depend on it.  Does nothing if
+ * the source is unchanged since the method was last compiled successfully.
+ * Returns NO if the method failed to compile.
+ */
+- (BOOL) compileMethod: (NSString*)source onClassNamed: (NSString*)aClass;
+/**
+ * Compiles a source file containing class definitions, and then recompiles
+ * the methods that depend on the new classes or their variables.  Any methods
+ * in the definitions are compiled with the class.  Only those that had other
+ * methods inlined into them are recorded, so that changing an inlined method
+ * recompiles them from the definition's source, without inlining.
+ *
+ * The instance variables of a class that has been loaded can not change, so
+ * redefining a class that this session has already compiled fails unless the
+ * definition only differs in its methods.  A definition that changes the
+ * superclass or variables is reported to the compiler's delegate as an
+ * LKRedefinedClassWarning, and then this method returns NO without compiling
+ * anything, even if the delegate asked to continue.
+ */
+- (BOOL) compileClassDefinition: (NSString*)source;
+/**
+ * Returns the methods that the last change caused to be recompiled, as
+ * strings of the form "Class>>selector" or "Class class>>selector".  The
+ * method that was changed is not included.
+ */
+- (NSArray*) recompiledMethods;
+@end
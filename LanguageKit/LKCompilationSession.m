@@ -0,0 +1,570 @@
+#import "LKCompilationSession.h"
+#import "LKASTVisitor.h"
+#import "LKCategory.h"
+#import "LKCodeGen.h"
+#import "LKCompiler.h"
+#import "LKCompilerErrors.h"
+#import "LKDeclRef.h"
+#import "LKInliner.h"
+#import "LKInterpreter.h"
+#import "LKMessageSend.h"
+#import "LKMethod.h"
+#import "LKModule.h"
+#import "LKSubclass.h"
+#import "LKSymbolTable.h"
+#import "LKVariableDecl.h"
+
+/**
+ * Dependencies are strings.  Variables (including classes, which are
+ * globals) are keyed by name, because a name that can not be resolved now may
+ * resolve to a new variable later.  Selectors are keyed separately, because
+ * the two namespaces overlap.
+ */
+static NSString *variableKey(NSString *aName)
+{
+	return [@"var:" stringByAppendingString: aName];
+}
+static NSString *selectorKey(NSString *aSelector)
+{
+	return [@"sel:" stringByAppendingString: aSelector];
+}
+/**
+ * Methods that have another method inlined into them depend on the key of the
+ * inlined method.
+ */
+static NSString *inlinedKey(NSString *aMethodKey)
+{
+	return [@"inline:" stringByAppendingString: aMethodKey];
+}
+static NSString *methodKey(NSString *aClass, BOOL isClassMethod, NSString *aSelector)
+{
+	return [NSString stringWithFormat: @"%@%@>>%@",
+		aClass, isClassMethod ? @" class" : @"", aSelector];
+}
+
+/**
+ * Collects the names of the variables and the selectors that an AST refers
+ * to.
+ */
+@interface LKDependencyCollector : LKASTVisitor
+{
+	@public
+	NSMutableSet *dependencies;
+}
+@end
+@implementation LKDependencyCollector
+- (id)init
+{
+	self = [super init];
+	if (self)
+	{
+		dependencies = [NSMutableSet new];
+	}
+	return self;
+}
+- (LKAST*)visitDeclRef: (LKDeclRef*)aNode
+{
+	if ([aNode isKindOfClass: [LKBuiltinSymbol class]])
+	{
+		return aNode;
+	}
+	// Before a successful check, the symbol is still the name.
+	id symbol = [aNode symbol];
+	if ([symbol isKindOfClass: [LKSymbol class]])
+	{
+		switch ([symbol scope])
+		{
+			case LKSymbolScopeExternal:
+			case LKSymbolScopeArgument:
+			case LKSymbolScopeLocal:
+				return aNode;
+			default:
+				symbol = [symbol name];
+		}
+	}
+	[dependencies addObject: variableKey(symbol)];
+	return aNode;
+}
+- (LKAST*)visitMessageSend: (LKMessageSend*)aNode
+{
+	[dependencies addObject: selectorKey([aNode selector])];
+	return aNode;
+}
+@end
+
+/**
+ * Collects the selectors of the methods that LKInliner has inlined into a
+ * method.  Each inlined copy is guarded by a +LKInlinedClassForMethod: message
+ * whose argument is the inlined method's selector, prefixed with + or -.
+ */
+@interface LKInlinedCalleeCollector : LKASTVisitor
+{
+	@public
+	NSMutableSet *selectors;
+}
+@end
+@implementation LKInlinedCalleeCollector
+- (LKAST*)visitMessageSend: (LKMessageSend*)aNode
+{
+	if ([NSStringFromSelector(@selector(LKInlinedClassForMethod:))
+			isEqualToString: [aNode selector]])
+	{
+		NSString *method = [[[[aNode arguments] objectAtIndex: 0] description]
+			stringByTrimmingCharactersInSet:
+				[NSCharacterSet characterSetWithCharactersInString: @"'"]];
+		[selectors addObject: [method substringFromIndex: 1]];
+	}
+	return aNode;
+}
+@end
+
+/**
+ * A method recorded by a session.
+ */
+@interface LKSessionMethod : NSObject
+{
+	@public
+	NSString *source;
+	NSString *className;
+	NSString *selector;
+	/** The names that this method depends on. */
+	NSSet *dependencies;
+	/** Whether the current source compiled successfully. */
+	BOOL compiled;
+	/**
+	 * The source of the class definition that contains this method, for
+	 * methods that were compiled with a class and had other methods inlined
+	 * into them.  The source of the method itself is nil.
+	 */
+	NSString *definitionSource;
+	/** Whether this is a class method, for methods in a definition. */
+	BOOL isClassMethod;
+}
+@end
+@implementation LKSessionMethod @end
+
+@implementation LKCompilationSession
+@synthesize interpret;
++ (LKCompilationSession*) sessionWithCompiler: (LKCompiler*)aCompiler
+{
+	return [[self alloc] initWithCompiler: aCompiler];
+}
+- (id) initWithCompiler: (LKCompiler*)aCompiler
+{
+	self = [super init];
+	if (nil == self)
+	{
+		return nil;
+	}
+	compiler = aCompiler;
+	methods = [NSMutableDictionary new];
+	dependents = [NSMutableDictionary new];
+	selectors = [NSCountedSet new];
+	classes = [NSMutableDictionary new];
+	recompiledMethods = [NSMutableArray new];
+	interpret = (nil == [LKCodeGenLoader defaultJIT]);
+	return self;
+}
+- (NSArray*) recompiledMethods
+{
+	return recompiledMethods;
+}
+/**
+ * Runs or compiles a checked module.
+ */
+- (void) loadModule: (LKModule*)aModule
+{
+	if (interpret)
+	{
+		[aModule interpretInContext: nil];
+	}
+	else
+	{
+		[aModule compileWithGenerator: [LKCodeGenLoader defaultJIT]];
+	}
+}
+/**
+ * Records that the method with the specified key now has a new set of
+ * dependencies.
+ */
+- (void) setDependencies: (NSSet*)aSet ofMethod: (LKSessionMethod*)aMethod key: (NSString*)aKey
+{
+	for (NSString *dependency in aMethod->dependencies)
+	{
+		[[dependents objectForKey: dependency] removeObject: aKey];
+	}
+	aMethod->dependencies = aSet;
+	for (NSString *dependency in aSet)
+	{
+		NSMutableSet *set = [dependents objectForKey: dependency];
+		if (nil == set)
+		{
+			set = [NSMutableSet new];
+			[dependents setObject: set forKey: dependency];
+		}
+		[set addObject: aKey];
+	}
+}
+/**
+ * Parses, checks and loads a recorded method.  Adds the dependencies that
+ * have changed as a result to the changes set.
+ */
+- (BOOL) compileMethod: (LKSessionMethod*)aMethod
+                   key: (NSString*)aKey
+               changes: (NSMutableSet*)changes
+{
+	LKMethod *ast = nil;
+	@try
+	{
+		if (nil == aMethod->definitionSource)
+		{
+			ast = [[[[compiler class] parserClass] new] parseMethod: aMethod->source];
+		}
+		else
+		{
+			ast = [self methodNamed: aMethod->selector
+			          isClassMethod: aMethod->isClassMethod
+			                inClass: aMethod->className
+			             definition: aMethod->definitionSource];
+		}
+	}
+	@catch (NSException *e)
+	{
+		[LKCompiler reportParseError: e];
+	}
+	if (nil == ast)
+	{
+		return NO;
+	}
+	LKCategoryDef *category =
+		[LKCategoryDef categoryOnClassNamed: aMethod->className
+		                            methods: [NSArray arrayWithObject: ast]];
+	LKModule *module = [LKModule module];
+	[module addCategory: (LKCategory*)category];
+
+	// A method can only be added to a class that exists.  If it doesn't, then
+	// try again when the class is defined.
+	BOOL success = (Nil != NSClassFromString(aMethod->className)) &&
+		[compiler checkAST: module];
+	LKDependencyCollector *collector = [LKDependencyCollector new];
+	[ast visitWithVisitor: collector];
+	NSMutableSet *newDependencies = collector->dependencies;
+	[newDependencies addObject: variableKey(aMethod->className)];
+	[self setDependencies: newDependencies ofMethod: aMethod key: aKey];
+
+	// Methods are keyed by selector, so a method that compiled before still
+	// implements the same selector.
+	NSString *selector = [[ast signature] selector];
+	BOOL wasCompiled = aMethod->compiled;
+	if (nil != aMethod->definitionSource)
+	{
+		// The class definition implemented the selector, so compiling the
+		// method again does not implement anything new.
+		aMethod->compiled = success;
+		if (success)
+		{
+			[self loadModule: module];
+		}
+		return success;
+	}
+	if (wasCompiled)
+	{
+		[selectors removeObject: aMethod->selector];
+	}
+	aMethod->selector = selector;
+	aMethod->compiled = success;
+	if (!success)
+	{
+		return NO;
+	}
+	if (!wasCompiled && ([selectors countForObject: selector] == 0))
+	{
+		[changes addObject: selectorKey(selector)];
+	}
+	[selectors addObject: selector];
+	[self loadModule: module];
+	// Methods that inlined an earlier version of this one must be compiled
+	// again, or they would keep running the old code.
+	[changes addObject: inlinedKey(aKey)];
+	return YES;
+}
+/**
+ * Returns a newly parsed copy of a method from the source of a class
+ * definition.
+ */
+- (LKMethod*) methodNamed: (NSString*)aSelector
+            isClassMethod: (BOOL)isClassMethod
+                  inClass: (NSString*)aClass
+               definition: (NSString*)source
+{
+	LKModule *module = (LKModule*)[[[[compiler class] parserClass] new] parseString: source];
+	for (LKSubclass *cls in [module allClasses])
+	{
+		if (![[cls classname] isEqualToString: aClass])
+		{
+			continue;
+		}
+		for (LKMethod *method in [cls methods])
+		{
+			if (([method isClassMethod] == isClassMethod) &&
+			    [[[method signature] selector] isEqualToString: aSelector])
+			{
+				return method;
+			}
+		}
+	}
+	return nil;
+}
+/**
+ * Records the methods in a checked class definition that had other methods
+ * inlined into them, so that they are compiled again if one of those methods
+ * changes.  Replaces the records from any earlier definition of the classes.
+ */
+- (void) recordInlinedCallersInModule: (LKModule*)aModule
+                               source: (NSString*)source
+{
+	for (LKSubclass *cls in [aModule allClasses])
+	{
+		NSString *name = [cls classname];
+		for (NSString *key in [methods allKeys])
+		{
+			LKSessionMethod *method = [methods objectForKey: key];
+			if ((nil != method->definitionSource) &&
+			    [method->className isEqualToString: name])
+			{
+				[self setDependencies: nil ofMethod: method key: key];
+				[methods removeObjectForKey: key];
+			}
+		}
+		for (LKMethod *ast in [cls methods])
+		{
+			LKInlinedCalleeCollector *collector = [LKInlinedCalleeCollector new];
+			collector->selectors = [NSMutableSet set];
+			[ast visitWithVisitor: collector];
+			NSSet *inlined = collector->selectors;
+			if (0 == [inlined count])
+			{
+				continue;
+			}
+			NSString *selector = [[ast signature] selector];
+			NSString *key = methodKey(name, [ast isClassMethod], selector);
+			// A method recorded with its own source takes precedence.
+			if (nil != [methods objectForKey: key])
+			{
+				continue;
+			}
+			LKSessionMethod *method = [LKSessionMethod new];
+			method->className = name;
+			method->selector = selector;
+			method->isClassMethod = [ast isClassMethod];
+			method->definitionSource = source;
+			method->compiled = YES;
+			NSMutableSet *dependencies = [NSMutableSet set];
+			for (NSString *callee in inlined)
+			{
+				[dependencies addObject:
+					inlinedKey(methodKey(name, [ast isClassMethod], callee))];
+			}
+			[self setDependencies: dependencies ofMethod: method key: key];
+			[methods setObject: method forKey: key];
+		}
+	}
+}
+/**
+ * Recompiles the methods with the specified keys, and then every method that
+ * depends on one of the changes, including the changes that recompiling
+ * methods makes in turn.  Methods in the done set are not recompiled, and
+ * recompiled methods are added to it.
+ */
+- (void) recompileMethods: (NSArray*)keys
+                  changes: (NSMutableSet*)changes
+                     done: (NSMutableSet*)done
+{
+	NSMutableArray *pending = [keys mutableCopy];
+	do
+	{
+		for (NSString *key in pending)
+		{
+			if ([done containsObject: key])
+			{
+				continue;
+			}
+			[done addObject: key];
+			[recompiledMethods addObject: key];
+			[self compileMethod: [methods objectForKey: key]
+			                key: key
+			            changes: changes];
+		}
+		[pending removeAllObjects];
+		for (NSString *change in changes)
+		{
+			[pending addObjectsFromArray: [[dependents objectForKey: change] allObjects]];
+		}
+		[changes removeAllObjects];
+	} while ([pending count] > 0);
+}
+/**
+ * Returns YES if the first class is the same as or inherits from the second.
+ * Classes that have not been loaded yet are looked up in this session's
+ * class definitions.
+ */
+- (BOOL) isClassNamed: (NSString*)aClass subclassOf: (NSString*)aSuperclass
+{
+	while (nil != aClass)
+	{
+		if ([aClass isEqualToString: aSuperclass])
+		{
+			return YES;
+		}
+		LKSubclass *def = [classes objectForKey: aClass];
+		if (nil != def)
+		{
+			aClass = [def superclassname];
+			continue;
+		}
+		Class cls = NSClassFromString(aClass);
+		Class superclass = NSClassFromString(aSuperclass);
+		return (Nil != cls) && (Nil != superclass) &&
+			[cls isSubclassOfClass: superclass];
+	}
+	return NO;
+}
+- (BOOL) compileMethod: (NSString*)source onClassNamed: (NSString*)aClass
+{
+	[recompiledMethods removeAllObjects];
+	LKMethod *ast = nil;
+	@try
+	{
+		ast = [[[[compiler class] parserClass] new] parseMethod: source];
+	}
+	@catch (NSException *e)
+	{
+		[LKCompiler reportParseError: e];
+	}
+	if (nil == ast)
+	{
+		return NO;
+	}
+	NSString *key = methodKey(aClass, [ast isClassMethod], [[ast signature] selector]);
+	LKSessionMethod *method = [methods objectForKey: key];
+	if (nil == method)
+	{
+		method = [LKSessionMethod new];
+		method->className = aClass;
+		[methods setObject: method forKey: key];
+	}
+	else if (method->compiled && [method->source isEqualToString: source])
+	{
+		return YES;
+	}
+	method->source = source;
+	method->definitionSource = nil;
+	NSMutableSet *changes = [NSMutableSet set];
+	BOOL success = [self compileMethod: method key: key changes: changes];
+	[self recompileMethods: [NSArray array]
+	               changes: changes
+	                  done: [NSMutableSet setWithObject: key]];
+	return success;
+}
+/**
+ * Returns the names of the instance and class variables declared by a class
+ * definition.
+ */
+static NSSet *variableNames(LKSubclass *aClass)
+{
+	NSMutableSet *names = [NSMutableSet set];
+	for (LKVariableDecl *decl in [aClass instanceVariables])
+	{
+		[names addObject: [decl name]];
+	}
+	for (LKVariableDecl *decl in [aClass classVariables])
+	{
+		[names addObject: [@"+" stringByAppendingString: [decl name]]];
+	}
+	return names;
+}
+- (BOOL) compileClassDefinition: (NSString*)source
+{
+	[recompiledMethods removeAllObjects];
+	LKModule *module = nil;
+	@try
+	{
+		module = (LKModule*)[[[[compiler class] parserClass] new] parseString: source];
+	}
+	@catch (NSException *e)
+	{
+		[LKCompiler reportParseError: e];
+	}
+	if (![module isKindOfClass: [LKModule class]])
+	{
+		return NO;
+	}
+	for (LKSubclass *cls in [module allClasses])
+	{
+		LKSubclass *old = [classes objectForKey: [cls classname]];
+		if ((nil != old) &&
+		    (![[old superclassname] isEqualToString: [cls superclassname]] ||
+		     ![variableNames(old) isEqualToSet: variableNames(cls)]))
+		{
+			NSDictionary *errorDetails = [NSDictionary dictionaryWithObjectsAndKeys:
+				[NSString stringWithFormat:
+					@"Can not change the superclass or variables of loaded class %@",
+					[cls classname]], kLKHumanReadableDescription,
+				cls, kLKASTNode,
+				nil];
+			// The delegate is told, as it would be by LKSubclass, but the
+			// definition is rejected whatever it returns, because the layout
+			// of a loaded class can not change.
+			[LKCompiler reportWarning: LKRedefinedClassWarning
+			                  details: errorDetails];
+			return NO;
+		}
+	}
+	if (![compiler checkAST: module])
+	{
+		return NO;
+	}
+	[self loadModule: module];
+	[self recordInlinedCallersInModule: module source: source];
+
+	// Methods that refer to the new classes may now compile, and methods in
+	// them or their subclasses that refer to names that are now variables
+	// may resolve those names differently.
+	NSMutableArray *keys = [NSMutableArray array];
+	for (LKSubclass *cls in [module allClasses])
+	{
+		NSString *name = [cls classname];
+		if (nil != [classes objectForKey: name])
+		{
+			continue;
+		}
+		[classes setObject: cls forKey: name];
+		[keys addObjectsFromArray:
+			[[dependents objectForKey: variableKey(name)] allObjects]];
+		NSMutableSet *variables = [NSMutableSet set];
+		for (LKVariableDecl *decl in [cls instanceVariables])
+		{
+			[variables addObject: variableKey([decl name])];
+		}
+		for (LKVariableDecl *decl in [cls classVariables])
+		{
+			[variables addObject: variableKey([decl name])];
+		}
+		for (NSString *variable in variables)
+		{
+			for (NSString *key in [dependents objectForKey: variable])
+			{
+				LKSessionMethod *method = [methods objectForKey: key];
+				if ([self isClassNamed: method->className subclassOf: name])
+				{
+					[keys addObject: key];
+				}
+			}
+		}
+	}
+	[self recompileMethods: keys
+	               changes: [NSMutableSet set]
+	                  done: [NSMutableSet set]];
+	return YES;
+}
+@end
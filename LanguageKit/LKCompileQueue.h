@@ -0,0 +1,75 @@
+#import <Foundation/Foundation.h>
+
+@class LKCompiler;
+@class LKModule;
+
+/**
+ * A queue that compiles code in the background, in the current process.
+ *
+ * Code can be run in the interpreter as soon as it has been checked, and then
+ * compiled on this queue.  When a module has been compiled, the compiled
+ * methods replace the interpreted ones.  Each method is replaced atomically
+ * by the runtime, so other threads may keep calling methods while this
+ * happens: a call runs either the interpreted or the compiled version.
+ *
+ * Compilations run on background threads at a low priority, so they do not
+ * compete with the threads that are running the program.  The number that run
+ * at once is bounded, and compilations that have not started yet can be
+ * prioritised or cancelled through the returned operations.  Code generation
+ * itself is serialised with every other module compiled in the process,
+ * including those compiled on the main thread, by -[LKModule
+ * compileWithGenerator:].
+ */
+@interface LKCompileQueue : NSObject
+{
+	/** The queue that compilations are run on. */
+	NSOperationQueue *queue;
+}
+/**
+ * The maximum number of compilations that run at once.  Defaults to 1,
+ * because code generators are not thread-safe.
+ */
+@property (nonatomic) NSInteger maxConcurrentCompilations;
+/**
+ * The thread priority that compilations run at, from 0.0 (the lowest) to
+ * 1.0.  Defaults to 0.0.
+ */
+@property (nonatomic) double threadPriority;
+/**
+ * Returns the queue used for background compilation of bundles.
+ */
++ (LKCompileQueue*) sharedQueue;
+/**
+ * Compiles a module with the JIT, replacing its interpreted methods with
+ * compiled ones.  The module must already have been checked and run with
+ * -interpretInContext:, so that its classes exist.  The module is copied
+ * before this method returns, and the copy is checked with the compiler's
+ * -checkAST: and compiled, so the module may keep being interpreted.
+ * Checking and compiling the copy both hold +[LKModule codeGenerationLock].
+ *
+ * The completion block, if any, is called on a background thread after the
+ * methods have been replaced, with YES if compilation succeeded.  Compilation
+ * fails if no JIT is installed.
+ */
+- (NSOperation*) compileModule: (LKModule*)aModule
+                  withCompiler: (LKCompiler*)aCompiler
+                      priority: (NSOperationQueuePriority)aPriority
+                    completion: (void(^)(BOOL success))aBlock;
+/**
+ * Compiles a bundle loaded with +[LKCompiler loadLanguageKitBundle:] with
+ * +[LKCompiler justTooLateCompileBundle:], so that a compiled library can be
+ * loaded the next time that the bundle is loaded.  This does nothing if no
+ * static code generator that can link libraries is installed.  The bundle is
+ * checked and compiled while holding +[LKModule codeGenerationLock].
+ *
+ * The completion block, if any, is called on a background thread when
+ * compilation has finished.
+ */
+- (NSOperation*) compileBundle: (NSBundle*)aBundle
+                      priority: (NSOperationQueuePriority)aPriority
+                    completion: (void(^)(void))aBlock;
+/**
+ * Waits until all of the compilations that have been added have finished.
+ */
+- (void) waitUntilAllCompilationsAreFinished;
+@end
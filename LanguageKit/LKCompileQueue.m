@@ -0,0 +1,196 @@
+#import "LKCompileQueue.h"
+#import "LKASTCache.h"
+#import "LKCategory.h"
+#import "LKCodeGen.h"
+#import "LKCompiler.h"
+#import "LKInterpreterRuntime.h"
+#import "LKMessageSend.h"
+#import "LKMethod.h"
+#import "LKModule.h"
+#import "LKSubclass.h"
+#import <objc/runtime.h>
+
+/**
+ * A method that is being replaced, and the implementation that it had before
+ * compilation.
+ */
+@interface LKReplacedMethod : NSObject
+{
+	@public
+	Class cls;
+	SEL selector;
+	IMP interpreted;
+}
+@end
+@implementation LKReplacedMethod @end
+
+/**
+ * Returns the implementation that a class currently uses for a selector.
+ */
+static IMP currentIMP(Class cls, SEL sel)
+{
+	Method m = class_getInstanceMethod(cls, sel);
+	return (NULL == m) ? NULL : method_getImplementation(m);
+}
+
+@implementation LKCompileQueue
++ (LKCompileQueue*) sharedQueue
+{
+	static LKCompileQueue *SharedQueue;
+	@synchronized(self)
+	{
+		if (nil == SharedQueue)
+		{
+			SharedQueue = [self new];
+		}
+		return SharedQueue;
+	}
+}
+@synthesize threadPriority;
+- (id) init
+{
+	self = [super init];
+	if (nil == self)
+	{
+		return nil;
+	}
+	queue = [NSOperationQueue new];
+	[queue setMaxConcurrentOperationCount: 1];
+	return self;
+}
+- (NSInteger) maxConcurrentCompilations
+{
+	return [queue maxConcurrentOperationCount];
+}
+- (void) setMaxConcurrentCompilations: (NSInteger)aCount
+{
+	[queue setMaxConcurrentOperationCount: aCount];
+}
+/**
+ * Adds an operation that runs the block at this queue's priority.
+ */
+- (NSOperation*) addCompilation: (void(^)(void))aBlock
+                       priority: (NSOperationQueuePriority)aPriority
+{
+	NSBlockOperation *op = [NSBlockOperation blockOperationWithBlock: ^{
+		@autoreleasepool
+		{
+			aBlock();
+		}
+	}];
+	[op setQueuePriority: aPriority];
+	[op setThreadPriority: threadPriority];
+	[queue addOperation: op];
+	return op;
+}
+/**
+ * Checks and compiles the copy of a module made by
+ * -compileModule:withCompiler:priority:completion:, and retires the
+ * implementations of the interpreted methods that it replaces.
+ */
+- (BOOL) compileCopy: (LKModule*)copy withCompiler: (LKCompiler*)aCompiler
+{
+	// The classes in the module already exist, so compile all of the
+	// methods as categories on them.
+	LKModule *module = [LKModule module];
+	NSMutableArray *replaced = [NSMutableArray array];
+	NSMutableArray *definitions = [NSMutableArray array];
+	[definitions addObjectsFromArray: [copy allClasses]];
+	[definitions addObjectsFromArray: [copy allCategories]];
+	BOOL success = (nil != copy);
+	for (id def in definitions)
+	{
+		NSString *className = [def classname];
+		Class cls = NSClassFromString(className);
+		if (Nil == cls)
+		{
+			success = NO;
+			continue;
+		}
+		for (LKMethod *method in [def methods])
+		{
+			LKReplacedMethod *r = [LKReplacedMethod new];
+			r->cls = [method isClassMethod] ? object_getClass(cls) : cls;
+			r->selector = sel_registerName([[[method signature] selector] UTF8String]);
+			r->interpreted = currentIMP(r->cls, r->selector);
+			[replaced addObject: r];
+		}
+		LKCategoryDef *category =
+			[LKCategoryDef categoryOnClassNamed: className
+			                            methods: [def methods]];
+		[module addCategory: (LKCategory*)category];
+	}
+	id<LKCodeGenerator> jit = [LKCodeGenLoader defaultJIT];
+	success = success && (nil != jit) && (nil != aCompiler) &&
+		[aCompiler checkAST: module];
+	if (success)
+	{
+		[module compileWithGenerator: jit];
+		// Compiling the module installs the compiled methods.  Retire the
+		// interpreter implementations that they replaced.  Retired
+		// implementations are never freed, so threads that are still
+		// running them are unaffected.
+		for (LKReplacedMethod *r in replaced)
+		{
+			IMP compiled = currentIMP(r->cls, r->selector);
+			if ((NULL != r->interpreted) && (compiled != r->interpreted))
+			{
+				LKInterpreterRetireIMP(r->interpreted);
+			}
+		}
+	}
+	return success;
+}
+- (NSOperation*) compileModule: (LKModule*)aModule
+                  withCompiler: (LKCompiler*)aCompiler
+                      priority: (NSOperationQueuePriority)aPriority
+                    completion: (void(^)(BOOL success))aBlock
+{
+	// Copy the module now, while the caller owns it.  Checking moves methods
+	// into new categories and rewrites them, which must not happen to the
+	// trees that the interpreter is running.
+	LKModule *copy = (LKModule*)[LKASTCache deepCopyOfAST: aModule];
+	return [self addCompilation: ^{
+		NSRecursiveLock *lock = [LKModule codeGenerationLock];
+		[lock lock];
+		BOOL success;
+		@try
+		{
+			success = [self compileCopy: copy withCompiler: aCompiler];
+		}
+		@finally
+		{
+			[lock unlock];
+		}
+		if (nil != aBlock)
+		{
+			aBlock(success);
+		}
+	} priority: aPriority];
+}
+- (NSOperation*) compileBundle: (NSBundle*)aBundle
+                      priority: (NSOperationQueuePriority)aPriority
+                    completion: (void(^)(void))aBlock
+{
+	return [self addCompilation: ^{
+		NSRecursiveLock *lock = [LKModule codeGenerationLock];
+		[lock lock];
+		@try
+		{
+			[LKCompiler justTooLateCompileBundle: aBundle];
+		}
+		@finally
+		{
+			[lock unlock];
+		}
+		if (nil != aBlock)
+		{
+			aBlock();
+		}
+	} priority: aPriority];
+}
+- (void) waitUntilAllCompilationsAreFinished
+{
+	[queue waitUntilAllOperationsAreFinished];
+}
+@end
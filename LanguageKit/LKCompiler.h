@@ -67,6 +67,12 @@ generatedWarning: (NSString*)aWarning
   generatedError: (NSString*)anError
          details: (NSDictionary*)info;
 @end
+/*
+ * Note: Source files may be checked on several threads at once.  The
+ * compiler serialises calls to each delegate, so delegates do not need to be
+ * thread-safe, but they may be called from threads other than the one that
+ * started the compilation.
+ */
 
 /**
  * Abstract class implementing a dynamic language compiler.  Concrete
@@ -75,6 +81,8 @@ generatedWarning: (NSString*)aWarning
 @interface LKCompiler : NSObject 
 {
 	id<LKCompilerDelegate> delegate;
+	/** Seconds spent in each checking and transform pass, by pass name. */
+	NSMutableDictionary *passTimings;
 }
 @property(nonatomic, retain) NSMutableArray *transforms;
 /**
@@ -98,6 +106,12 @@ generatedWarning: (NSString*)aWarning
  * Returns a new autoreleased compiler for this language.
  */
 + (LKCompiler*) compiler;
+/**
+ * Returns a new array of the AST transforms that compilers apply by default.
+ * New compilers start with these in their transforms array, and they are also
+ * applied when compiling bundles.
+ */
++ (NSMutableArray*) defaultTransforms;
 /**
  * Returns whether we are in developer mode.  In this mode, all unrecognised
  * symbols are assumed to be classes.
@@ -142,6 +156,18 @@ generatedWarning: (NSString*)aWarning
 - (BOOL) compileMethod:(NSString*)source
           onClassNamed:(NSString*)name
          withGenerator:(id<LKCodeGenerator>)cg;
+/**
+ * Performs semantic analysis on an AST, applies the receiver's transforms,
+ * and then checks the parts that they changed again, using an LKPassManager.
+ * Errors are reported with the receiver as the compiler.  Returns YES if the
+ * AST can be compiled.
+ */
+- (BOOL) checkAST:(LKAST*)anAST;
+/**
+ * Returns the total number of seconds that the receiver has spent in each
+ * checking and transform pass, keyed by pass name.
+ */
+- (NSDictionary*) passTimings;
 /**
  * Load a framework with the specified name.
  */
@@ -171,7 +197,9 @@ generatedWarning: (NSString*)aWarning
  */
 + (BOOL) loadScriptsFromBundle:(NSBundle*) aBundle;
 /**
- * Loads all scripts written in this language from the specified bundle.
+ * Loads all scripts written in this language from the specified bundle.  The
+ * scripts are parsed and checked concurrently, then compiled with each
+ * class's superclass first.
  */
 - (BOOL) loadScriptsFromBundle:(NSBundle*) aBundle;
 /**
@@ -185,10 +213,13 @@ generatedWarning: (NSString*)aWarning
 
 /**
  * Loads a bundle containing an LKInfo.plist file.  This should contain a
- * Source key giving an array of source files in the order in which they should
- * be compiled, a Frameworks key giving an array of frameworks and a
- * Classes key for declaring classes being compile in other to resolve symbols
- * correctly
+ * Source key giving an array of source files, a Frameworks key giving an
+ * array of frameworks and a Classes key for declaring classes being compile
+ * in other to resolve symbols correctly.  The sources are parsed and checked
+ * concurrently.  Code is generated with the files defining superclasses
+ * first, and otherwise in the order given.  The library's cache key is written
+ * to a plist with the same name, and the library is installed in
+ * LKBundleCache, so that loading the bundle later uses it.
  */
 + (BOOL) compileLanguageKitBundle: (NSBundle*)bundle output: (NSString*)bitcode;
 /**
@@ -199,6 +230,10 @@ generatedWarning: (NSString*)aWarning
  * PrincipalClass key for the class that should be instantiated when it is
  * loaded.
  *
+ * If there is no compiled library for the current version of the bundle,
+ * then the sources are compiled with the JIT and a library is compiled on the
+ * shared LKCompileQueue, for use next time.
+ *
  * Returns (Class)-1 in case of error, or the principal class if loading
  * succeeds (Nil if no principal class is specified).
  */
@@ -210,7 +245,9 @@ generatedWarning: (NSString*)aWarning
 /**
  * Attempts to parse a C header.  Returns YES on success, NO on failure.
  * Failure can be caused by an inability to locate the header or by
- * SourceCodeKit not being available.
+ * SourceCodeKit not being available.  Headers and frameworks are loaded one at
+ * a time, so this may be called from any thread, and loading a header again
+ * does nothing.
  */
 + (BOOL) loadHeader: (NSString*)aHeader;
 /**
@@ -259,11 +296,22 @@ generatedWarning: (NSString*)aWarning
  */
 + (BOOL)reportError: (NSString*)aWarning
             details: (NSDictionary*)info;
+/**
+ * Reports an exception raised by a parser as an LKParserError.
+ */
++ (void)reportParseError: (NSException*)anException;
 
 + (LKAST*) parseScript: (NSString*)script forFileExtension: (NSString*)extension;
 @end
 
 @interface LKCompiler (JTL)
+/**
+ * Compiles a bundle loaded with +loadLanguageKitBundle: in the background.
+ * The default implementation builds a library with
+ * +compileLanguageKitBundle:output:, which installs it in LKBundleCache so
+ * that it is used the next time that the bundle is loaded.  It does nothing
+ * unless a code generator implements +linkBitcodeFiles:outputDir:outputFile:.
+ */
 + (void) justTooLateCompileBundle: (NSBundle*)aBundle;
 /**
  * Link LKModule into a library. 
@@ -1,13 +1,20 @@
 #include <dlfcn.h>
-#include <sys/resource.h>
 #include <objc/runtime.h>
 
 #import "LKAST.h"
+#import "LKASTCache.h"
+#import "LKBundleCache.h"
 #import "LKCategory.h"
+#import "LKCompileQueue.h"
 #import "LKCompiler.h"
 #import "LKCompilerErrors.h"
+#import "LKConstantFolder.h"
+#import "LKInliner.h"
 #import "LKMethod.h"
 #import "LKModule.h"
+#import "LKPassManager.h"
+#import "LKSubclass.h"
+#import "LKTypeDatabase.h"
 
 static NSMutableDictionary *compilersByExtension;
 static NSMutableDictionary *compilersByLanguage;
@@ -26,9 +33,33 @@ static id<LKCompilerDelegate> DefaultDelegate;
 @interface SCKEnumeration : NSObject
 @property (nonatomic, readonly) NSMutableDictionary *values;
 @end
+@interface SCKEnumerationValue : NSObject
+@property (nonatomic, readonly) long long longLongValue;
+@end
+@interface SCKSourceLocation : NSObject
+@property (nonatomic, readonly) NSString *file;
+@end
+@interface SCKProgramComponent : NSObject
+@property (nonatomic, readonly) SCKSourceLocation *declaration;
+@end
 
 
 static SCKSourceCollection *collection;
+/**
+ * Type databases for the headers that have been loaded.  These are consulted
+ * before SourceCodeKit, and let headers be loaded without parsing them again.
+ */
+static NSMutableArray *typeDatabases;
+/**
+ * The paths of the headers that have been loaded.
+ */
+static NSMutableSet *loadedHeaders;
+/**
+ * Serialises loading headers and frameworks and every use of the SourceCodeKit
+ * collection, which is not thread-safe.  Modules that are checked concurrently
+ * can load the headers named in their pragmas at the same time.
+ */
+static NSRecursiveLock *HeaderLock;
 static NSMutableArray *loaders;
 static BOOL inDevMode;
 
@@ -48,6 +79,13 @@ static Class lookup_class(const char *name)
 	return cls;
 }
 
+@interface LKCompiler ()
+/**
+ * Adds the times from a pass manager to the receiver's totals.
+ */
+- (void) addPassTimings: (NSDictionary*)aDictionary;
+@end
+
 @interface LKDefaultCompilerDelegate : NSObject<LKCompilerDelegate>
 {
 	NSMutableSet *polymorphicSelectors;
@@ -88,77 +126,6 @@ generatedWarning: (NSString*)aWarning
 }
 @end
 
-/**
- * Returns the modification date of a file.
- */
-static NSDate *modificationDateForFile(NSString *file)
-{
-	NSFileManager *fm = [NSFileManager defaultManager];
-	NSDictionary *attrib = [fm attributesOfItemAtPath:file error:NULL];
-	return [attrib objectForKey: NSFileModificationDate];
-}
-/**
- * Returns the most recent modification date of a set of files.
- */
-static NSDate *mostRecentModificationDate(NSArray *files)
-{
-	NSDate *mostRecentDate = [NSDate distantPast];
-	for (NSString *file in files)
-	{
-		NSDate *date = modificationDateForFile(file);
-		mostRecentDate = [mostRecentDate laterDate: date];
-	}
-	return mostRecentDate;
-}
-
-/**
- * Open the cached (statically-compiled) version of a file if it is not too old.
- */
-static BOOL loadLibraryForBundle(NSString *soFile,
-                                 NSBundle *bundle,
-                                 NSDate *modified)
-{
-	//NSLog(@"Trying cache %@", soFile);
-	if (nil == soFile)
-	{
-		return NO;
-	}
-	NSDate *soDate = modificationDateForFile(soFile);
-	// If the bundle has been modified after the cached version...
-	if (nil == soDate || [modified compare: soDate] == NSOrderedDescending)
-	{
-		return NO;
-	}
-	// Return YES if dlopen succeeds.
-	//return NULL != dlopen([soFile UTF8String], RTLD_GLOBAL);
-	void *so = dlopen([soFile UTF8String], RTLD_GLOBAL);
-	if (so == NULL)
-	{
-		NSLog(@"Failed to load cache.  dlopen() error: %s", dlerror());
-	}
-	return NULL != so;
-}
-/**
- * Load any available cached version of the library.
- */
-static BOOL loadAnyLibraryForBundle(NSBundle *bundle, NSDate *modified)
-{
-	NSString *soFile = [bundle pathForResource: @"languagekit-cache"
-	                                    ofType: @"so"];
-	if (loadLibraryForBundle(soFile, bundle, modified))
-	{
-		return YES;
-	}
-	NSArray *dirs = NSSearchPathForDirectoriesInDomains( NSLibraryDirectory,
-			NSUserDomainMask, YES);
-	NSString *userCache = [dirs objectAtIndex: 0];
-	userCache = [[userCache stringByAppendingPathComponent: @"LKCaches"]
-			stringByAppendingPathComponent: [bundle bundlePath]];
-	userCache = 
-		[userCache stringByAppendingPathComponent: @"languagekit-cache.so"];
-	return loadLibraryForBundle(userCache, bundle, modified);
-}
-
 int DEBUG_DUMP_MODULES = 0;
 @implementation LKCompiler
 @synthesize transforms;
@@ -230,6 +197,9 @@ int DEBUG_DUMP_MODULES = 0;
 		[compilersByExtension setObject:nextClass
 		                         forKey:[nextClass fileExtension]];
 	}
+	typeDatabases = [NSMutableArray new];
+	loadedHeaders = [NSMutableSet new];
+	HeaderLock = [NSRecursiveLock new];
 	// If SourceCodeKit is installed, let's use it!
 	[self loadFrameworkNamed: @"SourceCodeKit"];
 	collection = [NSClassFromString(@"SCKSourceCollection") new];
@@ -265,7 +235,8 @@ int DEBUG_DUMP_MODULES = 0;
     self = [super init];
     if (self) {
         delegate = DefaultDelegate;
-        transforms = [NSMutableArray new];
+        transforms = [[self class] defaultTransforms];
+        passTimings = [NSMutableDictionary new];
     }
 	return self;
 }
@@ -273,6 +244,11 @@ int DEBUG_DUMP_MODULES = 0;
 {
 	return [[self alloc] init];
 }
++ (NSMutableArray*) defaultTransforms
+{
+	return [NSMutableArray arrayWithObjects: [LKInliner new],
+		[LKConstantFolder new], nil];
+}
 + (void) setDebugMode:(LKDebuggingMode)aFlag
 {
 	DEBUG_DUMP_MODULES = (int) aFlag;
@@ -295,6 +271,204 @@ static void emitParseError(NSException *localException)
 	[LKCompiler reportError: LKParserError
 	                details: parseErrorInfo];
 }
+/**
+ * Checks an AST, applies the transforms, and checks the parts that they
+ * changed.  The time spent in each pass is added to the compiler's totals.
+ */
+static BOOL checkAST(LKAST *ast, LKCompiler *aCompiler, NSArray *transforms)
+{
+	LKPassManager *passManager = [LKPassManager passManagerWithTransforms: transforms];
+	BOOL success = [passManager runOnAST: ast];
+	[aCompiler addPassTimings: [passManager timings]];
+	return success;
+}
+/**
+ * Runs a block on a pool of threads for each index in the set and waits for
+ * them all to finish.  Each thread reports errors to the calling thread's
+ * delegate, in the context of aCompiler.  An exception raised by any of the
+ * blocks is raised again in the calling thread.
+ */
+static void runConcurrently(NSIndexSet *indexes,
+                            LKCompiler *aCompiler,
+                            void(^block)(NSUInteger))
+{
+	NSDictionary *callerDict = [[NSThread currentThread] threadDictionary];
+	id<LKCompilerDelegate> errorDelegate = [callerDict objectForKey: @"LKCompilerDelegate"];
+	__block NSException *exception = nil;
+	NSOperationQueue *queue = [NSOperationQueue new];
+	[indexes enumerateIndexesUsingBlock: ^(NSUInteger i, BOOL *stop)
+		{
+			[queue addOperationWithBlock: ^{
+				@autoreleasepool
+				{
+					NSMutableDictionary *dict = [[NSThread currentThread] threadDictionary];
+					if (nil != errorDelegate)
+					{
+						[dict setObject: errorDelegate forKey: @"LKCompilerDelegate"];
+					}
+					if (nil != aCompiler)
+					{
+						[dict setObject: aCompiler forKey: @"LKCompilerContext"];
+					}
+					@try
+					{
+						block(i);
+					}
+					@catch (NSException *e)
+					{
+						@synchronized(queue)
+						{
+							if (nil == exception)
+							{
+								exception = e;
+							}
+						}
+					}
+					@finally
+					{
+						// Operation queue threads are reused.
+						[dict removeObjectForKey: @"LKCompilerDelegate"];
+						[dict removeObjectForKey: @"LKCompilerContext"];
+					}
+				}
+			}];
+		}];
+	[queue waitUntilAllOperationsAreFinished];
+	if (nil != exception)
+	{
+		[exception raise];
+	}
+}
+/**
+ * Parses and checks count source files, using parse to parse each one.
+ *
+ * Files are parsed concurrently.  They are then checked in batches: a file is
+ * only checked once the files defining the superclasses of its classes have
+ * been, because checking a class looks up symbols in its superclass's symbol
+ * table.  Files within a batch are checked concurrently.  Files whose
+ * superclasses depend on each other are checked one at a time, in their
+ * original order.
+ *
+ * Returns the ASTs that were checked successfully, in an order in which each
+ * class's superclass comes before it, so code generation can follow this
+ * order.  Sets *success to NO if any file failed to parse or check.
+ */
+static NSArray *parseAndCheckConcurrently(NSUInteger count,
+                                          LKAST*(^parse)(NSUInteger),
+                                          LKCompiler *aCompiler,
+                                          NSArray *transforms,
+                                          BOOL *success)
+{
+	NSMutableArray *asts = [NSMutableArray arrayWithCapacity: count];
+	for (NSUInteger i=0 ; i<count ; i++)
+	{
+		[asts addObject: [NSNull null]];
+	}
+	NSIndexSet *all = [NSIndexSet indexSetWithIndexesInRange: NSMakeRange(0, count)];
+	runConcurrently(all, aCompiler, ^(NSUInteger i)
+		{
+			LKAST *ast = nil;
+			@try
+			{
+				ast = parse(i);
+			}
+			@catch (NSException *e)
+			{
+				emitParseError(e);
+			}
+			if (nil != ast)
+			{
+				@synchronized(asts)
+				{
+					[asts replaceObjectAtIndex: i withObject: ast];
+				}
+			}
+		});
+
+	// Find the file that defines each class.
+	NSMutableDictionary *definingFiles = [NSMutableDictionary dictionary];
+	NSMutableIndexSet *pending = [NSMutableIndexSet indexSet];
+	for (NSUInteger i=0 ; i<count ; i++)
+	{
+		id ast = [asts objectAtIndex: i];
+		if ([NSNull null] == ast)
+		{
+			*success = NO;
+			continue;
+		}
+		[pending addIndex: i];
+		if ([ast isKindOfClass: [LKModule class]])
+		{
+			for (LKSubclass *cls in [ast allClasses])
+			{
+				[definingFiles setObject: [NSNumber numberWithUnsignedInteger: i]
+				                  forKey: [cls classname]];
+			}
+		}
+	}
+	NSMutableArray *ordered = [NSMutableArray arrayWithCapacity: count];
+	__block BOOL checked = YES;
+	void (^check)(NSUInteger) = ^(NSUInteger i)
+		{
+			if (!checkAST([asts objectAtIndex: i], aCompiler, transforms))
+			{
+				@synchronized(asts)
+				{
+					[asts replaceObjectAtIndex: i withObject: [NSNull null]];
+				}
+			}
+		};
+	while ([pending count] > 0)
+	{
+		NSIndexSet *batch = [pending indexesPassingTest: ^(NSUInteger i, BOOL *stop)
+			{
+				id ast = [asts objectAtIndex: i];
+				if (![ast isKindOfClass: [LKModule class]])
+				{
+					return YES;
+				}
+				for (LKSubclass *cls in [ast allClasses])
+				{
+					NSNumber *file = [definingFiles objectForKey: [cls superclassname]];
+					if ((nil != file) && ([file unsignedIntegerValue] != i) &&
+					    [pending containsIndex: [file unsignedIntegerValue]])
+					{
+						return NO;
+					}
+				}
+				return YES;
+			}];
+		if ([batch count] == 0)
+		{
+			// The remaining files depend on each other, so check them one at a
+			// time in the order that they were given.
+			batch = [pending copy];
+			[batch enumerateIndexesUsingBlock: ^(NSUInteger i, BOOL *stop)
+				{
+					runConcurrently([NSIndexSet indexSetWithIndex: i], aCompiler, check);
+				}];
+		}
+		else
+		{
+			runConcurrently(batch, aCompiler, check);
+		}
+		[batch enumerateIndexesUsingBlock: ^(NSUInteger i, BOOL *stop)
+			{
+				id ast = [asts objectAtIndex: i];
+				if ([NSNull null] == ast)
+				{
+					checked = NO;
+				}
+				else
+				{
+					[ordered addObject: ast];
+				}
+			}];
+		[pending removeIndexes: batch];
+	}
+	*success &= checked;
+	return ordered;
+}
 - (LKAST*) compileString:(NSString*)source withGenerator:(id<LKCodeGenerator>)cg
 {
 	id parser = [[[[self class] parserClass] alloc] init];
@@ -306,18 +480,13 @@ static void emitParseError(NSException *localException)
 		return nil;
 	NS_ENDHANDLER
 
+	// Code for a static code generator is loaded without recording the
+	// methods that it inlined, so its inlined copies would never be used.
+	NSArray *passes = [(id)cg conformsToProtocol: @protocol(LKStaticCodeGenerator)] ?
+		LKTransformsWithoutInlining(transforms) : transforms;
 	NSMutableDictionary *dict = [[NSThread currentThread] threadDictionary];
 	[dict setObject: self forKey: @"LKCompilerContext"];
-	BOOL success = [ast check];
-	if (!success)
-	{
-		return nil;
-	}
-	for (id<LKASTVisitor> transform in transforms)
-	{
-		[ast visitWithVisitor: transform];
-	}
-	success = [ast check];
+	BOOL success = checkAST(ast, self, passes);
 	[dict removeObjectForKey: @"LKCompilerContext"];
 	if (success)
 	{
@@ -325,6 +494,34 @@ static void emitParseError(NSException *localException)
 	}
 	return success ? ast : nil;
 }
+- (void) addPassTimings: (NSDictionary*)aDictionary
+{
+	@synchronized(passTimings)
+	{
+		for (NSString *pass in aDictionary)
+		{
+			double total = [[passTimings objectForKey: pass] doubleValue] +
+				[[aDictionary objectForKey: pass] doubleValue];
+			[passTimings setObject: [NSNumber numberWithDouble: total]
+			                forKey: pass];
+		}
+	}
+}
+- (NSDictionary*) passTimings
+{
+	@synchronized(passTimings)
+	{
+		return [passTimings copy];
+	}
+}
+- (BOOL) checkAST:(LKAST*)anAST
+{
+	NSMutableDictionary *dict = [[NSThread currentThread] threadDictionary];
+	[dict setObject: self forKey: @"LKCompilerContext"];
+	BOOL success = checkAST(anAST, self, transforms);
+	[dict removeObjectForKey: @"LKCompilerContext"];
+	return success;
+}
 - (LKAST*) compileString:(NSString*)source output:(NSString*)bitcode;
 {
 	id<LKCodeGenerator> cg = defaultStaticCompilterWithFile(bitcode);
@@ -377,7 +574,11 @@ static void emitParseError(NSException *localException)
 	             withGenerator: [LKCodeGenLoader defaultJIT]];
 }
 
-static NSString *loadFramework(NSString *framework)
+/**
+ * Loads a framework and parses its header, if SourceCodeKit is available.
+ * Must be called with HeaderLock held.
+ */
+static NSString *loadFrameworkLocked(NSString *framework)
 {
 	NSFileManager *fm = [NSFileManager defaultManager];
 	NSArray *dirs = NSSearchPathForDirectoriesInDomains(NSLibraryDirectory,
@@ -422,6 +623,19 @@ static NSString *loadFramework(NSString *framework)
 	return nil;
 }
 
+static NSString *loadFramework(NSString *framework)
+{
+	[HeaderLock lock];
+	@try
+	{
+		return loadFrameworkLocked(framework);
+	}
+	@finally
+	{
+		[HeaderLock unlock];
+	}
+}
+
 static BOOL loadLibraryInPath(NSFileManager *fm, NSString *aLibrary, NSString *basePath)
 {
 	NSString *lib = [basePath stringByAppendingPathComponent: aLibrary];
@@ -484,22 +698,174 @@ static BOOL loadLibraryInPath(NSFileManager *fm, NSString *aLibrary, NSString *b
 	return NO;
 }
 
-+ (BOOL) loadHeader: (NSString*)aHeader
+/**
+ * Returns YES if a SourceCodeKit declaration belongs in the type database for
+ * a header, which records everything that the header reaches, whether or not
+ * it was parsed before.  Declarations whose location SourceCodeKit does not
+ * report are recorded if this header introduced them.
+ */
+static BOOL IsDeclaredInFiles(id component, NSSet *files, BOOL isNew)
 {
-	// If SourceCodeKit is not loaded, give up
+	if (![component respondsToSelector: @selector(declaration)])
+	{
+		return isNew;
+	}
+	NSString *file = [[component declaration] file];
+	if (nil == file)
+	{
+		return isNew;
+	}
+	return [files containsObject: [file stringByStandardizingPath]];
+}
+
+/**
+ * Returns the type information from SourceCodeKit that is declared in the
+ * specified files, in the form used by LKTypeDatabase.  The snapshot contains
+ * the names that were known before the header was parsed.
+ */
+static NSDictionary *TypeDatabaseEntries(NSSet *files, NSDictionary *snapshot)
+{
+	NSMutableDictionary *functions = [NSMutableDictionary dictionary];
+	NSMutableDictionary *globals = [NSMutableDictionary dictionary];
+	NSMutableDictionary *values = [NSMutableDictionary dictionary];
+	NSMutableDictionary *enums = [NSMutableDictionary dictionary];
+	NSDictionary *all = [collection functions];
+	for (NSString *name in all)
+	{
+		id function = [all objectForKey: name];
+		if (IsDeclaredInFiles(function, files,
+		      nil == [[snapshot objectForKey: @"functions"] member: name]))
+		{
+			NSString *type = [function typeEncoding];
+			if (nil != type)
+			{
+				[functions setObject: type forKey: name];
+			}
+		}
+	}
+	all = [collection globals];
+	for (NSString *name in all)
+	{
+		id global = [all objectForKey: name];
+		if (IsDeclaredInFiles(global, files,
+		      nil == [[snapshot objectForKey: @"globals"] member: name]))
+		{
+			NSString *type = [global typeEncoding];
+			if (nil != type)
+			{
+				[globals setObject: type forKey: name];
+			}
+		}
+	}
+	all = [collection enumerationValues];
+	for (NSString *name in all)
+	{
+		id value = [all objectForKey: name];
+		BOOL isNew = (nil == [[snapshot objectForKey: @"enumerationValues"] member: name]);
+		// Ambiguous names are stored with an empty value, unless only one of
+		// the candidates is reachable from this header.
+		NSMutableArray *candidates = [NSMutableArray array];
+		for (id candidate in ([value isKindOfClass: [NSArray class]] ?
+		                      value : [NSArray arrayWithObject: value]))
+		{
+			if (IsDeclaredInFiles(candidate, files, isNew))
+			{
+				[candidates addObject: candidate];
+			}
+		}
+		if ([candidates count] > 0)
+		{
+			[values setObject: ([candidates count] > 1) ? @"" :
+				[NSString stringWithFormat: @"%lld", [[candidates objectAtIndex: 0] longLongValue]]
+			           forKey: name];
+		}
+	}
+	all = [collection enumerations];
+	for (NSString *enumName in all)
+	{
+		id enumeration = [all objectForKey: enumName];
+		if (IsDeclaredInFiles(enumeration, files,
+		      nil == [[snapshot objectForKey: @"enumerations"] member: enumName]))
+		{
+			NSDictionary *members = [enumeration values];
+			for (NSString *name in members)
+			{
+				[enums setObject: [NSString stringWithFormat: @"%lld",
+						[[members objectForKey: name] longLongValue]]
+				          forKey: [NSString stringWithFormat: @"%@.%@", enumName, name]];
+			}
+		}
+	}
+	return [NSDictionary dictionaryWithObjectsAndKeys:
+		functions, [NSNumber numberWithInt: LKTypeDatabaseFunction],
+		globals, [NSNumber numberWithInt: LKTypeDatabaseGlobal],
+		values, [NSNumber numberWithInt: LKTypeDatabaseEnumerationValue],
+		enums, [NSNumber numberWithInt: LKTypeDatabaseEnumeration],
+		nil];
+}
+
+/**
+ * Loads the header at the specified path.  The type database for the header
+ * is used if it is up to date.  Otherwise the header is parsed with
+ * SourceCodeKit and a new database is written for next time.  Must be called
+ * with HeaderLock held.
+ */
+static BOOL LoadHeaderAtPathLocked(NSString *aPath)
+{
+	if ([loadedHeaders containsObject: aPath])
+	{
+		return YES;
+	}
+	LKTypeDatabase *db = [LKTypeDatabase databaseForSource: aPath];
+	if (nil != db)
+	{
+		@synchronized(typeDatabases)
+		{
+			[typeDatabases addObject: db];
+		}
+		[loadedHeaders addObject: aPath];
+		return YES;
+	}
 	if (nil == collection) { return NO; }
 
+	NSDictionary *snapshot = [NSDictionary dictionaryWithObjectsAndKeys:
+		[NSSet setWithArray: [[collection functions] allKeys]], @"functions",
+		[NSSet setWithArray: [[collection globals] allKeys]], @"globals",
+		[NSSet setWithArray: [[collection enumerationValues] allKeys]], @"enumerationValues",
+		[NSSet setWithArray: [[collection enumerations] allKeys]], @"enumerations",
+		nil];
+	[collection sourceFileForPath: aPath];
+	NSSet *files = [NSSet setWithArray: [LKTypeDatabase filesIncludedBySource: aPath]];
+	[LKTypeDatabase writeDatabaseForSource: aPath
+	                               entries: TypeDatabaseEntries(files, snapshot)];
+	[loadedHeaders addObject: aPath];
+	return YES;
+}
+
+static BOOL LoadHeaderAtPath(NSString *aPath)
+{
+	[HeaderLock lock];
+	@try
+	{
+		return LoadHeaderAtPathLocked([aPath stringByStandardizingPath]);
+	}
+	@finally
+	{
+		[HeaderLock unlock];
+	}
+}
+
++ (BOOL) loadHeader: (NSString*)aHeader
+{
 	NSFileManager *fm = [NSFileManager defaultManager];
 	NSArray *dirs = NSSearchPathForDirectoriesInDomains(NSLibraryDirectory,
 			NSAllDomainsMask, YES);
-	NSBundle *bundle = nil;
 	BOOL isDir = NO;
  
 	// Check local paths
 	if ([fm fileExistsAtPath: aHeader isDirectory:&isDir] && !isDir)
 	{
-		[collection sourceFileForPath: aHeader];
-		return YES;
+		return LoadHeaderAtPath(aHeader);
 	}
 	else
 	{
@@ -512,8 +878,7 @@ static BOOL loadLibraryInPath(NSFileManager *fm, NSString *aLibrary, NSString *b
 			isDir = NO;
 			if ([fm fileExistsAtPath:f isDirectory:&isDir] && !isDir)
 			{
-				[collection sourceFileForPath: f];
-				return YES;
+				return LoadHeaderAtPath(f);
 			}
 		}
 		// Check system include paths
@@ -525,8 +890,7 @@ static BOOL loadLibraryInPath(NSFileManager *fm, NSString *aLibrary, NSString *b
 			isDir = NO;
 			if ([fm fileExistsAtPath:f isDirectory:&isDir] && !isDir)
 			{
-				[collection sourceFileForPath: f];
-				return YES;
+				return LoadHeaderAtPath(f);
 			}
 		}
 	}
@@ -543,6 +907,41 @@ static BOOL loadLibraryInPath(NSFileManager *fm, NSString *aLibrary, NSString *b
 	return inDevMode;
 }
 
+/**
+ * Loads the frameworks that a LanguageKit bundle uses, and returns the paths
+ * of everything that code compiled from the bundle depends on, for
+ * +[LKBundleCache keyForBundle:inputs:].  Sets success to NO if a framework or
+ * a source file can not be found.
+ */
+static NSMutableArray *loadBundleInputs(NSBundle *bundle, BOOL *success)
+{
+	NSString *plistPath = [bundle pathForResource:@"LKInfo" ofType:@"plist"];
+	NSDictionary *plist = [NSDictionary dictionaryWithContentsOfFile:plistPath];
+	NSMutableArray *inputs = [NSMutableArray arrayWithObject: plistPath];
+	for (NSString *framework in [plist objectForKey:@"Frameworks"])
+	{
+		NSString *path = loadFramework(framework);
+		if (nil == path)
+		{
+			*success = NO;
+			continue;
+		}
+		[inputs addObject: path];
+	}
+	for (NSString *source in [plist objectForKey:@"Sources"])
+	{
+		NSString *path = [bundle pathForResource: [source stringByDeletingPathExtension]
+		                                  ofType: [source pathExtension]];
+		if (nil == path)
+		{
+			*success = NO;
+			continue;
+		}
+		[inputs addObject: path];
+	}
+	return inputs;
+}
+
 + (BOOL) compileLanguageKitBundle: (NSBundle*)bundle output: (NSString*)bitcode
 {
 	NSString *dir = [bitcode stringByDeletingLastPathComponent];
@@ -560,32 +959,73 @@ static BOOL loadLibraryInPath(NSFileManager *fm, NSString *aLibrary, NSString *b
 	{
 		[LKSymbolTable symbolTableForClass: classeDef];
 	}
+	NSMutableArray *sources = [NSMutableArray array];
 	for (NSString *s in sourceFiles)
 	{
-		NSString *file = [s lastPathComponent];
 		NSString *source = [bundle pathForResource: [s lastPathComponent] 
 											ofType: nil 
 									   inDirectory: [s stringByDeletingLastPathComponent]];
+		if (nil == source)
+		{
+			NSLog(@"Unable to find %@ in bundle %@.", s, bundle);
+			success = NO;
+			continue;
+		}
+		[sources addObject: source];
+	}
+	// Check the files as -checkAST: would, so that warnings are reported
+	// with the compiler as their context.
+	LKCompiler *compiler = ([sources count] == 0) ? nil :
+		[[self compilerClassForFileExtension: [[sources objectAtIndex: 0] pathExtension]] compiler];
+	NSArray *transforms = (nil == compiler) ? [self defaultTransforms] : [compiler transforms];
+	NSMapTable *sourceForAST = [NSMapTable strongToStrongObjectsMapTable];
+	NSArray *asts = parseAndCheckConcurrently([sources count],
+		^LKAST*(NSUInteger i)
+		{
+			NSString *source = [sources objectAtIndex: i];
+			NSString *code = [NSString stringWithContentsOfFile: source encoding:NSUTF8StringEncoding error:NULL];
+			LKAST *ast = [LKCompiler parseScript: code forFileExtension: [source pathExtension]];
+			if (nil != ast)
+			{
+				@synchronized(sourceForAST)
+				{
+					[sourceForAST setObject: source forKey: ast];
+				}
+			}
+			return ast;
+		},
+		compiler, LKTransformsWithoutInlining(transforms), &success);
+	if (!success)
+	{
+		return NO;
+	}
+	// Code generators are not thread-safe, so generate code serially, with
+	// superclasses first.
+	for (LKAST *ast in asts)
+	{
 		NSString *outFile = 
 			[dir stringByAppendingPathComponent: 
-				[source lastPathComponent]];
+				[[sourceForAST objectForKey: ast] lastPathComponent]];
 		outFile = [outFile stringByAppendingPathExtension: @"bc"];
-		NSString *code = [NSString stringWithContentsOfFile: source encoding:NSUTF8StringEncoding error:NULL];
-		
-		LKAST *ast;
-		NS_DURING
-			ast = [LKCompiler parseScript: code forFileExtension: [source pathExtension]];
-		NS_HANDLER
-			emitParseError(localException);
-			return NO;
-		NS_ENDHANDLER
-		
-		BOOL checkOk = [ast check];
-		//applyTransforms(ast);
 		[ast compileWithGenerator: defaultStaticCompilterWithFile(outFile)];
 		[bitcodeFiles addObject: outFile];
 	}
-	[LKCompiler linkBitcodeFiles: bitcodeFiles outputDir: dir outputFile: outFile];
+	NSString *library =
+		[LKCompiler linkBitcodeFiles: bitcodeFiles outputDir: dir outputFile: outFile];
+	if (nil == library)
+	{
+		return NO;
+	}
+	// Record the key, so that the library can be shipped in the bundle as
+	// languagekit-cache.so, and install it for the next time that the bundle
+	// is loaded in this account.
+	BOOL inputsFound = YES;
+	[LKBundleCache keyForBundle: bundle inputs: loadBundleInputs(bundle, &inputsFound)];
+	if (inputsFound)
+	{
+		[LKBundleCache writeKeyForLibrary: library forBundle: bundle];
+		[LKBundleCache installLibrary: library forBundle: bundle];
+	}
 	return success;
 }
 
@@ -595,55 +1035,29 @@ static BOOL loadLibraryInPath(NSFileManager *fm, NSString *aLibrary, NSString *b
 	// subsequent runs
 	NSString *plistPath = [bundle pathForResource:@"LKInfo" ofType:@"plist"];
 	NSDictionary *plist = [NSDictionary dictionaryWithContentsOfFile:plistPath];
-	NSArray *frameworks = [plist objectForKey:@"Frameworks"];
-	NSMutableArray *pathsToCheckDateOf = [NSMutableArray array];
-	[pathsToCheckDateOf addObject: plistPath];
 	BOOL success = YES;
 	inDevMode = [[plist objectForKey: @"Development Mode"] boolValue];
-	for (NSString *framework in frameworks)
-	{
-		NSString *path = loadFramework(framework);
-		BOOL isLoaded = (nil != path);
-		success &= isLoaded;
-		if (isLoaded)
-		{
-			[pathsToCheckDateOf addObject: path];
-		}
-	}
+	[LKBundleCache keyForBundle: bundle inputs: loadBundleInputs(bundle, &success)];
 	NSArray *classesDefine = [plist objectForKey: @"Classes"];
 	for (NSString *classeDef in classesDefine)
 	{
 		[LKSymbolTable symbolTableForClass: classeDef];
 	}
 	NSArray *sourceFiles = [plist objectForKey:@"Sources"];
-	for (NSString *source in sourceFiles)
-	{
-		NSString *path = [bundle pathForResource: [source stringByDeletingPathExtension]
-		                                  ofType: [source pathExtension]];
-		BOOL isSourceFound = (nil != path);
-		success &= isSourceFound;
-		if (isSourceFound)
-		{
-			[pathsToCheckDateOf addObject: path];
-		}
-	}
-	NSDate *recentModificationDate = mostRecentModificationDate(pathsToCheckDateOf);
 	// TODO: Specify a set of AST transforms to apply.
-	if (!(success &= loadAnyLibraryForBundle(bundle, recentModificationDate)))
+	if (!(success &= [LKBundleCache loadLibraryForBundle: bundle]))
 	{
 		success = YES;
 		for (NSString *source in sourceFiles)
 		{
 			success &= [self loadScriptNamed: source fromBundle: bundle];
 		}
-		// Spawn a new process to do the background JTL compile.
-		if (success && fork() == 0)
-		{
-			[LKCompiler setDefaultDelegate: nil];
-			// Make the child process really, really, low priority.
-			setpriority(PRIO_PROCESS, 0, 20);
-			[self justTooLateCompileBundle: bundle];
-			exit(0);
+		// Compile a library for next time in the background.
+		if (success)
+		{
+			[[LKCompileQueue sharedQueue] compileBundle: bundle
+			                                   priority: NSOperationQueuePriorityVeryLow
+			                                 completion: nil];
 		}
 	}
 	if (!success)
@@ -711,28 +1125,125 @@ static BOOL loadLibraryInPath(NSFileManager *fm, NSString *aLibrary, NSString *b
 		NSLog(@"Unable to find %@.%@ in bundle %@.", name, extension, bundle);
 		return NO;
 	}
-	return [self compileString:[NSString stringWithContentsOfFile:path encoding:NSUTF8StringEncoding error:NULL]] != nil;
+	NSString *source = [NSString stringWithContentsOfFile:path encoding:NSUTF8StringEncoding error:NULL];
+	if (nil == source)
+	{
+		return NO;
+	}
+	// Reuse the tree from the last time that this script was parsed, if the
+	// script has not changed since.
+	Class parserClass = [[self class] parserClass];
+	LKAST *ast = [LKASTCache cachedASTForSource: source
+	                                     atPath: path
+	                                parserClass: parserClass];
+	if (nil == ast)
+	{
+		id parser = [[parserClass alloc] init];
+		NS_DURING
+			ast = [parser parseString: source];
+		NS_HANDLER
+			emitParseError(localException);
+			return NO;
+		NS_ENDHANDLER
+		[LKASTCache cacheAST: ast
+		           forSource: source
+		              atPath: path
+		         parserClass: parserClass];
+	}
+	if (![self checkAST: ast])
+	{
+		return NO;
+	}
+	[ast compileWithGenerator: defaultJIT()];
+	return YES;
 }
 
 + (BOOL) loadApplicationScriptNamed:(NSString*)fileName
 {
 	return [self loadScriptNamed: fileName fromBundle: [NSBundle mainBundle]];
 }
+/**
+ * Returns the value for a name from the first type database that has one.
+ */
+static const char *TypeDatabaseLookup(NSString *aName, LKTypeDatabaseKind aKind)
+{
+	const char *name = [aName UTF8String];
+	@synchronized(typeDatabases)
+	{
+		for (LKTypeDatabase *db in typeDatabases)
+		{
+			const char *value = [db valueForName: name kind: aKind];
+			if (NULL != value)
+			{
+				return value;
+			}
+		}
+	}
+	return NULL;
+}
 + (NSString*)typesForFunction: (NSString*)functionName
 {
-	return [[[collection functions] objectForKey: functionName] typeEncoding];
+	const char *types = TypeDatabaseLookup(functionName, LKTypeDatabaseFunction);
+	if (NULL != types)
+	{
+		return [NSString stringWithUTF8String: types];
+	}
+	[HeaderLock lock];
+	@try
+	{
+		return [[[collection functions] objectForKey: functionName] typeEncoding];
+	}
+	@finally
+	{
+		[HeaderLock unlock];
+	}
 }
 + (NSString*)typesForGlobal: (NSString*)globalName
 {
-	return [[[collection globals] objectForKey: globalName] typeEncoding];
+	const char *types = TypeDatabaseLookup(globalName, LKTypeDatabaseGlobal);
+	if (NULL != types)
+	{
+		return [NSString stringWithUTF8String: types];
+	}
+	[HeaderLock lock];
+	@try
+	{
+		return [[[collection globals] objectForKey: globalName] typeEncoding];
+	}
+	@finally
+	{
+		[HeaderLock unlock];
+	}
 }
 + (id)valueOf: (NSString*)enumName inEnumeration: (NSString*)anEnumeration
 {
-	if (nil == anEnumeration)
+	const char *value = (nil == anEnumeration) ?
+		TypeDatabaseLookup(enumName, LKTypeDatabaseEnumerationValue) :
+		TypeDatabaseLookup([NSString stringWithFormat: @"%@.%@", anEnumeration, enumName],
+		                   LKTypeDatabaseEnumeration);
+	if (NULL != value)
+	{
+		// An empty value marks an ambiguous name, which SourceCodeKit reports
+		// as an array of candidates.
+		if ('\0' == *value)
+		{
+			return [NSArray array];
+		}
+		return [NSNumber numberWithLongLong: strtoll(value, NULL, 10)];
+	}
+	[HeaderLock lock];
+	@try
+	{
+		if (nil == anEnumeration)
+		{
+			return [[collection enumerationValues] objectForKey: enumName];
+		}
+		return [[[[collection enumerations] objectForKey: anEnumeration] values] objectForKey: enumName];
+	}
+	@finally
 	{
-		return [[collection enumerationValues] objectForKey: enumName];
+		[HeaderLock unlock];
 	}
-	return [[[[collection enumerations] objectForKey: anEnumeration] values] objectForKey: enumName];
 }
 
 - (BOOL) loadApplicationScriptNamed:(NSString*)name
@@ -769,10 +1280,21 @@ static BOOL loadLibraryInPath(NSFileManager *fm, NSString *aLibrary, NSString *b
 		NSArray *scripts = [aBundle pathsForResourcesOfType:extension
 		                                        inDirectory:nil];
 		BOOL success = YES;
-		for (NSString *scriptFile in scripts)
+		Class parserClass = [[self class] parserClass];
+		NSArray *asts = parseAndCheckConcurrently([scripts count],
+			^LKAST*(NSUInteger i)
+			{
+				NSString *script = [NSString stringWithContentsOfFile: [scripts objectAtIndex: i]
+				                                             encoding: NSUTF8StringEncoding
+				                                                error: NULL];
+				return [[parserClass new] parseString: script];
+			},
+			self, transforms, &success);
+		// The JIT is not thread-safe, so generate code serially, with
+		// superclasses first.
+		for (LKAST *ast in asts)
 		{
-			NSString *script = [NSString stringWithContentsOfFile: scriptFile encoding:NSUTF8StringEncoding error:NULL];
-			success &= ([self compileString:script] != nil);
+			[ast compileWithGenerator: defaultJIT()];
 		}
 		return success;
 	}
@@ -821,9 +1343,14 @@ static BOOL loadLibraryInPath(NSFileManager *fm, NSString *aLibrary, NSString *b
 	{
 		errorDelegate = DefaultDelegate;
 	}
-	return [errorDelegate compiler: [threadDictionary objectForKey: @"LKCompilerContext"]
-	              generatedWarning: aWarning
-	                       details: info];
+	// Files may be checked on several threads at once.  Delegates are called
+	// one at a time, so that they do not need to be thread-safe.
+	@synchronized(errorDelegate)
+	{
+		return [errorDelegate compiler: [threadDictionary objectForKey: @"LKCompilerContext"]
+		              generatedWarning: aWarning
+		                       details: info];
+	}
 }
 + (BOOL)reportError: (NSString*)aWarning
             details: (NSDictionary*)info
@@ -835,9 +1362,16 @@ static BOOL loadLibraryInPath(NSFileManager *fm, NSString *aLibrary, NSString *b
 	{
 		errorDelegate = DefaultDelegate;
 	}
-    return [errorDelegate compiler: [threadDictionary objectForKey: @"LKCompilerContext"]
-	                generatedError: aWarning
-	                       details: info];
+	@synchronized(errorDelegate)
+	{
+		return [errorDelegate compiler: [threadDictionary objectForKey: @"LKCompilerContext"]
+		                generatedError: aWarning
+		                       details: info];
+	}
+}
++ (void)reportParseError: (NSException*)anException
+{
+	emitParseError(anException);
 }
 + (Class) parserClass
 {
@@ -861,6 +1395,29 @@ static BOOL loadLibraryInPath(NSFileManager *fm, NSString *aLibrary, NSString *b
 }
 
 
-// Replaced in category if a bundle supports JTL compilation, otherwise does nothing
-+ (void) justTooLateCompileBundle: (NSBundle*)aBundle {}
+// Replaced in category if a bundle supports JTL compilation.
++ (void) justTooLateCompileBundle: (NSBundle*)aBundle
+{
+	// Libraries can only be built if a code generator provides the linker.
+	if (![self respondsToSelector: @selector(linkBitcodeFiles:outputDir:outputFile:)])
+	{
+		return;
+	}
+	NSFileManager *fm = [NSFileManager defaultManager];
+	NSString *dir = [NSTemporaryDirectory() stringByAppendingPathComponent:
+		[@"LanguageKit-" stringByAppendingString:
+			[[NSProcessInfo processInfo] globallyUniqueString]]];
+	if (![fm createDirectoryAtPath: dir
+	   withIntermediateDirectories: YES
+	                    attributes: nil
+	                         error: NULL])
+	{
+		return;
+	}
+	// This installs the library in LKBundleCache, so the temporary copy is
+	// not needed afterwards.
+	[self compileLanguageKitBundle: aBundle
+	                        output: [dir stringByAppendingPathComponent: @"languagekit-cache.so"]];
+	[fm removeItemAtPath: dir error: NULL];
+}
 @end
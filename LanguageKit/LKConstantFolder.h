@@ -0,0 +1,27 @@
+#import <LanguageKit/LKASTVisitor.h>
+
+/**
+ * AST transform that evaluates constant expressions at compile time.
+ *
+ * Integer arithmetic (+, -, *, /, mod:, min: and max:) and comparisons whose
+ * operands are integer literals are replaced by their results, which are the
+ * same as the results of SmallInt and BigInt arithmetic at run time.
+ * Operations that would raise an exception, such as division by zero, are left
+ * alone.  Conditionals (ifTrue:, ifFalse:, ifNil: and their combinations, and
+ * LKIfStatement nodes) whose condition is constant are replaced by the branch
+ * that would be taken.  Statements with no effect, whose values are not used,
+ * are removed, as are statements that can not be reached.
+ *
+ * inject:into: sends whose block uses its accumulator argument only as the
+ * receiver of the +, - or * that it returns are replaced by
+ * inject:accumulating: sends, which may run the reduction with an
+ * LKBigAccumulator that is updated in place.
+ *
+ * Blocks that are removed no longer reference the variables of enclosing
+ * scopes, so the referencingScopes counts of those variables are reduced.
+ *
+ * The folder can share a traversal with other transforms that return YES from
+ * +canFuse.  The compiler applies this transform by default.
+ */
+@interface LKConstantFolder : LKASTVisitor
+@end
@@ -0,0 +1,571 @@
+#import "LanguageKit.h"
+#import "LKConstantFolder.h"
+#include <gmp.h>
+
+/**
+ * The largest integer that is a SmallInt on every platform.  Larger integers
+ * are not folded as conditions, because BigInts convert to BOOL differently.
+ */
+#define LKSmallIntMax (INTPTR_MAX >> 3)
+
+/** Selectors of integer operations that can be evaluated at compile time. */
+static NSSet *FoldableSelectors;
+/** Selectors of conditionals that test their receiver for truth. */
+static NSSet *TruthSelectors;
+/** Selectors of operations that an accumulator can perform in place. */
+static NSSet *AccumulatingSelectors;
+
+/**
+ * Collects the blocks in a tree.
+ */
+@interface LKBlockCollector : LKASTVisitor
+{
+	@public
+	NSMutableArray *blocks;
+}
+@end
+@implementation LKBlockCollector
+- (LKAST*) visitBlockExpr: (LKBlockExpr*)aBlock
+{
+	[blocks addObject: aBlock];
+	return aBlock;
+}
+@end
+
+/**
+ * Reduces the referencingScopes counts of the variables referenced by blocks
+ * in a tree that is being removed.
+ */
+static void releaseReferences(LKAST *aNode)
+{
+	LKBlockCollector *collector = [LKBlockCollector new];
+	collector->blocks = [NSMutableArray array];
+	if ([aNode isKindOfClass: [LKBlockExpr class]])
+	{
+		[collector->blocks addObject: aNode];
+	}
+	[aNode visitWithVisitor: collector];
+	for (LKBlockExpr *block in collector->blocks)
+	{
+		LKSymbolTable *table = [block symbols];
+		NSDictionary *enclosing = [[table enclosingScope] symbols];
+		for (LKSymbol *external in [table byRefVariables])
+		{
+			LKSymbol *referenced = [enclosing objectForKey: [external name]];
+			if ([referenced referencingScopes] > 0)
+			{
+				[referenced setReferencingScopes: [referenced referencingScopes] - 1];
+			}
+		}
+	}
+}
+
+/**
+ * Returns the name of the variable that a reference refers to.
+ */
+static NSString *referencedName(LKDeclRef *aReference)
+{
+	id symbol = [aReference symbol];
+	return [symbol isKindOfClass: [NSString class]] ? symbol : [symbol name];
+}
+
+/**
+ * Counts the references to a named variable in a tree.
+ */
+@interface LKReferenceCounter : LKASTVisitor
+{
+	@public
+	NSString *name;
+	NSUInteger count;
+}
+@end
+@implementation LKReferenceCounter
+- (LKAST*) visitDeclRef: (LKDeclRef*)aReference
+{
+	if ([name isEqualToString: referencedName(aReference)])
+	{
+		count++;
+	}
+	return aReference;
+}
+@end
+
+/**
+ * Returns an inject:accumulating: send to use in place of an inject:into: send
+ * whose block uses its accumulator only as the receiver of the arithmetic
+ * operation that it returns.  The block can then be given an accumulator that
+ * the operation updates in place, because nothing else in the block can see
+ * it.  Returns nil if the send can not be rewritten.
+ */
+static LKMessageSend *accumulatingReduction(LKMessageSend *aMessage)
+{
+	if (![@"inject:into:" isEqualToString: [aMessage selector]] ||
+	    [[aMessage target] isKindOfClass: [LKSuperRef class]])
+	{
+		return nil;
+	}
+	LKBlockExpr *block = [[aMessage arguments] objectAtIndex: 1];
+	if (![block isKindOfClass: [LKBlockExpr class]] ||
+	    ([[block arguments] count] != 2))
+	{
+		return nil;
+	}
+	LKMessageSend *operation = [[block statements] lastObject];
+	if (![operation isKindOfClass: [LKMessageSend class]] ||
+	    ![AccumulatingSelectors containsObject: [operation selector]] ||
+	    ![[operation target] isKindOfClass: [LKDeclRef class]])
+	{
+		return nil;
+	}
+	LKReferenceCounter *counter = [LKReferenceCounter new];
+	counter->name = [[[block arguments] objectAtIndex: 1] name];
+	if (![counter->name isEqualToString: referencedName([operation target])])
+	{
+		return nil;
+	}
+	[block visitWithVisitor: counter];
+	if (counter->count != 1)
+	{
+		return nil;
+	}
+	LKMessageSend *reduction =
+		[LKMessageSend messageWithSelectorName: @"inject:accumulating:"
+		                             arguments: [aMessage arguments]];
+	[reduction setTarget: [aMessage target]];
+	[[aMessage target] setParent: reduction];
+	for (LKAST *argument in [aMessage arguments])
+	{
+		[argument setParent: reduction];
+	}
+	return reduction;
+}
+
+/**
+ * Evaluates an integer operation.  Returns NO if the operation can not be
+ * evaluated at compile time.
+ */
+static BOOL evaluate(NSString *aSelector, mpz_t result, mpz_t lhs, mpz_t rhs)
+{
+	int cmp = mpz_cmp(lhs, rhs);
+	if ([@"plus:" isEqualToString: aSelector])
+	{
+		mpz_add(result, lhs, rhs);
+	}
+	else if ([@"sub:" isEqualToString: aSelector])
+	{
+		mpz_sub(result, lhs, rhs);
+	}
+	else if ([@"mul:" isEqualToString: aSelector])
+	{
+		mpz_mul(result, lhs, rhs);
+	}
+	else if ([@"div:" isEqualToString: aSelector])
+	{
+		// SmallInt and BigInt division both truncate.
+		if (0 == mpz_sgn(rhs))
+		{
+			return NO;
+		}
+		mpz_tdiv_q(result, lhs, rhs);
+	}
+	else if ([@"mod:" isEqualToString: aSelector])
+	{
+		// SmallInts use C's remainder and BigInts use the modulus, which only
+		// agree when both operands are positive.
+		if ((mpz_sgn(lhs) < 0) || (mpz_sgn(rhs) <= 0))
+		{
+			return NO;
+		}
+		mpz_mod(result, lhs, rhs);
+	}
+	else if ([@"min:" isEqualToString: aSelector])
+	{
+		mpz_set(result, (cmp <= 0) ? lhs : rhs);
+	}
+	else if ([@"max:" isEqualToString: aSelector])
+	{
+		mpz_set(result, (cmp >= 0) ? lhs : rhs);
+	}
+	else if ([@"isLessThan:" isEqualToString: aSelector])
+	{
+		mpz_set_si(result, cmp < 0);
+	}
+	else if ([@"isGreaterThan:" isEqualToString: aSelector])
+	{
+		mpz_set_si(result, cmp > 0);
+	}
+	else if ([@"isLessThanOrEqualTo:" isEqualToString: aSelector])
+	{
+		mpz_set_si(result, cmp <= 0);
+	}
+	else if ([@"isGreaterThanOrEqualTo:" isEqualToString: aSelector])
+	{
+		mpz_set_si(result, cmp >= 0);
+	}
+	else if ([@"isEqual:" isEqualToString: aSelector])
+	{
+		mpz_set_si(result, 0 == cmp);
+	}
+	else
+	{
+		return NO;
+	}
+	return YES;
+}
+
+/**
+ * Sets aValue, which must be initialised, to the value of an integer constant
+ * expression.  Returns NO if the expression is not constant.
+ */
+static BOOL integerValue(LKAST *anExpression, mpz_t aValue)
+{
+	if ([anExpression isKindOfClass: [LKFloatLiteral class]])
+	{
+		return NO;
+	}
+	if ([anExpression isKindOfClass: [LKNumberLiteral class]])
+	{
+		return 0 == mpz_set_str(aValue, [[anExpression description] UTF8String], 10);
+	}
+	if (![anExpression isKindOfClass: [LKMessageSend class]])
+	{
+		return NO;
+	}
+	LKMessageSend *message = (LKMessageSend*)anExpression;
+	NSArray *arguments = [message arguments];
+	if (([arguments count] != 1) ||
+	    ![FoldableSelectors containsObject: [message selector]])
+	{
+		return NO;
+	}
+	mpz_t lhs, rhs;
+	mpz_init(lhs);
+	mpz_init(rhs);
+	BOOL isConstant = integerValue([message target], lhs) &&
+		integerValue([arguments objectAtIndex: 0], rhs) &&
+		evaluate([message selector], aValue, lhs, rhs);
+	mpz_clear(lhs);
+	mpz_clear(rhs);
+	return isConstant;
+}
+
+/**
+ * Returns 1 if a condition is a constant that is true, 0 if it is a constant
+ * that is false, or -1 if it is not constant.
+ */
+static int constantTruth(LKAST *aCondition)
+{
+	mpz_t value;
+	mpz_init(value);
+	int truth = -1;
+	if (integerValue(aCondition, value) && mpz_fits_slong_p(value) &&
+	    (labs(mpz_get_si(value)) <= LKSmallIntMax))
+	{
+		truth = (0 != mpz_sgn(value));
+	}
+	mpz_clear(value);
+	return truth;
+}
+
+/**
+ * If a node is a conditional message whose receiver is constant, returns YES
+ * and sets *anIndex to the index of the block argument that is evaluated, or
+ * to NSNotFound if the result is nil.  The ifNil: family follow the
+ * interpreter.
+ */
+static BOOL constantConditional(LKAST *aNode, NSUInteger *anIndex)
+{
+	if (![aNode isKindOfClass: [LKMessageSend class]])
+	{
+		return NO;
+	}
+	LKMessageSend *message = (LKMessageSend*)aNode;
+	NSString *selector = [message selector];
+	NSArray *arguments = [message arguments];
+	if ([arguments count] == 0)
+	{
+		return NO;
+	}
+	for (LKAST *argument in arguments)
+	{
+		if (![argument isKindOfClass: [LKBlockExpr class]])
+		{
+			return NO;
+		}
+	}
+	LKAST *receiver = [message target];
+	BOOL isNil = [receiver isKindOfClass: [LKNilRef class]];
+	BOOL isLiteral = [receiver isKindOfClass: [LKLiteral class]];
+	NSUInteger none = NSNotFound;
+	if ([TruthSelectors containsObject: selector])
+	{
+		// Messages to nil return nil.
+		int truth = isNil ? -1 : constantTruth(receiver);
+		if (isNil)
+		{
+			*anIndex = none;
+			return YES;
+		}
+		if (truth < 0)
+		{
+			return NO;
+		}
+		BOOL first = [selector hasPrefix: @"ifTrue:"] ? truth : !truth;
+		if ([arguments count] == 2)
+		{
+			*anIndex = first ? 0 : 1;
+		}
+		else
+		{
+			*anIndex = first ? 0 : none;
+		}
+		return YES;
+	}
+	if (!(isNil || isLiteral))
+	{
+		return NO;
+	}
+	if ([@"ifNil:ifNotNil:" isEqualToString: selector])
+	{
+		*anIndex = isNil ? 0 : 1;
+	}
+	else if ([@"ifNotNil:ifNil:" isEqualToString: selector])
+	{
+		*anIndex = isNil ? 1 : 0;
+	}
+	else if ([@"ifNotNil:" isEqualToString: selector])
+	{
+		*anIndex = isNil ? none : 0;
+	}
+	else if ([@"ifNil:" isEqualToString: selector] && isNil)
+	{
+		*anIndex = 0;
+	}
+	else
+	{
+		return NO;
+	}
+	return YES;
+}
+
+/**
+ * Returns YES if evaluating a node has no effect.
+ */
+static BOOL hasNoEffect(LKAST *aNode)
+{
+	if ([aNode isKindOfClass: [LKLiteral class]] ||
+	    [aNode isKindOfClass: [LKDeclRef class]] ||
+	    [aNode isKindOfClass: [LKBlockExpr class]])
+	{
+		return YES;
+	}
+	if ([aNode isKindOfClass: [LKArrayExpr class]])
+	{
+		for (LKAST *element in [(LKArrayExpr*)aNode elements])
+		{
+			if (!hasNoEffect(element))
+			{
+				return NO;
+			}
+		}
+		return YES;
+	}
+	if ([aNode isKindOfClass: [LKCompare class]])
+	{
+		return hasNoEffect([(LKCompare*)aNode leftExpression]) &&
+			hasNoEffect([(LKCompare*)aNode rightExpression]);
+	}
+	NSUInteger taken;
+	if (constantConditional(aNode, &taken))
+	{
+		return NSNotFound == taken;
+	}
+	mpz_t value;
+	mpz_init(value);
+	BOOL isConstant = integerValue(aNode, value);
+	mpz_clear(value);
+	return isConstant;
+}
+
+/**
+ * Removes constant branches, statements with no effect and statements that
+ * can not be reached from a list of statements belonging to a node.  If the
+ * value of the last statement is used, then that statement is kept.  Returns
+ * YES if the list was changed.
+ */
+static BOOL simplifyStatements(NSMutableArray *statements,
+                               LKAST *anOwner,
+                               BOOL isValueUsed)
+{
+	BOOL changed = NO;
+	NSUInteger i = 0;
+	while (i < [statements count])
+	{
+		LKAST *statement = [statements objectAtIndex: i];
+		BOOL isLast = (i + 1 == [statements count]);
+		if ([statement isKindOfClass: [LKIfStatement class]])
+		{
+			LKIfStatement *ifStatement = (LKIfStatement*)statement;
+			int truth = constantTruth([ifStatement condition]);
+			if (truth >= 0)
+			{
+				NSArray *taken = truth ? [ifStatement thenStatements] :
+					[ifStatement elseStatements];
+				for (LKAST *skipped in (truth ? [ifStatement elseStatements] :
+				                                [ifStatement thenStatements]))
+				{
+					releaseReferences(skipped);
+				}
+				changed = YES;
+				[statements removeObjectAtIndex: i];
+				[statements insertObjects: taken
+				                atIndexes: [NSIndexSet indexSetWithIndexesInRange: NSMakeRange(i, [taken count])]];
+				for (LKAST *s in taken)
+				{
+					[s setParent: anOwner];
+				}
+				// An if statement with an empty branch has the value nil.
+				if (isLast && isValueUsed && ([taken count] == 0))
+				{
+					LKAST *nilRef = [LKNilRef builtin];
+					[nilRef setParent: anOwner];
+					[statements addObject: nilRef];
+				}
+				// Look at the first of the inserted statements next.
+				continue;
+			}
+		}
+		if (!(isLast && isValueUsed) && hasNoEffect(statement))
+		{
+			releaseReferences(statement);
+			[statements removeObjectAtIndex: i];
+			changed = YES;
+			continue;
+		}
+		i++;
+		if ([statement isBranch])
+		{
+			while (i < [statements count])
+			{
+				releaseReferences([statements objectAtIndex: i]);
+				[statements removeObjectAtIndex: i];
+				changed = YES;
+			}
+		}
+	}
+	return changed;
+}
+
+@implementation LKConstantFolder
+/**
+ * Constant expressions are evaluated from the whole subtree, not from
+ * children that have already been folded, so the folder does not need to see
+ * the tree after the other transforms in its traversal.
+ */
++ (BOOL) canFuse
+{
+	return YES;
+}
++ (void) initialize
+{
+	if (self != [LKConstantFolder class]) { return; }
+	FoldableSelectors = [[NSSet alloc] initWithObjects: @"plus:", @"sub:",
+		@"mul:", @"div:", @"mod:", @"min:", @"max:", @"isLessThan:",
+		@"isGreaterThan:", @"isLessThanOrEqualTo:", @"isGreaterThanOrEqualTo:",
+		@"isEqual:", nil];
+	TruthSelectors = [[NSSet alloc] initWithObjects: @"ifTrue:", @"ifFalse:",
+		@"ifTrue:ifFalse:", @"ifFalse:ifTrue:", nil];
+	AccumulatingSelectors = [[NSSet alloc] initWithObjects: @"plus:", @"sub:",
+		@"mul:", nil];
+}
+- (LKAST*) visitMethod: (LKMethod*)aMethod
+{
+	// Methods without a return statement return self, so the value of the
+	// last statement is not used.
+	if (simplifyStatements([aMethod statements], aMethod, NO))
+	{
+		[self didChangeNode: aMethod];
+	}
+	return aMethod;
+}
+- (LKAST*) visitBlockExpr: (LKBlockExpr*)aBlock
+{
+	if (simplifyStatements([aBlock statements], aBlock, YES))
+	{
+		[self didChangeNode: aBlock];
+	}
+	return aBlock;
+}
+- (LKAST*) visitIfStatement: (LKIfStatement*)anIfStatement
+{
+	BOOL changed =
+		simplifyStatements([anIfStatement thenStatements], anIfStatement, YES);
+	changed |=
+		simplifyStatements([anIfStatement elseStatements], anIfStatement, YES);
+	if (changed)
+	{
+		[self didChangeNode: anIfStatement];
+	}
+	return anIfStatement;
+}
+- (LKAST*) visitLoop: (LKLoop*)aLoop
+{
+	BOOL changed = simplifyStatements([aLoop loopInitStatements], aLoop, NO);
+	changed |= simplifyStatements([aLoop statements], aLoop, NO);
+	changed |= simplifyStatements([aLoop updateStatements], aLoop, NO);
+	if (changed)
+	{
+		[self didChangeNode: aLoop];
+	}
+	return aLoop;
+}
+- (LKAST*) visitMessageSend: (LKMessageSend*)aMessage
+{
+	LKAST *replacement = nil;
+	NSUInteger taken;
+	if (constantConditional(aMessage, &taken))
+	{
+		NSArray *arguments = [aMessage arguments];
+		for (NSUInteger i=0 ; i<[arguments count] ; i++)
+		{
+			if (i != taken)
+			{
+				releaseReferences([arguments objectAtIndex: i]);
+			}
+		}
+		if (NSNotFound == taken)
+		{
+			replacement = [LKNilRef builtin];
+		}
+		else
+		{
+			LKMessageSend *value = [LKMessageSend messageWithSelectorName: @"value"];
+			[value setTarget: [arguments objectAtIndex: taken]];
+			replacement = value;
+		}
+	}
+	else
+	{
+		mpz_t value;
+		mpz_init(value);
+		if (integerValue(aMessage, value))
+		{
+			char *str = malloc(mpz_sizeinbase(value, 10) + 2);
+			mpz_get_str(str, 10, value);
+			replacement = [LKNumberLiteral literalFromString: [NSString stringWithUTF8String: str]];
+			free(str);
+		}
+		mpz_clear(value);
+	}
+	if (nil == replacement)
+	{
+		replacement = accumulatingReduction(aMessage);
+	}
+	if (nil == replacement)
+	{
+		return aMessage;
+	}
+	[replacement setParent: [aMessage parent]];
+	return replacement;
+}
+@end
@@ -0,0 +1,207 @@
+#import "LanguageKit.h"
+#import "LKASTVisitor.h"
+
+/**
+ * Selectors that the integer classes in the LanguageKit runtime implement
+ * without keeping their block arguments.
+ */
+static NSSet *IntegerSelectors;
+/**
+ * Selectors that LanguageKit implements on blocks without keeping the
+ * receiver or its block arguments.
+ */
+static NSSet *ReceiverSelectors;
+
+/**
+ * Collects the block expressions in a tree.  Enclosing blocks are collected
+ * before the blocks that they contain.
+ */
+@interface LKBlockLiteralCollector : LKASTVisitor
+{
+	@public
+	NSMutableArray *blocks;
+}
+@end
+@implementation LKBlockLiteralCollector
++ (void) initialize
+{
+	if (self != [LKBlockLiteralCollector class]) { return; }
+	IntegerSelectors = [[NSSet alloc] initWithObjects: @"ifTrue:",
+		@"ifFalse:", @"ifTrue:ifFalse:", @"ifFalse:ifTrue:", @"and:", @"or:",
+		@"timesRepeat:", @"to:do:", @"to:by:do:", nil];
+	ReceiverSelectors = [[NSSet alloc] initWithObjects: @"value", @"value:",
+		@"value:value:", @"value:value:value:", @"whileTrue:", nil];
+}
+- (LKAST*) visitBlockExpr: (LKBlockExpr*)aBlock
+{
+	[blocks addObject: aBlock];
+	return aBlock;
+}
+@end
+
+/**
+ * Finds references to the block object in a tree.
+ */
+@interface LKBlockSelfRefFinder : LKASTVisitor
+{
+	@public
+	BOOL found;
+}
+@end
+@implementation LKBlockSelfRefFinder
+- (LKAST*) visitDeclRef: (LKDeclRef*)aRef
+{
+	if ([aRef isKindOfClass: [LKBlockSelfRef class]])
+	{
+		found = YES;
+	}
+	return aRef;
+}
+@end
+
+/**
+ * Collects the names of the variables from enclosing scopes that are assigned
+ * to in a tree.
+ */
+@interface LKExternalAssignmentCollector : LKASTVisitor
+{
+	@public
+	NSMutableSet *names;
+}
+@end
+@implementation LKExternalAssignmentCollector
+- (LKAST*) visitAssignExpr: (LKAssignExpr*)anAssignment
+{
+	id symbol = [[anAssignment target] symbol];
+	if ([symbol isKindOfClass: [LKSymbol class]] &&
+	    (LKSymbolScopeExternal == [symbol scope]))
+	{
+		[names addObject: [symbol name]];
+	}
+	return anAssignment;
+}
+@end
+
+/**
+ * Returns whether a message is implemented by LanguageKit without keeping the
+ * block that is its receiver or one of its arguments.  The receiver must be
+ * known to be a block literal or an integer, because any other object may
+ * implement the message differently.  The arguments of the value messages are
+ * passed to the receiver's code, which may keep them.
+ */
+static BOOL isKnownNonEscapingMessage(LKMessageSend *aMessage, LKBlockExpr *aBlock)
+{
+	NSString *selector = [aMessage selector];
+	LKAST *target = [aMessage target];
+	if ([target isKindOfClass: [LKBlockExpr class]])
+	{
+		return [ReceiverSelectors containsObject: selector] &&
+			((target == aBlock) || [@"whileTrue:" isEqualToString: selector]);
+	}
+	switch ([[target inferredType] kind])
+	{
+		case LKInferredKindInteger:
+		case LKInferredKindSmallInt:
+		case LKInferredKindBool:
+			return [IntegerSelectors containsObject: selector];
+		default:
+			return NO;
+	}
+}
+
+/**
+ * Returns whether a block is only called while the scope that creates it is
+ * active.  This is the case for block literals that are the receiver or an
+ * argument of a message that LanguageKit implements by calling them and then
+ * forgetting them, unless they refer to the block object, which could then be
+ * stored anywhere.
+ */
+static BOOL isNonEscapingBlock(LKBlockExpr *aBlock)
+{
+	LKAST *parent = [aBlock parent];
+	if (![parent isKindOfClass: [LKMessageSend class]])
+	{
+		return NO;
+	}
+	LKMessageSend *message = (LKMessageSend*)parent;
+	if ((([message target] != aBlock) &&
+	     (NSNotFound == [[message arguments] indexOfObjectIdenticalTo: aBlock])) ||
+	    !isKnownNonEscapingMessage(message, aBlock))
+	{
+		return NO;
+	}
+	return ![aBlock isSelfReferencing];
+}
+
+@implementation LKAST (EscapeAnalysis)
+- (void) analyseEscapes
+{
+	LKBlockLiteralCollector *collector = [LKBlockLiteralCollector new];
+	collector->blocks = [NSMutableArray array];
+	if ([self isKindOfClass: [LKBlockExpr class]])
+	{
+		[collector->blocks addObject: self];
+	}
+	[self visitWithVisitor: collector];
+	for (LKBlockExpr *block in collector->blocks)
+	{
+		LKBlockSelfRefFinder *finder = [LKBlockSelfRefFinder new];
+		[block visitWithVisitor: finder];
+		[block setSelfReferencing: finder->found];
+	}
+	for (LKBlockExpr *block in collector->blocks)
+	{
+		[block setNonEscaping: isNonEscapingBlock(block)];
+	}
+	// Find the symbol that declares each variable that a block references.
+	// The variable must be in byref storage if the referencing block, or any
+	// block between it and the declaring scope, escapes, or if the block
+	// assigns to it.
+	NSMapTable *declarations = [NSMapTable strongToStrongObjectsMapTable];
+	NSMutableSet *escaping = [NSMutableSet set];
+	for (LKBlockExpr *block in collector->blocks)
+	{
+		LKSymbolTable *table = [block symbols];
+		LKExternalAssignmentCollector *assignments = [LKExternalAssignmentCollector new];
+		assignments->names = [NSMutableSet set];
+		[block visitWithVisitor: assignments];
+		for (LKSymbol *external in [table byRefVariables])
+		{
+			NSString *name = [external name];
+			BOOL escapes = ![block isNonEscaping] ||
+				[assignments->names containsObject: name];
+			LKSymbol *declaration = nil;
+			for (LKSymbolTable *scope = [table enclosingScope] ;
+			     nil != scope ; scope = [scope enclosingScope])
+			{
+				LKSymbol *symbol = [[scope symbols] objectForKey: name];
+				if (nil == symbol) { break; }
+				if (LKSymbolScopeExternal != [symbol scope])
+				{
+					declaration = symbol;
+					break;
+				}
+				id intermediate = [scope declarationScope];
+				if ([intermediate isKindOfClass: [LKBlockExpr class]] &&
+				    ![intermediate isNonEscaping])
+				{
+					escapes = YES;
+				}
+			}
+			if (nil == declaration) { continue; }
+			[declarations setObject: declaration forKey: external];
+			if (escapes)
+			{
+				[escaping addObject: declaration];
+			}
+		}
+	}
+	for (LKSymbol *external in declarations)
+	{
+		LKSymbol *declaration = [declarations objectForKey: external];
+		BOOL nonEscaping = ![escaping containsObject: declaration];
+		[declaration setNonEscaping: nonEscaping];
+		[external setNonEscaping: nonEscaping];
+	}
+}
+@end
@@ -9,6 +9,18 @@
                                        then:(NSArray*)thenClause
                                        else:(NSArray*)elseClause;
 + (LKIfStatement*) ifStatementWithCondition:(LKAST*) aCondition;
+/**
+ * Returns the condition.
+ */
+- (LKAST*)condition;
+/**
+ * Returns the statements executed when the condition is true.
+ */
+- (NSMutableArray*)thenStatements;
+/**
+ * Returns the statements executed when the condition is false.
+ */
+- (NSMutableArray*)elseStatements;
 - (void)setElseStatements:(NSArray*)elseClause;
 - (void)setThenStatements:(NSArray*)thenClause;
 @end
@@ -48,6 +48,21 @@ static void *emitBlock(id<LKCodeGenerator> aGenerator,
 	return bb;
 }
 
+- (LKAST*) condition
+{
+	return condition;
+}
+
+- (NSMutableArray*) thenStatements
+{
+	return thenStatements;
+}
+
+- (NSMutableArray*) elseStatements
+{
+	return elseStatements;
+}
+
 - (void) setElseStatements: (NSArray*)elseClause
 {
 	elseStatements = [elseClause mutableCopy];
@@ -0,0 +1,105 @@
+#import <Foundation/Foundation.h>
+
+/**
+ * The kinds of value that type inference distinguishes.  The numeric kinds
+ * are ordered from the most general to the most specific: every BOOL is a
+ * SmallInt, and every SmallInt is an integer.
+ */
+typedef enum
+{
+	/** Nothing is known about the value. */
+	LKInferredKindUnknown = 0,
+	/** The value is always nil. */
+	LKInferredKindNil,
+	/**
+	 * An object.  If the class name is not nil, then the object is an instance
+	 * of that class or of one of its subclasses.
+	 */
+	LKInferredKindObject,
+	/** The class object named by the class name. */
+	LKInferredKindClass,
+	/** An integer, stored as a SmallInt or as a BigInt. */
+	LKInferredKindInteger,
+	/** An integer that always fits in a SmallInt. */
+	LKInferredKindSmallInt,
+	/** A BOOL, stored as the SmallInt 0 or 1. */
+	LKInferredKindBool,
+	/** A floating point value. */
+	LKInferredKindFloat
+} LKInferredKind;
+
+/**
+ * The type inferred for a value by -[LKAST inferTypes].  Types are immutable,
+ * and the types of the numeric kinds are shared.
+ */
+@interface LKInferredType : NSObject
+{
+	LKInferredKind kind;
+	NSString *className;
+	BOOL nonNil;
+}
+/**
+ * Returns the type of a value about which nothing is known.
+ */
++ (LKInferredType*) unknownType;
+/**
+ * Returns the type of nil.
+ */
++ (LKInferredType*) nilType;
+/**
+ * Returns the type of an instance of the named class, or of any object if the
+ * name is nil.
+ */
++ (LKInferredType*) objectTypeWithClassName: (NSString*)aClass
+                                     nonNil: (BOOL)isNonNil;
+/**
+ * Returns the type of the named class object.
+ */
++ (LKInferredType*) classTypeWithClassName: (NSString*)aClass;
+/**
+ * Returns the type of an integer that may be a SmallInt or a BigInt.
+ */
++ (LKInferredType*) integerType;
+/**
+ * Returns the type of an integer that fits in a SmallInt.
+ */
++ (LKInferredType*) smallIntType;
+/**
+ * Returns the type of a BOOL.
+ */
++ (LKInferredType*) boolType;
+/**
+ * Returns the type of a floating point value.
+ */
++ (LKInferredType*) floatType;
+/**
+ * Returns the type of a value of the specified Objective-C type once it has
+ * been boxed for use in LanguageKit code.  Object types are unknown, because
+ * the encoding does not say which class they are.
+ */
++ (LKInferredType*) typeForEncoding: (const char*)anEncoding;
+/**
+ * Returns the kind of this type.
+ */
+- (LKInferredKind) kind;
+/**
+ * Returns the name of the class for object and class types, or nil if the
+ * class is not known.
+ */
+- (NSString*) className;
+/**
+ * Returns YES if values of this type are never nil.  Numeric values are never
+ * nil.
+ */
+- (BOOL) isNonNil;
+/**
+ * Returns YES if values of this type are always integers or floating point
+ * values.
+ */
+- (BOOL) isNumeric;
+/**
+ * Returns the most specific type that includes every value of both the
+ * receiver and the argument.  Merging with nil returns the receiver.
+ */
+- (LKInferredType*) typeByMergingWithType: (LKInferredType*)aType;
+@end
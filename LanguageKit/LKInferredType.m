@@ -0,0 +1,241 @@
+#import "LKInferredType.h"
+#import <objc/runtime.h>
+
+static LKInferredType *UnknownType;
+static LKInferredType *NilType;
+static LKInferredType *IntegerType;
+static LKInferredType *SmallIntType;
+static LKInferredType *BoolType;
+static LKInferredType *FloatType;
+
+/**
+ * Returns the name of the most specific class that both named classes inherit
+ * from, or nil if either class does not exist yet.
+ */
+static NSString *commonSuperclassName(NSString *aClass, NSString *anotherClass)
+{
+	Class cls = NSClassFromString(aClass);
+	Class other = NSClassFromString(anotherClass);
+	if ((Nil == cls) || (Nil == other))
+	{
+		return nil;
+	}
+	for (Class c = cls ; Nil != c ; c = class_getSuperclass(c))
+	{
+		for (Class o = other ; Nil != o ; o = class_getSuperclass(o))
+		{
+			if (c == o)
+			{
+				return NSStringFromClass(c);
+			}
+		}
+	}
+	return nil;
+}
+
+static BOOL isIntegerKind(LKInferredKind aKind)
+{
+	return (aKind >= LKInferredKindInteger) && (aKind <= LKInferredKindBool);
+}
+
+@implementation LKInferredType
+- (id) initWithKind: (LKInferredKind)aKind
+          className: (NSString*)aClass
+             nonNil: (BOOL)isNonNil
+{
+	self = [super init];
+	if (nil == self)
+	{
+		return nil;
+	}
+	kind = aKind;
+	className = aClass;
+	nonNil = isNonNil;
+	return self;
+}
++ (void) initialize
+{
+	if (self != [LKInferredType class]) { return; }
+	UnknownType = [[self alloc] initWithKind: LKInferredKindUnknown
+	                               className: nil
+	                                  nonNil: NO];
+	NilType = [[self alloc] initWithKind: LKInferredKindNil
+	                           className: nil
+	                              nonNil: NO];
+	IntegerType = [[self alloc] initWithKind: LKInferredKindInteger
+	                               className: nil
+	                                  nonNil: YES];
+	SmallIntType = [[self alloc] initWithKind: LKInferredKindSmallInt
+	                                className: nil
+	                                   nonNil: YES];
+	BoolType = [[self alloc] initWithKind: LKInferredKindBool
+	                            className: nil
+	                               nonNil: YES];
+	FloatType = [[self alloc] initWithKind: LKInferredKindFloat
+	                             className: nil
+	                                nonNil: YES];
+}
++ (LKInferredType*) unknownType { return UnknownType; }
++ (LKInferredType*) nilType { return NilType; }
++ (LKInferredType*) integerType { return IntegerType; }
++ (LKInferredType*) smallIntType { return SmallIntType; }
++ (LKInferredType*) boolType { return BoolType; }
++ (LKInferredType*) floatType { return FloatType; }
++ (LKInferredType*) objectTypeWithClassName: (NSString*)aClass
+                                     nonNil: (BOOL)isNonNil
+{
+	return [[self alloc] initWithKind: LKInferredKindObject
+	                        className: aClass
+	                           nonNil: isNonNil];
+}
++ (LKInferredType*) classTypeWithClassName: (NSString*)aClass
+{
+	return [[self alloc] initWithKind: LKInferredKindClass
+	                        className: aClass
+	                           nonNil: YES];
+}
++ (LKInferredType*) typeForEncoding: (const char*)anEncoding
+{
+	if (NULL == anEncoding)
+	{
+		return UnknownType;
+	}
+	// Skip type qualifiers.
+	while (('\0' != *anEncoding) && (NULL != strchr("rnNoORV", *anEncoding)))
+	{
+		anEncoding++;
+	}
+	switch (*anEncoding)
+	{
+		case 'B':
+			return BoolType;
+		case 'c': case 'C': case 's': case 'S':
+			return SmallIntType;
+		case 'i': case 'I':
+			return (sizeof(int) < sizeof(void*)) ? SmallIntType : IntegerType;
+		case 'l': case 'L': case 'q': case 'Q':
+			return IntegerType;
+		case 'f': case 'd':
+			return FloatType;
+		case '#':
+			return [self objectTypeWithClassName: nil nonNil: NO];
+		default:
+			return UnknownType;
+	}
+}
+- (LKInferredKind) kind
+{
+	return kind;
+}
+- (NSString*) className
+{
+	return className;
+}
+- (BOOL) isNonNil
+{
+	return nonNil;
+}
+- (BOOL) isNumeric
+{
+	return isIntegerKind(kind) || (LKInferredKindFloat == kind);
+}
+/**
+ * Returns the type of values that are either of this type or nil.
+ */
+- (LKInferredType*) typeIncludingNil
+{
+	if (!nonNil)
+	{
+		return self;
+	}
+	if ([self isNumeric])
+	{
+		return UnknownType;
+	}
+	return [[LKInferredType alloc] initWithKind: kind
+	                                  className: className
+	                                     nonNil: NO];
+}
+- (LKInferredType*) typeByMergingWithType: (LKInferredType*)aType
+{
+	if ((nil == aType) || [self isEqual: aType])
+	{
+		return self;
+	}
+	LKInferredKind otherKind = [aType kind];
+	if (LKInferredKindNil == kind)
+	{
+		return [aType typeIncludingNil];
+	}
+	if (LKInferredKindNil == otherKind)
+	{
+		return [self typeIncludingNil];
+	}
+	BOOL bothNonNil = nonNil && [aType isNonNil];
+	if (isIntegerKind(kind) && isIntegerKind(otherKind))
+	{
+		// The more general integer kinds have lower values.
+		return (kind < otherKind) ? self : aType;
+	}
+	BOOL isObject = (LKInferredKindObject == kind) || (LKInferredKindClass == kind);
+	BOOL otherIsObject = (LKInferredKindObject == otherKind) ||
+		(LKInferredKindClass == otherKind);
+	if (isObject && otherIsObject)
+	{
+		NSString *common = nil;
+		if ((LKInferredKindObject == kind) && (LKInferredKindObject == otherKind))
+		{
+			common = commonSuperclassName(className, [aType className]);
+		}
+		return [LKInferredType objectTypeWithClassName: common
+		                                        nonNil: bothNonNil];
+	}
+	if (!bothNonNil)
+	{
+		return UnknownType;
+	}
+	return [[LKInferredType alloc] initWithKind: LKInferredKindUnknown
+	                                  className: nil
+	                                     nonNil: YES];
+}
+- (BOOL) isEqual: (id)anObject
+{
+	if (self == anObject)
+	{
+		return YES;
+	}
+	if (![anObject isKindOfClass: [LKInferredType class]])
+	{
+		return NO;
+	}
+	LKInferredType *other = anObject;
+	return (kind == other->kind) && (nonNil == other->nonNil) &&
+		((className == other->className) ||
+		 [className isEqualToString: other->className]);
+}
+- (NSUInteger) hash
+{
+	return ((kind << 1) | nonNil) ^ [className hash];
+}
+- (NSString*) description
+{
+	NSString *name;
+	switch (kind)
+	{
+		case LKInferredKindNil: return @"nil";
+		case LKInferredKindInteger: return @"Integer";
+		case LKInferredKindSmallInt: return @"SmallInt";
+		case LKInferredKindBool: return @"BOOL";
+		case LKInferredKindFloat: return @"Float";
+		case LKInferredKindObject:
+			name = (nil == className) ? @"id" : className;
+			break;
+		case LKInferredKindClass:
+			name = [NSString stringWithFormat: @"%@ class", className];
+			break;
+		default:
+			name = @"?";
+	}
+	return nonNil ? name : [name stringByAppendingString: @" or nil"];
+}
+@end
@@ -0,0 +1,77 @@
+#import <LanguageKit/LKASTVisitor.h>
+#import <LanguageKit/LKModule.h>
+
+/**
+ * AST transform that inlines small methods into methods of the same class that
+ * send them to self.
+ *
+ * A message to self that is a statement on its own, the value of an
+ * assignment, or the value of a return is replaced by a test of the receiver's
+ * class.  If the receiver is an instance of the class that defines both
+ * methods, then the body of the sent method runs in place of the message.
+ * Otherwise, for example when a subclass overrides the method, the message is
+ * sent as before.  The arguments and local variables of the inlined method
+ * become new local variables of the caller, with names that can not appear in
+ * source code.
+ *
+ * Only methods whose arguments and return values are objects, which contain no
+ * blocks, and which only return from their last statement are inlined, so
+ * inlined code never has a non-local return that did not appear in the
+ * caller.  Messages to self in inlined code are not inlined again.
+ *
+ * The test also sends +LKInlinedClassForMethod: to the class, so the inlined
+ * copy is only used while the class's implementation of the method is the one
+ * that was loaded with the caller.  If the method is replaced at run time, for
+ * example by a category, then the message is sent instead.  Methods are only
+ * recorded when LanguageKit compiles or interprets the module that defines
+ * them, so code for a static code generator should be checked with the
+ * transforms returned by LKTransformsWithoutInlining().
+ *
+ * The compiler applies this transform by default.
+ */
+@interface LKInliner : LKASTVisitor
+/**
+ * The largest number of AST nodes that a method may contain and still be
+ * inlined.  Defaults to 16.
+ */
+@property (nonatomic) NSUInteger maxMethodSize;
+/**
+ * The largest number of statements that a method may contain and still be
+ * inlined.  Defaults to 4.
+ */
+@property (nonatomic) NSUInteger maxStatementCount;
+@end
+
+/**
+ * Returns a copy of an array of transforms without any LKInliner instances.
+ */
+NSArray *LKTransformsWithoutInlining(NSArray *transforms);
+
+/**
+ * Stops the inlined copies of a method being used.  The interpreter calls this
+ * whenever it installs a method, because a new definition may reuse the old
+ * implementation.  cls is the metaclass for class methods.
+ */
+void LKInvalidateInlinedMethod(Class cls, SEL aSelector);
+
+@interface NSObject (LKInliner)
+/**
+ * Returns the receiver if its implementation of the named method, prefixed
+ * with + for a class method or - for an instance method, is the one that was
+ * recorded by -[LKModule recordInlinedMethods].  Returns Nil otherwise, or if
+ * no implementation was recorded.
+ *
+ * Recording replaces this method in the class with one that checks a table of
+ * the recorded methods without taking a lock.
+ */
++ (Class) LKInlinedClassForMethod: (NSString*)aMethod;
+@end
+
+@interface LKModule (LKInliner)
+/**
+ * Records the current implementations of the methods that this module defines
+ * and that its methods have inlined.  Must be called once the module has been
+ * loaded, so that its inlined code is used.
+ */
+- (void) recordInlinedMethods;
+@end
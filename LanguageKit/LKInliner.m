@@ -0,0 +1,796 @@
+#import "LanguageKit.h"
+#import "LKInliner.h"
+#import "Runtime/LKObject.h"
+#import <objc/runtime.h>
+#include <pthread.h>
+
+/**
+ * Key for the associated object that marks message sends that must not be
+ * inlined.
+ */
+static char NotInlinedKey;
+
+static BOOL isInlinable(LKMessageSend *aMessage)
+{
+	return nil == objc_getAssociatedObject(aMessage, &NotInlinedKey);
+}
+
+static void markNotInlinable(LKMessageSend *aMessage)
+{
+	objc_setAssociatedObject(aMessage, &NotInlinedKey, [NSNull null],
+	                         OBJC_ASSOCIATION_RETAIN);
+}
+
+/**
+ * The selector of the message that inlined code sends to the class that
+ * defines the inlined method, to find out whether the inlined copy is still
+ * valid.
+ */
+static NSString *const GuardSelector = @"LKInlinedClassForMethod:";
+
+/**
+ * An inlined method's implementation when it was loaded with the methods that
+ * inline it.
+ */
+struct LKInlinedMethod
+{
+	/** The method's name, prefixed with + or -.  Never released. */
+	__unsafe_unretained NSString *name;
+	/** The class, or metaclass for a class method, that implements it. */
+	Class cls;
+	/** The method's selector. */
+	SEL selector;
+	/** The implementation that the inlined copies were made from. */
+	IMP imp;
+	/**
+	 * Cleared when the interpreter installs a new definition of the method.
+	 * Redefining an interpreted method can reuse its implementation, so
+	 * comparing implementations alone would not notice.
+	 */
+	int valid;
+};
+
+/**
+ * The inlined methods of a class.  Tables are never freed, because the guard
+ * implementation that uses a table may still be running when it is replaced.
+ */
+struct LKInlinedMethods
+{
+	NSUInteger count;
+	struct LKInlinedMethod methods[];
+};
+
+/**
+ * Map from classes to their current LKInlinedMethods tables.  Only used when
+ * recording or invalidating methods; guards read their own table directly.
+ */
+static NSMapTable *InlinedMethods;
+/**
+ * Protects InlinedMethods.
+ */
+static pthread_mutex_t InlinedMethodsLock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Returns whether the implementation of an inlined method is still the one
+ * that its inlined copies were made from.
+ */
+static inline BOOL isCurrent(struct LKInlinedMethod *aMethod)
+{
+	return __atomic_load_n(&aMethod->valid, __ATOMIC_ACQUIRE) &&
+		(class_getMethodImplementation(aMethod->cls, aMethod->selector) == aMethod->imp);
+}
+
+/**
+ * Returns an implementation of +LKInlinedClassForMethod: that checks the
+ * methods in a table, without taking any locks.
+ */
+static IMP guardForTable(struct LKInlinedMethods *table)
+{
+	return imp_implementationWithBlock(^Class(Class receiver, NSString *aMethod)
+	{
+		// Guards in compiled code and in interpreted code each pass the same
+		// string object every time, so try identical names first.
+		for (NSUInteger i=0 ; i<table->count ; i++)
+		{
+			if (table->methods[i].name == aMethod)
+			{
+				return isCurrent(&table->methods[i]) ? receiver : Nil;
+			}
+		}
+		for (NSUInteger i=0 ; i<table->count ; i++)
+		{
+			if ([table->methods[i].name isEqualToString: aMethod])
+			{
+				return isCurrent(&table->methods[i]) ? receiver : Nil;
+			}
+		}
+		return Nil;
+	});
+}
+
+void LKInvalidateInlinedMethod(Class cls, SEL aSelector)
+{
+	Class key = class_isMetaClass(cls) ? objc_getClass(class_getName(cls)) : cls;
+	pthread_mutex_lock(&InlinedMethodsLock);
+	struct LKInlinedMethods *table = (nil == InlinedMethods) ? NULL :
+		NSMapGet(InlinedMethods, (__bridge void*)key);
+	for (NSUInteger i=0 ; (NULL != table) && (i<table->count) ; i++)
+	{
+		struct LKInlinedMethod *m = &table->methods[i];
+		if ((m->cls == cls) && sel_isEqual(m->selector, aSelector))
+		{
+			__atomic_store_n(&m->valid, 0, __ATOMIC_RELEASE);
+		}
+	}
+	pthread_mutex_unlock(&InlinedMethodsLock);
+}
+
+NSArray *LKTransformsWithoutInlining(NSArray *transforms)
+{
+	NSMutableArray *result = [NSMutableArray array];
+	for (id transform in transforms)
+	{
+		if (![transform isKindOfClass: [LKInliner class]])
+		{
+			[result addObject: transform];
+		}
+	}
+	return result;
+}
+
+@implementation NSObject (LKInliner)
++ (Class) LKInlinedClassForMethod: (NSString*)aMethod
+{
+	return Nil;
+}
+@end
+
+/**
+ * Collects the guard messages in a tree.
+ */
+@interface LKInlineGuardCollector : LKASTVisitor
+{
+	@public
+	NSMutableArray *guards;
+}
+@end
+@implementation LKInlineGuardCollector
+- (LKAST*) visitMessageSend: (LKMessageSend*)aMessage
+{
+	if ([GuardSelector isEqualToString: [aMessage selector]])
+	{
+		[guards addObject: aMessage];
+	}
+	return aMessage;
+}
+@end
+
+/**
+ * Returns the name of a class or method referenced by a node in a guard.
+ */
+static NSString *guardName(LKAST *aNode)
+{
+	if ([aNode isKindOfClass: [LKDeclRef class]])
+	{
+		id symbol = [(LKDeclRef*)aNode symbol];
+		return [symbol isKindOfClass: [NSString class]] ? symbol : [symbol name];
+	}
+	return [[aNode description] stringByTrimmingCharactersInSet:
+		[NSCharacterSet characterSetWithCharactersInString: @"'"]];
+}
+
+@implementation LKModule (LKInliner)
+- (void) recordInlinedMethods
+{
+	// Only methods defined in this module are recorded.  A method that
+	// replaces one of them from elsewhere, for example in a category, leaves
+	// the recorded implementation unchanged, so the inlined copies of the
+	// original are no longer used.
+	NSMutableSet *defined = [NSMutableSet set];
+	NSMutableArray *definitions = [NSMutableArray arrayWithArray: [self allClasses]];
+	[definitions addObjectsFromArray: [self allCategories]];
+	for (id def in definitions)
+	{
+		for (LKMethod *method in [def methods])
+		{
+			[defined addObject: [NSString stringWithFormat: @"%@ %@%@",
+				[def classname], [method isClassMethod] ? @"+" : @"-",
+				[[method signature] selector]]];
+		}
+	}
+	LKInlineGuardCollector *collector = [LKInlineGuardCollector new];
+	collector->guards = [NSMutableArray array];
+	[self visitWithVisitor: collector];
+	NSMapTable *recorded = [NSMapTable strongToStrongObjectsMapTable];
+	for (LKMessageSend *guard in collector->guards)
+	{
+		NSString *className = guardName([guard target]);
+		NSString *methodName = guardName([[guard arguments] objectAtIndex: 0]);
+		Class cls = NSClassFromString(className);
+		if ((Nil == cls) || ![defined containsObject:
+			[NSString stringWithFormat: @"%@ %@", className, methodName]])
+		{
+			continue;
+		}
+		NSMutableSet *names = [recorded objectForKey: cls];
+		if (nil == names)
+		{
+			names = [NSMutableSet set];
+			[recorded setObject: names forKey: cls];
+		}
+		[names addObject: methodName];
+	}
+	pthread_mutex_lock(&InlinedMethodsLock);
+	if (nil == InlinedMethods)
+	{
+		InlinedMethods = [NSMapTable mapTableWithKeyOptions: NSPointerFunctionsOpaquePersonality | NSPointerFunctionsOpaqueMemory
+		                                       valueOptions: NSPointerFunctionsOpaquePersonality | NSPointerFunctionsOpaqueMemory];
+	}
+	for (Class cls in recorded)
+	{
+		NSSet *names = [recorded objectForKey: cls];
+		struct LKInlinedMethods *old = NSMapGet(InlinedMethods, (__bridge void*)cls);
+		NSUInteger oldCount = (NULL == old) ? 0 : old->count;
+		struct LKInlinedMethods *table = calloc(1, sizeof(struct LKInlinedMethods) +
+			([names count] + oldCount) * sizeof(struct LKInlinedMethod));
+		for (NSString *methodName in names)
+		{
+			struct LKInlinedMethod *m = &table->methods[table->count++];
+			BOOL isClassMethod = [methodName hasPrefix: @"+"];
+			m->name = (__bridge NSString*)CFBridgingRetain([methodName copy]);
+			m->cls = isClassMethod ? object_getClass(cls) : cls;
+			m->selector = sel_registerName([[methodName substringFromIndex: 1] UTF8String]);
+			m->imp = class_getMethodImplementation(m->cls, m->selector);
+			m->valid = 1;
+		}
+		// Keep the methods recorded by other modules, whose inlined copies
+		// may still be in use.
+		for (NSUInteger i=0 ; i<oldCount ; i++)
+		{
+			if (![names containsObject: old->methods[i].name])
+			{
+				table->methods[table->count++] = old->methods[i];
+			}
+		}
+		NSMapInsert(InlinedMethods, (__bridge void*)cls, table);
+		class_replaceMethod(object_getClass(cls),
+		                    @selector(LKInlinedClassForMethod:),
+		                    guardForTable(table), "#@:@");
+	}
+	pthread_mutex_unlock(&InlinedMethodsLock);
+}
+@end
+
+/**
+ * State used while copying the body of a method into another method.
+ */
+@interface LKInlineContext : NSObject
+{
+	@public
+	/** New names for the arguments and locals of the inlined method. */
+	NSDictionary *names;
+	/**
+	 * The other variable names referenced by the copied nodes, or nil if they
+	 * are not needed.
+	 */
+	NSMutableSet *freeNames;
+	/** The number of nodes copied so far. */
+	NSUInteger size;
+	/** The largest number of nodes that may be copied. */
+	NSUInteger maxSize;
+}
+@end
+@implementation LKInlineContext @end
+
+/**
+ * Counts a copied node, returning NO if too many nodes have been copied.
+ */
+static BOOL countNode(LKInlineContext *aContext)
+{
+	return ++aContext->size <= aContext->maxSize;
+}
+
+@interface LKAST (Inlining)
+/**
+ * Returns a copy of this node for use in another method, or nil if it can not
+ * be copied.  Nodes that contain blocks, returns, or control flow can not be
+ * copied.
+ */
+- (LKAST*) inlinedCopyInContext: (LKInlineContext*)aContext;
+@end
+@implementation LKAST (Inlining)
+- (LKAST*) inlinedCopyInContext: (LKInlineContext*)aContext
+{
+	return nil;
+}
+@end
+@implementation LKLiteral (Inlining)
+- (LKAST*) inlinedCopyInContext: (LKInlineContext*)aContext
+{
+	if (!countNode(aContext))
+	{
+		return nil;
+	}
+	return [[self class] literalFromString: value];
+}
+@end
+@implementation LKDeclRef (Inlining)
+- (LKAST*) inlinedCopyInContext: (LKInlineContext*)aContext
+{
+	if (!countNode(aContext))
+	{
+		return nil;
+	}
+	id symbol = [self symbol];
+	NSString *name = [symbol isKindOfClass: [NSString class]] ? symbol : [symbol name];
+	NSString *newName = [aContext->names objectForKey: name];
+	if (nil == newName)
+	{
+		newName = name;
+		[aContext->freeNames addObject: name];
+	}
+	return [[self class] referenceWithSymbol: newName];
+}
+@end
+@implementation LKBuiltinSymbol (Inlining)
+- (LKAST*) inlinedCopyInContext: (LKInlineContext*)aContext
+{
+	if (!countNode(aContext))
+	{
+		return nil;
+	}
+	return [[self class] builtin];
+}
+@end
+@implementation LKBlockSelfRef (Inlining)
+- (LKAST*) inlinedCopyInContext: (LKInlineContext*)aContext
+{
+	return nil;
+}
+@end
+@implementation LKMessageSend (Inlining)
+- (LKAST*) inlinedCopyInContext: (LKInlineContext*)aContext
+{
+	if (!countNode(aContext))
+	{
+		return nil;
+	}
+	LKAST *newTarget = [(LKAST*)target inlinedCopyInContext: aContext];
+	if (nil == newTarget)
+	{
+		return nil;
+	}
+	NSMutableArray *newArguments = nil;
+	for (LKAST *argument in arguments)
+	{
+		LKAST *copy = [argument inlinedCopyInContext: aContext];
+		if (nil == copy)
+		{
+			return nil;
+		}
+		if (nil == newArguments)
+		{
+			newArguments = [NSMutableArray array];
+		}
+		[newArguments addObject: copy];
+	}
+	LKMessageSend *copy = [[self class] messageWithSelectorName: selector
+	                                                  arguments: newArguments];
+	[copy setTarget: newTarget];
+	// Inlining messages to self in copied code could go on forever.
+	if ([target isKindOfClass: [LKSelfRef class]])
+	{
+		markNotInlinable(copy);
+	}
+	return copy;
+}
+@end
+@implementation LKCompare (Inlining)
+- (LKAST*) inlinedCopyInContext: (LKInlineContext*)aContext
+{
+	if (!countNode(aContext))
+	{
+		return nil;
+	}
+	LKAST *left = [lhs inlinedCopyInContext: aContext];
+	LKAST *right = [rhs inlinedCopyInContext: aContext];
+	if ((nil == left) || (nil == right))
+	{
+		return nil;
+	}
+	return [LKCompare comparisonWithLeftExpression: left rightExpression: right];
+}
+@end
+@implementation LKAssignExpr (Inlining)
+- (LKAST*) inlinedCopyInContext: (LKInlineContext*)aContext
+{
+	if (!countNode(aContext))
+	{
+		return nil;
+	}
+	LKDeclRef *newTarget = (LKDeclRef*)[target inlinedCopyInContext: aContext];
+	LKAST *newExpr = [expr inlinedCopyInContext: aContext];
+	if ((nil == newTarget) || (nil == newExpr))
+	{
+		return nil;
+	}
+	return [[self class] assignWithTarget: newTarget expr: newExpr];
+}
+@end
+@implementation LKArrayExpr (Inlining)
+- (LKAST*) inlinedCopyInContext: (LKInlineContext*)aContext
+{
+	if (!countNode(aContext))
+	{
+		return nil;
+	}
+	NSMutableArray *newElements = [NSMutableArray array];
+	for (LKAST *element in elements)
+	{
+		LKAST *copy = [element inlinedCopyInContext: aContext];
+		if (nil == copy)
+		{
+			return nil;
+		}
+		[newElements addObject: copy];
+	}
+	return [[self class] arrayWithElements: newElements];
+}
+@end
+
+/**
+ * Returns the symbol that a name refers to in a scope, without binding
+ * variables from enclosing scopes into it.
+ */
+static LKSymbol *declaredSymbol(LKSymbolTable *aTable, NSString *aName)
+{
+	for (LKSymbolTable *t = aTable ; nil != t ; t = [t enclosingScope])
+	{
+		LKSymbol *symbol = [[t symbols] objectForKey: aName];
+		if (nil != symbol)
+		{
+			return symbol;
+		}
+	}
+	return nil;
+}
+
+/**
+ * Returns a name for a new local variable in a scope.  The names of new
+ * variables contain a dot, so they can not clash with names in source code.
+ */
+static NSString *temporaryName(LKSymbolTable *aTable,
+                               NSString *aName,
+                               NSArray *chosenNames)
+{
+	for (NSUInteger i=0 ; ; i++)
+	{
+		NSString *name = [NSString stringWithFormat: @"%@.%lu", aName, (unsigned long)i];
+		if ((nil == declaredSymbol(aTable, name)) &&
+		    ![chosenNames containsObject: name])
+		{
+			return name;
+		}
+	}
+}
+
+static BOOL isObjectType(const char *aType)
+{
+	// Skip type qualifiers.
+	while (('\0' != *aType) && (NULL != strchr("rnNoORV", *aType)))
+	{
+		aType++;
+	}
+	return '@' == *aType;
+}
+
+/**
+ * Returns YES if every argument and return value in a set of type encodings is
+ * an object.
+ */
+static BOOL hasOnlyObjectTypes(NSArray *types)
+{
+	for (NSString *type in types)
+	{
+		NSMethodSignature *sig = [NSMethodSignature signatureWithObjCTypes: [type UTF8String]];
+		if (!isObjectType([sig methodReturnType]))
+		{
+			return NO;
+		}
+		for (NSUInteger i=2 ; i<[sig numberOfArguments] ; i++)
+		{
+			if (!isObjectType([sig getArgumentTypeAtIndex: i]))
+			{
+				return NO;
+			}
+		}
+	}
+	return YES;
+}
+
+/**
+ * Returns YES if a node is a statement whose value is not used.  The last
+ * statement in a block or an if statement gives the value of that node, unless
+ * it is a return.
+ */
+static BOOL isUnusedStatement(LKAST *aNode)
+{
+	LKAST *owner = [aNode parent];
+	NSArray *lists[3] = { nil, nil, nil };
+	BOOL isLastUsed = NO;
+	if ([owner isKindOfClass: [LKMethod class]])
+	{
+		lists[0] = [(LKMethod*)owner statements];
+	}
+	else if ([owner isKindOfClass: [LKBlockExpr class]])
+	{
+		lists[0] = [(LKBlockExpr*)owner statements];
+		isLastUsed = YES;
+	}
+	else if ([owner isKindOfClass: [LKIfStatement class]])
+	{
+		lists[0] = [(LKIfStatement*)owner thenStatements];
+		lists[1] = [(LKIfStatement*)owner elseStatements];
+		isLastUsed = YES;
+	}
+	else if ([owner isKindOfClass: [LKLoop class]])
+	{
+		lists[0] = [(LKLoop*)owner loopInitStatements];
+		lists[1] = [(LKLoop*)owner statements];
+		lists[2] = [(LKLoop*)owner updateStatements];
+	}
+	for (int l=0 ; l<3 ; l++)
+	{
+		NSUInteger i = (nil == lists[l]) ? NSNotFound :
+			[lists[l] indexOfObjectIdenticalTo: aNode];
+		if (NSNotFound != i)
+		{
+			return !isLastUsed || [aNode isBranch] || (i + 1 < [lists[l] count]);
+		}
+	}
+	return NO;
+}
+
+@implementation LKInliner
+@synthesize maxMethodSize, maxStatementCount;
+- (id) init
+{
+	self = [super init];
+	if (nil == self)
+	{
+		return nil;
+	}
+	maxMethodSize = 16;
+	maxStatementCount = 4;
+	return self;
+}
+/**
+ * Returns an if statement that runs the inlined body of the method called by
+ * aMessage in place of aStatement, which is the message send or the
+ * assignment or return whose value it is.  Returns aStatement if the message
+ * can not be inlined.
+ */
+- (LKAST*) inlineMessage: (LKMessageSend*)aMessage
+             inStatement: (LKAST*)aStatement
+{
+	if (![[aMessage target] isKindOfClass: [LKSelfRef class]] ||
+	    !isInlinable(aMessage))
+	{
+		return aStatement;
+	}
+	LKMethod *caller = nil;
+	LKSubclass *cls = nil;
+	for (LKAST *p = [aStatement parent] ; nil != p ; p = [p parent])
+	{
+		if ((nil == caller) && [p isKindOfClass: [LKMethod class]])
+		{
+			caller = (LKMethod*)p;
+		}
+		if ([p isKindOfClass: [LKSubclass class]])
+		{
+			cls = (LKSubclass*)p;
+			break;
+		}
+	}
+	if ((nil == caller) || (nil == cls))
+	{
+		return aStatement;
+	}
+	NSString *selector = [aMessage selector];
+	LKMethod *callee = nil;
+	for (LKMethod *method in [cls methods])
+	{
+		if ([[[method signature] selector] isEqualToString: selector] &&
+		    ([method isClassMethod] == [caller isClassMethod]))
+		{
+			callee = method;
+			break;
+		}
+	}
+	NSArray *body = [callee statements];
+	if ((nil == callee) || (callee == caller) ||
+	    ([body count] > maxStatementCount) ||
+	    !hasOnlyObjectTypes([[aMessage module] typesForMethod: selector]))
+	{
+		return aStatement;
+	}
+
+	// Choose names for the callee's variables in the caller's scope.
+	LKSymbolTable *table = [aStatement symbols];
+	NSMutableDictionary *names = [NSMutableDictionary dictionary];
+	NSMutableArray *arguments = [NSMutableArray array];
+	NSMutableArray *locals = [NSMutableArray array];
+	for (LKSymbol *symbol in [[callee symbols] arguments])
+	{
+		NSString *name = temporaryName(table, [symbol name], [names allValues]);
+		[names setObject: name forKey: [symbol name]];
+		[arguments addObject: name];
+	}
+	for (LKSymbol *symbol in [[callee symbols] locals])
+	{
+		NSString *name = temporaryName(table, [symbol name], [names allValues]);
+		[names setObject: name forKey: [symbol name]];
+		[locals addObject: name];
+	}
+
+	// Copy the callee's body.
+	LKInlineContext *context = [LKInlineContext new];
+	context->names = names;
+	context->freeNames = [NSMutableSet setWithObject: [cls classname]];
+	context->maxSize = maxMethodSize;
+	NSMutableArray *inlined = [NSMutableArray array];
+	LKAST *result = nil;
+	for (NSUInteger i=0, count=[body count] ; i<count ; i++)
+	{
+		LKAST *statement = [body objectAtIndex: i];
+		if ([statement isComment])
+		{
+			continue;
+		}
+		if ([statement isKindOfClass: [LKReturn class]])
+		{
+			if (i + 1 < count)
+			{
+				return aStatement;
+			}
+			result = [[(LKReturn*)statement expression] inlinedCopyInContext: context];
+			if (nil == result)
+			{
+				return aStatement;
+			}
+			break;
+		}
+		LKAST *copy = [statement inlinedCopyInContext: context];
+		if (nil == copy)
+		{
+			return aStatement;
+		}
+		[inlined addObject: copy];
+	}
+	// Names that refer to instance variables, class variables or classes in
+	// the callee must not refer to variables in the caller.
+	for (NSString *name in context->freeNames)
+	{
+		switch ([declaredSymbol(table, name) scope])
+		{
+			case LKSymbolScopeExternal:
+			case LKSymbolScopeArgument:
+			case LKSymbolScopeLocal:
+				return aStatement;
+			default:
+				break;
+		}
+	}
+
+	// Evaluate the arguments into the new variables and start the locals as
+	// nil, as they would be on entry to the callee.
+	LKInlineContext *argumentContext = [LKInlineContext new];
+	argumentContext->maxSize = NSUIntegerMax;
+	NSMutableArray *then = [NSMutableArray array];
+	NSArray *messageArguments = [aMessage arguments];
+	for (NSUInteger i=0, count=[messageArguments count] ; i<count ; i++)
+	{
+		LKAST *copy = [[messageArguments objectAtIndex: i] inlinedCopyInContext: argumentContext];
+		if (nil == copy)
+		{
+			return aStatement;
+		}
+		[then addObject: [LKAssignExpr assignWithTarget: [LKDeclRef referenceWithSymbol: [arguments objectAtIndex: i]]
+		                                           expr: copy]];
+	}
+	for (NSString *name in locals)
+	{
+		[then addObject: [LKAssignExpr assignWithTarget: [LKDeclRef referenceWithSymbol: name]
+		                                           expr: [LKNilRef builtin]]];
+	}
+	[then addObjectsFromArray: inlined];
+	// Methods without a return statement return self.
+	if (nil == result)
+	{
+		result = [LKSelfRef builtin];
+	}
+	if (aStatement == aMessage)
+	{
+		if (![result isKindOfClass: [LKDeclRef class]] &&
+		    ![result isKindOfClass: [LKLiteral class]])
+		{
+			[then addObject: result];
+		}
+	}
+	else if ([aStatement isKindOfClass: [LKAssignExpr class]])
+	{
+		id target = [[(LKAssignExpr*)aStatement target] symbol];
+		NSString *name = [target isKindOfClass: [NSString class]] ? target : [target name];
+		[then addObject: [LKAssignExpr assignWithTarget: [LKDeclRef referenceWithSymbol: name]
+		                                           expr: result]];
+	}
+	else
+	{
+		[then addObject: [[aStatement class] returnWithExpr: result]];
+	}
+
+	for (NSString *name in [arguments arrayByAddingObjectsFromArray: locals])
+	{
+		LKSymbol *symbol = [LKSymbol new];
+		[symbol setName: name];
+		[symbol setTypeEncoding: NSStringFromRuntimeString(@encode(LKObject))];
+		[symbol setScope: LKSymbolScopeLocal];
+		[symbol setIndex: [[table locals] count]];
+		[table addSymbol: symbol];
+	}
+	// Instances of subclasses may override the method, so send the message
+	// to anything that is not an instance of this class.  The method may also
+	// have been replaced since it was loaded, in which case the guard message
+	// returns Nil and the message is sent.
+	LKAST *receiverClass = [LKSelfRef builtin];
+	if (![caller isClassMethod])
+	{
+		LKMessageSend *classMessage = [LKMessageSend messageWithSelectorName: @"class"];
+		[classMessage setTarget: receiverClass];
+		receiverClass = classMessage;
+	}
+	LKMessageSend *inlinedClass = [LKMessageSend messageWithSelectorName: GuardSelector];
+	[inlinedClass setTarget: [LKDeclRef referenceWithSymbol: [cls classname]]];
+	[inlinedClass addArgument: [LKStringLiteral literalFromString:
+		[NSString stringWithFormat: @"%@%@", [caller isClassMethod] ? @"+" : @"-", selector]]];
+	markNotInlinable(inlinedClass);
+	LKCompare *guard =
+		[LKCompare comparisonWithLeftExpression: receiverClass
+		                        rightExpression: inlinedClass];
+	markNotInlinable(aMessage);
+	LKIfStatement *ifStatement =
+		[LKIfStatement ifStatementWithCondition: guard
+		                                   then: then
+		                                   else: [NSArray arrayWithObject: aStatement]];
+	[ifStatement setParent: [aStatement parent]];
+	return ifStatement;
+}
+- (LKAST*) visitMessageSend: (LKMessageSend*)aMessage
+{
+	if (!isUnusedStatement(aMessage))
+	{
+		return aMessage;
+	}
+	return [self inlineMessage: aMessage inStatement: aMessage];
+}
+- (LKAST*) visitAssignExpr: (LKAssignExpr*)anAssignment
+{
+	LKAST *value = [anAssignment expression];
+	if (![value isKindOfClass: [LKMessageSend class]] ||
+	    !isUnusedStatement(anAssignment))
+	{
+		return anAssignment;
+	}
+	return [self inlineMessage: (LKMessageSend*)value inStatement: anAssignment];
+}
+- (LKAST*) visitReturn: (LKReturn*)aReturn
+{
+	LKAST *value = [aReturn expression];
+	if (![value isKindOfClass: [LKMessageSend class]] ||
+	    !isUnusedStatement(aReturn))
+	{
+		return aReturn;
+	}
+	return [self inlineMessage: (LKMessageSend*)value inStatement: aReturn];
+}
+@end
@@ -56,6 +56,12 @@ typedef struct
      WithArguments: (const id*)args
              count: (int)count
          inContext: (LKInterpreterContext*)context;
+- (id)callWithArguments: (const id*)args
+                  count: (int)count
+              inContext: (LKInterpreterContext*)parentContext;
+- (id)callWithFirstArgument: (__unsafe_unretained id)arg0
+                  arguments: (va_list)arglist
+                  inContext: (LKInterpreterContext*)parentContext;
 @end
 
 @interface LKMethod (LKInterpreter)
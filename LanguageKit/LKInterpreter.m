@@ -204,6 +204,23 @@ void LKPropertySetter(id self, SEL _cmd, id newObject)
 }
 @end
 
+/**
+ * Evaluates to a block that runs a block expression in the context in which it
+ * was created.  The block is not copied, so on its own it may only be used
+ * while the scope that contains it is active.
+ */
+#define LKInterpretedBlock(blockExpr, parentContext) \
+	^id(__unsafe_unretained id arg0, ...) \
+	{ \
+		va_list arglist; \
+		va_start(arglist, arg0); \
+		id result = [blockExpr callWithFirstArgument: arg0 \
+		                                   arguments: arglist \
+		                                   inContext: parentContext]; \
+		va_end(arglist); \
+		return result; \
+	}
+
 @implementation LKBlockExpr (LKInterpreter)
 - (id)executeBlock: (id)block
      WithArguments: (const id*)args
@@ -226,40 +243,54 @@ void LKPropertySetter(id self, SEL _cmd, id newObject)
 	[context setBlockContextObject: nil];
 	return result;
 }
-- (id)interpretInContext: (LKInterpreterContext*)parentContext
+- (id)callWithArguments: (const id*)args
+                   count: (int)count
+               inContext: (LKInterpreterContext*)parentContext
 {
-	int count = [[[self symbols] arguments] count];
-	id (^block)(__unsafe_unretained id arg0, ...) = ^id(__unsafe_unretained id arg0, ...) {
-		LKInterpreterContext *context = [[LKInterpreterContext alloc]
-		            initWithSymbolTable: [self symbols]
-		                         parent: parentContext];
-		id params[count];
-		
-		va_list arglist;
-		va_start(arglist, arg0);
-		if (count > 0)
-		{
-			params[0] = arg0;
-		}
-		for (int i = 1; i < count; i++)
-		{
-			params[i] = (id) va_arg(arglist, __unsafe_unretained id);
-		}
-		va_end(arglist);
-		
-		@try
-		{
-			return [self executeBlock: self
-			            WithArguments: params
-			                    count: count
-			                inContext: context];
-		}
-		@finally
+	// A block without arguments or locals has nothing to store in a context
+	// of its own, so it runs in its parent's, unless it needs its own context
+	// to refer to the block object.
+	LKSymbolTable *table = [self symbols];
+	if ((0 == count) && ![self isSelfReferencing] &&
+	    ([[table arguments] count] == 0) && ([[table locals] count] == 0))
+	{
+		id result = nil;
+		for (LKAST *statement in statements)
 		{
-			context = nil;
+			result = [statement interpretInContext: parentContext];
 		}
-		return nil;
-	};
+		return result;
+	}
+	LKInterpreterContext *context = [[LKInterpreterContext alloc]
+	            initWithSymbolTable: [self symbols]
+	                         parent: parentContext];
+	return [self executeBlock: self
+	            WithArguments: args
+	                    count: count
+	                inContext: context];
+}
+- (id)callWithFirstArgument: (__unsafe_unretained id)arg0
+                  arguments: (va_list)arglist
+                  inContext: (LKInterpreterContext*)parentContext
+{
+	int count = [[[self symbols] arguments] count];
+	id params[count];
+	if (count > 0)
+	{
+		params[0] = arg0;
+	}
+	for (int i = 1; i < count; i++)
+	{
+		params[i] = (id) va_arg(arglist, __unsafe_unretained id);
+	}
+	return [self callWithArguments: params
+	                         count: count
+	                     inContext: parentContext];
+}
+- (id)interpretInContext: (LKInterpreterContext*)parentContext
+{
+	id (^block)(__unsafe_unretained id arg0, ...) =
+		LKInterpretedBlock(self, parentContext);
 	return [block copy];
 }
 @end
@@ -293,9 +324,12 @@ void LKPropertySetter(id self, SEL _cmd, id newObject)
 		//FIXME: check the superclass type explicitly
 		const char *type = [[[(LKModule*)[self parent] typesForMethod: methodName] objectAtIndex: 0] UTF8String];
 		Class destClass = isClassMethod ? object_getClass(cls) : cls;
-		class_replaceMethod(destClass, sel, LKInterpreterMakeIMP(destClass, type), type);
+		LKInterpreterRetireIMP(class_replaceMethod(destClass, sel,
+			LKInterpreterMakeIMP(destClass, sel, type), type));
+		LKInvalidateInlinedMethod(destClass, sel);
 		StoreASTForMethod(classname, isClassMethod, methodName, method);
 	}
+	LKInterpreterInvalidateSignatureCache();
 	return nil;
 }
 @end
@@ -454,6 +488,23 @@ void LKPropertySetter(id self, SEL _cmd, id newObject)
 
 @interface LKMessageSend (LKInterpreter)
 @end
+/**
+ * Returns the result of sending value to a block argument.  Block literals are
+ * run directly, without creating a block object, unless they refer to the
+ * block object.
+ */
+static id valueOfBlockArgument(LKAST *anArgument, LKInterpreterContext *context)
+{
+	if ([anArgument isKindOfClass: [LKBlockExpr class]] &&
+	    ![(LKBlockExpr*)anArgument isSelfReferencing])
+	{
+		return [(LKBlockExpr*)anArgument callWithArguments: NULL
+		                                              count: 0
+		                                          inContext: context];
+	}
+	id block = [anArgument interpretInContext: context];
+	return LKSendMessage(@"NSBlock", block, @"value", 0, NULL);
+}
 @implementation LKMessageSend (LKInterpreter)
 - (id)interpretInContext: (LKInterpreterContext*)context forTarget: (id)receiver
 {
@@ -461,29 +512,25 @@ void LKPropertySetter(id self, SEL _cmd, id newObject)
     {
         if (!receiver)
         {
-            id block = [[arguments firstObject] interpretInContext: context];
-            return LKSendMessage(@"NSBlock", block, @"value", 0, NULL);
+            return valueOfBlockArgument([arguments firstObject], context);
         }
     }
     else if ([selector isEqual: @"ifNotNil:"])
     {
         if (receiver)
         {
-            id block = [[arguments firstObject] interpretInContext: context];
-            return LKSendMessage(@"NSBlock", block, @"value", 0, NULL);
+            return valueOfBlockArgument([arguments firstObject], context);
         }
     }
     else if ([selector isEqual: @"ifNil:ifNotNil:"])
     {
         id argument = (!receiver) ? [arguments firstObject] : [arguments lastObject];
-        id block = [argument interpretInContext: context];
-        return LKSendMessage(@"NSBlock", block, @"value", 0, NULL);
+        return valueOfBlockArgument(argument, context);
     }
     else if ([selector isEqual: @"ifNotNil:ifNil:"])
     {
         id argument = (receiver) ? [arguments firstObject] : [arguments lastObject];
-        id block = [argument interpretInContext: context];
-        return LKSendMessage(@"NSBlock", block, @"value", 0, NULL);
+        return valueOfBlockArgument(argument, context);
     }
 	NSString *receiverClassName = nil;
 	if ([target isKindOfClass: [LKSuperRef class]])
@@ -496,25 +543,73 @@ void LKPropertySetter(id self, SEL _cmd, id newObject)
 		receiverClassName = [(LKSubclass*)ast superclassname];
 	}
 	unsigned int argc = [arguments count];
-	__strong id argv[argc];
+	__strong id values[argc];
+	__unsafe_unretained id argv[argc];
+	// Non-escaping block literals are only called during this message, whose
+	// implementation for this receiver is LanguageKit's own, so up to two of
+	// them are passed as blocks on the stack, rather than copied.  values
+	// keeps the other arguments alive, and argv refers to both without
+	// retaining them.  LKSendMessageWithStackBlocks() does not retain the
+	// stack blocks either, because that would copy them.
+	__unsafe_unretained LKBlockExpr *stackBlockExprs[2] = { nil, nil };
+	unsigned int stackBlockIndexes[2];
+	unsigned int stackBlockCount = 0;
 	for (unsigned int i=0 ; i<argc ; i++)
 	{
 		LKAST *arg = [arguments objectAtIndex: i];
+		if ((stackBlockCount < 2) && (i < 32) &&
+		    [arg isKindOfClass: [LKBlockExpr class]] &&
+		    [(LKBlockExpr*)arg isNonEscaping])
+		{
+			stackBlockExprs[stackBlockCount] = (LKBlockExpr*)arg;
+			stackBlockIndexes[stackBlockCount++] = i;
+			continue;
+		}
 		@try
 		{
-			argv[i] = [arg interpretInContext: context];
+			values[i] = [arg interpretInContext: context];
+			argv[i] = values[i];
 		}
 		@finally
 		{
 			arg = nil;
 		}
 	}
-	return LKSendMessage(receiverClassName, receiver, selector, argc, argv);
+	__unsafe_unretained LKBlockExpr *firstBlockExpr = stackBlockExprs[0];
+	__unsafe_unretained LKBlockExpr *secondBlockExpr = stackBlockExprs[1];
+	__unsafe_unretained id stackBlocks[2] =
+	{
+		LKInterpretedBlock(firstBlockExpr, context),
+		LKInterpretedBlock(secondBlockExpr, context)
+	};
+	uint32_t stackBlockMask = 0;
+	for (unsigned int i=0 ; i<stackBlockCount ; i++)
+	{
+		argv[stackBlockIndexes[i]] = stackBlocks[i];
+		stackBlockMask |= 1U << stackBlockIndexes[i];
+	}
+	return LKSendMessageWithStackBlocks(receiverClassName, receiver, selector,
+	                                    argc, argv, stackBlockMask);
 }
 - (id)interpretInContext: (LKInterpreterContext*)context
 {
+	// A non-escaping block receiver is only called during this message, so it
+	// can also stay on the stack.
+	__unsafe_unretained LKBlockExpr *blockExpr = nil;
+	if ([target isKindOfClass: [LKBlockExpr class]] && [target isNonEscaping])
+	{
+		blockExpr = target;
+	}
+	__unsafe_unretained id stackBlock = LKInterpretedBlock(blockExpr, context);
+	__unsafe_unretained id receiver = stackBlock;
+	id value = nil;
+	if (nil == blockExpr)
+	{
+		value = [(LKAST*)target interpretInContext: context];
+		receiver = value;
+	}
 	id result = [self interpretInContext: context
-	                      forTarget: [(LKAST*)target interpretInContext: context]];
+	                      forTarget: receiver];
 	return result;
 }
 @end
@@ -611,6 +706,7 @@ void LKPropertySetter(id self, SEL _cmd, id newObject)
 	{
 		[category interpretInContext: context];
 	}
+	[self recordInlinedMethods];
 	return nil;
 }
 @end
@@ -746,14 +842,22 @@ static uint8_t logBase2(uint8_t x)
 		Class destClass = isClassMethod ? object_getClass(cls) : cls;
         if (alreadyExists)
         {
-            class_replaceMethod(destClass, sel, LKInterpreterMakeIMP(destClass, type), type);
+            LKInterpreterRetireIMP(class_replaceMethod(destClass, sel,
+                LKInterpreterMakeIMP(destClass, sel, type), type));
         }
         else
         {
-            class_addMethod(destClass, sel, LKInterpreterMakeIMP(destClass, type), type);
+            IMP imp = LKInterpreterMakeIMP(destClass, sel, type);
+            // A method defined twice in the same class replaces the first.
+            if (!class_addMethod(destClass, sel, imp, type))
+            {
+                LKInterpreterRetireIMP(class_replaceMethod(destClass, sel, imp, type));
+            }
         }
+		LKInvalidateInlinedMethod(destClass, sel);
 		StoreASTForMethod(classname, isClassMethod, methodName, method);
 	}
+	LKInterpreterInvalidateSignatureCache();
 	
 	if (!alreadyExists)
 	{
@@ -810,12 +914,17 @@ static uint8_t logBase2(uint8_t x)
 @implementation LKSymbolRef (LKInterpreter)
 - (id)interpretInContext: (LKInterpreterContext*)context
 {
-    id s = nil;//[Symbol SymbolForString: symbol];
-    if (nil == s)
-    {
-        void ** dataPtr = dlsym(RTLD_DEFAULT, [symbol UTF8String]);
-        s = (__bridge NSString *)(dataPtr ? *dataPtr : nil);
-    }
-    return s;
+	// Symbols are resolved the first time that the node is interpreted.  A
+	// global variable with the symbol's name takes precedence over a Symbol.
+	if (!__atomic_load_n(&resolved, __ATOMIC_ACQUIRE))
+	{
+		address = dlsym(RTLD_DEFAULT, [symbol UTF8String]);
+		if (NULL == address)
+		{
+			value = [Symbol SymbolForString: symbol];
+		}
+		__atomic_store_n(&resolved, YES, __ATOMIC_RELEASE);
+	}
+	return (NULL != address) ? (__bridge id)*address : value;
 }
 @end
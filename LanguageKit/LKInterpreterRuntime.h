@@ -17,6 +17,22 @@
  */
 id LKSendMessage(NSString *className, id receiver, NSString *selName,
                  unsigned int argc, const id *args);
+/**
+ * Sends a message as LKSendMessage() does.  The arguments whose indexes are
+ * set as bits in stackBlocks are blocks on the caller's stack, which the
+ * method must not keep.  They are not retained, because retaining a block on
+ * the stack copies it to the heap.  Only the first 32 arguments can be passed
+ * this way.
+ */
+id LKSendMessageWithStackBlocks(NSString *className, id receiver,
+                                NSString *selName, unsigned int argc,
+                                const id *args, uint32_t stackBlocks);
+/**
+ * Discards the cached method signatures used by LKSendMessage().  Must be
+ * called after adding or replacing methods, because the cache is keyed by
+ * class and selector.
+ */
+void LKInterpreterInvalidateSignatureCache(void);
 /**
  * Calls the named function, with the specified type encoding.  
  */
@@ -37,14 +53,56 @@ BOOL LKSetIvar(id receiver, NSString *name, id value);
 
 /**
  * Creates and returns a "trampoline" Objective-C method implementation for a 
- * method with the given type string.
+ * method with the given selector and type string.
  * 
  * When invoked, this method implementation will call ASTForMethod() which will
  * look up the method's AST node using the slector and receiver's class, and
  * finally interpret the AST node using
  * -[LKMethod executeWithReciever:arguments:count:].
  *
- * Note that the method IMPs returned by LKInterpreterMakeIMP can never be
- * freed (because they might be cached).
+ * Methods that take up to eight object arguments and return an object or void
+ * get a specialised implementation that passes its arguments through
+ * directly.  Other methods use a libffi closure, which boxes each argument.
+ *
+ * Methods that can share an implementation do: calling this again for the
+ * same class, selector and types returns the same IMP.  Each call must be
+ * balanced by a call to LKInterpreterRetireIMP() when the method is replaced.
+ */
+IMP LKInterpreterMakeIMP(Class cls, SEL sel, const char *objctype);
+
+/**
+ * Releases a method implementation returned by LKInterpreterMakeIMP(), for
+ * example the one returned by class_replaceMethod() when a method is
+ * redefined.  Implementations that were not created by LKInterpreterMakeIMP()
+ * are ignored.
+ *
+ * An implementation that is no longer used by any method is kept, because code
+ * that looked it up earlier, for example with -methodForSelector:, may still
+ * call it.  It runs the method's current definition if it is called.  When a
+ * method with the same class, selector and types is defined again, the
+ * implementation is reused, so redefining methods does not use more memory.
+ */
+void LKInterpreterRetireIMP(IMP imp);
+
+/**
+ * Memory used by interpreter method implementations.
+ */
+struct LKTrampolineStatistics
+{
+	/** The number of implementations in use. */
+	NSUInteger live;
+	/** The approximate number of bytes used by implementations in use. */
+	NSUInteger liveBytes;
+	/** The number of implementations that no method uses. */
+	NSUInteger retired;
+	/** The approximate number of bytes used by retired implementations. */
+	NSUInteger retiredBytes;
+	/** The number of times that a retired implementation has been reused. */
+	NSUInteger reused;
+};
+
+/**
+ * Returns the current memory statistics for interpreter method
+ * implementations.
  */
-IMP LKInterpreterMakeIMP(Class cls, const char *objctype);
+struct LKTrampolineStatistics LKInterpreterTrampolineStatistics(void);
@@ -12,49 +12,177 @@
 #include <string.h>
 #include <ffi.h>
 #include <dlfcn.h>
+#include <pthread.h>
 
 OBJC_EXPORT id objc_retainAutoreleaseReturnValue(id obj);
 
-static id BoxValue(void *value, const char *typestr);
-static void UnboxValue(id value, void *dest, const char *objctype);
-static void RetainValue(id value, const char *objctype);
-
-#ifdef __LP64__
-ffi_type *_ffi_type_nspoint_elements[] = {
-	&ffi_type_double, &ffi_type_double, NULL
-};
-#else
-ffi_type *_ffi_type_nspoint_elements[] = {
-	&ffi_type_float, &ffi_type_float, NULL
-};
-#endif
-ffi_type ffi_type_nspoint = {
-	0, 0, FFI_TYPE_STRUCT, _ffi_type_nspoint_elements
-};
-ffi_type *_ffi_type_nsrect_elements[] = {
-	&ffi_type_nspoint, &ffi_type_nspoint, NULL
-};
-ffi_type ffi_type_nsrect = {
-	0, 0, FFI_TYPE_STRUCT, _ffi_type_nsrect_elements
-};
-#if NSUIntegerMax == ULONG_MAX
-ffi_type *_ffi_type_nsrange_elements[] = {
-	&ffi_type_ulong, &ffi_type_ulong, NULL
-};
-#else
-ffi_type *_ffi_type_nsrange_elements[] = {
-	&ffi_type_uint, &ffi_type_uint, NULL
-};
-#endif
-ffi_type ffi_type_nsrange = {
-	0, 0, FFI_TYPE_STRUCT, _ffi_type_nsrange_elements
+/**
+ * A structure type built from a type encoding.  The ffi_type is the first
+ * field, so a pointer to this structure can be used as an ffi_type pointer.
+ */
+struct LKStructType
+{
+	ffi_type type;
+	/** The encoding of the structure, without qualifiers or following types. */
+	const char *encoding;
+	/** The size of the structure. */
+	NSUInteger size;
 };
 
-struct trampoline
+/**
+ * Structure types that have already been built, keyed by their encoding.
+ * Entries are never freed, because they are referenced by call interfaces
+ * that may be cached.
+ */
+static NSMapTable *StructTypes;
+static pthread_mutex_t StructTypesLock = PTHREAD_MUTEX_INITIALIZER;
+
+static ffi_type *FFITypeForObjCType(const char *typestr);
+
+/**
+ * Returns a structure type containing count elements of the specified type.
+ * libffi has no array type, but this has the same layout.
+ */
+static ffi_type *FFITypeForArray(ffi_type *element, unsigned long count)
 {
-	Class cls;
-	const char *types;
-};
+	ffi_type *array = calloc(1, sizeof(ffi_type));
+	ffi_type **elements = calloc(count + 1, sizeof(ffi_type*));
+	for (unsigned long i=0 ; i<count ; i++)
+	{
+		elements[i] = element;
+	}
+	array->type = FFI_TYPE_STRUCT;
+	array->elements = elements;
+	return array;
+}
+
+/**
+ * Returns a type with the same size and alignment as a union.  libffi can not
+ * describe unions, so this is an array of integers of the union's alignment.
+ */
+static ffi_type *FFITypeForUnion(const char *typestr)
+{
+	NSUInteger size, align;
+	NSGetSizeAndAlignment(typestr, &size, &align);
+	ffi_type *unit;
+	switch (align)
+	{
+		case 8: unit = &ffi_type_uint64; break;
+		case 4: unit = &ffi_type_uint32; break;
+		case 2: unit = &ffi_type_uint16; break;
+		default: unit = &ffi_type_uint8; align = 1;
+	}
+	return FFITypeForArray(unit, size / align);
+}
+
+/**
+ * Returns the type of a field in a structure.  Unlike arguments, arrays and
+ * unions in structures are stored inline.
+ */
+static ffi_type *FFITypeForField(const char *typestr)
+{
+	LKSkipQualifiers(&typestr);
+	switch (*typestr)
+	{
+		case '[':
+		{
+			char *end;
+			unsigned long count = strtoul(typestr + 1, &end, 10);
+			return FFITypeForArray(FFITypeForField(end), count);
+		}
+		case '(':
+			return FFITypeForUnion(typestr);
+		case 'b':
+			[NSException raise: LKInterpreterException
+			            format: @"Bitfields in structures are not supported"];
+	}
+	return FFITypeForObjCType(typestr);
+}
+
+/**
+ * Builds the type for the structure with the specified encoding.  Nested
+ * structures are looked up with StructTypeForEncoding(), so they are shared.
+ */
+static struct LKStructType *BuildStructType(const char *encoding)
+{
+	const char *fields = encoding + 1;
+	while (*fields != '=' && *fields != '}' && *fields != '\0')
+	{
+		fields++;
+	}
+	if (*fields != '=')
+	{
+		[NSException raise: LKInterpreterException
+		            format: @"Can not pass opaque structure %s", encoding];
+	}
+	fields++;
+	unsigned int count = 0;
+	for (const char *f = fields ; *f != '}' && *f != '\0' ; count++)
+	{
+		LKSkipFieldName(&f);
+		LKNextType(&f);
+	}
+	ffi_type **elements = calloc(count + 1, sizeof(ffi_type*));
+	const char *f = fields;
+	for (unsigned int i=0 ; i<count ; i++)
+	{
+		LKSkipFieldName(&f);
+		elements[i] = FFITypeForField(f);
+		LKNextType(&f);
+	}
+	struct LKStructType *type = calloc(1, sizeof(struct LKStructType));
+	type->type.type = FFI_TYPE_STRUCT;
+	type->type.elements = elements;
+	type->encoding = encoding;
+	NSGetSizeAndAlignment(encoding, &type->size, NULL);
+	return type;
+}
+
+/**
+ * Returns the structure type for the first type in the string, building it
+ * if this is the first time that the encoding has been seen.
+ */
+static struct LKStructType *StructTypeForEncoding(const char *typestr)
+{
+	LKSkipQualifiers(&typestr);
+	const char *end = typestr;
+	LKNextType(&end);
+	size_t length = end - typestr;
+	char key[length + 1];
+	memcpy(key, typestr, length);
+	key[length] = '\0';
+
+	pthread_mutex_lock(&StructTypesLock);
+	if (nil == StructTypes)
+	{
+		NSPointerFunctions *keys = [NSPointerFunctions pointerFunctionsWithOptions:
+			NSPointerFunctionsCStringPersonality | NSPointerFunctionsOpaqueMemory];
+		NSPointerFunctions *values = [NSPointerFunctions pointerFunctionsWithOptions:
+			NSPointerFunctionsOpaquePersonality | NSPointerFunctionsOpaqueMemory];
+		StructTypes = [[NSMapTable alloc] initWithKeyPointerFunctions: keys
+		                                        valuePointerFunctions: values
+		                                                     capacity: 32];
+	}
+	struct LKStructType *type = NSMapGet(StructTypes, key);
+	pthread_mutex_unlock(&StructTypesLock);
+	if (NULL != type)
+	{
+		return type;
+	}
+	// Build the type without holding the lock, because nested structures
+	// recursively look up their types.  If another thread builds the same
+	// type in the meantime, keep the first one.
+	struct LKStructType *newType = BuildStructType(strdup(key));
+	pthread_mutex_lock(&StructTypesLock);
+	type = NSMapGet(StructTypes, key);
+	if (NULL == type)
+	{
+		type = newType;
+		NSMapInsert(StructTypes, type->encoding, type);
+	}
+	pthread_mutex_unlock(&StructTypesLock);
+	return type;
+}
 
 static ffi_type *FFITypeForObjCType(const char *typestr)
 {
@@ -89,36 +217,16 @@ static ffi_type *FFITypeForObjCType(const char *typestr)
 			return &ffi_type_double;
 		case ':': 
 			return &ffi_type_pointer;
+		case 'D':
+			return &ffi_type_longdouble;
 		case '{':
-		{
-			if (0 == strncmp(typestr, "{_NSRect", 8))
-			{
-				return &ffi_type_nsrect;
-			}
-            else if (0 == strncmp(typestr, "{CGRect", 7))
-            {
-                return &ffi_type_nsrect;
-            }
-			else if (0 == strncmp(typestr, "{_NSRange", 9))
-			{
-				return &ffi_type_nsrange;
-			}
-			else if (0 == strncmp(typestr, "{_NSPoint", 9))
-			{
-				return &ffi_type_nspoint;
-			}
-			else if (0 == strncmp(typestr, "{_NSSize", 8))
-			{
-				return &ffi_type_nspoint;
-			}
-			[NSException raise: LKInterpreterException  
-			            format: @"ObjC to FFI type conversion not supported for"
-			                    "arbitrary structs"];
-		}
+			return &StructTypeForEncoding(typestr)->type;
 		case 'v':
 			return &ffi_type_void;
 		case '(':
+		case '[':
 		case '^':
+		case '*':
 		case '@':
 		case '#':
 			return &ffi_type_pointer;
@@ -129,279 +237,483 @@ static ffi_type *FFITypeForObjCType(const char *typestr)
 	return NULL;
 }
 
-static id BoxValue(void *value, const char *typestr)
+struct LKTypeConverter;
+
+/**
+ * Boxes a value described by a converter.  The type is only inspected when
+ * the converter is built, so these functions never parse the type string.
+ */
+typedef id (*LKBoxFunction)(void *value, const struct LKTypeConverter *c);
+/**
+ * Unboxes an object to a value described by a converter.
+ */
+typedef void (*LKUnboxFunction)(id value, void *dest,
+                                const struct LKTypeConverter *c);
+
+/**
+ * Converts values of one type in a signature between their C representation
+ * and objects.
+ */
+struct LKTypeConverter
+{
+	/** The type encoding, with qualifiers skipped. */
+	const char *type;
+	/** The libffi type, or NULL if the converter is not part of a signature. */
+	ffi_type *ffiType;
+	/** Function that boxes values of this type. */
+	LKBoxFunction box;
+	/** Function that unboxes objects to values of this type. */
+	LKUnboxFunction unbox;
+	/** The structure type, for structures without special boxing support. */
+	struct LKStructType *structType;
+	/** YES if arguments of this type are retained when sending messages. */
+	BOOL retain;
+	/** The offset of values of this type in an argument frame. */
+	size_t offset;
+};
+
+/**
+ * A type encoding compiled into a call interface and a converter for each
+ * value.  Signatures are built once per distinct encoding and never freed.
+ */
+struct LKSignature
+{
+	/** The type encoding. */
+	const char *types;
+	/** The number of arguments, including the receiver and selector for methods. */
+	unsigned int argc;
+	/** The size of a frame holding all of the unboxed arguments. */
+	size_t frameSize;
+	/** The size of the buffer required for the return value. */
+	size_t returnSize;
+	/** The libffi call interface. */
+	ffi_cif cif;
+	/** The converter for the return value. */
+	struct LKTypeConverter returnType;
+	/** The converters for the arguments. */
+	struct LKTypeConverter args[];
+};
+
+/**
+ * A method implementation created by LKInterpreterMakeIMP().  Trampolines are
+ * shared between all methods that can use the same implementation, and
+ * counted so that the statistics can say which are in use.  They are never
+ * freed, because code that cached the implementation may call it at any time.
+ * A trampoline looks up the method's AST when it is called, so calling one
+ * that is no longer installed still runs the current definition.
+ */
+struct trampoline
+{
+	/** The class that the methods were added to. */
+	Class cls;
+	/**
+	 * The selector, for block implementations, which do not receive _cmd.
+	 * libffi closures read the selector from their arguments, so they are
+	 * shared between selectors and this is NULL.
+	 */
+	SEL sel;
+	/** The method signature. */
+	struct LKSignature *signature;
+	/** The method implementation. */
+	IMP imp;
+	/** The writable address of the libffi closure, or NULL for blocks. */
+	ffi_closure *closure;
+	/** The number of methods using this implementation. */
+	unsigned int refCount;
+	/** The approximate number of bytes used. */
+	size_t size;
+};
+
+#define INTEGER_CONVERTER(name, type, boxMethod, unboxMethod) \
+static id Box ## name(void *value, const struct LKTypeConverter *c)\
+{\
+	return [BigInt boxMethod: *(type*)value];\
+}\
+static void Unbox ## name(id value, void *dest, const struct LKTypeConverter *c)\
+{\
+	*(type*)dest = [value unboxMethod];\
+}
+INTEGER_CONVERTER(Bool, BOOL, bigIntWithLong, boolValue)
+INTEGER_CONVERTER(Char, char, bigIntWithLong, charValue)
+INTEGER_CONVERTER(UnsignedChar, unsigned char, bigIntWithUnsignedLong, unsignedCharValue)
+INTEGER_CONVERTER(Short, short, bigIntWithLong, shortValue)
+INTEGER_CONVERTER(UnsignedShort, unsigned short, bigIntWithUnsignedLong, unsignedShortValue)
+INTEGER_CONVERTER(Int, int, bigIntWithLong, intValue)
+INTEGER_CONVERTER(UnsignedInt, unsigned int, bigIntWithUnsignedLong, unsignedIntValue)
+INTEGER_CONVERTER(Long, long, bigIntWithLongLong, longValue)
+INTEGER_CONVERTER(UnsignedLong, unsigned long, bigIntWithUnsignedLong, unsignedLongValue)
+// FIXME: Incorrect for unsiged long long
+INTEGER_CONVERTER(LongLong, long long, bigIntWithLongLong, longLongValue)
+INTEGER_CONVERTER(UnsignedLongLong, unsigned long long, bigIntWithLongLong, unsignedLongLongValue)
+
+static id BoxFloat(void *value, const struct LKTypeConverter *c)
+{
+	return [BoxedFloat boxedFloatWithFloat: *(float*)value];
+}
+static void UnboxFloat(id value, void *dest, const struct LKTypeConverter *c)
+{
+	*(float*)dest = [value floatValue];
+}
+static id BoxDouble(void *value, const struct LKTypeConverter *c)
+{
+	return [BoxedFloat boxedFloatWithDouble: *(double*)value];
+}
+static void UnboxDouble(id value, void *dest, const struct LKTypeConverter *c)
+{
+	*(double*)dest = [value doubleValue];
+}
+static id BoxSelector(void *value, const struct LKTypeConverter *c)
+{
+	return [Symbol SymbolForSelector: *(SEL*)value];
+}
+static void UnboxSelector(id value, void *dest, const struct LKTypeConverter *c)
+{
+	*(SEL*)dest = [value selValue];
+}
+static id BoxObject(void *value, const struct LKTypeConverter *c)
+{
+	return *(__unsafe_unretained id*)value;
+}
+static void UnboxObject(id value, void *dest, const struct LKTypeConverter *c)
+{
+	*(__unsafe_unretained id*)dest = value;
+}
+static id BoxNil(void *value, const struct LKTypeConverter *c)
+{
+	return nil;
+}
+static void UnboxNothing(id value, void *dest, const struct LKTypeConverter *c) {}
+static void UnboxVoid(id value, void *dest, const struct LKTypeConverter *c)
+{
+	*(void**)dest = NULL;
+}
+static id BoxRect(void *value, const struct LKTypeConverter *c)
+{
+	return [NSValue valueWithRect: *(NSRect*)value];
+}
+static void UnboxRect(id value, void *dest, const struct LKTypeConverter *c)
+{
+	*(NSRect*)dest = [value rectValue];
+}
+static id BoxRange(void *value, const struct LKTypeConverter *c)
+{
+	return [NSValue valueWithRange: *(NSRange*)value];
+}
+static void UnboxRange(id value, void *dest, const struct LKTypeConverter *c)
+{
+	*(NSRange*)dest = [value rangeValue];
+}
+static id BoxPoint(void *value, const struct LKTypeConverter *c)
+{
+	return [NSValue valueWithPoint: *(NSPoint*)value];
+}
+static void UnboxPoint(id value, void *dest, const struct LKTypeConverter *c)
+{
+	*(NSPoint*)dest = [value pointValue];
+}
+static id BoxSize(void *value, const struct LKTypeConverter *c)
+{
+	return [NSValue valueWithSize: *(NSSize*)value];
+}
+static void UnboxSize(id value, void *dest, const struct LKTypeConverter *c)
+{
+	*(NSSize*)dest = [value sizeValue];
+}
+static id BoxStruct(void *value, const struct LKTypeConverter *c)
+{
+	return [NSValue valueWithBytes: value objCType: c->structType->encoding];
+}
+static void UnboxCompound(id value, void *dest, const struct LKTypeConverter *c)
+{
+	[NSException raise: LKInterpreterException  
+	            format: @"Unable to transmogriy object to"
+	                    "compound type: %s\n", c->type];
+}
+static void UnboxStruct(id value, void *dest, const struct LKTypeConverter *c)
+{
+	// Any other structure must be in an NSValue of the same type.  Values of
+	// other types with the same size would be reinterpreted silently.
+	if ([value isKindOfClass: [NSValue class]] &&
+	    LKTypesMatch([value objCType], c->structType->encoding))
+	{
+		[value getValue: dest];
+		return;
+	}
+	UnboxCompound(value, dest, c);
+}
+static id BoxOther(void *value, const struct LKTypeConverter *c)
+{
+	NSLog(@"Warning: using +[NSValue valueWithBytes:objCType:]");
+	return [NSValue valueWithBytes: value objCType: c->type];
+}
+
+/**
+ * Selects the functions that convert values of the first type in typestr.
+ * This is the only place where the boxing code looks at type encodings.
+ */
+static void InitConverter(struct LKTypeConverter *c, const char *typestr)
 {
 	LKSkipQualifiers(&typestr);
-	
+	memset(c, 0, sizeof(struct LKTypeConverter));
+	c->type = typestr;
+	c->box = BoxOther;
+	c->unbox = UnboxCompound;
 	switch(*typestr)
 	{
-		case 'B':
-			return [BigInt bigIntWithLong: *(BOOL*)value];
-		case 'c':
-			return [BigInt bigIntWithLong: *(char*)value];
-		case 'C':
-			return [BigInt bigIntWithUnsignedLong: *(unsigned char*)value];
-		case 's':
-			return [BigInt bigIntWithLong: *(short*)value];
-		case 'S':
-			return [BigInt bigIntWithUnsignedLong: *(unsigned short*)value];
-		case 'i':
-			return [BigInt bigIntWithLong: *(int*)value];
-		case 'I':
-			return [BigInt bigIntWithUnsignedLong: *(unsigned int*)value];
-		case 'l':
-			return [BigInt bigIntWithLongLong: *(long*)value];
-		case 'L':
-			return [BigInt bigIntWithUnsignedLong: *(unsigned long*)value];
-		case 'q': case 'Q': // FIXME: Incorrect for unsiged long long
-			return [BigInt bigIntWithLongLong: *(long long*)value];
-		case 'f': 
-			return [BoxedFloat boxedFloatWithFloat: *(float*)value];
-		case 'd':
-			return [BoxedFloat boxedFloatWithFloat: *(double*)value];
-		case ':': 
-			return [Symbol SymbolForSelector: *(SEL*)value];
+#define CONVERTER(ch, name) \
+		case ch: c->box = Box ## name; c->unbox = Unbox ## name; break;
+		CONVERTER('B', Bool)
+		CONVERTER('c', Char)
+		CONVERTER('C', UnsignedChar)
+		CONVERTER('s', Short)
+		CONVERTER('S', UnsignedShort)
+		CONVERTER('i', Int)
+		CONVERTER('I', UnsignedInt)
+		CONVERTER('l', Long)
+		CONVERTER('L', UnsignedLong)
+		CONVERTER('q', LongLong)
+		CONVERTER('Q', UnsignedLongLong)
+		CONVERTER('f', Float)
+		CONVERTER('d', Double)
+		CONVERTER(':', Selector)
+#undef CONVERTER
+		case '(':
+		case '^': // FIXME: properly box pointers!
+			c->box = BoxNil;
+			c->unbox = UnboxNothing;
+			if (strncmp(typestr, @encode(LKObject), strlen(@encode(LKObject))) == 0)
+			{
+				c->unbox = UnboxObject;
+			}
+			break;
+		case '@':
+			c->retain = YES;
+		case '#':
+			c->box = BoxObject;
+			c->unbox = UnboxObject;
+			break;
+		case 'v':
+			// Map void returns to nil
+			c->box = BoxNil;
+			c->unbox = UnboxVoid;
+			break;
 		case '{':
-		{
-			if (0 == strncmp(typestr, "{_NSRect", 8))
+			if ((0 == strncmp(typestr, "{_NSRect", 8)) ||
+			    (0 == strncmp(typestr, "{CGRect", 7)))
 			{
-				return [NSValue valueWithRect: *(NSRect*)value];
+				c->box = BoxRect;
+				c->unbox = UnboxRect;
 			}
-            else if (0 == strncmp(typestr, "{CGRect", 7))
-            {
-                return [NSValue valueWithRect: *(NSRect*)value];
-            }
 			else if (0 == strncmp(typestr, "{_NSRange", 9))
 			{
-				return [NSValue valueWithRange: *(NSRange*)value];
+				c->box = BoxRange;
+				c->unbox = UnboxRange;
 			}
 			else if (0 == strncmp(typestr, "{_NSPoint", 9))
 			{
-				return [NSValue valueWithPoint: *(NSPoint*)value];
+				c->box = BoxPoint;
+				c->unbox = UnboxPoint;
 			}
 			else if (0 == strncmp(typestr, "{_NSSize", 8))
 			{
-				return [NSValue valueWithSize: *(NSSize*)value];
+				c->box = BoxSize;
+				c->unbox = UnboxSize;
 			}
-			[NSException raise: LKInterpreterException  
-			            format: @"Boxing arbitrary structures doesn't work yet."];
-		}
-		case '^': // FIXME: properly box pointers!
-			// Map void returns to nil
-		case 'v':
-			return nil;
-			// If it's already an object, we don't need to do anything
-		case '(':
-			return nil;
-		case '@':
-		case '#':
-			return *(__unsafe_unretained id*)value;
-			// Other types, just wrap them up in an NSValue
-		default:
-			NSLog(@"Warning: using +[NSValue valueWithBytes:objCType:]");
-			return [NSValue valueWithBytes: value objCType: typestr];
+			else
+			{
+				c->structType = StructTypeForEncoding(typestr);
+				c->box = BoxStruct;
+				c->unbox = UnboxStruct;
+			}
+			break;
 	}
 }
 
+static id BoxValue(void *value, const char *typestr)
+{
+	struct LKTypeConverter c;
+	InitConverter(&c, typestr);
+	return c.box(value, &c);
+}
+
 static void UnboxValue(id value, void *dest, const char *objctype)
 {
-	LKSkipQualifiers(&objctype);
+	struct LKTypeConverter c;
+	InitConverter(&c, objctype);
+	c.unbox(value, dest, &c);
+}
+
+OBJC_EXPORT id objc_retain(id value);
+
+/**
+ * Signatures that have already been compiled, keyed by their type encoding.
+ */
+static NSMapTable *Signatures;
+static pthread_mutex_t SignaturesLock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Compiles a type encoding into a signature.  The encoding must remain valid
+ * for the lifetime of the signature.
+ */
+static struct LKSignature *BuildSignature(const char *types)
+{
+	unsigned int argc = LKCountObjCTypes(types) - 1;
+	struct LKSignature *sig = calloc(1, sizeof(struct LKSignature) +
+		argc * sizeof(struct LKTypeConverter));
+	ffi_type **ffiTypes = calloc(argc + 1, sizeof(ffi_type*));
+	sig->types = types;
+	sig->argc = argc;
 
-	switch(*objctype)
+	const char *type = types;
+	InitConverter(&sig->returnType, type);
+	sig->returnType.ffiType = FFITypeForObjCType(type);
+	LKNextType(&type);
+	for (unsigned int i=0 ; i<argc ; i++)
 	{
-		case 'c':
-			*(char*)dest = [value charValue];
-			break;
-		case 'C':
-			*(unsigned char*)dest = [value unsignedCharValue];
-			break;
-		case 's':
-			*(short*)dest = [value shortValue];
-			break;
-		case 'S':
-			*(unsigned short*)dest = [value unsignedShortValue];
-			break;
-		case 'i':
-			*(int*)dest = [value intValue];
-			break;
-		case 'I':
-			*(unsigned int*)dest = [value unsignedIntValue];
-			break;
-		case 'l':
-			*(long*)dest = [value longValue];
-			break;
-		case 'L':
-			*(unsigned long*)dest = [value unsignedLongValue];
-			break;
-		case 'q':
-			*(long long*)dest = [value longLongValue];
-			break;
-		case 'Q':
-			*(unsigned long long*)dest = [value unsignedLongLongValue];
-			break;
-		case 'f':
-			*(float*)dest = [value floatValue];
-			break;
-		case 'd':
-			*(double*)dest = [value doubleValue];
-			break;
-		case 'B':
-			*(BOOL*)dest = [value boolValue];
-			break;
-		case ':':
-			*(SEL*)dest = [value selValue];
-			break;
-		case '(':
-		case '^':
-			if (strncmp(objctype, @encode(LKObject), strlen(@encode(LKObject))) != 0)
-			{
-				break;
-			}
-		case '#':
-            *(__unsafe_unretained id*)dest = value; // catlan: hmm?
-		case '@':
-			*(__unsafe_unretained id*)dest = value;
-			return;
-		case 'v':
-			*(void**)dest = NULL;
-			return;
-		case '{':
-		{
-			if (0 == strncmp(objctype, "{_NSRect", 8))
-			{
-				*(NSRect*)dest = [value rectValue];
-				break;
-			}
-            else if (0 == strncmp(objctype, "{CGRect", 7))
-            {
-                *(NSRect*)dest = [value rectValue];
-                break;
-            }
-			else if (0 == strncmp(objctype, "{_NSRange", 9))
-			{
-				*(NSRange*)dest = [value rangeValue];
-				break;
-			}
-			else if (0 == strncmp(objctype, "{_NSPoint", 9))
-			{
-				*(NSPoint*)dest = [value pointValue];
-				break;
-			}
-			else if (0 == strncmp(objctype, "{_NSSize", 8))
-			{
-				*(NSSize*)dest = [value sizeValue];
-				break;
-			}
-		}
-		default:
-			[NSException raise: LKInterpreterException  
-			            format: @"Unable to transmogriy object to"
-			                    "compound type: %s\n", objctype];
+		InitConverter(&sig->args[i], type);
+		ffiTypes[i] = sig->args[i].ffiType = FFITypeForObjCType(type);
+		LKNextType(&type);
+	}
+	if (FFI_OK != ffi_prep_cif(&sig->cif, FFI_DEFAULT_ABI, argc,
+	                           sig->returnType.ffiType, ffiTypes))
+	{
+		[NSException raise: LKInterpreterException
+		            format: @"Error preparing call signature"];
 	}
+	// ffi_prep_cif() has now computed the size and alignment of every type,
+	// including structures.
+	size_t offset = 0;
+	for (unsigned int i=0 ; i<argc ; i++)
+	{
+		ffi_type *ty = sig->args[i].ffiType;
+		offset = (offset + ty->alignment - 1) & ~(size_t)(ty->alignment - 1);
+		sig->args[i].offset = offset;
+		offset += ty->size;
+	}
+	sig->frameSize = offset;
+	sig->returnSize = MAX(sig->returnType.ffiType->size, sizeof(ffi_arg));
+	return sig;
 }
 
-OBJC_EXPORT id objc_retain(id value);
+/**
+ * Returns the compiled signature for a type encoding, compiling it if this is
+ * the first time that the encoding has been seen.
+ */
+static struct LKSignature *SignatureForTypes(const char *types)
+{
+	pthread_mutex_lock(&SignaturesLock);
+	if (nil == Signatures)
+	{
+		NSPointerFunctions *keys = [NSPointerFunctions pointerFunctionsWithOptions:
+			NSPointerFunctionsCStringPersonality | NSPointerFunctionsOpaqueMemory];
+		NSPointerFunctions *values = [NSPointerFunctions pointerFunctionsWithOptions:
+			NSPointerFunctionsOpaquePersonality | NSPointerFunctionsOpaqueMemory];
+		Signatures = [[NSMapTable alloc] initWithKeyPointerFunctions: keys
+		                                       valuePointerFunctions: values
+		                                                    capacity: 64];
+	}
+	struct LKSignature *sig = NSMapGet(Signatures, types);
+	pthread_mutex_unlock(&SignaturesLock);
+	if (NULL != sig)
+	{
+		return sig;
+	}
+	// Building the signature may build structure types, which take their own
+	// lock, so do it without holding this one.
+	struct LKSignature *newSig = BuildSignature(strdup(types));
+	pthread_mutex_lock(&SignaturesLock);
+	sig = NSMapGet(Signatures, types);
+	if (NULL == sig)
+	{
+		sig = newSig;
+		NSMapInsert(Signatures, sig->types, sig);
+	}
+	pthread_mutex_unlock(&SignaturesLock);
+	return sig;
+}
 
-static void RetainValue(id value, const char *objctype)
-{
-    LKSkipQualifiers(&objctype);
-    
-    switch(*objctype)
-    {
-        case 'c':
-            break;
-        case 'C':
-            break;
-        case 's':
-            break;
-        case 'S':
-            break;
-        case 'i':
-            break;
-        case 'I':
-            break;
-        case 'l':
-            break;
-        case 'L':
-            break;
-        case 'q':
-            break;
-        case 'Q':
-            break;
-        case 'f':
-            break;
-        case 'd':
-            break;
-        case 'B':
-            break;
-        case ':':
-            break;
-        case '(':
-        case '^':
-            if (strncmp(objctype, @encode(LKObject), strlen(@encode(LKObject))) != 0)
-            {
-                break;
-            }
-        case '#':
-            break;
-        case '@':
-            objc_retain(value);
-            return;
-        case 'v':
-            return;
-        case '{':
-        {
-            break;
-        }
-        default:
-            [NSException raise: LKInterpreterException
-                        format: @"Unable to transmogriy object to"
-             "compound type: %s\n", objctype];
-    }
+/**
+ * Returns the compiled signature for a method signature.  The key is built by
+ * concatenating the types, which does not require parsing them.
+ */
+static struct LKSignature *SignatureForMethodSignature(NSMethodSignature *sig)
+{
+	NSUInteger count = [sig numberOfArguments];
+	const char *types[count + 1];
+	size_t lengths[count + 1];
+	size_t total = 0;
+	types[0] = [sig methodReturnType];
+	for (NSUInteger i=0 ; i<count ; i++)
+	{
+		types[i+1] = [sig getArgumentTypeAtIndex: i];
+	}
+	for (NSUInteger i=0 ; i<=count ; i++)
+	{
+		lengths[i] = strlen(types[i]);
+		total += lengths[i];
+	}
+	char key[total + 1];
+	char *end = key;
+	for (NSUInteger i=0 ; i<=count ; i++)
+	{
+		memcpy(end, types[i], lengths[i]);
+		end += lengths[i];
+	}
+	*end = '\0';
+	return SignatureForTypes(key);
+}
+
+/**
+ * Unboxes the arguments into frame and fills in the argument pointers for
+ * ffi_call(), starting at the argument with index first.  If retain is YES,
+ * object arguments are retained, except for those whose bits are set in
+ * stackBlocks.
+ */
+static void UnboxArguments(struct LKSignature *sig, unsigned int first,
+                           const id *args, BOOL retain, uint32_t stackBlocks,
+                           char *frame, void **unboxedArguments)
+{
+	for (unsigned int i=first ; i<sig->argc ; i++)
+	{
+		struct LKTypeConverter *c = &sig->args[i];
+		void *dest = frame + c->offset;
+		unsigned int index = i - first;
+		id arg = args[index];
+		c->unbox(arg, dest, c);
+		// Retaining a block on the stack copies it to the heap.
+		if (retain && c->retain &&
+		    ((index >= 32) || !(stackBlocks & (1U << index))))
+		{
+			objc_retain(arg);
+		}
+		unboxedArguments[i] = dest;
+	}
 }
 
 id LKCallFunction(NSString *functionName, NSString *types,
                  unsigned int argc, const id *args)
 {
-	NSMethodSignature *sig = [NSMethodSignature signatureWithObjCTypes: [types UTF8String]];
+	struct LKSignature *sig = SignatureForTypes([types UTF8String]);
 	void *function = dlsym(RTLD_DEFAULT, [functionName UTF8String]);
 	if (NULL == function)
 	{
 		[NSException raise: LKInterpreterException
 		            format: @"Could not look up function %@", functionName];
 	}
-
-	// Prepare FFI types
-	const char *returnObjCType = [sig methodReturnType];
-	ffi_type *ffi_ret_ty = FFITypeForObjCType(returnObjCType);
-	ffi_type *ffi_tys[argc];
-	for (unsigned int i = 0; i < argc; i++)
-	{
-		const char *objCType = [sig getArgumentTypeAtIndex: i];
-		ffi_tys[i] = FFITypeForObjCType(objCType);
-	}
-	
-	ffi_cif cif;
-	if (FFI_OK != ffi_prep_cif(&cif,  FFI_DEFAULT_ABI, argc, ffi_ret_ty, ffi_tys))
+	if (argc != sig->argc)
 	{
 		[NSException raise: LKInterpreterException
-		            format: @"Error preparing call signature"];
+		            format: @"Tried to call %@ with %d arguments", functionName, argc];
 	}
-	
-	// Prepare actual args. Use more space than needed
-	char unboxedArgumentsBuffer[[sig numberOfArguments]][[sig frameLength]];
-	void *unboxedArguments[[sig numberOfArguments]];
-	for (unsigned int i = 0; i < argc; i++)
-	{
-		const char *objCType = [sig getArgumentTypeAtIndex: i];
-		UnboxValue(args[i], unboxedArgumentsBuffer[i], objCType);
-		unboxedArguments[i] = unboxedArgumentsBuffer[i];
-	}
-	
-	char msgSendRet[[sig methodReturnLength]];
-	ffi_call(&cif, function, &msgSendRet, unboxedArguments);
-	
-	return BoxValue(msgSendRet, [sig methodReturnType]);
+
+	char frame[sig->frameSize + 1] __attribute__((aligned(16)));
+	void *unboxedArguments[argc + 1];
+	UnboxArguments(sig, 0, args, NO, 0, frame, unboxedArguments);
+
+	char ret[sig->returnSize] __attribute__((aligned(16)));
+	ffi_call(&sig->cif, function, ret, unboxedArguments);
+
+	return sig->returnType.box(ret, &sig->returnType);
 }
 
 static BOOL isInMethodFamily(NSString *selName, NSString *family)
@@ -417,27 +729,130 @@ static BOOL isInMethodFamily(NSString *selName, NSString *family)
 	return isupper([selName characterAtIndex: [family length]]);
 }
 
-id LKSendMessage(NSString *className, id receiver, NSString *selName,
-                 unsigned int argc, const id *args)
+/**
+ * Number of entries in the message send cache.  Must be a power of two.
+ */
+#define SEND_CACHE_SIZE 1024
+
+/**
+ * An entry in the message send cache.  Entries are updated with a sequence
+ * lock: the sequence number is odd while a writer is updating the entry, and
+ * readers retry (or treat the lookup as a miss) if it changed while they were
+ * reading.  Neither readers nor writers ever block.
+ */
+struct LKSendCacheEntry
 {
-	if (receiver == nil)
+	/** Sequence number, odd while the entry is being written. */
+	unsigned long sequence;
+	/** The generation in which the entry was stored. */
+	unsigned long generation;
+	/** The class of the receiver. */
+	const void *cls;
+	/** The selector. */
+	SEL sel;
+	/** The compiled signature of the method. */
+	struct LKSignature *signature;
+	/** Whether the result must be autoreleased, from the method family. */
+	BOOL autoreleaseResult;
+};
+
+static struct LKSendCacheEntry SendCache[SEND_CACHE_SIZE];
+/**
+ * Incremented to invalidate every entry in the send cache.
+ */
+static unsigned long SendCacheGeneration;
+
+void LKInterpreterInvalidateSignatureCache(void)
+{
+	__atomic_add_fetch(&SendCacheGeneration, 1, __ATOMIC_SEQ_CST);
+}
+
+static inline struct LKSendCacheEntry *SendCacheEntry(Class cls, SEL sel)
+{
+	uintptr_t hash = ((uintptr_t)cls >> 4) ^ ((uintptr_t)sel >> 3);
+	return &SendCache[hash & (SEND_CACHE_SIZE - 1)];
+}
+
+/**
+ * Looks up the signature of a method in the send cache.  Returns NO on a
+ * miss.
+ */
+static inline BOOL LookupSendCache(Class cls, SEL sel,
+                                   struct LKSignature **signature,
+                                   BOOL *autoreleaseResult)
+{
+	struct LKSendCacheEntry *e = SendCacheEntry(cls, sel);
+	unsigned long sequence = __atomic_load_n(&e->sequence, __ATOMIC_ACQUIRE);
+	if (sequence & 1)
 	{
-		return nil;
+		return NO;
+	}
+	BOOL hit = (__atomic_load_n(&e->cls, __ATOMIC_RELAXED) == (__bridge const void*)cls) &&
+		(__atomic_load_n(&e->sel, __ATOMIC_RELAXED) == sel) &&
+		(__atomic_load_n(&e->generation, __ATOMIC_RELAXED) ==
+		 __atomic_load_n(&SendCacheGeneration, __ATOMIC_ACQUIRE));
+	*signature = __atomic_load_n(&e->signature, __ATOMIC_RELAXED);
+	*autoreleaseResult = __atomic_load_n(&e->autoreleaseResult, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return hit && (__atomic_load_n(&e->sequence, __ATOMIC_RELAXED) == sequence);
+}
+
+/**
+ * Stores the signature of a method in the send cache.  The generation must be
+ * read before the signature was looked up: if the cache has been invalidated
+ * since then, the signature may be stale and is not stored.  If another thread
+ * is updating the same entry, the value is simply not cached.
+ */
+static void StoreSendCache(Class cls, SEL sel, struct LKSignature *signature,
+                           BOOL autoreleaseResult, unsigned long generation)
+{
+	if (__atomic_load_n(&SendCacheGeneration, __ATOMIC_ACQUIRE) != generation)
+	{
+		return;
+	}
+	struct LKSendCacheEntry *e = SendCacheEntry(cls, sel);
+	unsigned long sequence = __atomic_load_n(&e->sequence, __ATOMIC_RELAXED);
+	if ((sequence & 1) ||
+	    !__atomic_compare_exchange_n(&e->sequence, &sequence, sequence + 1, NO,
+	                                 __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+	{
+		return;
 	}
-	BOOL autoreleaseResult = NO;
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	// If the cache was invalidated after the check above, readers will see
+	// that the stored generation is out of date.
+	__atomic_store_n(&e->generation, generation, __ATOMIC_RELAXED);
+	__atomic_store_n(&e->cls, (__bridge const void*)cls, __ATOMIC_RELAXED);
+	__atomic_store_n(&e->sel, sel, __ATOMIC_RELAXED);
+	__atomic_store_n(&e->signature, signature, __ATOMIC_RELAXED);
+	__atomic_store_n(&e->autoreleaseResult, autoreleaseResult, __ATOMIC_RELAXED);
+	__atomic_store_n(&e->sequence, sequence + 2, __ATOMIC_RELEASE);
+}
+
+/**
+ * Looks up the signature of the method that a message send will call, and
+ * whether its result must be autoreleased.  This is the slow path, taken
+ * when the send cache misses.
+ */
+static struct LKSignature *SignatureForSend(id receiver, Class cls, SEL sel,
+                                            NSString *selName,
+                                            BOOL *autoreleaseResult)
+{
+	unsigned long generation =
+		__atomic_load_n(&SendCacheGeneration, __ATOMIC_ACQUIRE);
+	*autoreleaseResult = NO;
 	if (isInMethodFamily(selName, @"alloc") ||
 	    isInMethodFamily(selName, @"new") ||
 	    isInMethodFamily(selName, @"copy") ||
 	    isInMethodFamily(selName, @"mutableCopy"))
 	{
-		autoreleaseResult = YES;
+		*autoreleaseResult = YES;
 	}
 	else if (isInMethodFamily(selName, @"init"))
 	{
-		autoreleaseResult = YES;
+		*autoreleaseResult = YES;
 	}
 
-	SEL sel = sel_getUid([selName UTF8String]);
     NSMethodSignature *sig = nil;
     @try {
         sig = [receiver methodSignatureForSelector: sel];
@@ -450,7 +865,41 @@ id LKSendMessage(NSString *className, id receiver, NSString *selName,
 		[NSException raise: LKInterpreterException
 		            format: @"Couldn't determine type for selector %@", selName];
 	}
-	if (argc + 2 != [sig numberOfArguments])
+	struct LKSignature *signature = SignatureForMethodSignature(sig);
+	// Only cache signatures for methods that the class implements.  Objects
+	// that forward messages may return a different signature each time.
+	if (NULL != class_getInstanceMethod(cls, sel))
+	{
+		StoreSendCache(cls, sel, signature, *autoreleaseResult, generation);
+	}
+	return signature;
+}
+
+id LKSendMessage(NSString *className, id receiver, NSString *selName,
+                 unsigned int argc, const id *args)
+{
+	return LKSendMessageWithStackBlocks(className, receiver, selName, argc,
+	                                    args, 0);
+}
+
+id LKSendMessageWithStackBlocks(NSString *className, id receiver,
+                                NSString *selName, unsigned int argc,
+                                const id *args, uint32_t stackBlocks)
+{
+	if (receiver == nil)
+	{
+		return nil;
+	}
+	SEL sel = sel_getUid([selName UTF8String]);
+	Class receiverClass = object_getClass(receiver);
+	struct LKSignature *signature;
+	BOOL autoreleaseResult;
+	if (!LookupSendCache(receiverClass, sel, &signature, &autoreleaseResult))
+	{
+		signature = SignatureForSend(receiver, receiverClass, sel, selName,
+		                             &autoreleaseResult);
+	}
+	if (argc + 2 != signature->argc)
 	{
 		[NSException raise: LKInterpreterException
 					format: @"Tried to call %@ with %d arguments", selName, argc];
@@ -475,7 +924,7 @@ id LKSendMessage(NSString *className, id receiver, NSString *selName,
 #else
 	if (className)
 	{
-		switch (*[sig methodReturnType])
+		switch (*signature->returnType.type)
 		{
 			case '{':
 				methodIMP = objc_msgSendSuper_stret;
@@ -496,7 +945,7 @@ id LKSendMessage(NSString *className, id receiver, NSString *selName,
 	}
 	else
 	{
-		switch (*[sig methodReturnType])
+		switch (*signature->returnType.type)
 		{
 			case '{':
 				methodIMP = objc_msgSend_stret;
@@ -519,49 +968,26 @@ id LKSendMessage(NSString *className, id receiver, NSString *selName,
 	}
 #endif
 	
-	// Prepare FFI types
-	const char *returnObjCType = [sig methodReturnType];
-	ffi_type *ffi_ret_ty = FFITypeForObjCType(returnObjCType);
-	ffi_type *ffi_tys[argc + 2];
-	for (unsigned int i = 0; i < (argc + 2); i++)
-	{
-		const char *objCType = [sig getArgumentTypeAtIndex: i];
-		ffi_tys[i] = FFITypeForObjCType(objCType);
-	}
+	// Unbox the arguments using the compiled converters
+	char frame[signature->frameSize + 1] __attribute__((aligned(16)));
+	void *unboxedArguments[argc + 2];
+	unboxedArguments[0] = &receiver;
+	unboxedArguments[1] = &sel;
+	UnboxArguments(signature, 2, args, YES, stackBlocks, frame, unboxedArguments);
 	
-	ffi_cif cif;
-	if (FFI_OK != ffi_prep_cif(&cif,  FFI_DEFAULT_ABI, argc + 2, ffi_ret_ty, ffi_tys))
+	char msgSendRet[signature->returnSize] __attribute__((aligned(16)));
+	if (methodIMP == objc_msgSend_stret )
 	{
-		[NSException raise: LKInterpreterException
-		            format: @"Error preparing call signature"];
+		// http://www.cocoabuilder.com/archive/cocoa/200146-returning-values-from-objc-msgsend-etc.html
+		methodIMP = objc_msgSend;
+		ffi_call(&signature->cif, methodIMP, msgSendRet, unboxedArguments);
 	}
-	
-	// Prepare actual args. Use more space than needed
-	char unboxedArgumentsBuffer[[sig numberOfArguments]][[sig frameLength]];
-	void *unboxedArguments[[sig numberOfArguments]];
-	unboxedArguments[0] = &receiver;
-	unboxedArguments[1] = &sel;
-	for (unsigned int i = 0; i < argc; i++)
+	else
 	{
-		const char *objCType = [sig getArgumentTypeAtIndex: i + 2];
-		UnboxValue(args[i], unboxedArgumentsBuffer[i + 2], objCType);
-        RetainValue(args[i], objCType);
-		unboxedArguments[i + 2] = unboxedArgumentsBuffer[i + 2];
+		ffi_call(&signature->cif, methodIMP, msgSendRet, unboxedArguments);
 	}
-	
-	char msgSendRet[[sig methodReturnLength]];
-    if (methodIMP == objc_msgSend_stret )
-    {
-        // http://www.cocoabuilder.com/archive/cocoa/200146-returning-values-from-objc-msgsend-etc.html
-        methodIMP = objc_msgSend;
-        ffi_call(&cif, methodIMP, &msgSendRet, unboxedArguments);
-    }
-    else
-    {
-        ffi_call(&cif, methodIMP, &msgSendRet, unboxedArguments);
-    }
-    
-	id result = BoxValue(msgSendRet, [sig methodReturnType]);
+
+	id result = signature->returnType.box(msgSendRet, &signature->returnType);
 	if (autoreleaseResult)
 	{
 		objc_retainAutoreleaseReturnValue(result);
@@ -604,85 +1030,285 @@ BOOL LKSetIvar(id receiver, NSString *name, id value)
 	return YES;
 }
 
+/**
+ * Trampolines, keyed by class, selector and signature, so that methods that
+ * can share an implementation do.
+ */
+static NSMapTable *Trampolines;
+/**
+ * Trampolines keyed by their implementation.
+ */
+static NSMapTable *TrampolinesByIMP;
+/**
+ * Counters reported by LKInterpreterTrampolineStatistics().
+ */
+static struct LKTrampolineStatistics TrampolineStatistics;
+/**
+ * Protects the trampoline tables and the statistics.
+ */
+static pthread_mutex_t TrampolinesLock = PTHREAD_MUTEX_INITIALIZER;
+
+static NSUInteger HashTrampoline(const void *item,
+                                 NSUInteger (*size)(const void *item))
+{
+	const struct trampoline *t = item;
+	return ((uintptr_t)t->cls >> 4) ^ ((uintptr_t)t->sel >> 2) ^
+		((uintptr_t)t->signature >> 3);
+}
+
+static BOOL IsEqualTrampoline(const void *item1, const void *item2,
+                              NSUInteger (*size)(const void *item))
+{
+	const struct trampoline *t1 = item1;
+	const struct trampoline *t2 = item2;
+	return (t1->cls == t2->cls) && (t1->sel == t2->sel) &&
+		(t1->signature == t2->signature);
+}
+
 static void LKInterpreterFFITrampoline(ffi_cif *cif, void *ret, 
                                        void **args, void *user_data)
 {
 	struct trampoline *t = user_data;
 	Class cls = t->cls;
+	struct LKSignature *sig = t->signature;
 	
 	id receiver = *((__unsafe_unretained id*)args[0]);
 	SEL cmd = *((SEL*)args[1]);
-	const char *objctype = t->types;
 
 	LKMethod *methodASTNode = LKASTForMethod(cls, 
 		[NSString stringWithUTF8String: sel_getName(cmd)]);
 	
-	id returnObject;
-	if (cif->nargs - 2 == 0)
-	{
-		returnObject = [methodASTNode executeWithReciever: receiver
-		                                        arguments: NULL
-		                                            count: 0];
-	}
-	else 
-	{
-		id argumentObjects[cif->nargs - 2];
-		
-		const char *argtypes = objctype;
-		// Skip the return type, recevier type, and selector type
-		LKNextType(&argtypes);
-		LKNextType(&argtypes);
-		LKNextType(&argtypes);
-		for (unsigned int i=0; i<cif->nargs - 2; i++)
+	// Box the arguments, skipping the receiver and selector
+	unsigned int argc = sig->argc - 2;
+	id argumentObjects[argc + 1];
+	for (unsigned int i=0; i<argc; i++)
+	{
+		struct LKTypeConverter *c = &sig->args[i+2];
+		argumentObjects[i] = c->box(args[i+2], c);
+	}
+	id returnObject = [methodASTNode executeWithReciever: receiver
+	                                           arguments: argumentObjects
+	                                               count: argc];
+	
+	sig->returnType.unbox(returnObject, ret, &sig->returnType);
+}
+
+/**
+ * Returns YES if a signature takes and returns only objects, and has no more
+ * arguments than the specialised trampolines handle.  The return type may
+ * also be void.
+ */
+static BOOL IsObjectSignature(struct LKSignature *sig)
+{
+	if ((sig->argc < 2) || (sig->argc - 2 > 8))
+	{
+		return NO;
+	}
+	char ret = *sig->returnType.type;
+	if ((ret != '@') && (ret != 'v'))
+	{
+		return NO;
+	}
+	for (unsigned int i=2 ; i<sig->argc ; i++)
+	{
+		if (*sig->args[i].type != '@')
 		{
-			argumentObjects[i] = BoxValue(args[i+2], argtypes);
-			LKNextType(&argtypes);
+			return NO;
 		}
-		returnObject = [methodASTNode executeWithReciever: receiver
-		                                        arguments: argumentObjects
-		                                            count: cif->nargs - 2];
 	}
-	
-	UnboxValue(returnObject, ret, objctype);
+	return YES;
 }
 
-IMP LKInterpreterMakeIMP(Class cls, const char *objctype)
+/**
+ * Interprets a method called through one of the specialised trampolines.
+ */
+static id CallInterpretedMethod(Class cls, NSString *selName, id receiver,
+                                const id *args, int count)
 {
-	struct trampoline *t = malloc(sizeof(struct trampoline));
-	t->cls = cls;
-	t->types = strdup(objctype);
+	LKMethod *methodASTNode = LKASTForMethod(cls, selName);
+	return [methodASTNode executeWithReciever: receiver
+	                                arguments: args
+	                                    count: count];
+}
 
-	int nargs = LKCountObjCTypes(objctype);
-	ffi_type *ffi_ret_ty;
-	ffi_type **ffi_tys = malloc((nargs - 1) * sizeof(ffi_type*));
-	
-	ffi_ret_ty = FFITypeForObjCType(objctype);
-	LKNextType(&objctype);
-	for (unsigned int i=0; i<nargs-1; i++)
+#define PARAMS0
+#define PARAMS1 , id a0
+#define PARAMS2 PARAMS1, id a1
+#define PARAMS3 PARAMS2, id a2
+#define PARAMS4 PARAMS3, id a3
+#define PARAMS5 PARAMS4, id a4
+#define PARAMS6 PARAMS5, id a5
+#define PARAMS7 PARAMS6, id a6
+#define PARAMS8 PARAMS7, id a7
+#define OBJECT_TRAMPOLINE(n, ...) \
+	case n:\
+		if (returnsVoid)\
+		{\
+			block = ^(id self PARAMS ## n)\
+				{\
+					id args[] = { __VA_ARGS__ };\
+					CallInterpretedMethod(cls, selName, self, args, n);\
+				};\
+		}\
+		else\
+		{\
+			block = ^id(id self PARAMS ## n)\
+				{\
+					id args[] = { __VA_ARGS__ };\
+					return CallInterpretedMethod(cls, selName, self, args, n);\
+				};\
+		}\
+		break;
+
+/**
+ * Returns a method implementation for a method that only takes and returns
+ * objects.  These are implemented as blocks with the same signature as the
+ * method, so arguments are passed straight through without libffi or boxing.
+ */
+static IMP MakeObjectIMP(Class cls, SEL sel, struct LKSignature *sig)
+{
+	NSString *selName = [NSString stringWithUTF8String: sel_getName(sel)];
+	BOOL returnsVoid = (*sig->returnType.type == 'v');
+	id block = nil;
+	switch (sig->argc - 2)
 	{
-		ffi_tys[i] = FFITypeForObjCType(objctype);
-		LKNextType(&objctype);
+		case 0:
+			if (returnsVoid)
+			{
+				block = ^(id self)
+					{
+						CallInterpretedMethod(cls, selName, self, NULL, 0);
+					};
+			}
+			else
+			{
+				block = ^id(id self)
+					{
+						return CallInterpretedMethod(cls, selName, self, NULL, 0);
+					};
+			}
+			break;
+		OBJECT_TRAMPOLINE(1, a0)
+		OBJECT_TRAMPOLINE(2, a0, a1)
+		OBJECT_TRAMPOLINE(3, a0, a1, a2)
+		OBJECT_TRAMPOLINE(4, a0, a1, a2, a3)
+		OBJECT_TRAMPOLINE(5, a0, a1, a2, a3, a4)
+		OBJECT_TRAMPOLINE(6, a0, a1, a2, a3, a4, a5)
+		OBJECT_TRAMPOLINE(7, a0, a1, a2, a3, a4, a5, a6)
+		OBJECT_TRAMPOLINE(8, a0, a1, a2, a3, a4, a5, a6, a7)
 	}
-	
-	ffi_cif *cif = malloc(sizeof(ffi_cif));
-	if (FFI_OK != ffi_prep_cif(cif,
-	                           FFI_DEFAULT_ABI, nargs - 1, ffi_ret_ty, ffi_tys))
+	return imp_implementationWithBlock(block);
+}
+
+/**
+ * Creates the implementation for a trampoline that has not been seen before.
+ */
+static void MakeTrampolineIMP(struct trampoline *t)
+{
+	if (NULL != t->sel)
 	{
-		[NSException raise: LKInterpreterException
-		            format: @"Error preparing closure signature"];
+		t->imp = MakeObjectIMP(t->cls, t->sel, t->signature);
+		t->size = sizeof(struct trampoline);
+		return;
 	}
-	
 	ffi_closure *closure_exec;
 	ffi_closure *closure_write = ffi_closure_alloc(sizeof(ffi_closure),
 	                                               (void*)&closure_exec);
 	
-	if (FFI_OK != ffi_prep_closure_loc(closure_write, cif, 
+	if (FFI_OK != ffi_prep_closure_loc(closure_write, &t->signature->cif, 
 	                                   LKInterpreterFFITrampoline, 
 	                                   t, closure_exec))
 	{
+		ffi_closure_free(closure_write);
 		[NSException raise: LKInterpreterException
 		            format: @"Error preparing closure"];
 	}
-	
-	return (IMP)closure_exec;
+	t->closure = closure_write;
+	t->imp = (IMP)closure_exec;
+	t->size = sizeof(struct trampoline) + sizeof(ffi_closure);
+}
+
+IMP LKInterpreterMakeIMP(Class cls, SEL sel, const char *objctype)
+{
+	struct LKSignature *sig = SignatureForTypes(objctype);
+	// Block implementations are specific to a selector, libffi closures are
+	// shared by every method in the class with the same signature.
+	struct trampoline key = { cls, IsObjectSignature(sig) ? sel : NULL, sig };
+
+	pthread_mutex_lock(&TrampolinesLock);
+	if (nil == Trampolines)
+	{
+		NSPointerFunctions *keys = [NSPointerFunctions pointerFunctionsWithOptions:
+			NSPointerFunctionsOpaquePersonality | NSPointerFunctionsOpaqueMemory];
+		[keys setHashFunction: HashTrampoline];
+		[keys setIsEqualFunction: IsEqualTrampoline];
+		NSPointerFunctions *values = [NSPointerFunctions pointerFunctionsWithOptions:
+			NSPointerFunctionsOpaquePersonality | NSPointerFunctionsOpaqueMemory];
+		Trampolines = [[NSMapTable alloc] initWithKeyPointerFunctions: keys
+		                                        valuePointerFunctions: values
+		                                                     capacity: 64];
+		TrampolinesByIMP = [[NSMapTable alloc] initWithKeyPointerFunctions: values
+		                                             valuePointerFunctions: values
+		                                                          capacity: 64];
+	}
+	struct trampoline *t = NSMapGet(Trampolines, &key);
+	if (NULL == t)
+	{
+		t = calloc(1, sizeof(struct trampoline));
+		*t = key;
+		@try
+		{
+			MakeTrampolineIMP(t);
+		}
+		@catch (id e)
+		{
+			free(t);
+			pthread_mutex_unlock(&TrampolinesLock);
+			@throw;
+		}
+		NSMapInsert(Trampolines, t, t);
+		NSMapInsert(TrampolinesByIMP, t->imp, t);
+		TrampolineStatistics.live++;
+		TrampolineStatistics.liveBytes += t->size;
+	}
+	else if (0 == t->refCount)
+	{
+		// Redefining a method with the same signature reuses the trampoline
+		// that the old definition retired.
+		TrampolineStatistics.retired--;
+		TrampolineStatistics.retiredBytes -= t->size;
+		TrampolineStatistics.live++;
+		TrampolineStatistics.liveBytes += t->size;
+		TrampolineStatistics.reused++;
+	}
+	t->refCount++;
+	pthread_mutex_unlock(&TrampolinesLock);
+	return t->imp;
+}
+
+void LKInterpreterRetireIMP(IMP imp)
+{
+	if (NULL == imp)
+	{
+		return;
+	}
+	pthread_mutex_lock(&TrampolinesLock);
+	struct trampoline *t = (nil == TrampolinesByIMP) ? NULL :
+		NSMapGet(TrampolinesByIMP, imp);
+	if ((NULL != t) && (t->refCount > 0) && (0 == --t->refCount))
+	{
+		TrampolineStatistics.live--;
+		TrampolineStatistics.liveBytes -= t->size;
+		TrampolineStatistics.retired++;
+		TrampolineStatistics.retiredBytes += t->size;
+	}
+	pthread_mutex_unlock(&TrampolinesLock);
+}
+
+struct LKTrampolineStatistics LKInterpreterTrampolineStatistics(void)
+{
+	pthread_mutex_lock(&TrampolinesLock);
+	struct LKTrampolineStatistics stats = TrampolineStatistics;
+	pthread_mutex_unlock(&TrampolinesLock);
+	return stats;
 }
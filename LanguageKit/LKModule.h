@@ -23,6 +23,12 @@
  * Return a new autoreleased module.
  */
 + (id) module;
+/**
+ * Returns the lock that -compileWithGenerator: holds while it generates code.
+ * Background compilations hold it while they check their modules as well, so
+ * that they run one at a time with respect to code generation.
+ */
++ (NSRecursiveLock*) codeGenerationLock;
 /**
  * Add compile-time pragmas.
  */
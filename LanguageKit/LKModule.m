@@ -1,16 +1,34 @@
 #import "LKModule.h"
 #import "LKSubclass.h"
 #import "LKCompilerErrors.h"
+#import "LKInliner.h"
 #import "Runtime/LKObject.h"
 #import <objc/runtime.h>
 
 /**
- * Maps method names to type encodings, gathered by iterating through all
- * methods in all classes. Needed only on the Mac runtime, which
- * doesn't have a function for looking up the types given a selector.
+ * Maps selectors to the type encoding of the first method found for them.
+ * Needed only on the Mac runtime, which doesn't have a function for looking
+ * up the types given a selector.  Each class's method list is walked once,
+ * the first time that a lookup sees the class, so every later lookup is a
+ * single map access.  The encodings belong to the runtime and are not copied.
  */
-static NSMutableDictionary *Types = nil;
+static NSMapTable *Types = nil;
+/**
+ * Maps selectors that classes implement with more than one type encoding to
+ * arrays of all of the encodings.
+ */
+static NSMapTable *PolymorphicTypes = nil;
 static NSMutableDictionary *SelectorConflicts = nil;
+/**
+ * Types synthesized for selectors that no class implements, keyed by the
+ * number of arguments.
+ */
+static NSMutableDictionary *DefaultTypes = nil;
+/**
+ * Held while a module is being compiled.  Recursive, because code generators
+ * may compile other code while generating a module.
+ */
+static NSRecursiveLock *CodeGenerationLock;
 NSString *LKCompilerDidCompileNewClassesNotification = 
 	@"LKCompilerDidCompileNewClassesNotification";
 
@@ -39,73 +57,114 @@ static NSArray *TypesForMethodName(NSString *methodName)
 	return typeStrings;
 }
 #else
-static NSArray* TypesForMethodName(NSString *methodName)
+/**
+ * The classes whose methods have been added to the index.
+ */
+static NSHashTable *IndexedClasses = nil;
+static unsigned int IndexedClassCount = 0;
+
+/**
+ * Adds the types of every instance method that cls implements to the index.
+ */
+static void IndexClass(Class cls)
 {
-    id object = [Types objectForKey: methodName];
-    if (object)
-    {
-        if ([object isKindOfClass:[NSArray class]])
-             return object;
-        return [NSArray arrayWithObject:object];
-    }
-	return nil;
+	unsigned int count;
+	Method *methods = class_copyMethodList(cls, &count);
+	for (unsigned int i=0 ; i<count ; i++)
+	{
+		SEL sel = method_getName(methods[i]);
+		const char *type = method_getTypeEncoding(methods[i]);
+		const char *first = NSMapGet(Types, sel);
+		if (NULL == first)
+		{
+			NSMapInsert(Types, sel, type);
+			continue;
+		}
+		if (0 == strcmp(first, type))
+		{
+			continue;
+		}
+		NSMutableArray *types = (__bridge id)NSMapGet(PolymorphicTypes, sel);
+		if (nil == types)
+		{
+			types = [NSMutableArray arrayWithObject:
+				NSStringFromRuntimeString(first)];
+			NSMapInsert(PolymorphicTypes, sel, (__bridge void*)types);
+		}
+		NSString *typeString = NSStringFromRuntimeString(type);
+		if (![types containsObject: typeString])
+		{
+			[types addObject: typeString];
+		}
+	}
+	free(methods);
 }
-#endif
 
-@implementation LKModule 
-+ (void) initialize
+/**
+ * Adds any classes registered since the last call to the index.
+ */
+static void IndexNewClasses(void)
 {
-	if (self != [LKModule class])
+	unsigned int count = objc_getClassList(NULL, 0);
+	if (count == IndexedClassCount)
 	{
 		return;
 	}
-	// Look up potential selector conflicts.
-	Types = [NSMutableDictionary new];
-	SelectorConflicts = [NSMutableDictionary new];
-	
-	unsigned int numClasses = objc_getClassList(NULL, 0);
-	Class *classes = NULL;
-	if (numClasses > 0)
+	Class *classes = (__unsafe_unretained Class*)malloc(sizeof(Class) * count);
+	count = objc_getClassList(classes, count);
+	for (unsigned int i=0 ; i<count ; i++)
 	{
-		classes = (__unsafe_unretained Class*)malloc(sizeof(Class) * numClasses);
-		numClasses = objc_getClassList(classes, numClasses);
+		Class cls = classes[i];
+		if ([IndexedClasses containsObject: cls])
+		{
+			continue;
+		}
+		[IndexedClasses addObject: cls];
+		IndexClass(cls);
 	}
-	
-	for (unsigned int classIndex=0; classIndex<numClasses; classIndex++)
+	IndexedClassCount = count;
+	free(classes);
+}
+
+static NSArray* TypesForMethodName(NSString *methodName)
+{
+	@synchronized(Types)
 	{
-		unsigned int methodCount;
-		Method *methods = class_copyMethodList(classes[classIndex], &methodCount);
-		for (unsigned int i=0 ; i<methodCount ; i++)
+		IndexNewClasses();
+		SEL sel = sel_getUid([methodName UTF8String]);
+		NSArray *types = (__bridge id)NSMapGet(PolymorphicTypes, sel);
+		if (nil != types)
 		{
-			Method m = methods[i];
-
-			NSString *name = NSStringFromRuntimeString(sel_getName(method_getName(m)));
-			NSString *type = NSStringFromRuntimeString(method_getTypeEncoding(m));
-            
-            id old = [Types objectForKey: name];
-            if (nil == old)
-            {
-                [Types setObject: type forKey: name];
-            }
-            else
-            {
-                if ([old isKindOfClass: [NSMutableArray class]])
-                {
-                    [(NSMutableArray*)old addObject: type];
-                }
-                else
-                {
-                    [Types setObject: [NSMutableArray arrayWithObjects: old, type, nil]
-                              forKey: name];
-                }
-            }
+			return [types copy];
+		}
+		const char *type = NSMapGet(Types, sel);
+		if (NULL == type)
+		{
+			return [NSArray array];
 		}
+		return [NSArray arrayWithObject: NSStringFromRuntimeString(type)];
 	}
-	
-	if (classes)
+}
+#endif
+
+@implementation LKModule 
++ (void) initialize
+{
+	if (self != [LKModule class])
 	{
-		free(classes);
+		return;
 	}
+	SelectorConflicts = [NSMutableDictionary new];
+	DefaultTypes = [NSMutableDictionary new];
+	CodeGenerationLock = [NSRecursiveLock new];
+#if !defined(__GNUSTEP_RUNTIME__)
+	Types = NSCreateMapTable(NSNonOwnedPointerMapKeyCallBacks,
+		NSNonOwnedPointerMapValueCallBacks, 0);
+	PolymorphicTypes = NSCreateMapTable(NSNonOwnedPointerMapKeyCallBacks,
+		NSObjectMapValueCallBacks, 0);
+	IndexedClasses = [NSHashTable hashTableWithOptions:
+		NSPointerFunctionsOpaquePersonality | NSPointerFunctionsOpaqueMemory];
+#endif
 }
 + (id) module
 {
@@ -118,6 +177,7 @@ static NSArray* TypesForMethodName(NSString *methodName)
         classes = [[NSMutableArray alloc] init];
         categories = [[NSMutableArray alloc] init];
         pragmas = [[NSMutableDictionary alloc] init];
+        owningModule = self;
     }
 	return self;
 }
@@ -174,16 +234,25 @@ static NSArray* TypesForMethodName(NSString *methodName)
 				argCount++;
 			}
 		}
-		int offset = sizeof(id) + sizeof(SEL);
-        NSMutableString *ty = [NSMutableString stringWithFormat: @"%s%lu@0:%d",
-			@encode(NSObject *), sizeof(SEL) + sizeof(id) * (argCount + 2),
-			offset];
-		for (int i=0 ; i<argCount ; i++)
+		NSNumber *key = [NSNumber numberWithInt: argCount];
+		@synchronized(DefaultTypes)
 		{
-			offset += sizeof(id);
-			[ty appendFormat: @"%s%d", @encode(NSObject *), offset];
+			types = [DefaultTypes objectForKey: key];
+			if (nil == types)
+			{
+				int offset = sizeof(id) + sizeof(SEL);
+				NSMutableString *ty = [NSMutableString stringWithFormat: @"%s%lu@0:%d",
+					@encode(NSObject *), sizeof(SEL) + sizeof(id) * (argCount + 2),
+					offset];
+				for (int i=0 ; i<argCount ; i++)
+				{
+					offset += sizeof(id);
+					[ty appendFormat: @"%s%d", @encode(NSObject *), offset];
+				}
+				types = [NSArray arrayWithObject: ty];
+				[DefaultTypes setObject: types forKey: key];
+			}
 		}
-		types = [NSArray arrayWithObject: ty];
 	}
 	return types;
 }
@@ -235,19 +304,36 @@ static NSArray* TypesForMethodName(NSString *methodName)
 	}
 	return str;
 }
++ (NSRecursiveLock*) codeGenerationLock
+{
+	return CodeGenerationLock;
+}
 - (void*) compileWithGenerator: (id<LKCodeGenerator>)aGenerator
 {
-	// FIXME: Get the file name from somewhere.
-	[aGenerator startModule: @"Anonymous"];
-    for (LKAST *class in classes)
+	// Code generators share state, so only one module is compiled at a time,
+	// whether on the main thread or on an LKCompileQueue.
+	[CodeGenerationLock lock];
+	@try
 	{
-		[class compileWithGenerator: aGenerator];
+		// FIXME: Get the file name from somewhere.
+		[aGenerator startModule: @"Anonymous"];
+		for (LKAST *class in classes)
+		{
+			[class compileWithGenerator: aGenerator];
+		}
+		for (LKAST *category in categories)
+		{
+			[category compileWithGenerator: aGenerator];
+		}
+		[aGenerator endModule];
 	}
-    for (LKAST *category in categories)
+	@finally
 	{
-		[category compileWithGenerator: aGenerator];
+		[CodeGenerationLock unlock];
 	}
-	[aGenerator endModule];
+	// Static code generators do not load the classes, and recording is
+	// skipped for classes that do not exist.
+	[self recordInlinedMethods];
 	[[NSNotificationCenter defaultCenter]
 	  	postNotificationName: LKCompilerDidCompileNewClassesNotification
 		              object: nil];
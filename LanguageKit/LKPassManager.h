@@ -0,0 +1,54 @@
+#import <Foundation/Foundation.h>
+
+@class LKAST;
+
+/**
+ * Runs semantic analysis and a sequence of AST transforms over a tree.
+ *
+ * Consecutive LKASTVisitor transforms whose classes return YES from +canFuse
+ * are fused into a single traversal: each node is passed to every transform
+ * in turn before the traversal moves on to its children.  Other transforms
+ * run in a traversal of their own.  LKASTVisitor subclasses must change
+ * the tree either by returning replacement nodes, or by changing a node in
+ * place and reporting it with -didChangeNode:, so that the pass manager knows
+ * which parts of the tree changed.  After the transforms have run, only the
+ * methods containing replaced or changed nodes are checked again, rather
+ * than the whole tree.  Transforms that are not LKASTVisitor
+ * subclasses run in their own traversal and cause the whole tree to be
+ * checked again.
+ *
+ * The time spent in each pass is recorded.
+ */
+@interface LKPassManager : NSObject
+{
+	/**
+	 * The passes, in order.  Each is an array of transforms that are run in a
+	 * single traversal.
+	 */
+	NSMutableArray *passes;
+	/** Seconds spent in each pass, keyed by pass name. */
+	NSMutableDictionary *timings;
+}
+/**
+ * Returns a pass manager that applies the transforms, in order.
+ */
++ (LKPassManager*) passManagerWithTransforms: (NSArray*)transforms;
+/**
+ * Initialises a pass manager that applies the transforms, in order.
+ */
+- (id) initWithTransforms: (NSArray*)transforms;
+/**
+ * Checks the tree, applies the transforms, and checks the parts of the tree
+ * that they changed.  If the tree can be compiled, then infers the types in
+ * it, marks the blocks that do not escape, and returns YES.
+ */
+- (BOOL) runOnAST: (LKAST*)anAST;
+/**
+ * Returns the total number of seconds spent in each pass by this pass
+ * manager, keyed by the name of the pass.  Checking is named "check" and
+ * "recheck", type inference is named "types", escape analysis is named
+ * "escapes", and transform passes are named after the classes of their
+ * transforms.
+ */
+- (NSDictionary*) timings;
+@end
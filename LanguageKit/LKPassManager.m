@@ -0,0 +1,224 @@
+#import "LKPassManager.h"
+#import "LKASTVisitor.h"
+#import "LKMethod.h"
+
+/**
+ * Runs several visitors in one traversal, recording the nodes that they
+ * replace.
+ */
+@interface LKFusedVisitor : LKASTVisitor
+{
+	@public
+	NSArray *visitors;
+	/** Nodes that were replaced or removed. */
+	NSMutableArray *replaced;
+}
+@end
+@implementation LKFusedVisitor
+- (LKAST*) visitASTNode: (LKAST*)aNode
+{
+	LKAST *node = aNode;
+	for (id<LKASTVisitor> visitor in visitors)
+	{
+		node = [visitor visitASTNode: node];
+		if (nil == node)
+		{
+			break;
+		}
+	}
+	if (node != aNode)
+	{
+		[replaced addObject: aNode];
+	}
+	return node;
+}
+@end
+
+/**
+ * Returns the method containing a node, or nil if the node is not inside a
+ * method.
+ */
+static LKMethod *enclosingMethod(LKAST *aNode)
+{
+	for (LKAST *node = [aNode parent] ; nil != node ; node = [node parent])
+	{
+		if ([node isKindOfClass: [LKMethod class]])
+		{
+			return (LKMethod*)node;
+		}
+	}
+	return nil;
+}
+
+@implementation LKPassManager
++ (LKPassManager*) passManagerWithTransforms: (NSArray*)transforms
+{
+	return [[self alloc] initWithTransforms: transforms];
+}
+- (id) initWithTransforms: (NSArray*)transforms
+{
+	self = [super init];
+	if (nil == self)
+	{
+		return nil;
+	}
+	passes = [NSMutableArray new];
+	timings = [NSMutableDictionary new];
+	NSMutableArray *fused = nil;
+	for (id<LKASTVisitor> transform in transforms)
+	{
+		if (![(id)transform isKindOfClass: [LKASTVisitor class]] ||
+		    ![[(id)transform class] canFuse])
+		{
+			fused = nil;
+			[passes addObject: [NSArray arrayWithObject: transform]];
+			continue;
+		}
+		if (nil == fused)
+		{
+			fused = [NSMutableArray array];
+			[passes addObject: fused];
+		}
+		[fused addObject: transform];
+	}
+	return self;
+}
+- (void) addTime: (NSTimeInterval)aTime toPass: (NSString*)aPass
+{
+	@synchronized(timings)
+	{
+		NSNumber *total = [timings objectForKey: aPass];
+		[timings setObject: [NSNumber numberWithDouble: [total doubleValue] + aTime]
+		            forKey: aPass];
+	}
+}
+/**
+ * Checks the tree and applies the transforms.
+ */
+- (BOOL) runTransformsOnAST: (LKAST*)anAST
+{
+	NSTimeInterval start = [NSDate timeIntervalSinceReferenceDate];
+	BOOL success = [anAST check];
+	[self addTime: [NSDate timeIntervalSinceReferenceDate] - start toPass: @"check"];
+	if (!success || ([passes count] == 0))
+	{
+		return success;
+	}
+	BOOL recheckAll = NO;
+	NSMutableArray *replaced = [NSMutableArray array];
+	NSMutableArray *changed = [NSMutableArray array];
+	for (NSArray *pass in passes)
+	{
+		NSMutableArray *names = [NSMutableArray array];
+		for (id transform in pass)
+		{
+			[names addObject: NSStringFromClass([transform class])];
+		}
+		start = [NSDate timeIntervalSinceReferenceDate];
+		id<LKASTVisitor> first = [pass objectAtIndex: 0];
+		if ([(id)first isKindOfClass: [LKASTVisitor class]])
+		{
+			LKFusedVisitor *fused = [LKFusedVisitor new];
+			fused->visitors = pass;
+			fused->replaced = replaced;
+			// The transforms may be shared with pass managers on other
+			// threads, so changes are recorded per thread.
+			NSMutableDictionary *dict = [[NSThread currentThread] threadDictionary];
+			id outer = [dict objectForKey: @"LKChangedNodes"];
+			[dict setObject: changed forKey: @"LKChangedNodes"];
+			@try
+			{
+				[anAST visitWithVisitor: fused];
+			}
+			@finally
+			{
+				if (nil == outer)
+				{
+					[dict removeObjectForKey: @"LKChangedNodes"];
+				}
+				else
+				{
+					[dict setObject: outer forKey: @"LKChangedNodes"];
+				}
+			}
+		}
+		else
+		{
+			[anAST visitWithVisitor: first];
+			recheckAll = YES;
+		}
+		[self addTime: [NSDate timeIntervalSinceReferenceDate] - start
+		       toPass: [names componentsJoinedByString: @"+"]];
+	}
+	if ([replaced count] == 0 && [changed count] == 0 && !recheckAll)
+	{
+		return YES;
+	}
+	start = [NSDate timeIntervalSinceReferenceDate];
+	// Transforms replace nodes within methods, and checking a method checks
+	// everything in it.  Anything else may have changed declarations that
+	// other code depends on, so check everything.
+	NSMutableArray *methods = [NSMutableArray array];
+	for (LKAST *node in replaced)
+	{
+		LKMethod *method = enclosingMethod(node);
+		if (nil == method)
+		{
+			recheckAll = YES;
+			break;
+		}
+		if (NSNotFound == [methods indexOfObjectIdenticalTo: method])
+		{
+			[methods addObject: method];
+		}
+	}
+	for (LKAST *node in changed)
+	{
+		LKMethod *method = [node isKindOfClass: [LKMethod class]] ?
+			(LKMethod*)node : enclosingMethod(node);
+		if (nil == method)
+		{
+			recheckAll = YES;
+			break;
+		}
+		if (NSNotFound == [methods indexOfObjectIdenticalTo: method])
+		{
+			[methods addObject: method];
+		}
+	}
+	if (recheckAll)
+	{
+		success = [anAST check];
+	}
+	else
+	{
+		for (LKMethod *method in methods)
+		{
+			success &= [method check];
+		}
+	}
+	[self addTime: [NSDate timeIntervalSinceReferenceDate] - start toPass: @"recheck"];
+	return success;
+}
+- (BOOL) runOnAST: (LKAST*)anAST
+{
+	BOOL success = [self runTransformsOnAST: anAST];
+	if (success)
+	{
+		NSTimeInterval start = [NSDate timeIntervalSinceReferenceDate];
+		[anAST inferTypes];
+		[self addTime: [NSDate timeIntervalSinceReferenceDate] - start toPass: @"types"];
+		start = [NSDate timeIntervalSinceReferenceDate];
+		[anAST analyseEscapes];
+		[self addTime: [NSDate timeIntervalSinceReferenceDate] - start toPass: @"escapes"];
+	}
+	return success;
+}
+- (NSDictionary*) timings
+{
+	@synchronized(timings)
+	{
+		return [timings copy];
+	}
+}
+@end
@@ -9,6 +9,20 @@
 	 * The symbol.
 	 */
 	NSString *symbol;
+	/**
+	 * The address of the global variable named by the symbol, cached by the
+	 * interpreter.
+	 */
+	void **address;
+	/**
+	 * The interned Symbol, cached by the interpreter when there is no global
+	 * variable with this name.
+	 */
+	id value;
+	/**
+	 * Set by the interpreter once the symbol has been resolved.
+	 */
+	BOOL resolved;
 }
 /** Returns autoreleased reference for the specified symbol. */
 + (id) referenceWithSymbol:(NSString*)sym;
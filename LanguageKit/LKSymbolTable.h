@@ -1,4 +1,5 @@
 #import <Foundation/Foundation.h>
+#import <LanguageKit/LKInferredType.h>
 
 @class LKAST;
 @class LKVariableDecl;
@@ -56,12 +57,38 @@ typedef enum
  * include the scope in which it is declared.
  */
 @property (nonatomic) NSUInteger referencingScopes;
+/**
+ * The type of every value that is stored in this variable, set by
+ * -[LKAST inferTypes].  Local variables also start as nil, which is not
+ * included here; the types of references to the variable say when it may
+ * still be nil.
+ */
+@property (nonatomic, strong) LKInferredType *inferredType;
+/**
+ * Whether every block that references this variable is non-escaping and none
+ * of them assigns to it, set by -[LKAST analyseEscapes].  The variable then
+ * never outlives the scope that declares it and is only read by blocks, so it
+ * does not need to be moved to byref storage.  Variables that no block
+ * references are not marked.
+ */
+@property (nonatomic, getter=isNonEscaping) BOOL nonEscaping;
 @end
 
 /**
  * Symbol table.  Base class, with subclasses for each scope.
  */
 @interface LKSymbolTable : NSObject {
+	/**
+	 * Arrays of the symbols of each scope, indexed by scope, in the order in
+	 * which they were added.  Arguments are ordered by index.
+	 */
+	NSMutableArray *symbolsByScope;
+	/**
+	 * Immutable copies of the arrays in symbolsByScope, returned by the
+	 * accessors for each kind of symbol.  Entries are NSNull when the copy
+	 * must be rebuilt.
+	 */
+	NSMutableArray *snapshots;
 }
 /** The AST node (class, block, method) that contains these declarations. */
 @property (unsafe_unretained, nonatomic) LKAST *declarationScope;
@@ -70,9 +97,10 @@ typedef enum
 /** The scope of this symbol table. */
 @property (nonatomic) LKSymbolScope tableScope;
 /**
- * The symbols stored in this symbol table, indexed by name.
+ * The symbols stored in this symbol table, indexed by name.  This must not be
+ * modified directly: use -addSymbol: and -removeSymbolNamed: instead.
  */
-@property (nonatomic, strong) NSMutableDictionary *symbols;
+@property (nonatomic, readonly) NSMutableDictionary *symbols;
 /**
  * Returns the symbol table for a class.  If the class exists, then this will
  * be populated with its instance variables.  If not, then it will be empty.
@@ -92,6 +120,10 @@ typedef enum
  * initially have no type assigned to them.
  */
 - (void)addSymbolsNamed: (NSArray<LKVariableDecl*>*)anArray ofKind: (LKSymbolScope)kind;
+/**
+ * Removes the symbol with the specified name from this table.
+ */
+- (void)removeSymbolNamed: (NSString*)aName;
 /**
  * Looks up the symbol for a specified name.
  */
@@ -3,11 +3,23 @@
 #import "LKVariableDecl.h"
 #import "Runtime/LKObject.h"
 
+/**
+ * Symbol tables for classes, keyed by class name.  Accesses are synchronized
+ * on the dictionary, because the compiler checks several files at once.
+ */
 static NSMutableDictionary *NewClasses;
 
+static BOOL isNewClass(NSString *aName)
+{
+	@synchronized(NewClasses)
+	{
+		return nil != [NewClasses objectForKey: aName];
+	}
+}
+
 static LKSymbolScope lookupUnscopedSymbol(NSString *aName)
 {
-	if(NSClassFromString(aName) != NULL || [NewClasses objectForKey:aName] || [LKCompiler inDevMode])
+	if(NSClassFromString(aName) != NULL || isNewClass(aName) || [LKCompiler inDevMode])
 	{
 		return LKSymbolScopeGlobal;
 	}
@@ -26,6 +38,13 @@ static LKSymbolScope lookupUnscopedSymbol(NSString *aName)
     if (self) {
         enclosingScope = aTable;
         symbols = [NSMutableDictionary new];
+        symbolsByScope = [NSMutableArray new];
+        snapshots = [NSMutableArray new];
+        for (int i=0 ; i<=LKSymbolScopeGlobal ; i++)
+        {
+            [symbolsByScope addObject: [NSMutableArray array]];
+            [snapshots addObject: [NSNull null]];
+        }
     }
 	return self;
 }
@@ -34,6 +53,18 @@ static LKSymbolScope lookupUnscopedSymbol(NSString *aName)
 	return [self initInScope: nil];
 }
 + (LKSymbolTable*) symbolTableForClass: (NSString*)aClassName
+{
+	@synchronized(NewClasses)
+	{
+		return [self lockedSymbolTableForClass: aClassName];
+	}
+}
+/**
+ * Returns the table for a class, creating it if needed.  Must be called with
+ * the NewClasses lock held, so that two threads do not create different tables
+ * for the same class.
+ */
++ (LKSymbolTable*) lockedSymbolTableForClass: (NSString*)aClassName
 {
 	LKSymbolTable *table = [NewClasses objectForKey: aClassName];
 	if (nil != table) { return table; }
@@ -65,14 +96,18 @@ static LKSymbolScope lookupUnscopedSymbol(NSString *aName)
 		class = class_getSuperclass(class);
 		if (Nil != class)
 		{
-			[table setEnclosingScope: [self symbolTableForClass: [class className]]];
+			[table setEnclosingScope: [self lockedSymbolTableForClass: [class className]]];
 		}
 	}
 	return table;
 }
 + (LKSymbolTable*)lookupTableForClass: aClassName
 {
-  LKSymbolTable *table = [NewClasses objectForKey: aClassName];
+  LKSymbolTable *table;
+  @synchronized(NewClasses)
+  {
+    table = [NewClasses objectForKey: aClassName];
+  }
   if (nil != table) { return table; }
   
   Class class = NSClassFromString(aClassName);
@@ -82,11 +117,65 @@ static LKSymbolScope lookupUnscopedSymbol(NSString *aName)
   }
   return nil;
 }
+/**
+ * Removes a symbol from the array for its scope.  Must be called with the lock
+ * held.
+ */
+- (void)unindexSymbol: (LKSymbol*)aSymbol
+{
+	LKSymbolScope scope = [aSymbol scope];
+	[[symbolsByScope objectAtIndex: scope] removeObjectIdenticalTo: aSymbol];
+	[snapshots replaceObjectAtIndex: scope withObject: [NSNull null]];
+}
 - (void)addSymbol: (LKSymbol*)aSymbol
 {
-	[symbols setObject: aSymbol forKey: [aSymbol name]];
+	@synchronized(self)
+	{
+		NSString *name = [aSymbol name];
+		LKSymbol *old = [symbols objectForKey: name];
+		if (nil != old)
+		{
+			[self unindexSymbol: old];
+		}
+		[symbols setObject: aSymbol forKey: name];
+		LKSymbolScope scope = [aSymbol scope];
+		NSMutableArray *array = [symbolsByScope objectAtIndex: scope];
+		NSUInteger i = [array count];
+		// Arguments are usually added in order, so this rarely has to search.
+		if (LKSymbolScopeArgument == scope)
+		{
+			while ((i > 0) && ([[array objectAtIndex: i-1] index] > [aSymbol index]))
+			{
+				i--;
+			}
+		}
+		[array insertObject: aSymbol atIndex: i];
+		[snapshots replaceObjectAtIndex: scope withObject: [NSNull null]];
+	}
+}
+- (void)removeSymbolNamed: (NSString*)aName
+{
+	@synchronized(self)
+	{
+		LKSymbol *old = [symbols objectForKey: aName];
+		if (nil != old)
+		{
+			[self unindexSymbol: old];
+			[symbols removeObjectForKey: aName];
+		}
+	}
 }
 - (LKSymbol*)symbolForName: (NSString*)aName
+{
+	// Class tables are shared between files that are checked concurrently,
+	// and lookups may add symbols to them.  Locks are always taken from the
+	// inner scope outwards, so this can not deadlock.
+	@synchronized(self)
+	{
+		return [self lockedSymbolForName: aName];
+	}
+}
+- (LKSymbol*)lockedSymbolForName: (NSString*)aName
 {
 	LKSymbol *s = [symbols objectForKey: aName];
 	if (nil == s)
@@ -123,54 +212,45 @@ static LKSymbolScope lookupUnscopedSymbol(NSString *aName)
 	}
 	return s;
 }
-static inline NSMutableArray* collectSymbolsOfType(NSDictionary *symbols,
-                                            LKSymbolScope scope)
+/**
+ * Returns the symbols of the specified scope, or nil if there are none.  The
+ * returned array is shared until the next change to this scope, so repeated
+ * calls do not allocate.
+ */
+- (NSArray*)symbolsOfScope: (LKSymbolScope)scope
 {
-	NSMutableArray *args = nil;
-	for (LKSymbol *s in [symbols objectEnumerator])
+	@synchronized(self)
 	{
-		if ([s scope] == scope)
+		NSArray *snapshot = [snapshots objectAtIndex: scope];
+		if ([NSNull null] == (id)snapshot)
 		{
-			if (nil == args)
-			{
-				args = [NSMutableArray new];
-			}
-			[args addObject: s];
+			NSArray *array = [symbolsByScope objectAtIndex: scope];
+			snapshot = ([array count] == 0) ? nil : [array copy];
+			[snapshots replaceObjectAtIndex: scope
+			                     withObject: (nil == snapshot) ? (id)[NSNull null] : snapshot];
 		}
+		return ([NSNull null] == (id)snapshot) ? nil : snapshot;
 	}
-	return args;
 }
-
-static NSComparisonResult compareSymbolOrder(LKSymbol *a, LKSymbol *b, void *c)
-{
-	NSInteger i1 = [a index];
-	NSInteger i2 = [b index];
-	if (i1 < i2) { return NSOrderedAscending; }
-	if (i1 > i2) { return NSOrderedDescending; }
-	return NSOrderedSame;
-}
-
 - (NSArray*)arguments
 {
-	NSMutableArray *arguments = collectSymbolsOfType(symbols, LKSymbolScopeArgument);
-	[arguments sortUsingFunction: compareSymbolOrder context: NULL];
-	return arguments;
+	return [self symbolsOfScope: LKSymbolScopeArgument];
 }
 - (NSArray*)locals
 {
-	return collectSymbolsOfType(symbols, LKSymbolScopeLocal);
+	return [self symbolsOfScope: LKSymbolScopeLocal];
 }
 - (NSArray*)byRefVariables;
 {
-	return collectSymbolsOfType(symbols, LKSymbolScopeExternal);
+	return [self symbolsOfScope: LKSymbolScopeExternal];
 }
 - (NSArray*)classVariables
 {
-	return collectSymbolsOfType(symbols, LKSymbolScopeClass);
+	return [self symbolsOfScope: LKSymbolScopeClass];
 }
 - (NSArray*)instanceVariables
 {
-	return collectSymbolsOfType(symbols, LKSymbolScopeObject);
+	return [self symbolsOfScope: LKSymbolScopeObject];
 }
 - (void)addSymbolsNamed: (NSArray<LKVariableDecl *>*)anArray ofKind: (LKSymbolScope)kind;
 {
@@ -188,7 +268,8 @@ static NSComparisonResult compareSymbolOrder(LKSymbol *a, LKSymbol *b, void *c)
 @end
 
 @implementation LKSymbol
-@synthesize name, typeEncoding, owner, scope, index, referencingScopes;
+@synthesize name, typeEncoding, owner, scope, index, referencingScopes, inferredType,
+            nonEscaping;
 - (id)init
 {
     self = [super init];
@@ -222,6 +303,8 @@ static NSComparisonResult compareSymbolOrder(LKSymbol *a, LKSymbol *b, void *c)
 	[c setScope: scope];
 	[c setIndex: index];
 	[c setReferencingScopes: referencingScopes];
+	[c setInferredType: inferredType];
+	[c setNonEscaping: nonEscaping];
 	return c;
 }
 @end
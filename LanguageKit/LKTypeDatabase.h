@@ -0,0 +1,75 @@
+#import <Foundation/Foundation.h>
+
+/**
+ * The kinds of entry stored in a type database.
+ */
+typedef enum
+{
+	/** Type encoding of a C function, keyed by the function name. */
+	LKTypeDatabaseFunction,
+	/** Type encoding of a global variable, keyed by its name. */
+	LKTypeDatabaseGlobal,
+	/**
+	 * Value of an enumeration constant, keyed by the constant name.  The
+	 * value is empty if the name is ambiguous.
+	 */
+	LKTypeDatabaseEnumerationValue,
+	/**
+	 * Value of a constant in a named enumeration, keyed by
+	 * "enumeration.constant".
+	 */
+	LKTypeDatabaseEnumeration,
+	/**
+	 * Hash of the contents of a file that the source includes, keyed by the
+	 * file's path.  Used to check that the database is up to date.
+	 */
+	LKTypeDatabaseDependency
+} LKTypeDatabaseKind;
+
+/**
+ * A persistent index of the type information extracted from a C header, so
+ * that the header does not have to be parsed again in later processes.
+ *
+ * The database file is mapped into memory and searched in place, so its size
+ * does not affect the cost of opening it.  Each database records a hash of the
+ * contents of the header that it was built from and of every file that the
+ * header includes, directly or indirectly, and is ignored if any of them has
+ * changed.  Opening a database checks all of these files.  The first check
+ * in a process reads and hashes each of them.  Later checks only stat them,
+ * and read again the files whose size, inode or modification time has changed.
+ */
+@interface LKTypeDatabase : NSObject
+{
+	/** The mapped file. */
+	const void *data;
+	/** The size of the mapping. */
+	size_t size;
+}
+/**
+ * Returns the database for the header at the specified path, or nil if there
+ * is no database for it or the header has changed since it was written.
+ */
++ (LKTypeDatabase*) databaseForSource: (NSString*)aPath;
+/**
+ * Returns the standardised paths of the header at the specified path and of
+ * every file that it includes or imports, directly or indirectly.  Includes
+ * are found by scanning for preprocessor directives, ignoring conditionals,
+ * so this may return files that a compiler would skip.  Files that can not be
+ * found in the header's directory or the system header directories are left
+ * out.
+ */
++ (NSArray*) filesIncludedBySource: (NSString*)aPath;
+/**
+ * Writes a database for the header at the specified path.  The entries
+ * dictionary maps NSNumbers containing an LKTypeDatabaseKind to dictionaries
+ * of names and string values.  The hashes of all of the files returned by
+ * +filesIncludedBySource: are recorded with them.  Returns YES on success.
+ */
++ (BOOL) writeDatabaseForSource: (NSString*)aPath
+                        entries: (NSDictionary*)entries;
+/**
+ * Returns the value stored for a name, or NULL if there is none.  The returned
+ * string is valid for the lifetime of the receiver.
+ */
+- (const char*) valueForName: (const char*)aName kind: (LKTypeDatabaseKind)aKind;
+@end
@@ -0,0 +1,496 @@
+#import "LKTypeDatabase.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+
+/**
+ * Format version.  Increment when the layout changes.
+ */
+static const uint32_t LKTypeDatabaseVersion = 2;
+static const char LKTypeDatabaseMagic[8] = { 'L', 'K', 'T', 'Y', 'P', 'E', 'D', 'B' };
+
+/**
+ * The file starts with this header, followed by the entries, sorted by kind
+ * and then by name, followed by the strings that they refer to.  The
+ * dependencies of the source are stored as entries of kind
+ * LKTypeDatabaseDependency, so they come last.  Values are
+ * in the byte order of the machine that wrote the file, which is fine for a
+ * per-user cache.
+ */
+struct LKTypeDatabaseHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t count;
+	/** Hash of the contents of the source. */
+	uint64_t sourceHash;
+};
+
+struct LKTypeDatabaseEntry
+{
+	uint32_t kind;
+	/** Offset of the null-terminated name from the start of the file. */
+	uint32_t name;
+	/** Offset of the null-terminated value from the start of the file. */
+	uint32_t value;
+};
+
+/**
+ * Maps a file read-only.  Returns NULL on failure.
+ */
+static const void *MapFile(const char *path, size_t *size)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		return NULL;
+	}
+	struct stat st;
+	void *data = NULL;
+	if ((0 == fstat(fd, &st)) && (st.st_size > 0))
+	{
+		*size = (size_t)st.st_size;
+		data = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (MAP_FAILED == data)
+		{
+			data = NULL;
+		}
+	}
+	close(fd);
+	return data;
+}
+
+/**
+ * Returns the 64-bit FNV-1a hash of the bytes.
+ */
+static uint64_t Hash(const unsigned char *bytes, size_t length)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	for (size_t i=0 ; i<length ; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+/**
+ * The hash of a file's contents, along with the attributes that the file had
+ * when it was hashed.
+ */
+struct LKFileHash
+{
+	dev_t device;
+	ino_t inode;
+	off_t size;
+	time_t modified;
+	time_t changed;
+	uint64_t hash;
+};
+
+/**
+ * Hashes of the files that this process has read, keyed by path.  Protected by
+ * synchronising on the LKTypeDatabase class.
+ */
+static NSMutableDictionary *FileHashes;
+
+/**
+ * Returns the hash of the contents of a file, or 0 if it can not be read.
+ * Files are only read again if their size, inode or times have changed since
+ * this process last hashed them, so checking the dependencies of a database a
+ * second time costs a stat for each file.
+ */
+static uint64_t HashFile(NSString *aPath)
+{
+	struct stat st;
+	if (0 != stat([aPath fileSystemRepresentation], &st))
+	{
+		return 0;
+	}
+	struct LKFileHash cached = { st.st_dev, st.st_ino, st.st_size,
+		st.st_mtime, st.st_ctime, 0 };
+	@synchronized([LKTypeDatabase class])
+	{
+		NSData *entry = [FileHashes objectForKey: aPath];
+		if (nil != entry)
+		{
+			const struct LKFileHash *old = [entry bytes];
+			if ((old->device == cached.device) && (old->inode == cached.inode) &&
+			    (old->size == cached.size) && (old->modified == cached.modified) &&
+			    (old->changed == cached.changed))
+			{
+				return old->hash;
+			}
+		}
+	}
+	size_t size;
+	const void *data = MapFile([aPath fileSystemRepresentation], &size);
+	if (NULL == data)
+	{
+		return 0;
+	}
+	cached.hash = Hash(data, size);
+	munmap((void*)data, size);
+	@synchronized([LKTypeDatabase class])
+	{
+		if (nil == FileHashes)
+		{
+			FileHashes = [NSMutableDictionary new];
+		}
+		[FileHashes setObject: [NSData dataWithBytes: &cached length: sizeof(cached)]
+		               forKey: aPath];
+	}
+	return cached.hash;
+}
+
+/**
+ * Returns the directories that are searched for headers included with angle
+ * brackets, in the order used by +[LKCompiler loadHeader:].
+ */
+static NSArray *IncludePaths(void)
+{
+	NSMutableArray *paths = [NSMutableArray array];
+	for (NSString *dir in NSSearchPathForDirectoriesInDomains(NSLibraryDirectory,
+			NSAllDomainsMask, YES))
+	{
+		[paths addObject: [dir stringByAppendingPathComponent: @"Headers"]];
+	}
+	[paths addObject: @"/usr/local/include"];
+	[paths addObject: @"/usr/include"];
+	return paths;
+}
+
+/**
+ * Returns the names in the #include and #import directives in a file, and
+ * whether each was in quotes rather than angle brackets.
+ */
+static void ScanIncludes(NSString *aPath, NSMutableArray *names,
+                         NSMutableArray *quoted)
+{
+	NSData *contents = [NSData dataWithContentsOfFile: aPath];
+	const char *p = [contents bytes];
+	const char *end = p + [contents length];
+	while (p < end)
+	{
+		const char *lineEnd = memchr(p, '\n', end - p);
+		if (NULL == lineEnd)
+		{
+			lineEnd = end;
+		}
+		while ((p < lineEnd) && ((' ' == *p) || ('\t' == *p))) { p++; }
+		if ((p < lineEnd) && ('#' == *p))
+		{
+			p++;
+			while ((p < lineEnd) && ((' ' == *p) || ('\t' == *p))) { p++; }
+			size_t length = lineEnd - p;
+			if ((length > 7) && (0 == strncmp(p, "include", 7)))
+			{
+				p += 7;
+			}
+			else if ((length > 6) && (0 == strncmp(p, "import", 6)))
+			{
+				p += 6;
+			}
+			else
+			{
+				p = lineEnd;
+			}
+			while ((p < lineEnd) && ((' ' == *p) || ('\t' == *p))) { p++; }
+			if ((p < lineEnd) && (('"' == *p) || ('<' == *p)))
+			{
+				char close = ('"' == *p) ? '"' : '>';
+				const char *start = ++p;
+				while ((p < lineEnd) && (close != *p)) { p++; }
+				if (p < lineEnd)
+				{
+					NSString *name = [[NSString alloc] initWithBytes: start
+					                                          length: p - start
+					                                        encoding: NSUTF8StringEncoding];
+					if (nil != name)
+					{
+						[names addObject: name];
+						[quoted addObject: [NSNumber numberWithBool: ('"' == close)]];
+					}
+				}
+			}
+		}
+		p = lineEnd + 1;
+	}
+}
+
+/**
+ * Returns the path of the database for a source file.  Databases are stored
+ * in the user's caches directory, named after a hash of the source's absolute
+ * path.
+ */
+static NSString *DatabasePath(NSString *aPath)
+{
+	NSArray *dirs = NSSearchPathForDirectoriesInDomains(NSCachesDirectory,
+			NSUserDomainMask, YES);
+	if ([dirs count] == 0)
+	{
+		return nil;
+	}
+	NSString *dir = [[[dirs objectAtIndex: 0]
+		stringByAppendingPathComponent: @"LanguageKit"]
+		stringByAppendingPathComponent: @"TypeDatabases"];
+	const char *source = [[aPath stringByStandardizingPath] UTF8String];
+	NSString *name = [NSString stringWithFormat: @"%016llx.lktypes",
+		(unsigned long long)Hash((const unsigned char*)source, strlen(source))];
+	return [dir stringByAppendingPathComponent: name];
+}
+
+static int CompareEntry(uint32_t kind, const char *name,
+                        const struct LKTypeDatabaseEntry *entry, const char *base)
+{
+	if (kind != entry->kind)
+	{
+		return (kind < entry->kind) ? -1 : 1;
+	}
+	return strcmp(name, base + entry->name);
+}
+
+@implementation LKTypeDatabase
+- (id) initWithPath: (NSString*)aPath sourceHash: (uint64_t)hash
+{
+	self = [super init];
+	if (nil == self)
+	{
+		return nil;
+	}
+	data = MapFile([aPath fileSystemRepresentation], &size);
+	if (NULL == data)
+	{
+		return nil;
+	}
+	const struct LKTypeDatabaseHeader *header = data;
+	// Validate everything that lookups rely on, so that they do not have to
+	// check it again.  The last byte must be a null, so that every string in
+	// the file is terminated.
+	if ((size < sizeof(struct LKTypeDatabaseHeader)) ||
+	    (0 != memcmp(header->magic, LKTypeDatabaseMagic, 8)) ||
+	    (header->version != LKTypeDatabaseVersion) ||
+	    (header->sourceHash != hash) ||
+	    ((size - sizeof(struct LKTypeDatabaseHeader)) /
+	      sizeof(struct LKTypeDatabaseEntry) < header->count) ||
+	    (((const char*)data)[size - 1] != '\0'))
+	{
+		return nil;
+	}
+	return self;
+}
+- (void) dealloc
+{
+	if (NULL != data)
+	{
+		munmap((void*)data, size);
+	}
+}
+/**
+ * Returns YES if every file that the database depends on still has the
+ * contents that it had when the database was written.
+ */
+- (BOOL) dependenciesAreUpToDate
+{
+	const struct LKTypeDatabaseHeader *header = data;
+	const struct LKTypeDatabaseEntry *entries = (const void*)(header + 1);
+	const char *base = data;
+	for (uint32_t i=header->count ; i>0 ; i--)
+	{
+		const struct LKTypeDatabaseEntry *e = &entries[i-1];
+		if (LKTypeDatabaseDependency != e->kind)
+		{
+			break;
+		}
+		if ((e->name >= size) || (e->value >= size))
+		{
+			return NO;
+		}
+		NSString *file = [NSString stringWithUTF8String: base + e->name];
+		uint64_t hash = strtoull(base + e->value, NULL, 16);
+		if ((nil == file) || (HashFile(file) != hash))
+		{
+			return NO;
+		}
+	}
+	return YES;
+}
++ (LKTypeDatabase*) databaseForSource: (NSString*)aPath
+{
+	NSString *path = DatabasePath(aPath);
+	if (nil == path)
+	{
+		return nil;
+	}
+	uint64_t hash = HashFile(aPath);
+	if (0 == hash)
+	{
+		return nil;
+	}
+	LKTypeDatabase *db = [[self alloc] initWithPath: path sourceHash: hash];
+	if (![db dependenciesAreUpToDate])
+	{
+		return nil;
+	}
+	return db;
+}
++ (NSArray*) filesIncludedBySource: (NSString*)aPath
+{
+	NSArray *includePaths = IncludePaths();
+	NSFileManager *fm = [NSFileManager defaultManager];
+	NSMutableArray *files = [NSMutableArray arrayWithObject:
+		[aPath stringByStandardizingPath]];
+	NSMutableSet *seen = [NSMutableSet setWithArray: files];
+	for (NSUInteger i=0 ; i<[files count] ; i++)
+	{
+		NSString *file = [files objectAtIndex: i];
+		NSMutableArray *names = [NSMutableArray array];
+		NSMutableArray *quoted = [NSMutableArray array];
+		ScanIncludes(file, names, quoted);
+		for (NSUInteger j=0 ; j<[names count] ; j++)
+		{
+			NSString *name = [names objectAtIndex: j];
+			NSMutableArray *candidates = [NSMutableArray array];
+			if ([[quoted objectAtIndex: j] boolValue])
+			{
+				[candidates addObject: [[file stringByDeletingLastPathComponent]
+					stringByAppendingPathComponent: name]];
+			}
+			for (NSString *dir in includePaths)
+			{
+				[candidates addObject: [dir stringByAppendingPathComponent: name]];
+			}
+			for (NSString *candidate in candidates)
+			{
+				BOOL isDir = NO;
+				if ([fm fileExistsAtPath: candidate isDirectory: &isDir] && !isDir)
+				{
+					candidate = [candidate stringByStandardizingPath];
+					if (![seen containsObject: candidate])
+					{
+						[seen addObject: candidate];
+						[files addObject: candidate];
+					}
+					break;
+				}
+			}
+		}
+	}
+	return files;
+}
++ (BOOL) writeDatabaseForSource: (NSString*)aPath
+                        entries: (NSDictionary*)entries
+{
+	NSString *path = DatabasePath(aPath);
+	uint64_t hash = HashFile(aPath);
+	if ((nil == path) || (0 == hash))
+	{
+		return NO;
+	}
+	NSMutableDictionary *dependencies = [NSMutableDictionary dictionary];
+	for (NSString *file in [self filesIncludedBySource: aPath])
+	{
+		[dependencies setObject: [NSString stringWithFormat: @"%016llx",
+				(unsigned long long)HashFile(file)]
+		                 forKey: file];
+	}
+	NSMutableDictionary *allEntries = [entries mutableCopy];
+	[allEntries setObject: dependencies
+	               forKey: [NSNumber numberWithInt: LKTypeDatabaseDependency]];
+	// Sort the entries in the order used for lookups.
+	NSMutableArray *sorted = [NSMutableArray array];
+	for (NSNumber *kind in allEntries)
+	{
+		NSDictionary *values = [allEntries objectForKey: kind];
+		for (NSString *name in values)
+		{
+			[sorted addObject: [NSArray arrayWithObjects: kind, name,
+				[values objectForKey: name], nil]];
+		}
+	}
+	[sorted sortUsingComparator: ^(NSArray *a, NSArray *b)
+		{
+			uint32_t ka = [[a objectAtIndex: 0] unsignedIntValue];
+			uint32_t kb = [[b objectAtIndex: 0] unsignedIntValue];
+			if (ka != kb)
+			{
+				return (ka < kb) ? NSOrderedAscending : NSOrderedDescending;
+			}
+			int cmp = strcmp([[a objectAtIndex: 1] UTF8String],
+			                 [[b objectAtIndex: 1] UTF8String]);
+			return (cmp < 0) ? NSOrderedAscending :
+				((cmp > 0) ? NSOrderedDescending : NSOrderedSame);
+		}];
+
+	uint32_t count = (uint32_t)[sorted count];
+	size_t entriesSize = count * sizeof(struct LKTypeDatabaseEntry);
+	struct LKTypeDatabaseHeader header;
+	memcpy(header.magic, LKTypeDatabaseMagic, 8);
+	header.version = LKTypeDatabaseVersion;
+	header.count = count;
+	header.sourceHash = hash;
+
+	NSMutableData *strings = [NSMutableData data];
+	struct LKTypeDatabaseEntry *table = calloc(count + 1,
+		sizeof(struct LKTypeDatabaseEntry));
+	size_t stringsStart = sizeof(header) + entriesSize;
+	for (uint32_t i=0 ; i<count ; i++)
+	{
+		NSArray *e = [sorted objectAtIndex: i];
+		const char *name = [[e objectAtIndex: 1] UTF8String];
+		const char *value = [[e objectAtIndex: 2] UTF8String];
+		table[i].kind = [[e objectAtIndex: 0] unsignedIntValue];
+		table[i].name = (uint32_t)(stringsStart + [strings length]);
+		[strings appendBytes: name length: strlen(name) + 1];
+		table[i].value = (uint32_t)(stringsStart + [strings length]);
+		[strings appendBytes: value length: strlen(value) + 1];
+	}
+	NSMutableData *file = [NSMutableData dataWithBytes: &header
+	                                            length: sizeof(header)];
+	[file appendBytes: table length: entriesSize];
+	[file appendData: strings];
+	// An empty database still needs a terminating null.
+	[file appendBytes: "" length: 1];
+	free(table);
+
+	[[NSFileManager defaultManager]
+		createDirectoryAtPath: [path stringByDeletingLastPathComponent]
+		withIntermediateDirectories: YES
+		               attributes: nil
+		                    error: NULL];
+	return [file writeToFile: path atomically: YES];
+}
+- (const char*) valueForName: (const char*)aName kind: (LKTypeDatabaseKind)aKind
+{
+	const struct LKTypeDatabaseHeader *header = data;
+	const struct LKTypeDatabaseEntry *entries = (const void*)(header + 1);
+	const char *base = data;
+	size_t low = 0;
+	size_t high = header->count;
+	while (low < high)
+	{
+		size_t mid = low + (high - low) / 2;
+		const struct LKTypeDatabaseEntry *e = &entries[mid];
+		if ((e->name >= size) || (e->value >= size))
+		{
+			return NULL;
+		}
+		int cmp = CompareEntry(aKind, aName, e, base);
+		if (0 == cmp)
+		{
+			return base + e->value;
+		}
+		if (cmp < 0)
+		{
+			high = mid;
+		}
+		else
+		{
+			low = mid + 1;
+		}
+	}
+	return NULL;
+}
+@end
@@ -5,5 +5,16 @@
  */
 
 void LKSkipQualifiers(const char **typestr);
+/**
+ * Skips the quoted field name that may precede a type inside a structure
+ * encoding, if there is one.
+ */
+void LKSkipFieldName(const char **typestr);
 void LKNextType(const char **typestr);
+/**
+ * Returns whether the first types in two encodings describe the same type.
+ * Qualifiers, field names, and the class names of objects are ignored, as is
+ * the name of an anonymous structure or union.
+ */
+BOOL LKTypesMatch(const char *type1, const char *type2);
 int LKCountObjCTypes(const char *objctype);
@@ -1,4 +1,5 @@
 #import "LKTypeHelpers.h"
+#include <string.h>
 
 void LKSkipQualifiers(const char **typestr)
 {
@@ -11,53 +12,218 @@ void LKSkipQualifiers(const char **typestr)
 	}
 }
 
-#define SKIPNAME \
-	while (**typestr != '=')\
-	{\
-		(*typestr)++;\
-	}\
-	(*typestr)++
+/**
+ * Skips the name of a structure or union, and the '=' that follows it.  Opaque
+ * types (for example {_NSZone}) have no '=', so stop at the closing bracket.
+ */
+static void SkipName(const char **typestr, char close)
+{
+	while (**typestr != '=' && **typestr != close && **typestr != '\0')
+	{
+		(*typestr)++;
+	}
+	if (**typestr == '=')
+	{
+		(*typestr)++;
+	}
+}
+
+void LKSkipFieldName(const char **typestr)
+{
+	if (**typestr == '"')
+	{
+		(*typestr)++;
+		while (**typestr != '"' && **typestr != '\0')
+		{
+			(*typestr)++;
+		}
+		if (**typestr == '"')
+		{
+			(*typestr)++;
+		}
+	}
+}
+
+/**
+ * Skips the fields of a structure or union, up to and including the closing
+ * bracket.
+ */
+static void SkipFields(const char **typestr, char close)
+{
+	while (**typestr != close && **typestr != '\0')
+	{
+		LKSkipFieldName(typestr);
+		LKNextType(typestr);
+	}
+	if (**typestr == close)
+	{
+		(*typestr)++;
+	}
+}
 
 void LKNextType(const char **typestr)
 {
 	LKSkipQualifiers(typestr);
 	switch (**typestr)
 	{
+		case '\0':
+			break;
 		case '{':
 			(*typestr)++;
-			SKIPNAME;
-			while (**typestr != '}')
-			{
-				LKNextType(typestr);
-			}
-			(*typestr)++;
+			SkipName(typestr, '}');
+			SkipFields(typestr, '}');
 			break;
 		case '(':
 			(*typestr)++;
-			SKIPNAME;
-			while (**typestr != ')')
-			{
-				LKNextType(typestr);
-			}
-			(*typestr)++;
+			SkipName(typestr, ')');
+			SkipFields(typestr, ')');
 			break;
 		case '[':
 			(*typestr)++;
-			while (**typestr != '[')
-			{
-				LKNextType(typestr);
-			}
-			(*typestr)++;
+			// The element count is skipped along with the qualifiers.
+			SkipFields(typestr, ']');
 			break;
 		case '^':
 			(*typestr)++;
 			LKNextType(typestr);
 			break;
+		case '@':
+			(*typestr)++;
+			// Blocks are @? and objects may be followed by their class name.
+			if (**typestr == '?')
+			{
+				(*typestr)++;
+			}
+			else if (**typestr == '"')
+			{
+				// In a structure with named fields, a quoted string after @
+				// may be the name of the next field instead.  It is a class
+				// name only if it is followed by another field name or by the
+				// end of the enclosing type.
+				const char *end = strchr(*typestr + 1, '"');
+				if (NULL != end && (end[1] == '"' || end[1] == '}' ||
+				    end[1] == ')' || end[1] == ']' || end[1] == '\0'))
+				{
+					*typestr = end + 1;
+				}
+			}
+			break;
 		default:
 			(*typestr)++;
 	}
 }
 
+/**
+ * Returns whether the names of two structures or unions match, and skips them
+ * and the '=' that follows each of them.  Anonymous types, named "?", match
+ * any name.
+ */
+static BOOL NamesMatch(const char **a, const char **b, char close)
+{
+	const char *nameA = *a;
+	const char *nameB = *b;
+	SkipName(a, close);
+	SkipName(b, close);
+	size_t lengthA = *a - nameA - (*(*a - 1) == '=' ? 1 : 0);
+	size_t lengthB = *b - nameB - (*(*b - 1) == '=' ? 1 : 0);
+	if ((lengthA == 1 && *nameA == '?') || (lengthB == 1 && *nameB == '?'))
+	{
+		return YES;
+	}
+	return (lengthA == lengthB) && (0 == strncmp(nameA, nameB, lengthA));
+}
+
+/**
+ * Compares the first types in two encodings, advancing past both of them
+ * when they match.
+ */
+static BOOL NextTypesMatch(const char **a, const char **b)
+{
+	LKSkipQualifiers(a);
+	LKSkipQualifiers(b);
+	char type = **a;
+	if (type != **b)
+	{
+		return NO;
+	}
+	switch (type)
+	{
+		case '{':
+		case '(':
+		{
+			char close = (type == '{') ? '}' : ')';
+			(*a)++;
+			(*b)++;
+			if (!NamesMatch(a, b, close))
+			{
+				return NO;
+			}
+			// An opaque type matches any type with the same name.
+			if (**a == close || **b == close)
+			{
+				SkipFields(a, close);
+				SkipFields(b, close);
+				return YES;
+			}
+			while (**a != close && **b != close)
+			{
+				LKSkipFieldName(a);
+				LKSkipFieldName(b);
+				if ((**a == '\0') || !NextTypesMatch(a, b))
+				{
+					return NO;
+				}
+			}
+			if (**a != close || **b != close)
+			{
+				return NO;
+			}
+			(*a)++;
+			(*b)++;
+			return YES;
+		}
+		case '[':
+		{
+			char *endA, *endB;
+			unsigned long countA = strtoul(*a + 1, &endA, 10);
+			unsigned long countB = strtoul(*b + 1, &endB, 10);
+			*a = endA;
+			*b = endB;
+			if ((countA != countB) || !NextTypesMatch(a, b) ||
+			    (**a != ']') || (**b != ']'))
+			{
+				return NO;
+			}
+			(*a)++;
+			(*b)++;
+			return YES;
+		}
+		case '^':
+			(*a)++;
+			(*b)++;
+			return NextTypesMatch(a, b);
+		case '@':
+			if (((*a)[1] == '?') != ((*b)[1] == '?'))
+			{
+				return NO;
+			}
+			LKNextType(a);
+			LKNextType(b);
+			return YES;
+		case '\0':
+			return YES;
+		default:
+			(*a)++;
+			(*b)++;
+			return YES;
+	}
+}
+
+BOOL LKTypesMatch(const char *type1, const char *type2)
+{
+	return NextTypesMatch(&type1, &type2);
+}
+
 int LKCountObjCTypes(const char *objctype)
 {
 	if (NULL == objctype)
@@ -0,0 +1,735 @@
+#import "LanguageKit.h"
+#import "LKASTVisitor.h"
+#import <objc/runtime.h>
+#import <errno.h>
+
+/**
+ * The largest integer literal that fits in a SmallInt on every platform.
+ */
+#define LKSmallIntLiteralMax (INTPTR_MAX >> 3)
+/**
+ * The number of times that a loop body is analysed before the types of the
+ * variables that it assigns to are given up on.
+ */
+#define LKMaxLoopIterations 8
+
+static NSSet *ArithmeticSelectors;
+static NSSet *ComparisonSelectors;
+
+/**
+ * Collects the symbols that are assigned to in a tree.
+ */
+@interface LKAssignmentCollector : LKASTVisitor
+{
+	@public
+	NSMutableArray *assigned;
+}
+@end
+@implementation LKAssignmentCollector
+- (LKAST*) visitAssignExpr: (LKAssignExpr*)anAssignment
+{
+	id symbol = [[anAssignment target] symbol];
+	if ([symbol isKindOfClass: [LKSymbol class]])
+	{
+		[assigned addObject: symbol];
+	}
+	return anAssignment;
+}
+@end
+
+/**
+ * Collects the methods in a tree.
+ */
+@interface LKMethodCollector : LKASTVisitor
+{
+	@public
+	NSMutableArray *methods;
+}
+@end
+@implementation LKMethodCollector
+- (LKAST*) visitMethod: (LKMethod*)aMethod
+{
+	[methods addObject: aMethod];
+	return aMethod;
+}
+@end
+
+/**
+ * Returns the symbols that are assigned to below a node.
+ */
+static NSArray *assignedSymbols(LKAST *aNode)
+{
+	LKAssignmentCollector *collector = [LKAssignmentCollector new];
+	collector->assigned = [NSMutableArray array];
+	[aNode visitWithVisitor: collector];
+	return collector->assigned;
+}
+
+/**
+ * Returns the names of variables from enclosing scopes that blocks below a
+ * node assign to.
+ */
+static NSSet *namesAssignedByBlocks(LKAST *aNode)
+{
+	NSMutableSet *names = [NSMutableSet set];
+	for (LKSymbol *symbol in assignedSymbols(aNode))
+	{
+		if (LKSymbolScopeExternal == [symbol scope])
+		{
+			[names addObject: [symbol name]];
+		}
+	}
+	return names;
+}
+
+static NSMapTable *newVariableMap(void)
+{
+	return [[NSMapTable alloc] initWithKeyOptions: NSPointerFunctionsStrongMemory | NSPointerFunctionsObjectPointerPersonality
+	                                 valueOptions: NSPointerFunctionsStrongMemory
+	                                     capacity: 8];
+}
+
+/**
+ * Merges the types in one map of variables into another.
+ */
+static void mergeVariables(NSMapTable *aMap, NSMapTable *otherMap)
+{
+	for (LKSymbol *symbol in otherMap)
+	{
+		LKInferredType *type = [otherMap objectForKey: symbol];
+		[aMap setObject: [type typeByMergingWithType: [aMap objectForKey: symbol]]
+		         forKey: symbol];
+	}
+}
+
+static BOOL variablesAreEqual(NSMapTable *aMap, NSMapTable *otherMap)
+{
+	if ([aMap count] != [otherMap count])
+	{
+		return NO;
+	}
+	for (LKSymbol *symbol in aMap)
+	{
+		if (![[aMap objectForKey: symbol] isEqual: [otherMap objectForKey: symbol]])
+		{
+			return NO;
+		}
+	}
+	return YES;
+}
+
+/**
+ * The state of inference at a point in a method or block.
+ */
+@interface LKTypeContext : NSObject
+{
+	@public
+	/** The types of the variables at this point, keyed by symbol. */
+	NSMapTable *variables;
+	/** The merged types of all values assigned to each variable. */
+	NSMapTable *assigned;
+	/**
+	 * Maps for each enclosing loop of the types assigned to variables in its
+	 * body, innermost last.
+	 */
+	NSMutableArray *loops;
+	/** The names of variables that blocks assign to. */
+	NSSet *unstable;
+	/** The symbols declared by the method or block. */
+	LKSymbolTable *scope;
+	/** The type of self. */
+	LKInferredType *selfType;
+	/** The context for the method, which collects the types returned. */
+	__unsafe_unretained LKTypeContext *method;
+	/** The merged types of the values returned from the method. */
+	LKInferredType *returnType;
+	/** Whether this point may be reached. */
+	BOOL reachable;
+}
+@end
+@interface LKAST (TypeInferenceContext)
+/**
+ * Infers the type of this node and of its children, given the types at the
+ * point where it is evaluated, and updates the types to those at the point
+ * after it.
+ */
+- (LKInferredType*) inferTypeInContext: (LKTypeContext*)aContext;
+@end
+
+@implementation LKTypeContext
++ (void) initialize
+{
+	if (self != [LKTypeContext class]) { return; }
+	ArithmeticSelectors = [[NSSet alloc] initWithObjects: @"plus:", @"sub:",
+		@"mul:", @"div:", @"mod:", @"min:", @"max:", nil];
+	ComparisonSelectors = [[NSSet alloc] initWithObjects: @"isLessThan:",
+		@"isGreaterThan:", @"isLessThanOrEqualTo:", @"isGreaterThanOrEqualTo:",
+		@"isEqual:", nil];
+}
++ (LKTypeContext*) contextForScope: (LKSymbolTable*)aTable
+                          selfType: (LKInferredType*)aType
+                          unstable: (NSSet*)unstableNames
+{
+	LKTypeContext *context = [self new];
+	context->variables = newVariableMap();
+	context->assigned = newVariableMap();
+	context->loops = [NSMutableArray array];
+	context->unstable = unstableNames;
+	context->scope = aTable;
+	context->selfType = aType;
+	context->method = context;
+	context->reachable = YES;
+	LKInferredType *unknown = [LKInferredType unknownType];
+	for (LKSymbol *symbol in [aTable arguments])
+	{
+		[context->variables setObject: unknown forKey: symbol];
+		[context->assigned setObject: unknown forKey: symbol];
+	}
+	for (LKSymbol *symbol in [aTable locals])
+	{
+		BOOL isUnstable = [unstableNames containsObject: [symbol name]];
+		[context->variables setObject: isUnstable ? unknown : [LKInferredType nilType]
+		                       forKey: symbol];
+	}
+	return context;
+}
+/**
+ * Returns a context for a branch starting with the specified variables.
+ */
+- (LKTypeContext*) branchWithVariables: (NSMapTable*)aMap
+{
+	LKTypeContext *branch = [LKTypeContext new];
+	branch->variables = [aMap copy];
+	branch->assigned = assigned;
+	branch->loops = loops;
+	branch->unstable = unstable;
+	branch->scope = scope;
+	branch->selfType = selfType;
+	branch->method = method;
+	branch->reachable = reachable;
+	return branch;
+}
+- (LKTypeContext*) branch
+{
+	return [self branchWithVariables: variables];
+}
+/**
+ * Continues from the end of two branches.
+ */
+- (void) mergeBranch: (LKTypeContext*)aBranch withBranch: (LKTypeContext*)otherBranch
+{
+	reachable = aBranch->reachable || otherBranch->reachable;
+	if (!otherBranch->reachable)
+	{
+		variables = aBranch->variables;
+		return;
+	}
+	variables = otherBranch->variables;
+	if (aBranch->reachable)
+	{
+		mergeVariables(variables, aBranch->variables);
+	}
+}
+/**
+ * Sets the type of the arguments from a method type encoding.
+ */
+- (void) setArgumentTypes: (NSString*)aTypeEncoding
+{
+	NSMethodSignature *sig =
+		[NSMethodSignature signatureWithObjCTypes: [aTypeEncoding UTF8String]];
+	NSUInteger i = 2;
+	for (LKSymbol *symbol in [scope arguments])
+	{
+		if (i >= [sig numberOfArguments])
+		{
+			break;
+		}
+		if ([unstable containsObject: [symbol name]])
+		{
+			i++;
+			continue;
+		}
+		LKInferredType *type =
+			[LKInferredType typeForEncoding: [sig getArgumentTypeAtIndex: i++]];
+		[variables setObject: type forKey: symbol];
+		[assigned setObject: type forKey: symbol];
+	}
+}
+- (LKInferredType*) typeOfSymbol: (LKSymbol*)aSymbol
+{
+	switch ([aSymbol scope])
+	{
+		case LKSymbolScopeArgument:
+		case LKSymbolScopeLocal:
+		{
+			LKInferredType *type = [variables objectForKey: aSymbol];
+			return (nil == type) ? [LKInferredType unknownType] : type;
+		}
+		case LKSymbolScopeObject:
+		case LKSymbolScopeClass:
+			return [LKInferredType typeForEncoding: [[aSymbol typeEncoding] UTF8String]];
+		case LKSymbolScopeGlobal:
+			// Globals are looked up by name at run time, so they are only known
+			// to be classes if the class already exists.  Anything else, such
+			// as a class defined later or a global in the interpreter's
+			// environment, may be any object.
+			if (Nil != NSClassFromString([aSymbol name]))
+			{
+				return [LKInferredType classTypeWithClassName: [aSymbol name]];
+			}
+			return [LKInferredType objectTypeWithClassName: nil nonNil: NO];
+		default:
+			return [LKInferredType unknownType];
+	}
+}
+- (void) assignType: (LKInferredType*)aType toSymbol: (LKSymbol*)aSymbol
+{
+	if (nil == [variables objectForKey: aSymbol])
+	{
+		return;
+	}
+	if ((nil == aType) || [unstable containsObject: [aSymbol name]])
+	{
+		aType = [LKInferredType unknownType];
+	}
+	[variables setObject: aType forKey: aSymbol];
+	[assigned setObject: [aType typeByMergingWithType: [assigned objectForKey: aSymbol]]
+	             forKey: aSymbol];
+	for (NSMapTable *loop in loops)
+	{
+		[loop setObject: [aType typeByMergingWithType: [loop objectForKey: aSymbol]]
+		         forKey: aSymbol];
+	}
+}
+/**
+ * Gives up on the types of the variables that are assigned to below a node.
+ */
+- (void) forgetSymbolsAssignedIn: (LKAST*)aNode
+{
+	for (LKSymbol *symbol in assignedSymbols(aNode))
+	{
+		[self assignType: [LKInferredType unknownType] toSymbol: symbol];
+	}
+}
+- (void) returnType: (LKInferredType*)aType
+{
+	method->returnType = [aType typeByMergingWithType: method->returnType];
+	reachable = NO;
+}
+- (void) inferStatements: (NSArray*)statements
+{
+	for (LKAST *statement in statements)
+	{
+		if (!reachable)
+		{
+			break;
+		}
+		[statement inferTypeInContext: self];
+	}
+}
+/**
+ * Stores the inferred types of the variables declared by the method or
+ * block in their symbols.
+ */
+- (void) setSymbolTypes
+{
+	for (LKSymbol *symbol in [scope arguments])
+	{
+		[symbol setInferredType: [assigned objectForKey: symbol]];
+	}
+	for (LKSymbol *symbol in [scope locals])
+	{
+		LKInferredType *type = [assigned objectForKey: symbol];
+		if ([unstable containsObject: [symbol name]])
+		{
+			type = [LKInferredType unknownType];
+		}
+		[symbol setInferredType: (nil == type) ? [LKInferredType nilType] : type];
+	}
+}
+@end
+
+@implementation LKAST (TypeInference)
+- (void) inferTypes
+{
+	LKMethodCollector *collector = [LKMethodCollector new];
+	collector->methods = [NSMutableArray array];
+	[self visitWithVisitor: collector];
+	for (LKMethod *method in collector->methods)
+	{
+		[method inferTypes];
+	}
+}
+- (LKInferredType*) inferTypeInContext: (LKTypeContext*)aContext
+{
+	[aContext forgetSymbolsAssignedIn: self];
+	[self setInferredType: [LKInferredType unknownType]];
+	return [self inferredType];
+}
+@end
+
+@implementation LKMethod (TypeInference)
+- (LKInferredType*) typeOfSelf
+{
+	LKAST *definition = [self parent];
+	NSString *className = nil;
+	if ([definition isKindOfClass: [LKSubclass class]])
+	{
+		className = [(LKSubclass*)definition classname];
+	}
+	else if ([definition isKindOfClass: [LKCategoryDef class]])
+	{
+		className = [(LKCategoryDef*)definition classname];
+	}
+	if (nil == className)
+	{
+		return [LKInferredType objectTypeWithClassName: nil nonNil: NO];
+	}
+	if ([self isClassMethod])
+	{
+		return [LKInferredType classTypeWithClassName: className];
+	}
+	return [LKInferredType objectTypeWithClassName: className nonNil: YES];
+}
+- (void) inferTypes
+{
+	LKTypeContext *context = [LKTypeContext contextForScope: symbols
+	                                               selfType: [self typeOfSelf]
+	                                               unstable: namesAssignedByBlocks(self)];
+	NSArray *types = [[self module] typesForMethod: [signature selector]];
+	// Methods with several possible types are compiled once for each, so only
+	// a single type says anything about the arguments.
+	if ([types count] == 1)
+	{
+		[context setArgumentTypes: [types objectAtIndex: 0]];
+	}
+	[context inferStatements: statements];
+	// Methods that do not return explicitly return self.
+	if (context->reachable)
+	{
+		[context returnType: context->selfType];
+	}
+	[self setInferredType: (nil == context->returnType) ?
+		[LKInferredType unknownType] : context->returnType];
+	[context setSymbolTypes];
+}
+@end
+
+@implementation LKBlockExpr (TypeInference)
+- (LKInferredType*) inferTypeInContext: (LKTypeContext*)aContext
+{
+	LKTypeContext *context = [LKTypeContext contextForScope: symbols
+	                                               selfType: aContext->selfType
+	                                               unstable: namesAssignedByBlocks(self)];
+	// Non-local returns return from the method.
+	context->method = aContext->method;
+	[context inferStatements: statements];
+	[context setSymbolTypes];
+	[self setInferredType: [LKInferredType objectTypeWithClassName: nil nonNil: YES]];
+	return [self inferredType];
+}
+@end
+
+@implementation LKArrayExpr (TypeInference)
+- (LKInferredType*) inferTypeInContext: (LKTypeContext*)aContext
+{
+	for (LKAST *element in elements)
+	{
+		[element inferTypeInContext: aContext];
+	}
+	[self setInferredType: [LKInferredType objectTypeWithClassName: @"NSArray" nonNil: YES]];
+	return [self inferredType];
+}
+@end
+
+@implementation LKAssignExpr (TypeInference)
+- (LKInferredType*) inferTypeInContext: (LKTypeContext*)aContext
+{
+	LKInferredType *type = [expr inferTypeInContext: aContext];
+	[aContext assignType: type toSymbol: [target symbol]];
+	[target setInferredType: type];
+	[self setInferredType: type];
+	return type;
+}
+@end
+
+@implementation LKComment (TypeInference)
+- (LKInferredType*) inferTypeInContext: (LKTypeContext*)aContext
+{
+	return nil;
+}
+@end
+
+@implementation LKCompare (TypeInference)
+- (LKInferredType*) inferTypeInContext: (LKTypeContext*)aContext
+{
+	[lhs inferTypeInContext: aContext];
+	[rhs inferTypeInContext: aContext];
+	[self setInferredType: [LKInferredType boolType]];
+	return [self inferredType];
+}
+@end
+
+@implementation LKDeclRef (TypeInference)
+- (LKInferredType*) inferTypeInContext: (LKTypeContext*)aContext
+{
+	[self setInferredType: [aContext typeOfSymbol: [self symbol]]];
+	return [self inferredType];
+}
+@end
+@implementation LKNilRef (TypeInference)
+- (LKInferredType*) inferTypeInContext: (LKTypeContext*)aContext
+{
+	[self setInferredType: [LKInferredType nilType]];
+	return [self inferredType];
+}
+@end
+@implementation LKSelfRef (TypeInference)
+- (LKInferredType*) inferTypeInContext: (LKTypeContext*)aContext
+{
+	[self setInferredType: aContext->selfType];
+	return [self inferredType];
+}
+@end
+@implementation LKSuperRef (TypeInference)
+- (LKInferredType*) inferTypeInContext: (LKTypeContext*)aContext
+{
+	[self setInferredType: aContext->selfType];
+	return [self inferredType];
+}
+@end
+@implementation LKBlockSelfRef (TypeInference)
+- (LKInferredType*) inferTypeInContext: (LKTypeContext*)aContext
+{
+	[self setInferredType: [LKInferredType objectTypeWithClassName: nil nonNil: YES]];
+	return [self inferredType];
+}
+@end
+
+@implementation LKIfStatement (TypeInference)
+- (LKInferredType*) inferTypeInContext: (LKTypeContext*)aContext
+{
+	[condition inferTypeInContext: aContext];
+	LKTypeContext *thenContext = [aContext branch];
+	[thenContext inferStatements: thenStatements];
+	LKTypeContext *elseContext = [aContext branch];
+	[elseContext inferStatements: elseStatements];
+	[aContext mergeBranch: thenContext withBranch: elseContext];
+	[self setInferredType: [LKInferredType unknownType]];
+	return [self inferredType];
+}
+@end
+
+@implementation LKStringLiteral (TypeInference)
+- (LKInferredType*) inferTypeInContext: (LKTypeContext*)aContext
+{
+	[self setInferredType: [LKInferredType objectTypeWithClassName: @"NSString" nonNil: YES]];
+	return [self inferredType];
+}
+@end
+
+@implementation LKNumberLiteral (TypeInference)
+- (LKInferredType*) inferTypeInContext: (LKTypeContext*)aContext
+{
+	const char *str = [value UTF8String];
+	char *end;
+	errno = 0;
+	long long v = strtoll(str, &end, 10);
+	BOOL isSmall = ('\0' == *end) && (0 == errno) &&
+		(v <= LKSmallIntLiteralMax) && (v >= -LKSmallIntLiteralMax);
+	[self setInferredType: isSmall ? [LKInferredType smallIntType] : [LKInferredType integerType]];
+	return [self inferredType];
+}
+@end
+
+@implementation LKFloatLiteral (TypeInference)
+- (LKInferredType*) inferTypeInContext: (LKTypeContext*)aContext
+{
+	[self setInferredType: [LKInferredType floatType]];
+	return [self inferredType];
+}
+@end
+
+@implementation LKLoop (TypeInference)
+- (LKInferredType*) inferTypeInContext: (LKTypeContext*)aContext
+{
+	[self setInferredType: [LKInferredType unknownType]];
+	[aContext inferStatements: loopInitStatements];
+	if (!aContext->reachable)
+	{
+		return [self inferredType];
+	}
+	// The loop may be entered, left or continued at any point in the body,
+	// where each variable may have its type on entry or the type of any value
+	// assigned to it in the body.  Repeat until that stops changing.
+	NSMapTable *entry = [aContext->variables copy];
+	for (int i=0 ; ; i++)
+	{
+		NSMapTable *assigned = newVariableMap();
+		[aContext->loops addObject: assigned];
+		LKTypeContext *body = [aContext branchWithVariables: entry];
+		[preCondition inferTypeInContext: body];
+		[body inferStatements: statements];
+		body->reachable = YES;
+		[body inferStatements: updateStatements];
+		[postCondition inferTypeInContext: body];
+		[aContext->loops removeLastObject];
+		if (i >= LKMaxLoopIterations)
+		{
+			for (LKSymbol *symbol in assigned)
+			{
+				[assigned setObject: [LKInferredType unknownType] forKey: symbol];
+			}
+		}
+		NSMapTable *next = [entry copy];
+		mergeVariables(next, assigned);
+		if (variablesAreEqual(next, entry))
+		{
+			break;
+		}
+		entry = next;
+	}
+	aContext->variables = entry;
+	return [self inferredType];
+}
+@end
+
+/**
+ * Returns the type of the result of sending a message, or nil if nothing is
+ * known about it.
+ */
+static LKInferredType *resultOfMessage(NSString *aSelector,
+                                       NSArray *types,
+                                       LKInferredType *target,
+                                       NSArray *argumentTypes)
+{
+	LKInferredKind targetKind = [target kind];
+	if ([target isNumeric] && ([argumentTypes count] == 1))
+	{
+		LKInferredType *argument = [argumentTypes objectAtIndex: 0];
+		if ([argument isNumeric])
+		{
+			if ([ComparisonSelectors containsObject: aSelector])
+			{
+				return [LKInferredType boolType];
+			}
+			if ([ArithmeticSelectors containsObject: aSelector])
+			{
+				BOOL isFloat = (LKInferredKindFloat == targetKind);
+				BOOL argumentIsFloat = (LKInferredKindFloat == [argument kind]);
+				if (isFloat && argumentIsFloat)
+				{
+					return [LKInferredType floatType];
+				}
+				// SmallInt arithmetic overflows into BigInts.
+				if (!isFloat && !argumentIsFloat)
+				{
+					return [LKInferredType integerType];
+				}
+			}
+		}
+	}
+	NSString *className = [target className];
+	if ((nil != className) &&
+	    ((LKInferredKindObject == targetKind) || (LKInferredKindClass == targetKind)))
+	{
+		Class cls = NSClassFromString(className);
+		BOOL isClass = (LKInferredKindClass == targetKind);
+		if (isClass && [@"alloc" isEqualToString: aSelector])
+		{
+			return [LKInferredType objectTypeWithClassName: className nonNil: YES];
+		}
+		if (isClass && [@"new" isEqualToString: aSelector])
+		{
+			return [LKInferredType objectTypeWithClassName: className nonNil: NO];
+		}
+		if (!isClass && [aSelector hasPrefix: @"init"])
+		{
+			return [LKInferredType objectTypeWithClassName: className nonNil: NO];
+		}
+		if (Nil != cls)
+		{
+			SEL sel = sel_registerName([aSelector UTF8String]);
+			Method m = isClass ? class_getClassMethod(cls, sel) :
+				class_getInstanceMethod(cls, sel);
+			if (NULL != m)
+			{
+				char ret[64];
+				method_getReturnType(m, ret, sizeof(ret));
+				return [LKInferredType typeForEncoding: ret];
+			}
+		}
+	}
+	if ([types count] == 1)
+	{
+		NSMethodSignature *sig =
+			[NSMethodSignature signatureWithObjCTypes: [[types objectAtIndex: 0] UTF8String]];
+		return [LKInferredType typeForEncoding: [sig methodReturnType]];
+	}
+	return nil;
+}
+
+@interface LKMessageSend (TypeInference)
+/**
+ * Infers the type of the result of this message, sent to a receiver of the
+ * specified type.
+ */
+- (LKInferredType*) inferTypeInContext: (LKTypeContext*)aContext
+                             forTarget: (LKInferredType*)aTarget;
+@end
+@implementation LKMessageSend (TypeInference)
+- (LKInferredType*) inferTypeInContext: (LKTypeContext*)aContext
+                             forTarget: (LKInferredType*)aTarget
+{
+	NSMutableArray *argumentTypes = [NSMutableArray array];
+	for (LKAST *argument in arguments)
+	{
+		LKInferredType *argumentType = [argument inferTypeInContext: aContext];
+		[argumentTypes addObject: (nil == argumentType) ?
+			[LKInferredType unknownType] : argumentType];
+	}
+	LKInferredType *result = resultOfMessage(selector, type, aTarget, argumentTypes);
+	[self setInferredType: (nil == result) ? [LKInferredType unknownType] : result];
+	return [self inferredType];
+}
+- (LKInferredType*) inferTypeInContext: (LKTypeContext*)aContext
+{
+	return [self inferTypeInContext: aContext
+	                      forTarget: [target inferTypeInContext: aContext]];
+}
+@end
+
+@implementation LKMessageCascade (TypeInference)
+- (LKInferredType*) inferTypeInContext: (LKTypeContext*)aContext
+{
+	LKInferredType *receiverType = [receiver inferTypeInContext: aContext];
+	LKInferredType *result = nil;
+	for (LKMessageSend *message in messages)
+	{
+		result = [message inferTypeInContext: aContext forTarget: receiverType];
+	}
+	[self setInferredType: result];
+	return result;
+}
+@end
+
+@implementation LKReturn (TypeInference)
+- (LKInferredType*) inferTypeInContext: (LKTypeContext*)aContext
+{
+	LKInferredType *result = [ret inferTypeInContext: aContext];
+	[aContext returnType: (nil == result) ? [LKInferredType unknownType] : result];
+	[self setInferredType: result];
+	return result;
+}
+@end
+
+@implementation LKBlockReturn (TypeInference)
+- (LKInferredType*) inferTypeInContext: (LKTypeContext*)aContext
+{
+	LKInferredType *result = [ret inferTypeInContext: aContext];
+	// Returns from the block, not from the method.
+	aContext->reachable = NO;
+	[self setInferredType: result];
+	return result;
+}
+@end
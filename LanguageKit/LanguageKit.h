@@ -1,23 +1,31 @@
 #import <LanguageKit/LKAST.h>
+#import <LanguageKit/LKASTCache.h>
 #import <LanguageKit/LKASTVisitor.h>
 #import <LanguageKit/LKArrayExpr.h>
 #import <LanguageKit/LKAssignExpr.h>
 #import <LanguageKit/LKBlockExpr.h>
+#import <LanguageKit/LKBundleCache.h>
 #import <LanguageKit/LKCategory.h>
 #import <LanguageKit/LKCodeGen.h>
 #import <LanguageKit/LKComment.h>
 #import <LanguageKit/LKComparison.h>
+#import <LanguageKit/LKCompileQueue.h>
+#import <LanguageKit/LKCompilationSession.h>
 #import <LanguageKit/LKCompiler.h>
 #import <LanguageKit/LKCompilerErrors.h>
+#import <LanguageKit/LKConstantFolder.h>
 #import <LanguageKit/LKDeclRef.h>
 #import <LanguageKit/LKEnumReference.h>
 #import <LanguageKit/LKFunctionCall.h>
 #import <LanguageKit/LKIfStatement.h>
+#import <LanguageKit/LKInferredType.h>
+#import <LanguageKit/LKInliner.h>
 #import <LanguageKit/LKLiteral.h>
 #import <LanguageKit/LKLoop.h>
 #import <LanguageKit/LKMessageSend.h>
 #import <LanguageKit/LKMethod.h>
 #import <LanguageKit/LKModule.h>
+#import <LanguageKit/LKPassManager.h>
 #import <LanguageKit/LKReturn.h>
 #import <LanguageKit/LKSubclass.h>
 #import <LanguageKit/LKSymbolRef.h>
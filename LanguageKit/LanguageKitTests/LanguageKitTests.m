@@ -8,6 +8,14 @@
 #import <XCTest/XCTest.h>
 
 #import <LanguageKit/LanguageKit.h>
+#import <LanguageKit/LKInterpreterRuntime.h>
+#import <LanguageKit/LKTypeDatabase.h>
+#import <LanguageKit/LKTypeHelpers.h>
+#import <objc/runtime.h>
+
+@interface LKCompiler (TypeLookup)
++ (NSString*)typesForFunction: (NSString*)functionName;
+@end
 
 @interface LanguageKitTests : XCTestCase {
     LKDBServer *_server;
@@ -46,5 +54,175 @@
     [self waitForExpectations:[NSArray arrayWithObjects:expectation1, expectation2, nil] timeout:10.0];
 }
 
+- (void)testRetiredTrampolineIsReused {
+    Class cls = [NSObject class];
+    SEL sel = sel_registerName("trampolineReuseTest");
+    struct LKTrampolineStatistics start = LKInterpreterTrampolineStatistics();
+    IMP imp = LKInterpreterMakeIMP(cls, sel, "@@:");
+    struct LKTrampolineStatistics made = LKInterpreterTrampolineStatistics();
+    XCTAssertEqual(start.live + 1, made.live, @"");
+    XCTAssertEqual(imp, LKInterpreterMakeIMP(cls, sel, "@@:"), @"equal methods should share an implementation");
+    LKInterpreterRetireIMP(imp);
+    LKInterpreterRetireIMP(imp);
+    struct LKTrampolineStatistics retired = LKInterpreterTrampolineStatistics();
+    XCTAssertEqual(start.live, retired.live, @"");
+    XCTAssertEqual(start.retired + 1, retired.retired, @"");
+    // Retiring an implementation that nothing uses, or one that the
+    // interpreter did not create, must not change the counts.
+    LKInterpreterRetireIMP(imp);
+    LKInterpreterRetireIMP(method_getImplementation(class_getInstanceMethod(cls, @selector(description))));
+    struct LKTrampolineStatistics ignored = LKInterpreterTrampolineStatistics();
+    XCTAssertEqual(retired.live, ignored.live, @"");
+    XCTAssertEqual(retired.retired, ignored.retired, @"");
+    // Redefining the method reuses the retired implementation.
+    XCTAssertEqual(imp, LKInterpreterMakeIMP(cls, sel, "@@:"), @"");
+    struct LKTrampolineStatistics reused = LKInterpreterTrampolineStatistics();
+    XCTAssertEqual(start.live + 1, reused.live, @"");
+    XCTAssertEqual(start.retired, reused.retired, @"");
+    XCTAssertEqual(start.reused + 1, reused.reused, @"");
+    XCTAssertEqual(made.liveBytes, reused.liveBytes, @"");
+    LKInterpreterRetireIMP(imp);
+}
+
+
+- (void)testReplacedVisitorMethodIsCalled {
+    Class cls = objc_allocateClassPair([LKASTVisitor class], "LKReplacedVisitorTest", 0);
+    objc_registerClassPair(cls);
+    __block NSString *visited = nil;
+    class_addMethod(cls, @selector(visitLiteral:), imp_implementationWithBlock(^LKAST*(id visitor, LKAST *node) {
+        visited = @"first";
+        return node;
+    }), "@@:@");
+    LKASTVisitor *visitor = [cls new];
+    LKAST *literal = [LKStringLiteral literalFromString:@"literal"];
+    [visitor visitASTNode:literal];
+    XCTAssertEqualObjects(@"first", visited, @"");
+    // Replace the method and free the old implementation, as a category or a
+    // redefinition might.  The visitor must not call the old one.
+    IMP old = class_replaceMethod(cls, @selector(visitLiteral:), imp_implementationWithBlock(^LKAST*(id visitor, LKAST *node) {
+        visited = @"second";
+        return node;
+    }), "@@:@");
+    imp_removeBlock(old);
+    [visitor visitASTNode:literal];
+    XCTAssertEqualObjects(@"second", visited, @"");
+}
+
+- (void)testConcurrentHeaderLoading {
+    NSString *header = [NSTemporaryDirectory() stringByAppendingPathComponent:
+        [NSString stringWithFormat:@"LKConcurrentHeader-%@.h", [[NSProcessInfo processInfo] globallyUniqueString]]];
+    XCTAssertTrue([@"int LKConcurrentHeaderFunction(int);\n" writeToFile:header atomically:YES encoding:NSUTF8StringEncoding error:NULL], @"");
+    // Modules checked concurrently load the headers in their pragmas from
+    // several threads at once.
+    const size_t count = 16;
+    BOOL *results = calloc(count, sizeof(BOOL));
+    dispatch_apply(count, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t i) {
+        results[i] = [LKCompiler loadHeader:header];
+    });
+    [[NSFileManager defaultManager] removeItemAtPath:header error:NULL];
+    BOOL loaded = results[0];
+    for (size_t i = 1; i < count; i++) {
+        XCTAssertEqual(loaded, results[i], @"");
+    }
+    free(results);
+    if (!loaded) {
+        // Headers can only be parsed when SourceCodeKit is installed.
+        return;
+    }
+    XCTAssertNotNil([LKCompiler typesForFunction:@"LKConcurrentHeaderFunction"], @"");
+}
+
+- (void)testRebuiltLanguageKitInvalidatesBundleCache {
+    NSFileManager *fm = [NSFileManager defaultManager];
+    NSString *dir = [NSTemporaryDirectory() stringByAppendingPathComponent:
+        [NSString stringWithFormat:@"LKStaleBundle-%@", [[NSProcessInfo processInfo] globallyUniqueString]]];
+    XCTAssertTrue([fm createDirectoryAtPath:dir withIntermediateDirectories:YES attributes:nil error:NULL], @"");
+    NSString *source = [dir stringByAppendingPathComponent:@"Stale.st"];
+    XCTAssertTrue([@"NSObject subclass: Stale [ ]\n" writeToFile:source atomically:YES encoding:NSUTF8StringEncoding error:NULL], @"");
+    NSString *library = [dir stringByAppendingPathComponent:@"languagekit-cache.so"];
+    XCTAssertTrue([[NSData data] writeToFile:library atomically:YES], @"");
+    NSBundle *bundle = [NSBundle bundleWithPath:dir];
+
+    NSString *key = [LKBundleCache keyForBundle:bundle inputs:@[source]];
+    XCTAssertNotNil(key, @"");
+    XCTAssertTrue([LKBundleCache writeKeyForLibrary:library forBundle:bundle], @"");
+    XCTAssertEqualObjects(key, [LKBundleCache keyForBundle:bundle inputs:@[source]], @"");
+
+    // Rebuilding LanguageKit does not change its version, but the library
+    // that the old build compiled must not be loaded.
+    NSString *binary = [[NSBundle bundleForClass:[LKAST class]] executablePath];
+    NSDate *built = [[fm attributesOfItemAtPath:binary error:NULL] fileModificationDate];
+    XCTAssertTrue([fm setAttributes:@{NSFileModificationDate: [built dateByAddingTimeInterval:10]} ofItemAtPath:binary error:NULL], @"");
+    NSString *rebuiltKey = [LKBundleCache keyForBundle:bundle inputs:@[source]];
+    BOOL loaded = [LKBundleCache loadLibraryForBundle:bundle];
+    [fm setAttributes:@{NSFileModificationDate: built} ofItemAtPath:binary error:NULL];
+    [fm removeItemAtPath:dir error:NULL];
+    XCTAssertNotNil(rebuiltKey, @"");
+    XCTAssertNotEqualObjects(key, rebuiltKey, @"");
+    XCTAssertFalse(loaded, @"the stale library should be compiled again, not loaded");
+}
+
+- (void)testTypeDatabaseSeesChangedHeaders {
+    NSString *header = [NSTemporaryDirectory() stringByAppendingPathComponent:
+        [NSString stringWithFormat:@"LKTypeDatabaseHeader-%@.h", [[NSProcessInfo processInfo] globallyUniqueString]]];
+    XCTAssertTrue([@"int LKTypeDatabaseFunction(int);\n" writeToFile:header atomically:NO encoding:NSUTF8StringEncoding error:NULL], @"");
+    NSDictionary *entries = @{ @(LKTypeDatabaseFunction): @{ @"LKTypeDatabaseFunction": @"i12@0:4i8" } };
+    XCTAssertTrue([LKTypeDatabase writeDatabaseForSource:header entries:entries], @"");
+    LKTypeDatabase *db = [LKTypeDatabase databaseForSource:header];
+    XCTAssertNotNil(db, @"");
+    XCTAssertEqual(0, strcmp("i12@0:4i8", [db valueForName:"LKTypeDatabaseFunction" kind:LKTypeDatabaseFunction]), @"");
+    // The second open uses the hashes remembered from the first.
+    XCTAssertNotNil([LKTypeDatabase databaseForSource:header], @"");
+    XCTAssertTrue([@"long LKTypeDatabaseFunction(long);\n" writeToFile:header atomically:NO encoding:NSUTF8StringEncoding error:NULL], @"");
+    XCTAssertNil([LKTypeDatabase databaseForSource:header], @"a changed header should not use the old database");
+    [[NSFileManager defaultManager] removeItemAtPath:header error:NULL];
+}
+
+- (void)testModuleSeesNewlyRegisteredMethods {
+    LKModule *module = [LKModule module];
+    XCTAssertTrue([[module typesForMethod:@"description"] containsObject:@"@16@0:8"], @"");
+    // Classes registered after the index was built are added to it, along
+    // with every selector that they implement.
+    Class first = objc_allocateClassPair([NSObject class], "LKModuleIndexTestFirst", 0);
+    class_addMethod(first, sel_registerName("lkModuleIndexTest:"), imp_implementationWithBlock(^double(id obj, double d) { return d; }), "d24@0:8d16");
+    objc_registerClassPair(first);
+    XCTAssertEqualObjects(@[@"d24@0:8d16"], [module typesForMethod:@"lkModuleIndexTest:"], @"");
+    Class second = objc_allocateClassPair([NSObject class], "LKModuleIndexTestSecond", 0);
+    class_addMethod(second, sel_registerName("lkModuleIndexTest:"), imp_implementationWithBlock(^id(id obj, id o) { return o; }), "@24@0:8@16");
+    objc_registerClassPair(second);
+    NSArray *expected = @[@"d24@0:8d16", @"@24@0:8@16"];
+    XCTAssertEqualObjects(expected, [module typesForMethod:@"lkModuleIndexTest:"], @"");
+}
+
+- (void)testStructsAreUnboxedOnlyFromTheSameType {
+    struct LKUnboxTest { double x; double y; } point = { 3, 4 };
+    Class cls = objc_allocateClassPair([NSObject class], "LKUnboxStructTest", 0);
+    XCTAssertTrue(class_addIvar(cls, "point", sizeof(point), log2(__alignof__(point)), "{LKUnboxTest=dd}"), @"");
+    objc_registerClassPair(cls);
+    id object = [cls new];
+    // Field names do not change the type.
+    LKSetIvar(object, @"point", [NSValue valueWithBytes:&point objCType:"{LKUnboxTest=\"x\"d\"y\"d}"]);
+    struct LKUnboxTest copy;
+    [LKGetIvar(object, @"point") getValue:&copy];
+    XCTAssertEqual(3, copy.x, @"");
+    XCTAssertEqual(4, copy.y, @"");
+    // A range is the same size, but must not be reinterpreted as the structure.
+    XCTAssertEqual(sizeof(NSRange), sizeof(point), @"");
+    XCTAssertThrows(LKSetIvar(object, @"point", [NSValue valueWithRange:NSMakeRange(1, 2)]), @"");
+    XCTAssertThrows(LKSetIvar(object, @"point", [NSValue valueWithBytes:&point objCType:"{LKOtherTest=dd}"]), @"");
+    XCTAssertTrue(LKTypesMatch("{LKUnboxTest=dd}", "{?=dd}"), @"");
+    XCTAssertFalse(LKTypesMatch("{LKUnboxTest=dd}", "{LKUnboxTest=qq}"), @"");
+}
+
+- (void)testTimesRepeatRejectsFractionalCounts {
+    __block int count = 0;
+    id (^block)(void) = ^id{ count++; return nil; };
+    [@3.0 performSelector:@selector(timesRepeat:) withObject:block];
+    XCTAssertEqual(3, count, @"");
+    // A fractional count must not be truncated.
+    XCTAssertThrows([@2.5 performSelector:@selector(timesRepeat:) withObject:block], @"");
+    XCTAssertThrows([@(NAN) performSelector:@selector(timesRepeat:) withObject:block], @"");
+    XCTAssertEqual(3, count, @"");
+}
 
 @end
@@ -1,5 +1,8 @@
 #import "BigInt.h"
 #import "BlockClosure.h"
+#import "BoxedFloat.h"
+#include <math.h>
+#import "LKCountedLoop.h"
 
 static mpz_t ZERO;
 Class BigIntClass;
@@ -7,6 +10,168 @@ Class BigIntClass;
 static BigInt *BigIntYES;
 static BigInt *BigIntNO;
 
+void *LKCountedLoopBoxIndex(intptr_t i)
+{
+	return [BigInt bigIntWithLongLong: (long long)i];
+}
+
+/**
+ * Returns YES if a loop bound is a floating point number, which can not be
+ * converted to an integer without changing the loop.
+ */
+static BOOL IsFloatBound(id obj)
+{
+	if ([obj isKindOfClass: BigIntClass])
+	{
+		return NO;
+	}
+	if ([obj isKindOfClass: [BoxedFloat class]])
+	{
+		return YES;
+	}
+	if ([obj isKindOfClass: [NSNumber class]])
+	{
+		const char *type = [obj objCType];
+		return ('f' == *type) || ('d' == *type);
+	}
+	return NO;
+}
+
+/**
+ * Stores the value of a numeric loop bound in i.  Returns NO if the object is
+ * not an integer or if its value does not fit in an intptr_t.
+ */
+static BOOL LoopBound(id obj, intptr_t *i)
+{
+	if ([obj isKindOfClass: BigIntClass])
+	{
+		if (!mpz_fits_slong_p(((BigInt*)obj)->v))
+		{
+			return NO;
+		}
+		*i = mpz_get_si(((BigInt*)obj)->v);
+		return YES;
+	}
+	if (IsFloatBound(obj))
+	{
+		return NO;
+	}
+	if ([obj respondsToSelector: @selector(longValue)])
+	{
+		*i = [obj longValue];
+		return YES;
+	}
+	return NO;
+}
+
+/**
+ * Initialises i with the value of a numeric loop bound.  Returns NO, leaving i
+ * uninitialised, if the object is not an integer.
+ */
+static BOOL LoopBoundMP(id obj, mpz_t i)
+{
+	if ([obj isKindOfClass: BigIntClass])
+	{
+		mpz_init_set(i, ((BigInt*)obj)->v);
+		return YES;
+	}
+	if (IsFloatBound(obj))
+	{
+		return NO;
+	}
+	if ([obj respondsToSelector: @selector(longValue)])
+	{
+		mpz_init_set_si(i, [obj longValue]);
+		return YES;
+	}
+	return NO;
+}
+
+/**
+ * Runs a loop with a floating point bound.  If the start and step are integers
+ * that fit in a machine word, then only the stop is a float and the loop is
+ * run by LKCountedLoop() up to the last integer that it reaches.  Otherwise,
+ * the index is a float and is passed to the block as a BoxedFloat.
+ */
+static id LKFloatToByDo(id start, id stop, id step, id aBlock)
+{
+	double max = [stop doubleValue];
+	intptr_t i, inc;
+	if (LoopBound(start, &i) && LoopBound(step, &inc) && !isnan(max))
+	{
+		double last = (inc > 0) ? floor(max) : ceil(max);
+		if (last >= (double)INTPTR_MAX) { last = (double)INTPTR_MAX; }
+		if (last <= (double)INTPTR_MIN) { last = (double)INTPTR_MIN; }
+		return LKCountedLoop(i, (intptr_t)last, inc, aBlock,
+		                     LKCountedLoopBoxIndex);
+	}
+	struct LKCountedLoopBlock *block = (struct LKCountedLoopBlock*)aBlock;
+	void *(*invoke)(void*, void*) = (void*(*)(void*, void*))block->invoke;
+	id result = nil;
+	double index = [start doubleValue];
+	double increment = [step doubleValue];
+	while (((increment > 0) && (index <= max)) ||
+	       ((increment < 0) && (index >= max)))
+	{
+		result = invoke(block, [BoxedFloat boxedFloatWithDouble: index]);
+		index += increment;
+	}
+	return result;
+}
+
+/**
+ * Implementation of -to:by:do: shared by all numeric receivers.  Loops where
+ * all of the bounds fit in a machine word are run by LKCountedLoop().  Only
+ * loops that really need arbitrary precision fall back to GMP, and loops with
+ * floating point bounds are run by LKFloatToByDo().  Returns nil if any of the
+ * bounds is not a number.
+ */
+static id LKNumberToByDo(id start, id stop, id step, id aBlock)
+{
+	intptr_t i, max, inc;
+	if (LoopBound(start, &i) && LoopBound(stop, &max) && LoopBound(step, &inc))
+	{
+		return LKCountedLoop(i, max, inc, aBlock, LKCountedLoopBoxIndex);
+	}
+	if (IsFloatBound(start) || IsFloatBound(stop) || IsFloatBound(step))
+	{
+		return LKFloatToByDo(start, stop, step, aBlock);
+	}
+	mpz_t bigI, bigMax, bigInc;
+	if (!LoopBoundMP(start, bigI))
+	{
+		return nil;
+	}
+	if (!LoopBoundMP(stop, bigMax))
+	{
+		mpz_clear(bigI);
+		return nil;
+	}
+	if (!LoopBoundMP(step, bigInc))
+	{
+		mpz_clear(bigI);
+		mpz_clear(bigMax);
+		return nil;
+	}
+	struct LKCountedLoopBlock *block = (struct LKCountedLoopBlock*)aBlock;
+	void *(*invoke)(void*, void*) = (void*(*)(void*, void*))block->invoke;
+	id result = nil;
+	int sign = mpz_sgn(bigInc);
+	while ((sign > 0 && mpz_cmp(bigI, bigMax) <= 0) ||
+	       (sign < 0 && mpz_cmp(bigI, bigMax) >= 0))
+	{
+		void *index = mpz_fits_slong_p(bigI) ?
+			LKCountedLoopIndex(mpz_get_si(bigI), LKCountedLoopBoxIndex) :
+			[BigInt bigIntWithMP: bigI];
+		result = invoke(block, index);
+		mpz_add(bigI, bigI, bigInc);
+	}
+	mpz_clear(bigI);
+	mpz_clear(bigMax);
+	mpz_clear(bigInc);
+	return result;
+}
+
 @implementation BigInt
 + (void) initialize
 {
@@ -81,7 +246,7 @@ static inline id LKObjCAutoreleaseReturnValue(id object)
 #endif
 }
 
-#define op2(name, func) \
+#define op3(name, func, isDivision) \
 - (NSObject *) name:(id)other\
 {\
 	if (nil == other)\
@@ -89,6 +254,12 @@ static inline id LKObjCAutoreleaseReturnValue(id object)
 		[NSException raise: @"BigIntException"\
 		            format: @"nil argument to " #name];\
 	}\
+	if (isDivision && (0 == ([other isKindOfClass: BigIntClass] ?\
+	                         mpz_sgn(((BigInt*)other)->v) : [other longValue])))\
+	{\
+		[NSException raise: @"BigIntException"\
+		            format: @"division by zero in " #name];\
+	}\
 	BigInt *b = [[BigInt alloc] init];\
 	mpz_init(b->v);\
 	if (object_getClass(other) == BigIntClass || [other isKindOfClass: BigIntClass])\
@@ -98,25 +269,27 @@ static inline id LKObjCAutoreleaseReturnValue(id object)
 	else\
 	{\
 		mpz_t number;\
-		mpz_init_set_si(number, [other intValue]);\
+		mpz_init_set_si(number, [other longValue]);\
 		mpz_## func (b->v, v, number);\
 		mpz_clear(number);\
 	}\
 	if (mpz_fits_sint_p(b->v))\
 	{\
 		int intValue = mpz_get_si(b->v);\
+		[b release];\
 		return LKObjectFromNSInteger(intValue);\
 	}\
 	return LKObjCAutoreleaseReturnValue(b);\
 }
 
+#define op2(name, func) op3(name, func, NO)
 #define op(name) op2(name, name)
 
 op2(plus, add)
 op(sub)
 op(mul)
-op(mod)
-op2(div, tdiv_q)
+op3(mod, mod, YES)
+op3(div, tdiv_q, YES)
 
 #define op_cmp(name, func) \
   - (LKObject) name: (id)other \
@@ -138,9 +311,8 @@ op2(div, tdiv_q)
 	}\
 	else\
 	{\
-		BigInt *b = [[BigInt alloc] init];\
 		mpz_t number;\
-		mpz_init_set_si(number, [other intValue]);\
+		mpz_init_set_si(number, [other longValue]);\
 		if (mpz_cmp(v, number) func  0)\
 		    returnVal = LKObjectFromObject(self);\
 		else\
@@ -155,14 +327,53 @@ op_cmp(min, <=)
 op_cmp(max, >=) 
 - (id)and: (id)a
 {
-	return mpz_get_si(v) && [a intValue] ? BigIntYES : BigIntNO;
+	return (mpz_sgn(v) != 0) && ([a longValue] != 0) ? BigIntYES : BigIntNO;
 }
 - (id)or: (id)a;
 {
-	return mpz_get_si(v) || [a intValue] ? BigIntYES : BigIntNO;
+	return (mpz_sgn(v) != 0) || ([a longValue] != 0) ? BigIntYES : BigIntNO;
 }
 op2(bitwiseAnd, and);
 op2(bitwiseOr, ior);
+- (NSObject *) bitShift:(id)other
+{
+	if (nil == other)
+	{
+		[NSException raise: @"BigIntException"
+		            format: @"nil argument to bitShift"];
+	}
+	long shift = [other longValue];
+	BigInt *b = [[BigInt alloc] init];
+	mpz_init(b->v);
+	if (shift >= 0)
+	{
+		mpz_mul_2exp(b->v, v, (mp_bitcnt_t)shift);
+	}
+	else
+	{
+		mpz_fdiv_q_2exp(b->v, v, (mp_bitcnt_t)-shift);
+	}
+	if (mpz_fits_sint_p(b->v))
+	{
+		int intValue = mpz_get_si(b->v);
+		[b release];
+		return LKObjectFromNSInteger(intValue);
+	}
+	return LKObjCAutoreleaseReturnValue(b);
+}
+- (NSObject *) negated
+{
+	BigInt *b = [[BigInt alloc] init];
+	mpz_init(b->v);
+	mpz_neg(b->v, v);
+	if (mpz_fits_sint_p(b->v))
+	{
+		int intValue = mpz_get_si(b->v);
+		[b release];
+		return LKObjectFromNSInteger(intValue);
+	}
+	return LKObjCAutoreleaseReturnValue(b);
+}
 - (id)not
 {
 	if (mpz_cmp(v, ZERO) != 0)
@@ -199,9 +410,14 @@ CTYPE(isWhitespace, isspace)
 		BigInt *o = other;\
 		return mpz_cmp(v, o->v) op 0;\
 	}\
-	if ([other respondsToSelector:@selector(intValue)])\
+	if (IsFloatBound(other))\
+	{\
+		double d = [other doubleValue];\
+		return !isnan(d) && (mpz_cmp_d(v, d) op 0);\
+	}\
+	if ([other respondsToSelector:@selector(longValue)])\
 	{\
-		return mpz_cmp_si(v, [other intValue]) op 0;\
+		return mpz_cmp_si(v, [other longValue]) op 0;\
 	}\
 	return NO;\
 }
@@ -212,107 +428,26 @@ CMP(isGreaterThanOrEqualTo, >=)
 CMP(isEqual, ==)
 - (id) timesRepeat:(id) aBlock
 {
-	id result = nil;
-	if (mpz_fits_sint_p(v))
+	if (mpz_fits_slong_p(v))
 	{
-		int  max = mpz_get_si(v);
-		for (int i=0 ; i<max ; i++)
-		{
-			result = [aBlock value];
-		}
+		return LKCountedLoopRepeat(mpz_get_si(v), aBlock);
 	}
-	else
+	struct LKCountedLoopBlock *block = (struct LKCountedLoopBlock*)aBlock;
+	void *(*invoke)(void*) = (void*(*)(void*))block->invoke;
+	id result = nil;
+	mpz_t i;
+	mpz_init_set(i, v);
+	while(mpz_sgn(i) > 0)
 	{
-		//TODO: This is very slow, and can be optimised a lot
-		mpz_t i;
-		mpz_init_set(i, v);
-		while(mpz_sgn(i) > 0)
-		{
-			result = [aBlock value];
-			mpz_sub_ui(i, i, 1);
-		}
+		result = invoke(block);
+		mpz_sub_ui(i, i, 1);
 	}
+	mpz_clear(i);
 	return result;
 }
 - (id) to: (id) other by: (id) incr do: (id) aBlock
 {
-	id result = nil;
-	if ([other isKindOfClass: object_getClass(self)] && [incr isKindOfClass: object_getClass(self)])
-	{
-		if (mpz_fits_sint_p(v) 
-			&& mpz_fits_sint_p(((BigInt*)other)->v)
-			&& mpz_fits_sint_p(((BigInt*)incr)->v))
-		{
-			int i = mpz_get_si(v);
-			int max = mpz_get_si(((BigInt*)other)->v);
-			int inc = mpz_get_si(((BigInt*)incr)->v);
-			for (;i<=max;i+=inc)
-			{
-				result = [(BlockClosure*)aBlock value: 
-					   [BigInt bigIntWithLongLong: (long long) i]];
-			}
-		}
-		else
-		{
-			mpz_t i, max, inc;
-			mpz_init_set(i, v);
-			mpz_init_set(max, ((BigInt*)other)->v);
-			mpz_init_set(inc, ((BigInt*)incr)->v);
-			while (mpz_cmp(i, max)<=0)
-			{
-				result = [(BlockClosure*)aBlock value: [BigInt bigIntWithMP: i]];
-				mpz_add(i, i, inc);
-			}
-		}
-	}
-	else
-	{
-		mpz_t i, max, inc;
-		mpz_init_set(i, v);
-
-		if ([other isKindOfClass: object_getClass(self)])
-		{
-			mpz_init_set(max, ((BigInt*)other)->v);
-		}
-		else if ([other respondsToSelector: @selector(intValue)])
-		{
-			mpz_init_set_si(max, [other intValue]);
-		}
-		else if ([other respondsToSelector: @selector(longValue)])
-		{
-			mpz_init_set_si(max, [other longValue]);
-		}
-		else
-		{
-			return nil;
-		}
-
-		if ([incr isKindOfClass: object_getClass(self)])
-		{
-			mpz_init_set(inc, ((BigInt*)incr)->v);
-		}
-		else if ([incr respondsToSelector: @selector(intValue)])
-		{
-			mpz_init_set_si(max, [incr intValue]);
-		}
-		else if ([incr respondsToSelector: @selector(longValue)])
-		{
-			mpz_init_set_si(max, [incr longValue]);
-		}
-		else
-		{
-			return nil;
-		}
-		while (mpz_cmp(i, max)<=0)
-		{
-			result = [(BlockClosure*)aBlock value: [BigInt bigIntWithMP: i]];
-			mpz_add(i, i, inc);
-		}
-		mpz_clear(i);
-		mpz_clear(inc);
-		mpz_clear(max);
-	}
-	return result;
+	return LKNumberToByDo(self, other, incr, aBlock);
 }
 - (id) to: (id) other do: (id) aBlock
 {
@@ -404,23 +539,16 @@ CASTMETHOD(BOOL, boolValue, mpz_get_ui)
 }
 - (id)timesRepeat: (id(^)(void))block
 {
-	void *ret = NULL;
-	unsigned long long max = [self unsignedLongLongValue];
-	for (unsigned long long i=0 ; i<max ; i++)
+	if (IsFloatBound(self))
 	{
-		ret = block();
+		return [[BoxedFloat boxedFloatWithDouble: [self doubleValue]]
+			timesRepeat: block];
 	}
-	return ret;
+	return LKCountedLoopRepeat([self longValue], (void*)block);
 }
 - (id)to: (id)to by: (id)by do: (id(^)(id))block
 {
-	unsigned long long i = [self unsignedLongLongValue];
-	id result = nil;
-	for (unsigned long long step = [by unsignedLongLongValue]; i<step ; i++)
-	{
-		result = block([NSNumber numberWithUnsignedLongLong: i]);
-	}
-	return result;
+	return LKNumberToByDo(self, to, by, block);
 }
 - (id)to: (id)to do: (id(^)(id))block
 {
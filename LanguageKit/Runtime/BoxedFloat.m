@@ -1,6 +1,7 @@
 #define class_pointer isa
 #import "BoxedFloat.h"
 #import "LKObject.h"
+#include <math.h>
 
 @implementation BoxedFloat
 + (BoxedFloat*) boxedFloatWithCString:(const char*) aString
@@ -96,12 +97,16 @@ cmp(isEqual, ==)
 }
 - (id) timesRepeat:(id) aBlock
 {
-	id result = nil;
-	int max = value;
-	if (value > INT_MAX)
+	// Truncating a fractional count would silently change the number of
+	// times that the block runs.
+	if (value != floor(value))
 	{
-		max = INT_MAX;
+		[NSException raise: NSInvalidArgumentException
+		            format: @"timesRepeat: sent to non-integral number %g",
+		                    value];
 	}
+	id result = nil;
+	int max = (value > INT_MAX) ? INT_MAX : ((value < 0) ? 0 : (int)value);
 	for (int i=0 ; i<max ; i++)
 	{
 		result = [aBlock value];
@@ -0,0 +1,67 @@
+#import "BigInt.h"
+
+/**
+ * A mutable big integer, used for reductions over large numbers.
+ *
+ * -add: and -addProduct:with: update the receiver in place and return it, so
+ * summing many values reuses a single mpz_t instead of allocating a new BigInt
+ * for each step.  Use -value to get an immutable copy of the current value.
+ *
+ * The arithmetic operators (-plus:, -sub: and -mul:) return a new immutable
+ * number as BigInt does, so that an expression such as acc + 1 does not change
+ * acc.  They only update the receiver when -updatesInPlace is set, which
+ * inject:accumulating: does for blocks that the compiler has shown use their
+ * accumulator only as the receiver of their final operation.
+ */
+@interface LKBigAccumulator : BigInt
+{
+	/** Whether the arithmetic operators modify the receiver. */
+	BOOL updatesInPlace;
+}
+/**
+ * Returns a new autoreleased accumulator with the value zero.
+ */
++ (LKBigAccumulator*) accumulator;
+/**
+ * Returns a new autoreleased accumulator with the value of the specified
+ * integer.
+ */
++ (LKBigAccumulator*) accumulatorWithValue: (id)aNumber;
+/**
+ * Returns YES if the object is an integer that can be used as the operand of
+ * an accumulator.
+ */
++ (BOOL) canAccumulate: (id)aNumber;
+/**
+ * Adds the argument to the receiver.
+ */
+- (id) add: (id)aNumber;
+/**
+ * Adds the product of the two arguments to the receiver.
+ */
+- (id) addProduct: (id)aNumber with: (id)anotherNumber;
+/**
+ * Returns the current value as an immutable number.
+ */
+- (id) value;
+/**
+ * Sets whether -plus:, -sub: and -mul: update the receiver in place and
+ * return it, rather than returning a new number.  This must only be set while
+ * nothing else can see the accumulator.
+ */
+- (void) setUpdatesInPlace: (BOOL)aFlag;
+/**
+ * Returns whether -plus:, -sub: and -mul: update the receiver in place.
+ */
+- (BOOL) updatesInPlace;
+@end
+
+@interface NSObject (LKBigAccumulator)
+/**
+ * Sent by compiled code in place of inject:into: when the block only uses its
+ * accumulator as the receiver of its final arithmetic operation.  Collections
+ * that can run such reductions in place override this; the default sends
+ * inject:into:.
+ */
+- (id) inject: (id)aValue accumulating: (id)aBlock;
+@end
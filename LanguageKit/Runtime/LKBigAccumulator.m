@@ -0,0 +1,135 @@
+#import "LKBigAccumulator.h"
+
+/**
+ * Returns the value of anInteger as an mpz_t.  BigInts return their own value,
+ * other integers are stored in tmp, which must already be initialised.
+ * Returns NULL if the object is not an integer.
+ */
+static mpz_srcptr OperandValue(id anInteger, mpz_t tmp)
+{
+	if ([anInteger isKindOfClass: [BigInt class]])
+	{
+		return ((BigInt*)anInteger)->v;
+	}
+	if (![anInteger isKindOfClass: [NSNumber class]])
+	{
+		return NULL;
+	}
+	const char *type = [anInteger objCType];
+	if ((NULL == type) || ('f' == *type) || ('d' == *type))
+	{
+		return NULL;
+	}
+	mpz_set_si(tmp, [anInteger longValue]);
+	return tmp;
+}
+
+/**
+ * Applies an in-place GMP operation to the receiver if inPlace is true and the
+ * argument is an integer.  Otherwise, returns the result of the BigInt
+ * operation, which is a new immutable number.
+ */
+#define INPLACE(sel, fallback, func, inPlace) \
+- (id) sel: (id)other\
+{\
+	if (!(inPlace))\
+	{\
+		return [super fallback: other];\
+	}\
+	mpz_t tmp;\
+	mpz_init(tmp);\
+	mpz_srcptr o = OperandValue(other, tmp);\
+	if (NULL == o)\
+	{\
+		mpz_clear(tmp);\
+		return [super fallback: other];\
+	}\
+	mpz_ ## func(v, v, o);\
+	mpz_clear(tmp);\
+	return self;\
+}
+
+@implementation LKBigAccumulator
++ (LKBigAccumulator*) accumulator
+{
+	return [[[self alloc] init] autorelease];
+}
++ (LKBigAccumulator*) accumulatorWithValue: (id)aNumber
+{
+	LKBigAccumulator *acc = [self accumulator];
+	[acc add: aNumber];
+	return acc;
+}
++ (BOOL) canAccumulate: (id)aNumber
+{
+	mpz_t tmp;
+	mpz_init(tmp);
+	BOOL isInteger = (NULL != OperandValue(aNumber, tmp));
+	mpz_clear(tmp);
+	return isInteger;
+}
+- (id) init
+{
+	self = [super init];
+	if (self)
+	{
+		mpz_init(v);
+	}
+	return self;
+}
+INPLACE(add, plus, add, YES)
+INPLACE(plus, plus, add, updatesInPlace)
+INPLACE(sub, sub, sub, updatesInPlace)
+INPLACE(mul, mul, mul, updatesInPlace)
+- (id) addProduct: (id)aNumber with: (id)anotherNumber
+{
+	mpz_t tmp1, tmp2;
+	mpz_init(tmp1);
+	mpz_init(tmp2);
+	mpz_srcptr a = OperandValue(aNumber, tmp1);
+	mpz_srcptr b = OperandValue(anotherNumber, tmp2);
+	if ((NULL == a) || (NULL == b))
+	{
+		mpz_clear(tmp1);
+		mpz_clear(tmp2);
+		[NSException raise: @"BigIntException"
+		            format: @"Non-integer argument to addProduct:with:"];
+	}
+	mpz_addmul(v, a, b);
+	mpz_clear(tmp1);
+	mpz_clear(tmp2);
+	return self;
+}
+- (id) value
+{
+	if (mpz_fits_sint_p(v))
+	{
+		return LKObjectFromNSInteger(mpz_get_si(v));
+	}
+	return [BigInt bigIntWithMP: v];
+}
+- (void) setUpdatesInPlace: (BOOL)aFlag
+{
+	updatesInPlace = aFlag;
+}
+- (BOOL) updatesInPlace
+{
+	return updatesInPlace;
+}
+// Copies of a mutable value are immutable.
+- (id) copyWithZone: (NSZone*)aZone
+{
+	BigInt *new = [BigInt allocWithZone: aZone];
+	mpz_init_set(new->v, v);
+	return new;
+}
+@end
+
+@implementation NSObject (LKBigAccumulator)
+- (id) inject: (id)aValue accumulating: (id)aBlock
+{
+	return [self performSelector: @selector(inject:into:)
+	                  withObject: aValue
+	                  withObject: aBlock];
+}
+@end
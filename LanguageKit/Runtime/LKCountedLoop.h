@@ -0,0 +1,113 @@
+/**
+ * LKCountedLoop.h contains the loop engine shared by the numeric
+ * implementations of -timesRepeat:, -to:do: and -to:by:do:.  It is plain C so
+ * that it can be used both from the Objective-C classes and from
+ * MsgSendSmallInt.m, which is compiled to bitcode and inlined into generated
+ * code.
+ *
+ * The block's invoke function is loaded once, before the loop starts, and the
+ * index is passed as a SmallInt whenever the runtime supports them and the
+ * value fits.  A box function is only called for indices that do not fit.
+ */
+#ifndef __LKCOUNTEDLOOP_H_INCLUDED__
+#define __LKCOUNTEDLOOP_H_INCLUDED__
+#include <stdint.h>
+
+#ifndef OBJC_SMALL_OBJECT_SHIFT
+#define OBJC_SMALL_OBJECT_SHIFT ((sizeof(void*) == 4) ? 1 : 3)
+#endif
+
+/**
+ * Layout of the start of a block, as defined by the blocks ABI.
+ */
+struct LKCountedLoopBlock
+{
+	void *isa;
+	int flags;
+	int reserved;
+	void *(*invoke)(void*, ...);
+};
+
+/**
+ * Function used to create an object for an index that can not be represented
+ * as a SmallInt.
+ */
+typedef void *(*LKCountedLoopBoxFunction)(intptr_t);
+
+/**
+ * Boxes a loop index that does not fit in a SmallInt as a BigInt.  This is the
+ * box function used by all of the numeric loops.
+ */
+void *LKCountedLoopBoxIndex(intptr_t i);
+
+/**
+ * Returns the object to pass to the loop body for the index i.
+ */
+__attribute__((unused))
+static inline void *LKCountedLoopIndex(intptr_t i, LKCountedLoopBoxFunction box)
+{
+#ifdef OBJC_SMALL_OBJECT_MASK
+	intptr_t tagged = (intptr_t)((uintptr_t)i << OBJC_SMALL_OBJECT_SHIFT);
+	if ((tagged >> OBJC_SMALL_OBJECT_SHIFT) == i)
+	{
+		return (void*)(tagged | 1);
+	}
+#endif
+	return box(i);
+}
+
+/**
+ * Invokes the block count times, returning the result of the last invocation.
+ */
+__attribute__((unused))
+static inline void *LKCountedLoopRepeat(intptr_t count, void *block)
+{
+	struct LKCountedLoopBlock *b = block;
+	void *(*invoke)(void*) = (void*(*)(void*))b->invoke;
+	void *result = 0;
+	for (intptr_t i=0 ; i<count ; i++)
+	{
+		result = invoke(b);
+	}
+	return result;
+}
+
+/**
+ * Invokes the block once for every value from start to stop, inclusive,
+ * counting by step.  A negative step counts down.  The loop does not run if
+ * step is zero or if stop is on the wrong side of start.  Returns the result
+ * of the last invocation, or NULL if the block was never invoked.
+ *
+ * The distance to the bound is computed with unsigned arithmetic, so the index
+ * never overflows, even for loops ending near INTPTR_MAX or INTPTR_MIN.
+ */
+__attribute__((unused))
+static inline void *LKCountedLoop(intptr_t start, intptr_t stop, intptr_t step,
+                                  void *block, LKCountedLoopBoxFunction box)
+{
+	struct LKCountedLoopBlock *b = block;
+	void *(*invoke)(void*, void*) = (void*(*)(void*, void*))b->invoke;
+	void *result = 0;
+	if (step > 0)
+	{
+		if (start > stop) { return 0; }
+		uintptr_t inc = (uintptr_t)step;
+		for (intptr_t i=start ; ; i = (intptr_t)((uintptr_t)i + inc))
+		{
+			result = invoke(b, LKCountedLoopIndex(i, box));
+			if ((uintptr_t)stop - (uintptr_t)i < inc) { break; }
+		}
+	}
+	else if (step < 0)
+	{
+		if (start < stop) { return 0; }
+		uintptr_t dec = -(uintptr_t)step;
+		for (intptr_t i=start ; ; i = (intptr_t)((uintptr_t)i - dec))
+		{
+			result = invoke(b, LKCountedLoopIndex(i, box));
+			if ((uintptr_t)i - (uintptr_t)stop < dec) { break; }
+		}
+	}
+	return result;
+}
+#endif // __LKCOUNTEDLOOP_H_INCLUDED__
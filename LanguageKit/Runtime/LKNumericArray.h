@@ -0,0 +1,185 @@
+#import <Foundation/Foundation.h>
+
+@class LKFloatArray;
+
+/**
+ * An array of 64-bit integers, stored contiguously without boxing.
+ *
+ * The reductions and element-wise operations run on the unboxed values using
+ * the kernels in LKVectorKernels.h, so they do not send a message or allocate
+ * an object per element.  Element-wise operations accept another array of the
+ * same length or a single number.  Operations that overflow 64 bits raise an
+ * LKNumericArrayException, except for -sum and -dot:, which return a BigInt.
+ */
+@interface LKIntArray : NSObject <NSCopying>
+{
+@public
+	/** The number of elements. */
+	NSUInteger count;
+	/** The elements. */
+	int64_t *values;
+}
+/**
+ * Returns a new autoreleased array with aCount elements, all zero.
+ */
++ (LKIntArray*) arrayWithCount: (NSUInteger)aCount;
+/**
+ * Returns a new autoreleased array containing the integer values of the
+ * numbers in anArray.
+ */
++ (LKIntArray*) arrayWithArray: (NSArray*)anArray;
+/**
+ * Initialises the array with aCount elements, all zero.
+ */
+- (id) initWithCount: (NSUInteger)aCount;
+/**
+ * Returns the number of elements.
+ */
+- (NSUInteger) count;
+/**
+ * Returns the element at the specified index as a number object.
+ */
+- (id) objectAtIndex: (NSUInteger)anIndex;
+/**
+ * Replaces the element at the specified index with the integer value of
+ * aNumber.
+ */
+- (void) replaceObjectAtIndex: (NSUInteger)anIndex withObject: (id)aNumber;
+/**
+ * Returns the elements as an NSArray of number objects.
+ */
+- (NSArray*) asArray;
+/**
+ * Returns the sum of the elements.
+ */
+- (id) sum;
+/**
+ * Returns the smallest element, or nil if the array is empty.
+ */
+- (id) min;
+/**
+ * Returns the largest element, or nil if the array is empty.
+ */
+- (id) max;
+/**
+ * Returns the dot product of the receiver and another array of the same
+ * length.
+ */
+- (id) dot: (id)other;
+/**
+ * Returns the element-wise sum of the receiver and the argument.  If the
+ * argument is a float array or a floating point number, the result is an
+ * LKFloatArray.
+ */
+- (id) plus: (id)other;
+/**
+ * Returns the element-wise product of the receiver and the argument.  If the
+ * argument is a float array or a floating point number, the result is an
+ * LKFloatArray.
+ */
+- (id) mul: (id)other;
+/**
+ * Returns an LKIntArray containing 1 where the receiver's element is less
+ * than the argument and 0 elsewhere.
+ */
+- (LKIntArray*) lessThan: (id)other;
+/**
+ * Returns an LKIntArray containing 1 where the receiver's element is greater
+ * than the argument and 0 elsewhere.
+ */
+- (LKIntArray*) greaterThan: (id)other;
+/**
+ * Returns an LKIntArray containing 1 where the receiver's element is equal to
+ * the argument and 0 elsewhere.
+ */
+- (LKIntArray*) equalTo: (id)other;
+@end
+
+/**
+ * An array of doubles, stored contiguously without boxing.  The operations
+ * mirror those on LKIntArray.  Integer arrays and numbers passed as arguments
+ * are converted to floating point.
+ */
+@interface LKFloatArray : NSObject <NSCopying>
+{
+@public
+	/** The number of elements. */
+	NSUInteger count;
+	/** The elements. */
+	double *values;
+}
+/**
+ * Returns a new autoreleased array with aCount elements, all zero.
+ */
++ (LKFloatArray*) arrayWithCount: (NSUInteger)aCount;
+/**
+ * Returns a new autoreleased array containing the floating point values of
+ * the numbers in anArray.
+ */
++ (LKFloatArray*) arrayWithArray: (NSArray*)anArray;
+/**
+ * Returns a new autoreleased array containing the values of an integer array.
+ */
++ (LKFloatArray*) arrayWithIntArray: (LKIntArray*)anArray;
+/**
+ * Initialises the array with aCount elements, all zero.
+ */
+- (id) initWithCount: (NSUInteger)aCount;
+/**
+ * Returns the number of elements.
+ */
+- (NSUInteger) count;
+/**
+ * Returns the element at the specified index as a number object.
+ */
+- (id) objectAtIndex: (NSUInteger)anIndex;
+/**
+ * Replaces the element at the specified index with the floating point value
+ * of aNumber.
+ */
+- (void) replaceObjectAtIndex: (NSUInteger)anIndex withObject: (id)aNumber;
+/**
+ * Returns the elements as an NSArray of number objects.
+ */
+- (NSArray*) asArray;
+/**
+ * Returns the sum of the elements.
+ */
+- (id) sum;
+/**
+ * Returns the smallest element, or nil if the array is empty.
+ */
+- (id) min;
+/**
+ * Returns the largest element, or nil if the array is empty.
+ */
+- (id) max;
+/**
+ * Returns the dot product of the receiver and another array of the same
+ * length.
+ */
+- (id) dot: (id)other;
+/**
+ * Returns the element-wise sum of the receiver and the argument.
+ */
+- (id) plus: (id)other;
+/**
+ * Returns the element-wise product of the receiver and the argument.
+ */
+- (id) mul: (id)other;
+/**
+ * Returns an LKIntArray containing 1 where the receiver's element is less
+ * than the argument and 0 elsewhere.
+ */
+- (LKIntArray*) lessThan: (id)other;
+/**
+ * Returns an LKIntArray containing 1 where the receiver's element is greater
+ * than the argument and 0 elsewhere.
+ */
+- (LKIntArray*) greaterThan: (id)other;
+/**
+ * Returns an LKIntArray containing 1 where the receiver's element is equal to
+ * the argument and 0 elsewhere.
+ */
+- (LKIntArray*) equalTo: (id)other;
+@end
@@ -0,0 +1,502 @@
+#import "LKNumericArray.h"
+#import "BigInt.h"
+#import "BoxedFloat.h"
+#include "LKVectorKernels.h"
+
+static NSString *LKNumericArrayException = @"LKNumericArrayException";
+
+/**
+ * Returns YES if aNumber should be treated as a floating point value.  BigInt
+ * claims to be a double so that comparisons work, so it must be checked
+ * first.
+ */
+static BOOL IsFloat(id aNumber)
+{
+	if ([aNumber isKindOfClass: [BigInt class]])
+	{
+		return NO;
+	}
+	if ([aNumber isKindOfClass: [BoxedFloat class]])
+	{
+		return YES;
+	}
+	if ([aNumber isKindOfClass: [NSNumber class]])
+	{
+		const char *type = [aNumber objCType];
+		return (NULL != type) && (('f' == *type) || ('d' == *type));
+	}
+	return NO;
+}
+
+static void CheckCount(NSUInteger count, id other)
+{
+	if ([other count] != count)
+	{
+		[NSException raise: LKNumericArrayException
+		            format: @"Array lengths differ (%lu and %lu)",
+		                    (unsigned long)count,
+		                    (unsigned long)[other count]];
+	}
+}
+
+static void CheckIndex(NSUInteger count, NSUInteger anIndex)
+{
+	if (anIndex >= count)
+	{
+		[NSException raise: NSRangeException
+		            format: @"Index %lu out of range (count %lu)",
+		                    (unsigned long)anIndex, (unsigned long)count];
+	}
+}
+
+static void CheckOverflow(BOOL ok, const char *op)
+{
+	if (!ok)
+	{
+		[NSException raise: LKNumericArrayException
+		            format: @"Integer overflow in %s", op];
+	}
+}
+
+/**
+ * Stores the integer value of aNumber in aValue.  Returns NO for BigInts that
+ * do not fit, instead of truncating them as -longLongValue would.
+ */
+static BOOL IntValue(id aNumber, int64_t *aValue)
+{
+	if ([aNumber isKindOfClass: [BigInt class]])
+	{
+		mpz_srcptr v = ((BigInt*)aNumber)->v;
+		if (!mpz_fits_slong_p(v))
+		{
+			return NO;
+		}
+		*aValue = (int64_t)mpz_get_si(v);
+		return YES;
+	}
+	*aValue = [aNumber longLongValue];
+	return YES;
+}
+
+/**
+ * Returns the integer value of an element, raising an exception if it does not
+ * fit in 64 bits.
+ */
+static int64_t ElementValue(id aNumber)
+{
+	int64_t value;
+	if (!IntValue(aNumber, &value))
+	{
+		[NSException raise: LKNumericArrayException
+		            format: @"%@ does not fit in an LKIntArray", aNumber];
+	}
+	return value;
+}
+
+/**
+ * Applies an operation with a BigInt scalar that does not fit in 64 bits to
+ * each element, using GMP.  Raises an exception if a result does not fit.
+ */
+static void BigScalarOp(const int64_t *v, BigInt *s, int64_t *out,
+                        NSUInteger count, BOOL isMul, const char *op)
+{
+	mpz_t r;
+	mpz_init(r);
+	for (NSUInteger i=0 ; i<count ; i++)
+	{
+		mpz_set_si(r, (long)v[i]);
+		if (isMul)
+		{
+			mpz_mul(r, r, s->v);
+		}
+		else
+		{
+			mpz_add(r, r, s->v);
+		}
+		if (!mpz_fits_slong_p(r))
+		{
+			mpz_clear(r);
+			CheckOverflow(NO, op);
+		}
+		out[i] = (int64_t)mpz_get_si(r);
+	}
+	mpz_clear(r);
+}
+
+static id BoxInt(int64_t aValue)
+{
+	return LKObjectFromNSInteger((NSInteger)aValue);
+}
+
+/**
+ * Returns the exact sum of v[i] * w[i], or of v[i] if w is NULL, as a BigInt.
+ * Used when the 64-bit kernels overflow.
+ */
+static id BigSum(const int64_t *v, const int64_t *w, NSUInteger count)
+{
+	mpz_t total, term;
+	mpz_init(total);
+	mpz_init(term);
+	for (NSUInteger i=0 ; i<count ; i++)
+	{
+		mpz_set_si(term, (long)v[i]);
+		if (NULL != w)
+		{
+			mpz_mul_si(term, term, (long)w[i]);
+		}
+		mpz_add(total, total, term);
+	}
+	BigInt *result = [BigInt bigIntWithMP: total];
+	mpz_clear(total);
+	mpz_clear(term);
+	return result;
+}
+
+#define ALLOC_VALUES(type) \
+	values = calloc(aCount ? aCount : 1, sizeof(type));\
+	if (NULL == values)\
+	{\
+		[self release];\
+		return nil;\
+	}\
+	count = aCount;
+
+@implementation LKIntArray
++ (LKIntArray*) arrayWithCount: (NSUInteger)aCount
+{
+	return [[[self alloc] initWithCount: aCount] autorelease];
+}
++ (LKIntArray*) arrayWithArray: (NSArray*)anArray
+{
+	LKIntArray *array = [self arrayWithCount: [anArray count]];
+	NSUInteger i = 0;
+	for (id obj in anArray)
+	{
+		array->values[i++] = ElementValue(obj);
+	}
+	return array;
+}
+- (id) initWithCount: (NSUInteger)aCount
+{
+	self = [super init];
+	if (self)
+	{
+		ALLOC_VALUES(int64_t)
+	}
+	return self;
+}
+- (id) init
+{
+	return [self initWithCount: 0];
+}
+- (void) dealloc
+{
+	free(values);
+	[super dealloc];
+}
+- (id) copyWithZone: (NSZone*)aZone
+{
+	LKIntArray *copy = [[LKIntArray allocWithZone: aZone] initWithCount: count];
+	memcpy(copy->values, values, count * sizeof(int64_t));
+	return copy;
+}
+- (NSUInteger) count
+{
+	return count;
+}
+- (id) objectAtIndex: (NSUInteger)anIndex
+{
+	CheckIndex(count, anIndex);
+	return BoxInt(values[anIndex]);
+}
+- (void) replaceObjectAtIndex: (NSUInteger)anIndex withObject: (id)aNumber
+{
+	CheckIndex(count, anIndex);
+	values[anIndex] = ElementValue(aNumber);
+}
+- (NSArray*) asArray
+{
+	NSMutableArray *array = [NSMutableArray arrayWithCapacity: count];
+	for (NSUInteger i=0 ; i<count ; i++)
+	{
+		[array addObject: BoxInt(values[i])];
+	}
+	return array;
+}
+- (NSString*) description
+{
+	return [[self asArray] description];
+}
+- (id) sum
+{
+	int64_t sum;
+	if (LKIntVectorSum(values, count, &sum))
+	{
+		return BoxInt(sum);
+	}
+	return BigSum(values, NULL, count);
+}
+- (id) min
+{
+	if (0 == count) { return nil; }
+	return BoxInt(LKIntVectorMin(values, count));
+}
+- (id) max
+{
+	if (0 == count) { return nil; }
+	return BoxInt(LKIntVectorMax(values, count));
+}
+- (id) dot: (id)other
+{
+	if ([other isKindOfClass: [LKFloatArray class]])
+	{
+		return [[LKFloatArray arrayWithIntArray: self] dot: other];
+	}
+	CheckCount(count, other);
+	LKIntArray *o = other;
+	int64_t dot;
+	if (LKIntVectorDot(values, o->values, count, &dot))
+	{
+		return BoxInt(dot);
+	}
+	return BigSum(values, o->values, count);
+}
+#define INT_OP(sel, kernel, isMul) \
+- (id) sel: (id)other\
+{\
+	if ([other isKindOfClass: [LKFloatArray class]] || IsFloat(other))\
+	{\
+		return [[LKFloatArray arrayWithIntArray: self] sel: other];\
+	}\
+	LKIntArray *result = [LKIntArray arrayWithCount: count];\
+	if ([other isKindOfClass: [LKIntArray class]])\
+	{\
+		CheckCount(count, other);\
+		CheckOverflow(LKIntVector ## kernel(values, ((LKIntArray*)other)->values,\
+			result->values, count), #sel);\
+	}\
+	else\
+	{\
+		int64_t scalar;\
+		if (IntValue(other, &scalar))\
+		{\
+			CheckOverflow(LKIntVector ## kernel ## Scalar(values,\
+				scalar, result->values, count), #sel);\
+		}\
+		else\
+		{\
+			BigScalarOp(values, other, result->values, count, isMul, #sel);\
+		}\
+	}\
+	return result;\
+}
+INT_OP(plus, Add, NO)
+INT_OP(mul, Mul, YES)
+/**
+ * Returns 1 if the comparison holds between any 64-bit integer and a BigInt
+ * that is too large to fit in 64 bits, 0 otherwise.
+ */
+static int64_t BigScalarComparison(BigInt *s, LKVectorComparison op)
+{
+	BOOL isPositive = mpz_sgn(s->v) > 0;
+	switch (op)
+	{
+		case LKVectorLessThan: return isPositive;
+		case LKVectorGreaterThan: return !isPositive;
+		case LKVectorEqual: default: return 0;
+	}
+}
+#define INT_CMP(sel, op) \
+- (LKIntArray*) sel: (id)other\
+{\
+	if ([other isKindOfClass: [LKFloatArray class]] || IsFloat(other))\
+	{\
+		return [[LKFloatArray arrayWithIntArray: self] sel: other];\
+	}\
+	LKIntArray *result = [LKIntArray arrayWithCount: count];\
+	if ([other isKindOfClass: [LKIntArray class]])\
+	{\
+		CheckCount(count, other);\
+		LKIntVectorCompare(values, ((LKIntArray*)other)->values,\
+			result->values, count, op);\
+	}\
+	else\
+	{\
+		int64_t scalar;\
+		if (IntValue(other, &scalar))\
+		{\
+			LKIntVectorCompareScalar(values, scalar, result->values, count, op);\
+		}\
+		else\
+		{\
+			/* Every element is on the same side of a BigInt that does not fit. */\
+			int64_t holds = BigScalarComparison(other, op);\
+			for (NSUInteger i=0 ; i<count ; i++)\
+			{\
+				result->values[i] = holds;\
+			}\
+		}\
+	}\
+	return result;\
+}
+INT_CMP(lessThan, LKVectorLessThan)
+INT_CMP(greaterThan, LKVectorGreaterThan)
+INT_CMP(equalTo, LKVectorEqual)
+@end
+
+@implementation LKFloatArray
++ (LKFloatArray*) arrayWithCount: (NSUInteger)aCount
+{
+	return [[[self alloc] initWithCount: aCount] autorelease];
+}
++ (LKFloatArray*) arrayWithArray: (NSArray*)anArray
+{
+	LKFloatArray *array = [self arrayWithCount: [anArray count]];
+	NSUInteger i = 0;
+	for (id obj in anArray)
+	{
+		array->values[i++] = [obj doubleValue];
+	}
+	return array;
+}
++ (LKFloatArray*) arrayWithIntArray: (LKIntArray*)anArray
+{
+	NSUInteger aCount = anArray->count;
+	LKFloatArray *array = [self arrayWithCount: aCount];
+	for (NSUInteger i=0 ; i<aCount ; i++)
+	{
+		array->values[i] = (double)anArray->values[i];
+	}
+	return array;
+}
+- (id) initWithCount: (NSUInteger)aCount
+{
+	self = [super init];
+	if (self)
+	{
+		ALLOC_VALUES(double)
+	}
+	return self;
+}
+- (id) init
+{
+	return [self initWithCount: 0];
+}
+- (void) dealloc
+{
+	free(values);
+	[super dealloc];
+}
+- (id) copyWithZone: (NSZone*)aZone
+{
+	LKFloatArray *copy = [[LKFloatArray allocWithZone: aZone] initWithCount: count];
+	memcpy(copy->values, values, count * sizeof(double));
+	return copy;
+}
+- (NSUInteger) count
+{
+	return count;
+}
+- (id) objectAtIndex: (NSUInteger)anIndex
+{
+	CheckIndex(count, anIndex);
+	return [BoxedFloat boxedFloatWithDouble: values[anIndex]];
+}
+- (void) replaceObjectAtIndex: (NSUInteger)anIndex withObject: (id)aNumber
+{
+	CheckIndex(count, anIndex);
+	values[anIndex] = [aNumber doubleValue];
+}
+- (NSArray*) asArray
+{
+	NSMutableArray *array = [NSMutableArray arrayWithCapacity: count];
+	for (NSUInteger i=0 ; i<count ; i++)
+	{
+		[array addObject: [BoxedFloat boxedFloatWithDouble: values[i]]];
+	}
+	return array;
+}
+- (NSString*) description
+{
+	return [[self asArray] description];
+}
+- (id) sum
+{
+	return [BoxedFloat boxedFloatWithDouble: LKFloatVectorSum(values, count)];
+}
+- (id) min
+{
+	if (0 == count) { return nil; }
+	return [BoxedFloat boxedFloatWithDouble: LKFloatVectorMin(values, count)];
+}
+- (id) max
+{
+	if (0 == count) { return nil; }
+	return [BoxedFloat boxedFloatWithDouble: LKFloatVectorMax(values, count)];
+}
+/**
+ * Returns the argument as a float array, converting integer arrays.  Returns
+ * nil for scalars.
+ */
+static LKFloatArray *FloatArrayOperand(NSUInteger count, id other)
+{
+	if ([other isKindOfClass: [LKIntArray class]])
+	{
+		other = [LKFloatArray arrayWithIntArray: other];
+	}
+	else if (![other isKindOfClass: [LKFloatArray class]])
+	{
+		return nil;
+	}
+	CheckCount(count, other);
+	return other;
+}
+- (id) dot: (id)other
+{
+	LKFloatArray *o = FloatArrayOperand(count, other);
+	if (nil == o)
+	{
+		[NSException raise: LKNumericArrayException
+		            format: @"dot: requires an array argument"];
+	}
+	return [BoxedFloat boxedFloatWithDouble:
+		LKFloatVectorDot(values, o->values, count)];
+}
+#define FLOAT_OP(sel, kernel) \
+- (id) sel: (id)other\
+{\
+	LKFloatArray *result = [LKFloatArray arrayWithCount: count];\
+	LKFloatArray *o = FloatArrayOperand(count, other);\
+	if (nil != o)\
+	{\
+		LKFloatVector ## kernel(values, o->values, result->values, count);\
+	}\
+	else\
+	{\
+		LKFloatVector ## kernel ## Scalar(values, [other doubleValue],\
+			result->values, count);\
+	}\
+	return result;\
+}
+FLOAT_OP(plus, Add)
+FLOAT_OP(mul, Mul)
+#define FLOAT_CMP(sel, op) \
+- (LKIntArray*) sel: (id)other\
+{\
+	LKIntArray *result = [LKIntArray arrayWithCount: count];\
+	LKFloatArray *o = FloatArrayOperand(count, other);\
+	if (nil != o)\
+	{\
+		LKFloatVectorCompare(values, o->values, result->values, count, op);\
+	}\
+	else\
+	{\
+		LKFloatVectorCompareScalar(values, [other doubleValue],\
+			result->values, count, op);\
+	}\
+	return result;\
+}
+FLOAT_CMP(lessThan, LKVectorLessThan)
+FLOAT_CMP(greaterThan, LKVectorGreaterThan)
+FLOAT_CMP(equalTo, LKVectorEqual)
+@end
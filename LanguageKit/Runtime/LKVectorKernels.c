@@ -0,0 +1,529 @@
+#include "LKVectorKernels.h"
+#include <string.h>
+
+#if defined(__GNUC__) || defined(__clang__)
+#define LK_VECTOR 4
+typedef int64_t LKIntVector __attribute__((vector_size(32)));
+typedef uint64_t LKUIntVector __attribute__((vector_size(32)));
+typedef double LKFloatVector __attribute__((vector_size(32)));
+
+// Vectors are never passed to or returned from functions by value, because
+// the ABI for doing so depends on whether AVX is enabled.  The helpers take
+// pointers, and compilers remove the indirection when they inline them.
+
+// Loads and stores go through memcpy so that the storage does not need to be
+// aligned.  Compilers turn these into single unaligned vector moves.
+static inline void LoadInts(LKIntVector *v, const int64_t *p)
+{
+	memcpy(v, p, sizeof(*v));
+}
+static inline void StoreInts(int64_t *p, const LKIntVector *v)
+{
+	memcpy(p, v, sizeof(*v));
+}
+static inline void LoadFloats(LKFloatVector *v, const double *p)
+{
+	memcpy(v, p, sizeof(*v));
+}
+static inline void StoreFloats(double *p, const LKFloatVector *v)
+{
+	memcpy(p, v, sizeof(*v));
+}
+/**
+ * Selects elements from a where mask is set and from b elsewhere.  The mask
+ * is the result of a vector comparison, with all bits set in true lanes.
+ */
+#define SelectInts(mask, a, b) (((a) & (mask)) | ((b) & ~(mask)))
+#define SelectFloats(mask, a, b) \
+	((LKFloatVector)SelectInts((mask), (LKIntVector)(a), (LKIntVector)(b)))
+/**
+ * Stores 1 in the lanes of out where the comparison holds, 0 elsewhere.
+ */
+static inline void CompareInts(LKIntVector *out, const LKIntVector *a,
+                               const LKIntVector *b, LKVectorComparison op)
+{
+	// True lanes of a comparison are -1, so negate to get 1.
+	switch (op)
+	{
+		case LKVectorLessThan: *out = -(LKIntVector)(*a < *b); break;
+		case LKVectorGreaterThan: *out = -(LKIntVector)(*a > *b); break;
+		case LKVectorEqual: default: *out = -(LKIntVector)(*a == *b); break;
+	}
+}
+static inline void CompareFloats(LKIntVector *out, const LKFloatVector *a,
+                                 const LKFloatVector *b, LKVectorComparison op)
+{
+	switch (op)
+	{
+		case LKVectorLessThan: *out = -(LKIntVector)(*a < *b); break;
+		case LKVectorGreaterThan: *out = -(LKIntVector)(*a > *b); break;
+		case LKVectorEqual: default: *out = -(LKIntVector)(*a == *b); break;
+	}
+}
+#else
+#define LK_VECTOR 0
+#endif
+
+static inline bool Compare(double a, double b, LKVectorComparison op)
+{
+	switch (op)
+	{
+		case LKVectorLessThan: return a < b;
+		case LKVectorGreaterThan: return a > b;
+		case LKVectorEqual: default: return a == b;
+	}
+}
+static inline bool CompareInt(int64_t a, int64_t b, LKVectorComparison op)
+{
+	switch (op)
+	{
+		case LKVectorLessThan: return a < b;
+		case LKVectorGreaterThan: return a > b;
+		case LKVectorEqual: default: return a == b;
+	}
+}
+
+bool LKIntVectorSum(const int64_t *v, size_t n, int64_t *sum)
+{
+	size_t i = 0;
+	int64_t total = 0;
+	bool overflow = false;
+#if LK_VECTOR
+	if (n >= LK_VECTOR)
+	{
+		LKIntVector acc = {0};
+		LKIntVector signs = {0};
+		for (; i + LK_VECTOR <= n ; i += LK_VECTOR)
+		{
+			LKIntVector x;
+			LoadInts(&x, v + i);
+			// Signed overflow is undefined, so add the unsigned
+			// representations, which wrap.
+			LKIntVector r = (LKIntVector)((LKUIntVector)acc +
+			                              (LKUIntVector)x);
+			// A lane overflows if both operands have the same sign and the
+			// result has a different one.
+			signs |= (acc ^ r) & (x ^ r);
+			acc = r;
+		}
+		for (int lane=0 ; lane<LK_VECTOR ; lane++)
+		{
+			overflow |= signs[lane] < 0;
+			overflow |= __builtin_add_overflow(total, acc[lane], &total);
+		}
+	}
+#endif
+	for (; i<n ; i++)
+	{
+		overflow |= __builtin_add_overflow(total, v[i], &total);
+	}
+	*sum = total;
+	return !overflow;
+}
+
+int64_t LKIntVectorMin(const int64_t *v, size_t n)
+{
+	size_t i = 0;
+	int64_t min = v[0];
+#if LK_VECTOR
+	if (n >= LK_VECTOR)
+	{
+		LKIntVector m;
+		LoadInts(&m, v);
+		for (i = LK_VECTOR ; i + LK_VECTOR <= n ; i += LK_VECTOR)
+		{
+			LKIntVector x;
+			LoadInts(&x, v + i);
+			m = SelectInts((LKIntVector)(x < m), x, m);
+		}
+		for (int lane=0 ; lane<LK_VECTOR ; lane++)
+		{
+			if (m[lane] < min) { min = m[lane]; }
+		}
+	}
+#endif
+	for (; i<n ; i++)
+	{
+		if (v[i] < min) { min = v[i]; }
+	}
+	return min;
+}
+
+int64_t LKIntVectorMax(const int64_t *v, size_t n)
+{
+	size_t i = 0;
+	int64_t max = v[0];
+#if LK_VECTOR
+	if (n >= LK_VECTOR)
+	{
+		LKIntVector m;
+		LoadInts(&m, v);
+		for (i = LK_VECTOR ; i + LK_VECTOR <= n ; i += LK_VECTOR)
+		{
+			LKIntVector x;
+			LoadInts(&x, v + i);
+			m = SelectInts((LKIntVector)(x > m), x, m);
+		}
+		for (int lane=0 ; lane<LK_VECTOR ; lane++)
+		{
+			if (m[lane] > max) { max = m[lane]; }
+		}
+	}
+#endif
+	for (; i<n ; i++)
+	{
+		if (v[i] > max) { max = v[i]; }
+	}
+	return max;
+}
+
+// Integer multiplication has no portable vector overflow check, so the
+// kernels that multiply are scalar loops.  The compiler may still vectorise
+// them where the target supports it.
+bool LKIntVectorDot(const int64_t *a, const int64_t *b, size_t n, int64_t *dot)
+{
+	int64_t total = 0;
+	bool overflow = false;
+	for (size_t i=0 ; i<n ; i++)
+	{
+		int64_t product;
+		overflow |= __builtin_mul_overflow(a[i], b[i], &product);
+		overflow |= __builtin_add_overflow(total, product, &total);
+	}
+	*dot = total;
+	return !overflow;
+}
+
+bool LKIntVectorMul(const int64_t *a, const int64_t *b, int64_t *out, size_t n)
+{
+	bool overflow = false;
+	for (size_t i=0 ; i<n ; i++)
+	{
+		overflow |= __builtin_mul_overflow(a[i], b[i], &out[i]);
+	}
+	return !overflow;
+}
+
+bool LKIntVectorMulScalar(const int64_t *a, int64_t s, int64_t *out, size_t n)
+{
+	bool overflow = false;
+	for (size_t i=0 ; i<n ; i++)
+	{
+		overflow |= __builtin_mul_overflow(a[i], s, &out[i]);
+	}
+	return !overflow;
+}
+
+bool LKIntVectorAdd(const int64_t *a, const int64_t *b, int64_t *out, size_t n)
+{
+	size_t i = 0;
+	bool overflow = false;
+#if LK_VECTOR
+	LKIntVector signs = {0};
+	for (; i + LK_VECTOR <= n ; i += LK_VECTOR)
+	{
+		LKIntVector x;
+		LoadInts(&x, a + i);
+		LKIntVector y;
+		LoadInts(&y, b + i);
+		LKIntVector r = (LKIntVector)((LKUIntVector)x +
+		                              (LKUIntVector)y);
+		signs |= (x ^ r) & (y ^ r);
+		StoreInts(out + i, &r);
+	}
+	for (int lane=0 ; lane<LK_VECTOR ; lane++)
+	{
+		overflow |= signs[lane] < 0;
+	}
+#endif
+	for (; i<n ; i++)
+	{
+		overflow |= __builtin_add_overflow(a[i], b[i], &out[i]);
+	}
+	return !overflow;
+}
+
+bool LKIntVectorAddScalar(const int64_t *a, int64_t s, int64_t *out, size_t n)
+{
+	size_t i = 0;
+	bool overflow = false;
+#if LK_VECTOR
+	LKIntVector y = {s, s, s, s};
+	LKIntVector signs = {0};
+	for (; i + LK_VECTOR <= n ; i += LK_VECTOR)
+	{
+		LKIntVector x;
+		LoadInts(&x, a + i);
+		LKIntVector r = (LKIntVector)((LKUIntVector)x +
+		                              (LKUIntVector)y);
+		signs |= (x ^ r) & (y ^ r);
+		StoreInts(out + i, &r);
+	}
+	for (int lane=0 ; lane<LK_VECTOR ; lane++)
+	{
+		overflow |= signs[lane] < 0;
+	}
+#endif
+	for (; i<n ; i++)
+	{
+		overflow |= __builtin_add_overflow(a[i], s, &out[i]);
+	}
+	return !overflow;
+}
+
+void LKIntVectorCompare(const int64_t *a, const int64_t *b, int64_t *out,
+                        size_t n, LKVectorComparison op)
+{
+	size_t i = 0;
+#if LK_VECTOR
+	for (; i + LK_VECTOR <= n ; i += LK_VECTOR)
+	{
+		LKIntVector x, y, r;
+		LoadInts(&x, a + i);
+		LoadInts(&y, b + i);
+		CompareInts(&r, &x, &y, op);
+		StoreInts(out + i, &r);
+	}
+#endif
+	for (; i<n ; i++)
+	{
+		out[i] = CompareInt(a[i], b[i], op);
+	}
+}
+
+void LKIntVectorCompareScalar(const int64_t *a, int64_t s, int64_t *out,
+                              size_t n, LKVectorComparison op)
+{
+	size_t i = 0;
+#if LK_VECTOR
+	LKIntVector y = {s, s, s, s};
+	for (; i + LK_VECTOR <= n ; i += LK_VECTOR)
+	{
+		LKIntVector x, r;
+		LoadInts(&x, a + i);
+		CompareInts(&r, &x, &y, op);
+		StoreInts(out + i, &r);
+	}
+#endif
+	for (; i<n ; i++)
+	{
+		out[i] = CompareInt(a[i], s, op);
+	}
+}
+
+double LKFloatVectorSum(const double *v, size_t n)
+{
+	size_t i = 0;
+	double total = 0;
+#if LK_VECTOR
+	LKFloatVector acc = {0};
+	for (; i + LK_VECTOR <= n ; i += LK_VECTOR)
+	{
+		LKFloatVector x;
+		LoadFloats(&x, v + i);
+		acc += x;
+	}
+	total = (acc[0] + acc[1]) + (acc[2] + acc[3]);
+#endif
+	for (; i<n ; i++)
+	{
+		total += v[i];
+	}
+	return total;
+}
+
+double LKFloatVectorMin(const double *v, size_t n)
+{
+	size_t i = 0;
+	double min = v[0];
+#if LK_VECTOR
+	if (n >= LK_VECTOR)
+	{
+		LKFloatVector m;
+		LoadFloats(&m, v);
+		for (i = LK_VECTOR ; i + LK_VECTOR <= n ; i += LK_VECTOR)
+		{
+			LKFloatVector x;
+			LoadFloats(&x, v + i);
+			m = SelectFloats((LKIntVector)(x < m), x, m);
+		}
+		for (int lane=0 ; lane<LK_VECTOR ; lane++)
+		{
+			if (m[lane] < min) { min = m[lane]; }
+		}
+	}
+#endif
+	for (; i<n ; i++)
+	{
+		if (v[i] < min) { min = v[i]; }
+	}
+	return min;
+}
+
+double LKFloatVectorMax(const double *v, size_t n)
+{
+	size_t i = 0;
+	double max = v[0];
+#if LK_VECTOR
+	if (n >= LK_VECTOR)
+	{
+		LKFloatVector m;
+		LoadFloats(&m, v);
+		for (i = LK_VECTOR ; i + LK_VECTOR <= n ; i += LK_VECTOR)
+		{
+			LKFloatVector x;
+			LoadFloats(&x, v + i);
+			m = SelectFloats((LKIntVector)(x > m), x, m);
+		}
+		for (int lane=0 ; lane<LK_VECTOR ; lane++)
+		{
+			if (m[lane] > max) { max = m[lane]; }
+		}
+	}
+#endif
+	for (; i<n ; i++)
+	{
+		if (v[i] > max) { max = v[i]; }
+	}
+	return max;
+}
+
+double LKFloatVectorDot(const double *a, const double *b, size_t n)
+{
+	size_t i = 0;
+	double total = 0;
+#if LK_VECTOR
+	LKFloatVector acc = {0};
+	for (; i + LK_VECTOR <= n ; i += LK_VECTOR)
+	{
+		LKFloatVector x, y;
+		LoadFloats(&x, a + i);
+		LoadFloats(&y, b + i);
+		acc += x * y;
+	}
+	total = (acc[0] + acc[1]) + (acc[2] + acc[3]);
+#endif
+	for (; i<n ; i++)
+	{
+		total += a[i] * b[i];
+	}
+	return total;
+}
+
+void LKFloatVectorAdd(const double *a, const double *b, double *out, size_t n)
+{
+	size_t i = 0;
+#if LK_VECTOR
+	for (; i + LK_VECTOR <= n ; i += LK_VECTOR)
+	{
+		LKFloatVector x, y;
+		LoadFloats(&x, a + i);
+		LoadFloats(&y, b + i);
+		x += y;
+		StoreFloats(out + i, &x);
+	}
+#endif
+	for (; i<n ; i++)
+	{
+		out[i] = a[i] + b[i];
+	}
+}
+
+void LKFloatVectorAddScalar(const double *a, double s, double *out, size_t n)
+{
+	size_t i = 0;
+#if LK_VECTOR
+	LKFloatVector y = {s, s, s, s};
+	for (; i + LK_VECTOR <= n ; i += LK_VECTOR)
+	{
+		LKFloatVector x;
+		LoadFloats(&x, a + i);
+		x += y;
+		StoreFloats(out + i, &x);
+	}
+#endif
+	for (; i<n ; i++)
+	{
+		out[i] = a[i] + s;
+	}
+}
+
+void LKFloatVectorMul(const double *a, const double *b, double *out, size_t n)
+{
+	size_t i = 0;
+#if LK_VECTOR
+	for (; i + LK_VECTOR <= n ; i += LK_VECTOR)
+	{
+		LKFloatVector x, y;
+		LoadFloats(&x, a + i);
+		LoadFloats(&y, b + i);
+		x *= y;
+		StoreFloats(out + i, &x);
+	}
+#endif
+	for (; i<n ; i++)
+	{
+		out[i] = a[i] * b[i];
+	}
+}
+
+void LKFloatVectorMulScalar(const double *a, double s, double *out, size_t n)
+{
+	size_t i = 0;
+#if LK_VECTOR
+	LKFloatVector y = {s, s, s, s};
+	for (; i + LK_VECTOR <= n ; i += LK_VECTOR)
+	{
+		LKFloatVector x;
+		LoadFloats(&x, a + i);
+		x *= y;
+		StoreFloats(out + i, &x);
+	}
+#endif
+	for (; i<n ; i++)
+	{
+		out[i] = a[i] * s;
+	}
+}
+
+void LKFloatVectorCompare(const double *a, const double *b, int64_t *out,
+                          size_t n, LKVectorComparison op)
+{
+	size_t i = 0;
+#if LK_VECTOR
+	for (; i + LK_VECTOR <= n ; i += LK_VECTOR)
+	{
+		LKFloatVector x, y;
+		LKIntVector r;
+		LoadFloats(&x, a + i);
+		LoadFloats(&y, b + i);
+		CompareFloats(&r, &x, &y, op);
+		StoreInts(out + i, &r);
+	}
+#endif
+	for (; i<n ; i++)
+	{
+		out[i] = Compare(a[i], b[i], op);
+	}
+}
+
+void LKFloatVectorCompareScalar(const double *a, double s, int64_t *out,
+                                size_t n, LKVectorComparison op)
+{
+	size_t i = 0;
+#if LK_VECTOR
+	LKFloatVector y = {s, s, s, s};
+	for (; i + LK_VECTOR <= n ; i += LK_VECTOR)
+	{
+		LKFloatVector x;
+		LKIntVector r;
+		LoadFloats(&x, a + i);
+		CompareFloats(&r, &x, &y, op);
+		StoreInts(out + i, &r);
+	}
+#endif
+	for (; i<n ; i++)
+	{
+		out[i] = Compare(a[i], s, op);
+	}
+}
@@ -0,0 +1,114 @@
+/**
+ * LKVectorKernels.h declares the loops used by LKIntArray and LKFloatArray.
+ * They are plain C and operate on contiguous int64_t or double storage.  When
+ * the compiler supports vector extensions, the kernels process four elements
+ * at a time, which becomes SSE or AVX code depending on the target flags.
+ * Otherwise, and for the remaining elements, they use scalar loops.
+ */
+#ifndef __LKVECTORKERNELS_H_INCLUDED__
+#define __LKVECTORKERNELS_H_INCLUDED__
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/**
+ * Comparisons supported by the mask kernels.
+ */
+typedef enum
+{
+	LKVectorLessThan,
+	LKVectorGreaterThan,
+	LKVectorEqual
+} LKVectorComparison;
+
+/**
+ * Stores the sum of the n values in sum.  Returns false if an intermediate
+ * value overflowed, in which case sum is not valid and the caller should
+ * compute the sum with arbitrary precision.
+ */
+bool LKIntVectorSum(const int64_t *v, size_t n, int64_t *sum);
+/**
+ * Returns the smallest of the n values.  n must not be zero.
+ */
+int64_t LKIntVectorMin(const int64_t *v, size_t n);
+/**
+ * Returns the largest of the n values.  n must not be zero.
+ */
+int64_t LKIntVectorMax(const int64_t *v, size_t n);
+/**
+ * Stores the dot product of a and b in dot.  Returns false on overflow.
+ */
+bool LKIntVectorDot(const int64_t *a, const int64_t *b, size_t n, int64_t *dot);
+/**
+ * Stores a[i] + b[i] in out[i].  Returns false on overflow.  out may alias a
+ * or b.
+ */
+bool LKIntVectorAdd(const int64_t *a, const int64_t *b, int64_t *out, size_t n);
+/**
+ * Stores a[i] + s in out[i].  Returns false on overflow.
+ */
+bool LKIntVectorAddScalar(const int64_t *a, int64_t s, int64_t *out, size_t n);
+/**
+ * Stores a[i] * b[i] in out[i].  Returns false on overflow.
+ */
+bool LKIntVectorMul(const int64_t *a, const int64_t *b, int64_t *out, size_t n);
+/**
+ * Stores a[i] * s in out[i].  Returns false on overflow.
+ */
+bool LKIntVectorMulScalar(const int64_t *a, int64_t s, int64_t *out, size_t n);
+/**
+ * Stores 1 in out[i] if the comparison between a[i] and b[i] holds, 0
+ * otherwise.
+ */
+void LKIntVectorCompare(const int64_t *a, const int64_t *b, int64_t *out,
+                        size_t n, LKVectorComparison op);
+/**
+ * Stores 1 in out[i] if the comparison between a[i] and s holds, 0 otherwise.
+ */
+void LKIntVectorCompareScalar(const int64_t *a, int64_t s, int64_t *out,
+                              size_t n, LKVectorComparison op);
+
+/**
+ * Returns the sum of the n values.
+ */
+double LKFloatVectorSum(const double *v, size_t n);
+/**
+ * Returns the smallest of the n values.  n must not be zero.
+ */
+double LKFloatVectorMin(const double *v, size_t n);
+/**
+ * Returns the largest of the n values.  n must not be zero.
+ */
+double LKFloatVectorMax(const double *v, size_t n);
+/**
+ * Returns the dot product of a and b.
+ */
+double LKFloatVectorDot(const double *a, const double *b, size_t n);
+/**
+ * Stores a[i] + b[i] in out[i].
+ */
+void LKFloatVectorAdd(const double *a, const double *b, double *out, size_t n);
+/**
+ * Stores a[i] + s in out[i].
+ */
+void LKFloatVectorAddScalar(const double *a, double s, double *out, size_t n);
+/**
+ * Stores a[i] * b[i] in out[i].
+ */
+void LKFloatVectorMul(const double *a, const double *b, double *out, size_t n);
+/**
+ * Stores a[i] * s in out[i].
+ */
+void LKFloatVectorMulScalar(const double *a, double s, double *out, size_t n);
+/**
+ * Stores 1 in out[i] if the comparison between a[i] and b[i] holds, 0
+ * otherwise.
+ */
+void LKFloatVectorCompare(const double *a, const double *b, int64_t *out,
+                          size_t n, LKVectorComparison op);
+/**
+ * Stores 1 in out[i] if the comparison between a[i] and s holds, 0 otherwise.
+ */
+void LKFloatVectorCompareScalar(const double *a, double s, int64_t *out,
+                                size_t n, LKVectorComparison op);
+#endif // __LKVECTORKERNELS_H_INCLUDED__
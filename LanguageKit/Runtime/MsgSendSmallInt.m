@@ -34,6 +34,7 @@ void NSLog(NSString*, ...);
 - (float)floatValue;
 @end
 #include "LKObject.h"
+#include "LKCountedLoop.h"
 
 // Dummy interfaces to make warnings go away
 @interface BigInt {}
@@ -52,6 +53,8 @@ void NSLog(NSString*, ...);
 - (id)not;
 - (LKObject)bitwiseAnd: (id)a;
 - (LKObject)bitwiseOr: (id)a;
+- (LKObject)bitShift: (id)a;
+- (LKObject)negated;
 - (BOOL)isLessThan: (id)a;
 - (BOOL)isGreaterThan: (id)a;
 - (BOOL)isLessThanOrEqualTo: (id)a;
@@ -160,13 +163,7 @@ id SmallIntMsgifTrue_ifFalse_(void* obj, void *t, void *f)
 	}
 }
 MSG1(timesRepeat_)
-	Block *block = other;
-	void *ret = NULL;
-	for (intptr_t i=0 ; i<val ; i++)
-	{
-		ret = block->invoke(block);
-	}
-	return ret;
+	return LKCountedLoopRepeat(val, other);
 }
 id SmallIntMsgto_by_do_(void* obj, void *to, void *by, void *tdo)
 {
@@ -193,14 +190,7 @@ id SmallIntMsgto_by_do_(void* obj, void *to, void *by, void *tdo)
 	}
 	inc >>= OBJC_SMALL_OBJECT_SHIFT;
 	max >>= OBJC_SMALL_OBJECT_SHIFT;
-
-	id result = nil;
-	for (;val<=max;val+=inc)
-	{
-		Block *block = tdo;
-		result = block->invoke(block, [BigInt bigIntWithLongLong:(long long)val]);
-	}
-	return result;
+	return LKCountedLoop(val, max, inc, tdo, LKCountedLoopBoxIndex);
 }
 id SmallIntMsgto_do_(void* obj, void *to, void *tdo)
 {
@@ -236,31 +226,55 @@ BOOL SmallIntMsgisEqual_(void *obj, void *other)
 		intptr_t val = (intptr_t)obj >> OBJC_SMALL_OBJECT_SHIFT;\
 		return [[BigInt bigIntWithLongLong:(long long)val] op:other];\
 	}
-#define RETURN_INT(x)     if(((x) << OBJC_SMALL_OBJECT_SHIFT >> OBJC_SMALL_OBJECT_SHIFT) != (x)) \
-    {\
-	  return [BigInt bigIntWithLongLong:(long long)(x)];	\
-	}\
-  return (void*)(((x) << OBJC_SMALL_OBJECT_SHIFT) | (uintptr_t)1);
+#define OVERFLOW_RETRY(op) \
+	{\
+		intptr_t val = (intptr_t)obj >> OBJC_SMALL_OBJECT_SHIFT;\
+		intptr_t otherval = (intptr_t)other >> OBJC_SMALL_OBJECT_SHIFT;\
+		LKObject ret = BOX_AND_RETRY(op);\
+		return *(void**)&ret;\
+	}
+
+/**
+ * Returns x as a SmallInt, or as a BigInt if it does not fit.
+ */
+static inline void *SmallIntFromValue(intptr_t x)
+{
+	intptr_t ret;
+	if (__builtin_mul_overflow(x, (intptr_t)1 << OBJC_SMALL_OBJECT_SHIFT, &ret))
+	{
+		return [BigInt bigIntWithLongLong:(long long)x];
+	}
+	return (void*)(ret | 1);
+}
+#define RETURN_INT(x) return SmallIntFromValue(x);
 
 void *SmallIntMsgplus_(void *obj, void *other)
 {
 	OTHER_OBJECT_CAST(plus);
-	// Clear the low bit on obj
+	// Clear the low bit on other
 	intptr_t val = ((intptr_t)other) & ~ OBJC_SMALL_OBJECT_MASK;
-	// Add the two values together.  This will cause the overflow handler to be
-	// invoked in case of overflow, otherwise it will contain the correct
-	// result.
-	return (void*)((intptr_t)obj + val);
+	// Adding the two values gives the correct SmallInt, unless it overflows,
+	// in which case we redo the operation with BigInts.
+	intptr_t result;
+	if (__builtin_add_overflow((intptr_t)obj, val, &result))
+	{
+		OVERFLOW_RETRY(plus)
+	}
+	return (void*)result;
 }
 void *SmallIntMsgsub_(void *obj, void *other)
 {
 	OTHER_OBJECT_CAST(sub);
-	// Clear the low bit and invert the sign bit on other
-	intptr_t val = -(((intptr_t)other) & ~ OBJC_SMALL_OBJECT_MASK);
-	// Add the two values together.  This will cause the overflow handler to be
-	// invoked in case of overflow, otherwise it will contain the correct
-	// result.
-	return (void*)((intptr_t)obj + val);
+	// Clear the low bit on other
+	intptr_t val = ((intptr_t)other) & ~ OBJC_SMALL_OBJECT_MASK;
+	// Subtracting leaves the low bit of obj set, so the result is the correct
+	// SmallInt unless it overflows.
+	intptr_t result;
+	if (__builtin_sub_overflow((intptr_t)obj, val, &result))
+	{
+		OVERFLOW_RETRY(sub)
+	}
+	return (void*)result;
 }
 void *SmallIntMsgmul_(void *obj, void *other)
 {
@@ -270,10 +284,13 @@ void *SmallIntMsgmul_(void *obj, void *other)
 	// Turn other into a C integer
 	intptr_t otherval = ((intptr_t)other) >> OBJC_SMALL_OBJECT_SHIFT;
 	// val * otherval will be the correct SmallInt value with the low bit
-	// cleared.  This sets the low bit in this case.  To avoid an extra test in
-	// case of overflow, we cheat a bit here and set the low bit spuriously
-	// when returning a big integer.  This then clears that bit.
-	return (void*)((val * otherval) ^ 1);
+	// cleared, unless it overflows.
+	intptr_t result;
+	if (__builtin_mul_overflow(val, otherval, &result))
+	{
+		OVERFLOW_RETRY(mul)
+	}
+	return (void*)(result | 1);
 }
 void *SmallIntMsgmin_(void *obj, void *other)
 {
@@ -296,10 +313,19 @@ void *SmallIntMsgmax_(void *obj, void *other)
 
 MSG1(div_)
 	OTHER_OBJECT_CAST(div)
+	// Division by zero would trap, so let BigInt raise the exception.
+	if (0 == otherval)
+	{
+		OVERFLOW_RETRY(div)
+	}
 	RETURN_INT((val / otherval));
 }
 MSG1(mod_)
 	OTHER_OBJECT_CAST(mod)
+	if (0 == otherval)
+	{
+		OVERFLOW_RETRY(mod)
+	}
 	RETURN_INT((val % otherval));
 }
 MSG1(bitwiseAnd_)
@@ -310,6 +336,30 @@ MSG1(bitwiseOr_)
 	OTHER_OBJECT_CAST(bitwiseOr)
 	RETURN_INT((val | otherval));
 }
+MSG1(bitShift_)
+	OTHER_OBJECT_CAST(bitShift)
+	const intptr_t bits = sizeof(intptr_t) * 8;
+	if (otherval < 0)
+	{
+		// Right shifts can not overflow, but shifting by the width of the
+		// type or more is undefined in C.
+		if (otherval <= -bits)
+		{
+			RETURN_INT(val < 0 ? -1 : 0);
+		}
+		RETURN_INT(val >> -otherval);
+	}
+	intptr_t result;
+	if ((otherval >= bits - 1) ||
+	    __builtin_mul_overflow(val, (intptr_t)1 << otherval, &result))
+	{
+		OVERFLOW_RETRY(bitShift)
+	}
+	RETURN_INT(result);
+}
+MSG0(negated)
+	RETURN_INT(-val);
+}
 
 #define BOOLMSG0(name) MSG(BOOL, name)
 #define BOOLMSG1(name) MSG(BOOL, name, void *other)\
@@ -396,6 +446,14 @@ METHOD1(div)
 METHOD1(min)
 METHOD1(max)
 METHOD1(timesRepeat)
+- (id)to: (id)to by: (id)by do: (id)aBlock
+{
+	return SmallIntMsgto_by_do_(self, to, by, aBlock);
+}
+- (id)to: (id)to do: (id)aBlock
+{
+	return SmallIntMsgto_do_(self, to, aBlock);
+}
 BOOLMETHOD1(isLessThan)
 BOOLMETHOD1(isGreaterThan)
 BOOLMETHOD1(isGreaterThanOrEqualTo)
@@ -403,6 +461,8 @@ BOOLMETHOD1(isLessThanOrEqualTo)
 METHOD1(mod)
 METHOD1(bitwiseAnd)
 METHOD1(bitwiseOr)
+METHOD1(bitShift)
+METHOD0(negated)
 METHOD1(and)
 METHOD1(or)
 METHOD0(not)
@@ -418,13 +478,10 @@ METHOD0(value)
 #endif
 
 void *MakeSmallInt(long long val) {
-	//fprintf(stderr, "Trying to make %lld into a small int\n", val);
-	intptr_t ptr = val << OBJC_SMALL_OBJECT_SHIFT;
-	//fprintf(stderr, "Failing if it is not %lld \n", (long long)(ptr >> 1));
-	if (((ptr >> OBJC_SMALL_OBJECT_SHIFT)) != val) {
+	if (val != (intptr_t)val) {
 		return [BigInt bigIntWithLongLong:val];
 	}
-	return (void*)(ptr | 1);
+	return SmallIntFromValue((intptr_t)val);
 }
 
 void *BoxSmallInt(void *obj) {
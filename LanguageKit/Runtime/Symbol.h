@@ -13,12 +13,28 @@
 #endif
 
 
+/**
+ * A Smalltalk symbol, wrapping a selector.
+ *
+ * Symbols returned by the SymbolFor... methods are interned: there is exactly
+ * one for each selector name, so symbols compare equal only if they are the
+ * same object, and can be used as cheap dictionary keys.
+ */
 @interface Symbol : NSObject
 {
 	SEL selector;
 }
+/**
+ * Returns the symbol for the named selector.
+ */
 + (id) SymbolForString:(NSString*)aSymbol NS_RETURNS_RETAINED;
+/**
+ * Returns the symbol for the named selector.
+ */
 + (id) SymbolForCString:(const char*)aSymbol NS_RETURNS_RETAINED;
+/**
+ * Returns the symbol for the selector.  This method is thread-safe.
+ */
 + (id) SymbolForSelector:(SEL) aSelector NS_RETURNS_RETAINED;
 
 - (id) copyWithZone: (NSZone*)aZone;
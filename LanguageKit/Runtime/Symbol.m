@@ -1,17 +1,52 @@
 #import "Symbol.h"
+#include <pthread.h>
+
+/**
+ * The interned symbols, keyed by selector name.  Symbols are never removed,
+ * so each selector maps to exactly one Symbol for the lifetime of the
+ * process.
+ */
+static NSMapTable *Symbols;
+static pthread_mutex_t SymbolsLock = PTHREAD_MUTEX_INITIALIZER;
 
 @implementation Symbol
++ (void) initialize
+{
+	if (self == [Symbol class])
+	{
+		NSPointerFunctions *keys = [NSPointerFunctions pointerFunctionsWithOptions:
+			NSPointerFunctionsCStringPersonality | NSPointerFunctionsOpaqueMemory];
+		NSPointerFunctions *values = [NSPointerFunctions pointerFunctionsWithOptions:
+			NSPointerFunctionsObjectPersonality | NSPointerFunctionsStrongMemory];
+		Symbols = [[NSMapTable alloc] initWithKeyPointerFunctions: keys
+		                                     valuePointerFunctions: values
+		                                                  capacity: 256];
+	}
+}
 + (id) SymbolForString:(NSString*)aSymbol
 {
 	return [self SymbolForCString: [aSymbol UTF8String]];
 }
 + (id) SymbolForCString:(const char*)aSymbol
 {
-	return [[Symbol alloc] initWithSelector:sel_getUid(aSymbol)];
+	return [self SymbolForSelector: sel_getUid(aSymbol)];
 }
 + (id) SymbolForSelector:(SEL) aSelector
 {
-	return [[Symbol alloc] initWithSelector:aSelector];
+	// The name returned by the runtime lives as long as the selector, so it
+	// can be used as the key.  Typed selectors with the same name share it.
+	const char *name = sel_getName(aSelector);
+	pthread_mutex_lock(&SymbolsLock);
+	Symbol *symbol = NSMapGet(Symbols, name);
+	if (nil == symbol)
+	{
+		symbol = [[Symbol alloc] initWithSelector: sel_getUid(name)];
+		NSMapInsert(Symbols, name, symbol);
+		[symbol release];
+	}
+	[symbol retain];
+	pthread_mutex_unlock(&SymbolsLock);
+	return symbol;
 }
 - (id) copyWithZone: (NSZone*) aZone
 {
@@ -25,6 +60,14 @@
     }
 	return self;
 }
+- (BOOL) isEqual: (id)anObject
+{
+	return self == anObject;
+}
+- (NSUInteger) hash
+{
+	return (NSUInteger)self >> 4;
+}
 - (id) stringValue
 {
 	return NSStringFromSelector(selector);
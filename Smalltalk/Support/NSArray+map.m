@@ -1,5 +1,6 @@
 #import "NSArray+map.h"
 #import "BlockClosure.h"
+#import "LKBigAccumulator.h"
 
 @implementation NSArray (map)
 - (NSArray*) map:(id)aClosure
@@ -77,6 +78,32 @@
 	}
 	return collect;
 }
+/**
+ * The compiler sends this in place of inject:into: when the block uses its
+ * accumulator argument only as the receiver of the arithmetic operation whose
+ * result it returns.  Reductions that start from an integer then run with an
+ * LKBigAccumulator that the block updates in place, instead of allocating a
+ * new BigInt for every element.
+ */
+- (id) inject:(id)aValue accumulating:aClosure
+{
+	if (![LKBigAccumulator canAccumulate: aValue])
+	{
+		return [self inject:aValue into:aClosure];
+	}
+	LKBigAccumulator *accumulator = [LKBigAccumulator accumulatorWithValue: aValue];
+	[accumulator setUpdatesInPlace: YES];
+	id collect = accumulator;
+	for (id obj in self)
+	{
+		collect = [aClosure value:obj value:collect];
+	}
+	if (collect == accumulator)
+	{
+		return [accumulator value];
+	}
+	return collect;
+}
 - (id) fold:(id)aClosure
 {
 	return [self inject:nil into:aClosure];
@@ -8,6 +8,8 @@
 #import <XCTest/XCTest.h>
 
 #import <LanguageKit/LanguageKit.h>
+#import <LanguageKit/LKInterpreter.h>
+#import <LanguageKit/LKInterpreterRuntime.h>
 #import <Smalltalk/Smalltalk.h>
 
 
@@ -42,6 +44,35 @@
 - (NSString *)var2;
 @end
 
+@interface SmalltalkSubclassTests (Redefinition)
+- (NSNumber *)redefinedAnswer;
+@end
+
+@interface SmalltalkReductionTests : NSObject
+- (NSNumber *)sum:(NSArray *)anArray;
+- (NSNumber *)compound:(NSArray *)anArray;
+@end
+
+@interface SmalltalkFusionTests : NSObject
+- (NSString *)three;
+@end
+
+@interface SelectorCollector : LKASTVisitor
+@property (nonatomic, strong) NSMutableArray *selectors;
+@end
+
+@implementation SelectorCollector
++ (BOOL)canFuse
+{
+    return YES;
+}
+- (LKAST *)visitMessageSend:(LKMessageSend *)aMessage
+{
+    [self.selectors addObject:[aMessage selector]];
+    return aMessage;
+}
+@end
+
 //static LKSymbolTable *_globalSymbolTable;
 static LKAST *_module = nil;
 static NSMutableArray *LogMessage;
@@ -66,6 +97,18 @@ static NSMutableArray *LogMessage;
     [_module interpretInContext: nil];
 }
 
++ (BOOL)interpretSource:(NSString *)source
+{
+    id<LKParser> parser = [[[LKCompiler compilerClassForFileExtension:@"st"] parserClass] new];
+    LKAST *module = [parser parseString:source];
+    if (![module check])
+    {
+        return NO;
+    }
+    [module interpretInContext: nil];
+    return YES;
+}
+
 + (void)tearDown
 {
     [super tearDown];
@@ -151,4 +194,66 @@ static NSMutableArray *LogMessage;
     XCTAssertEqualObjects(@"World", [obj2 var2], @"");
 }
 
+- (void)testRedefinedMethodKeepsCachedImplementation
+{
+    XCTAssertTrue([SmalltalkTests interpretSource:@"SmalltalkSubclassTests extend [ redefinedAnswer [ ^ 1 ] ]"], @"");
+    SmalltalkSubclassTests *obj = [[NSClassFromString(@"SmalltalkSubclassTests") alloc] init];
+    SEL sel = @selector(redefinedAnswer);
+    NSNumber *(*cached)(id, SEL) = (NSNumber *(*)(id, SEL))[obj methodForSelector:sel];
+    XCTAssertEqualObjects(@(1), cached(obj, sel), @"");
+    struct LKTrampolineStatistics before = LKInterpreterTrampolineStatistics();
+
+    XCTAssertTrue([SmalltalkTests interpretSource:@"SmalltalkSubclassTests extend [ redefinedAnswer [ ^ 2 ] ]"], @"");
+    struct LKTrampolineStatistics after = LKInterpreterTrampolineStatistics();
+    XCTAssertEqualObjects(@(2), [obj redefinedAnswer], @"");
+    // An implementation looked up before the method was redefined must still
+    // be callable, and runs the new definition.
+    XCTAssertEqualObjects(@(2), cached(obj, sel), @"");
+    XCTAssertEqual(before.live, after.live, @"redefining a method should not make a new implementation");
+    XCTAssertEqual(before.liveBytes + before.retiredBytes, after.liveBytes + after.retiredBytes, @"");
+}
+
+- (void)testReductionsUseAccumulators
+{
+    id<LKParser> parser = [[[LKCompiler compilerClassForFileExtension:@"st"] parserClass] new];
+    LKAST *module = [parser parseString:@"NSObject subclass: SmalltalkReductionTests ["
+        "sum: anArray [ ^ anArray inject: 0 into: [ :x :sum | sum + x ] ]"
+        "compound: anArray [ ^ anArray inject: 1 into: [ :x :sum | sum + (sum * x) ] ] ]"];
+    XCTAssertTrue([module check], @"");
+    LKPassManager *passManager = [LKPassManager passManagerWithTransforms:@[[LKConstantFolder new]]];
+    XCTAssertTrue([passManager runOnAST:module], @"");
+    SelectorCollector *collector = [SelectorCollector new];
+    collector.selectors = [NSMutableArray array];
+    [module visitWithVisitor:collector];
+    // Only the block that uses its accumulator once can update it in place.
+    XCTAssertEqual(1, [[collector.selectors filteredArrayUsingPredicate:[NSPredicate predicateWithFormat:@"SELF == 'inject:accumulating:'"]] count], @"");
+    XCTAssertEqual(1, [[collector.selectors filteredArrayUsingPredicate:[NSPredicate predicateWithFormat:@"SELF == 'inject:into:'"]] count], @"");
+
+    [module interpretInContext:nil];
+    SmalltalkReductionTests *obj = [[NSClassFromString(@"SmalltalkReductionTests") alloc] init];
+    NSArray *values = @[@1, @2, @3];
+    XCTAssertEqualObjects(@(6), [obj sum:values], @"");
+    XCTAssertEqualObjects(@(6), [obj sum:values], @"each reduction should start from its own accumulator");
+    XCTAssertEqualObjects(@(24), [obj compound:values], @"");
+}
+
+- (void)testFusedPasses
+{
+    id<LKParser> parser = [[[LKCompiler compilerClassForFileExtension:@"st"] parserClass] new];
+    LKAST *module = [parser parseString:@"NSObject subclass: SmalltalkFusionTests [ three [ ^ (1 + 2) description ] ]"];
+    SelectorCollector *collector = [SelectorCollector new];
+    collector.selectors = [NSMutableArray array];
+    LKPassManager *passManager = [LKPassManager passManagerWithTransforms:@[[LKInliner new], [LKConstantFolder new], collector]];
+    XCTAssertTrue([passManager runOnAST:module], @"");
+    NSDictionary *timings = [passManager timings];
+    XCTAssertNotNil([timings objectForKey:@"LKInliner"], @"the inliner should run in a traversal of its own");
+    XCTAssertNotNil([timings objectForKey:@"LKConstantFolder+SelectorCollector"], @"transforms that can fuse should share a traversal");
+    // Each node reaches the collector after the folder has replaced it.
+    XCTAssertEqualObjects(@[@"description"], collector.selectors, @"");
+
+    [module interpretInContext:nil];
+    SmalltalkFusionTests *obj = [[NSClassFromString(@"SmalltalkFusionTests") alloc] init];
+    XCTAssertEqualObjects(@"3", [obj three], @"");
+}
+
 @end